@@ -0,0 +1,92 @@
+/*
+ * HIK Core-0 ACPI Table Lookup
+ * 
+ * Locates tables through the XSDT (ACPI 2.0+) or the RSDT and validates
+ * their checksums before handing them out.
+ */
+
+#include "../include/acpi.h"
+#include "../include/string.h"
+
+/* Root table (XSDT or RSDT) */
+static const acpi_sdt_header_t *g_root_table = NULL;
+static uint32_t g_root_entry_size = 0;
+
+/*
+ * Check that a table sums to zero
+ */
+static int acpi_checksum_ok(const void *table, uint64_t length) {
+    const uint8_t *bytes = (const uint8_t *)table;
+    uint8_t sum = 0;
+    
+    for (uint64_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    
+    return sum == 0;
+}
+
+/*
+ * Initialize ACPI table access from the RSDP address
+ */
+int acpi_init(uint64_t rsdp_addr) {
+    g_root_table = NULL;
+    g_root_entry_size = 0;
+    
+    if (rsdp_addr == 0) {
+        return -1;
+    }
+    
+    const acpi_rsdp_t *rsdp = (const acpi_rsdp_t *)rsdp_addr;
+    if (memcmp(rsdp->signature, "RSD PTR ", 8) != 0 || !acpi_checksum_ok(rsdp, 20)) {
+        return -1;
+    }
+    
+    /* Prefer the XSDT (64-bit entries) when the RSDP has one */
+    if (rsdp->revision >= 2 && rsdp->xsdt_address != 0 &&
+        acpi_checksum_ok(rsdp, rsdp->length)) {
+        const acpi_sdt_header_t *xsdt = (const acpi_sdt_header_t *)rsdp->xsdt_address;
+        if (memcmp(xsdt->signature, "XSDT", 4) == 0 && acpi_checksum_ok(xsdt, xsdt->length)) {
+            g_root_table = xsdt;
+            g_root_entry_size = sizeof(uint64_t);
+            return 0;
+        }
+    }
+    
+    const acpi_sdt_header_t *rsdt = (const acpi_sdt_header_t *)(uint64_t)rsdp->rsdt_address;
+    if (rsdt == NULL || memcmp(rsdt->signature, "RSDT", 4) != 0 ||
+        !acpi_checksum_ok(rsdt, rsdt->length)) {
+        return -1;
+    }
+    
+    g_root_table = rsdt;
+    g_root_entry_size = sizeof(uint32_t);
+    
+    return 0;
+}
+
+/*
+ * Find a table by signature
+ */
+const acpi_sdt_header_t* acpi_find_table(const char *signature) {
+    if (g_root_table == NULL || signature == NULL) {
+        return NULL;
+    }
+    
+    const uint8_t *entries = (const uint8_t *)g_root_table + sizeof(acpi_sdt_header_t);
+    uint64_t count = (g_root_table->length - sizeof(acpi_sdt_header_t)) / g_root_entry_size;
+    
+    for (uint64_t i = 0; i < count; i++) {
+        /* XSDT entries are not 8-byte aligned */
+        uint64_t addr = 0;
+        memcpy(&addr, entries + i * g_root_entry_size, g_root_entry_size);
+        
+        const acpi_sdt_header_t *table = (const acpi_sdt_header_t *)addr;
+        if (table != NULL && memcmp(table->signature, signature, 4) == 0 &&
+            acpi_checksum_ok(table, table->length)) {
+            return table;
+        }
+    }
+    
+    return NULL;
+}
@@ -3,11 +3,17 @@
  */
 
 #include "../include/capability.h"
+#include "../include/numa.h"
+#include "../include/mm.h"
 #include "../include/string.h"
 
 /* Global capability system state */
 static cap_system_t g_cap_system;
 
+/* Capability and domain object caches */
+static kmem_cache_t g_cap_cache;
+static kmem_cache_t g_domain_cache;
+
 /* Spinlock operations */
 static inline void spin_lock(uint64_t *lock) {
     while (__sync_lock_test_and_set(lock, 1)) {
@@ -19,14 +25,29 @@ static inline void spin_unlock(uint64_t *lock) {
     __sync_lock_release(lock);
 }
 
+/*
+ * Remove a handle from a domain's capability space, dropping the
+ * reference the domain held (lock held)
+ */
+static int cap_drop_locked(capability_t *cap, domain_t *domain, cap_handle_t handle) {
+    if (cap_domain_remove_cap(domain->domain_id, handle) != 0) {
+        return -1;
+    }
+    cap->ref_count--;
+    return 0;
+}
+
 /*
  * Initialize capability system
  */
 int cap_init(void) {
     memset(&g_cap_system, 0, sizeof(cap_system_t));
     
-    g_cap_system.next_cap_handle = 1;
-    g_cap_system.next_domain_id = 1;
+    if (kmem_cache_init(&g_cap_cache, "capability", sizeof(capability_t), 8, NULL) != 0 ||
+        kmem_cache_init(&g_domain_cache, "domain", sizeof(domain_t), CACHE_LINE_SIZE, NULL) != 0) {
+        return -1;
+    }
+    
     g_cap_system.num_caps = 0;
     g_cap_system.num_domains = 0;
     g_cap_system.lock = 0;
@@ -42,21 +63,13 @@ cap_handle_t cap_create(cap_type_t type, uint32_t permissions,
                        uint64_t domain_id) {
     spin_lock(&g_cap_system.lock);
     
-    /* Find free capability slot */
-    uint32_t slot = 0;
-    for (slot = 0; slot < MAX_CAPABILITIES; slot++) {
-        if (g_cap_system.capabilities[slot].magic != HIK_CAP_MAGIC) {
-            break;
-        }
-    }
-    
-    if (slot >= MAX_CAPABILITIES) {
+    capability_t *cap = kmem_cache_alloc(&g_cap_cache);
+    if (cap == NULL) {
         spin_unlock(&g_cap_system.lock);
-        return 0;  /* No free slots */
+        return 0;  /* Out of memory */
     }
     
     /* Initialize capability */
-    capability_t *cap = &g_cap_system.capabilities[slot];
     cap->magic = HIK_CAP_MAGIC;
     cap->type = type;
     cap->permissions = permissions;
@@ -67,8 +80,13 @@ cap_handle_t cap_create(cap_type_t type, uint32_t permissions,
     cap->ref_count = 1;
     cap->flags = 0;
     
-    /* Generate handle */
-    cap_handle_t handle = g_cap_system.next_cap_handle++;
+    /* Generate handle (lookups without the lock find it initialized) */
+    cap_handle_t handle = (cap_handle_t)kmem_table_insert(&g_cap_system.capabilities, cap);
+    if (handle == 0) {
+        kmem_cache_free(&g_cap_cache, cap);
+        spin_unlock(&g_cap_system.lock);
+        return 0;
+    }
     
     /* Add to owner domain */
     domain_t *domain = cap_get_domain(domain_id);
@@ -95,13 +113,18 @@ int cap_delete(cap_handle_t handle) {
         return -1;
     }
     
-    /* Remove from all domains */
-    for (uint32_t i = 0; i < MAX_DOMAINS; i++) {
-        cap_domain_remove_cap(g_cap_system.domains[i].domain_id, handle);
+    /* Remove from the live domains, until every holder is found */
+    for (domain_t *domain = g_cap_system.live_domains;
+         domain != NULL && cap->ref_count > 0; domain = domain->live_next) {
+        while (cap_drop_locked(cap, domain, handle) == 0) {
+            /* A domain may hold the handle more than once */
+        }
     }
     
     /* Clear capability */
     memset(cap, 0, sizeof(capability_t));
+    kmem_table_remove(&g_cap_system.capabilities, handle);
+    kmem_defer_free(&g_cap_cache, cap);
     
     g_cap_system.num_caps--;
     
@@ -152,10 +175,8 @@ int cap_revoke(cap_handle_t handle, uint64_t domain_id) {
     }
     
     /* Remove from domain */
-    int result = cap_domain_remove_cap(domain_id, handle);
-    if (result == 0) {
-        cap->ref_count--;
-    }
+    domain_t *domain = cap_get_domain(domain_id);
+    int result = domain ? cap_drop_locked(cap, domain, handle) : -1;
     
     spin_unlock(&g_cap_system.lock);
     
@@ -207,34 +228,51 @@ int cap_check(uint64_t domain_id, cap_handle_t handle, uint32_t permission) {
 uint64_t cap_create_domain(uint64_t memory_base, uint64_t memory_size) {
     spin_lock(&g_cap_system.lock);
     
-    /* Find free domain slot */
-    uint32_t slot = 0;
-    for (slot = 0; slot < MAX_DOMAINS; slot++) {
-        if (g_cap_system.domains[slot].domain_id == 0) {
-            break;
-        }
-    }
-    
-    if (slot >= MAX_DOMAINS) {
+    domain_t *domain = kmem_cache_alloc(&g_domain_cache);
+    if (domain == NULL) {
         spin_unlock(&g_cap_system.lock);
-        return 0;  /* No free slots */
+        return 0;  /* Out of memory */
     }
     
     /* Initialize domain */
-    domain_t *domain = &g_cap_system.domains[slot];
-    domain->domain_id = g_cap_system.next_domain_id++;
     domain->memory_base = memory_base;
     domain->memory_size = memory_size;
     domain->num_caps = 0;
     domain->state = DOMAIN_STATE_STOPPED;
+    domain->home_node = numa_current_node();
+    domain->cpu_affinity = CPU_MASK_ALL;
+    domain->cpu_quota = 0;
+    domain->cpu_period = 0;
+    domain->cpu_period_start = 0;
+    domain->cpu_period_used = 0;
+    domain->cpu_cycles = 0;
+    domain->cpu_exhausted = 0;
+    domain->cpu_lock = 0;
     
     memset(domain->cap_space, 0, sizeof(domain->cap_space));
     
+    /* Published initialized: lookups run without the lock */
+    uint64_t domain_id = kmem_table_insert(&g_cap_system.domains, domain);
+    if (domain_id == 0) {
+        kmem_cache_free(&g_domain_cache, domain);
+        spin_unlock(&g_cap_system.lock);
+        return 0;
+    }
+    domain->domain_id = domain_id;
+    
+    domain->live_prev = NULL;
+    domain->live_next = g_cap_system.live_domains;
+    if (domain->live_next) {
+        domain->live_next->live_prev = domain;
+    }
+    g_cap_system.live_domains = domain;
+    mm_set_owner_node(domain_id, domain->home_node);
+    
     g_cap_system.num_domains++;
     
     spin_unlock(&g_cap_system.lock);
     
-    return domain->domain_id;
+    return domain_id;
 }
 
 /*
@@ -249,15 +287,31 @@ int cap_delete_domain(uint64_t domain_id) {
         return -1;
     }
     
-    /* Revoke all capabilities */
-    for (uint32_t i = 0; i < DOMAIN_CAP_SPACE_SIZE; i++) {
-        if (domain->cap_space[i] != 0) {
-            cap_revoke(domain->cap_space[i], domain_id);
+    /* Revoke all capabilities, from the domain's own list */
+    while (domain->num_caps > 0) {
+        cap_handle_t handle = domain->cap_space[domain->num_caps - 1];
+        capability_t *cap = cap_get_capability(handle);
+        if (cap) {
+            cap_drop_locked(cap, domain, handle);
+        } else {
+            domain->cap_space[--domain->num_caps] = 0;
         }
     }
     
-    /* Clear domain */
-    memset(domain, 0, sizeof(domain_t));
+    if (domain->live_prev) {
+        domain->live_prev->live_next = domain->live_next;
+    } else {
+        g_cap_system.live_domains = domain->live_next;
+    }
+    if (domain->live_next) {
+        domain->live_next->live_prev = domain->live_prev;
+    }
+    mm_set_owner_node(domain_id, NUMA_NO_NODE);
+    
+    /* Unlocked lookups (the scheduler charging its threads' time) may
+     * still hold the domain: it is freed after a grace period */
+    kmem_table_remove(&g_cap_system.domains, domain_id);
+    kmem_defer_free(&g_domain_cache, domain);
     
     g_cap_system.num_domains--;
     
@@ -270,12 +324,157 @@ int cap_delete_domain(uint64_t domain_id) {
  * Get domain by ID
  */
 domain_t* cap_get_domain(uint64_t domain_id) {
-    for (uint32_t i = 0; i < MAX_DOMAINS; i++) {
-        if (g_cap_system.domains[i].domain_id == domain_id) {
-            return &g_cap_system.domains[i];
+    if (domain_id == 0) {
+        return NULL;
+    }
+    return kmem_table_get(&g_cap_system.domains, domain_id);
+}
+
+/*
+ * Set the NUMA node a domain's memory is allocated from
+ */
+int cap_domain_set_home_node(uint64_t domain_id, uint32_t node) {
+    domain_t *domain = cap_get_domain(domain_id);
+    if (!domain) {
+        return -1;
+    }
+    
+    if (node >= numa_num_nodes()) {
+        return -2;
+    }
+    
+    domain->home_node = node;
+    mm_set_owner_node(domain_id, node);
+    
+    return 0;
+}
+
+/*
+ * Get the NUMA node of a domain (NUMA_NO_NODE if there is no such domain)
+ */
+uint32_t cap_domain_home_node(uint64_t domain_id) {
+    domain_t *domain = cap_get_domain(domain_id);
+    return domain ? domain->home_node : NUMA_NO_NODE;
+}
+
+/*
+ * Set the CPUs a domain's threads may run on
+ */
+int cap_domain_set_affinity(uint64_t domain_id, uint64_t mask) {
+    domain_t *domain = cap_get_domain(domain_id);
+    if (!domain) {
+        return -1;
+    }
+    
+    if (mask == 0) {
+        return -2;
+    }
+    
+    domain->cpu_affinity = mask;
+    
+    return 0;
+}
+
+/*
+ * Get the CPUs a domain's threads may run on (all of them if there is no
+ * such domain, as for kernel threads)
+ */
+uint64_t cap_domain_affinity(uint64_t domain_id) {
+    domain_t *domain = cap_get_domain(domain_id);
+    return domain ? domain->cpu_affinity : CPU_MASK_ALL;
+}
+
+/*
+ * Set the CPU time a domain's threads may run per period. The first
+ * period starts now.
+ */
+int cap_domain_set_quota(uint64_t domain_id, uint64_t quota, uint64_t period) {
+    domain_t *domain = cap_get_domain(domain_id);
+    if (!domain) {
+        return -1;
+    }
+    
+    if (quota != 0 && period == 0) {
+        return -2;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&domain->cpu_lock);
+    domain->cpu_quota = quota;
+    domain->cpu_period = quota != 0 ? period : 0;
+    domain->cpu_period_start = cpu_rdtsc();
+    domain->cpu_period_used = 0;
+    spin_unlock(&domain->cpu_lock);
+    cpu_irq_restore(flags);
+    
+    return 0;
+}
+
+/*
+ * Charge a domain CPU time (called by the scheduler with a CPU's lock
+ * held, at each pass it makes; there is no tick interrupt to charge a
+ * thread that does not reach it). Periods follow each other from the one
+ * the quota was set in; time counts towards the period it is charged in.
+ */
+uint64_t cap_domain_charge(uint64_t domain_id, uint64_t cycles, uint64_t now,
+                           uint64_t *refill) {
+    domain_t *domain = cap_get_domain(domain_id);
+    if (!domain) {
+        return UINT64_MAX;  /* Kernel threads are not limited */
+    }
+    
+    spin_lock(&domain->cpu_lock);
+    
+    uint64_t left = UINT64_MAX;
+    domain->cpu_cycles += cycles;
+    if (domain->cpu_quota != 0) {
+        /* TSCs of different CPUs may be slightly apart: never go back */
+        if (now > domain->cpu_period_start &&
+            now - domain->cpu_period_start >= domain->cpu_period) {
+            uint64_t elapsed = now - domain->cpu_period_start;
+            domain->cpu_period_start += elapsed - elapsed % domain->cpu_period;
+            domain->cpu_period_used = 0;
+        }
+        
+        uint64_t used = domain->cpu_period_used;
+        domain->cpu_period_used += cycles;
+        if (used < domain->cpu_quota && domain->cpu_period_used >= domain->cpu_quota) {
+            domain->cpu_exhausted++;
+        }
+        left = domain->cpu_period_used < domain->cpu_quota ?
+               domain->cpu_quota - domain->cpu_period_used : 0;
+        if (refill != NULL) {
+            *refill = domain->cpu_period_start + domain->cpu_period;
         }
     }
-    return NULL;
+    
+    spin_unlock(&domain->cpu_lock);
+    
+    return left;
+}
+
+/*
+ * Get the CPU time a domain has used
+ */
+int cap_domain_cpu_usage(uint64_t domain_id, domain_cpu_usage_t *usage) {
+    domain_t *domain = cap_get_domain(domain_id);
+    if (!domain || usage == NULL) {
+        return -1;
+    }
+    
+    /* Through a charge of nothing, so a period that has ended reads as new */
+    uint64_t flags = cpu_irq_save();
+    cap_domain_charge(domain_id, 0, cpu_rdtsc(), NULL);
+    spin_lock(&domain->cpu_lock);
+    usage->cycles = domain->cpu_cycles;
+    usage->period_cycles = domain->cpu_period_used;
+    usage->quota = domain->cpu_quota;
+    usage->period = domain->cpu_period;
+    usage->exhausted = domain->cpu_exhausted;
+    spin_unlock(&domain->cpu_lock);
+    cpu_irq_restore(flags);
+    
+    return 0;
 }
 
 /*
@@ -323,21 +522,16 @@ int cap_domain_remove_cap(uint64_t domain_id, cap_handle_t handle) {
  * Get capability by handle
  */
 capability_t* cap_get_capability(cap_handle_t handle) {
-    if (handle == 0 || handle >= g_cap_system.next_cap_handle) {
+    if (handle == 0) {
         return NULL;
     }
     
-    /* Search for capability (simplified - in real implementation, use hash table) */
-    for (uint32_t i = 0; i < MAX_CAPABILITIES; i++) {
-        if (g_cap_system.capabilities[i].magic == HIK_CAP_MAGIC) {
-            /* Assume handle maps to index + 1 */
-            if (i == (handle - 1) % MAX_CAPABILITIES) {
-                return &g_cap_system.capabilities[i];
-            }
-        }
+    capability_t *cap = kmem_table_get(&g_cap_system.capabilities, handle);
+    if (cap == NULL || cap->magic != HIK_CAP_MAGIC) {
+        return NULL;
     }
     
-    return NULL;
+    return cap;
 }
 
 /*
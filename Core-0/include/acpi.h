@@ -0,0 +1,173 @@
+/*
+ * HIK Core-0 ACPI Tables
+ * 
+ * This file defines the ACPI table formats Core-0 reads directly
+ * (RSDP, RSDT/XSDT, SRAT, SLIT, MADT) and the table lookup interface. Tables
+ * are read in place through the identity map; nothing is copied.
+ */
+
+#ifndef HIK_CORE0_ACPI_H
+#define HIK_CORE0_ACPI_H
+
+#include "stdint.h"
+
+/* Root System Description Pointer */
+typedef struct {
+    char signature[8];           /* "RSD PTR " */
+    uint8_t checksum;            /* Checksum of the first 20 bytes */
+    char oem_id[6];
+    uint8_t revision;            /* 0 = ACPI 1.0, 2+ = has XSDT */
+    uint32_t rsdt_address;       /* Physical address of RSDT */
+    uint32_t length;             /* Length of the whole RSDP (ACPI 2.0+) */
+    uint64_t xsdt_address;       /* Physical address of XSDT (ACPI 2.0+) */
+    uint8_t extended_checksum;   /* Checksum of the whole RSDP */
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+/* System description table header */
+typedef struct {
+    char signature[4];           /* Table signature */
+    uint32_t length;             /* Length including header */
+    uint8_t revision;
+    uint8_t checksum;            /* Whole table sums to zero */
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+/* System Resource Affinity Table (SRAT) */
+typedef struct {
+    acpi_sdt_header_t header;    /* "SRAT" */
+    uint32_t reserved1;
+    uint64_t reserved2;
+    /* Affinity structures follow */
+} __attribute__((packed)) acpi_srat_t;
+
+/* SRAT structure types */
+#define ACPI_SRAT_CPU_AFFINITY     0
+#define ACPI_SRAT_MEMORY_AFFINITY  1
+#define ACPI_SRAT_X2APIC_AFFINITY  2
+
+/* SRAT affinity flags */
+#define ACPI_SRAT_ENABLED          0x01
+
+/* SRAT structure header */
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) acpi_srat_entry_t;
+
+/* Processor local APIC affinity */
+typedef struct {
+    acpi_srat_entry_t entry;
+    uint8_t proximity_low;       /* Proximity domain bits 0-7 */
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t proximity_high[3];   /* Proximity domain bits 8-31 */
+    uint32_t clock_domain;
+} __attribute__((packed)) acpi_srat_cpu_t;
+
+/* Memory affinity */
+typedef struct {
+    acpi_srat_entry_t entry;
+    uint32_t proximity;
+    uint16_t reserved1;
+    uint64_t base;
+    uint64_t length;
+    uint32_t reserved2;
+    uint32_t flags;
+    uint64_t reserved3;
+} __attribute__((packed)) acpi_srat_memory_t;
+
+/* Processor local x2APIC affinity */
+typedef struct {
+    acpi_srat_entry_t entry;
+    uint16_t reserved1;
+    uint32_t proximity;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved2;
+} __attribute__((packed)) acpi_srat_x2apic_t;
+
+/* System Locality Information Table (SLIT) */
+typedef struct {
+    acpi_sdt_header_t header;    /* "SLIT" */
+    uint64_t localities;         /* Matrix dimension */
+    uint8_t distance[];          /* localities x localities, row major */
+} __attribute__((packed)) acpi_slit_t;
+
+/* Multiple APIC Description Table (MADT) */
+typedef struct {
+    acpi_sdt_header_t header;    /* "APIC" */
+    uint32_t lapic_address;      /* Physical address of the local APICs */
+    uint32_t flags;
+    /* Interrupt controller structures follow */
+} __attribute__((packed)) acpi_madt_t;
+
+/* MADT structure types */
+#define ACPI_MADT_LAPIC            0
+#define ACPI_MADT_LAPIC_OVERRIDE   5
+#define ACPI_MADT_X2APIC           9
+
+/* MADT processor flags */
+#define ACPI_MADT_ENABLED          0x01
+#define ACPI_MADT_ONLINE_CAPABLE   0x02
+
+/* MADT structure header */
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) acpi_madt_entry_t;
+
+/* Processor local APIC */
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_lapic_t;
+
+/* Local APIC address override (64-bit) */
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint16_t reserved;
+    uint64_t lapic_address;
+} __attribute__((packed)) acpi_madt_lapic_override_t;
+
+/* Processor local x2APIC */
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint16_t reserved;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t processor_uid;
+} __attribute__((packed)) acpi_madt_x2apic_t;
+
+/* High Precision Event Timer description (HPET) */
+typedef struct {
+    acpi_sdt_header_t header;    /* "HPET" */
+    uint32_t event_timer_block_id;
+    uint8_t address_space;       /* Register block: generic address structure */
+    uint8_t register_bit_width;
+    uint8_t register_bit_offset;
+    uint8_t access_size;
+    uint64_t address;            /* Physical address of the registers */
+    uint8_t hpet_number;
+    uint16_t min_tick;
+    uint8_t page_protection;
+} __attribute__((packed)) acpi_hpet_t;
+
+/* Generic address structure spaces */
+#define ACPI_GAS_MEMORY            0
+
+/* Initialize ACPI table access from the RSDP address */
+int acpi_init(uint64_t rsdp);
+
+/* Find a table by signature (NULL if absent or corrupt) */
+const acpi_sdt_header_t* acpi_find_table(const char *signature);
+
+#endif /* HIK_CORE0_ACPI_H */
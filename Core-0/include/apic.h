@@ -0,0 +1,55 @@
+/*
+ * HIK Core-0 Local APIC
+ * 
+ * This file defines the local APIC interface used for SMP bring-up
+ * (INIT/STARTUP IPIs) and the per-CPU timer, periodic or armed for a
+ * single expiry. The APIC is driven in xAPIC mode through its
+ * memory-mapped registers.
+ */
+
+#ifndef HIK_CORE0_APIC_H
+#define HIK_CORE0_APIC_H
+
+#include "stdint.h"
+
+/* Architectural default register base */
+#define APIC_DEFAULT_BASE 0xFEE00000ULL
+
+/* Spurious interrupt vector */
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+/* Initialize the boot CPU's APIC and calibrate its timer */
+int apic_init(uint64_t base);
+
+/* Enable the calling CPU's APIC */
+void apic_init_cpu(void);
+
+/* Get the calling CPU's APIC ID */
+uint32_t apic_id(void);
+
+/* Send an INIT IPI */
+int apic_send_init(uint32_t apic_id);
+
+/* Send a STARTUP IPI (the target starts in real mode at page << 12) */
+int apic_send_startup(uint32_t apic_id, uint32_t page);
+
+/* Start the calling CPU's periodic timer */
+int apic_timer_start(uint8_t vector, uint32_t hz);
+
+/* Check whether the timer has TSC-deadline mode */
+int apic_has_tsc_deadline(void);
+
+/* Arm the calling CPU's timer to fire once after a delay */
+int apic_timer_oneshot(uint8_t vector, uint64_t microseconds);
+
+/* Arm the calling CPU's timer to fire once at a TSC value (TSC-deadline
+ * mode only) */
+int apic_timer_deadline(uint8_t vector, uint64_t tsc);
+
+/* Stop the calling CPU's timer */
+void apic_timer_stop(void);
+
+/* Busy-wait for a number of microseconds */
+void apic_delay_us(uint64_t microseconds);
+
+#endif /* HIK_CORE0_APIC_H */
\ No newline at end of file
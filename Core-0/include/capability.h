@@ -10,6 +10,8 @@
 #define HIK_CORE0_CAPABILITY_H
 
 #include "stdint.h"
+#include "slab.h"
+#include "cpu.h"
 
 /* Capability types */
 typedef enum {
@@ -32,10 +34,6 @@ typedef enum {
 /* Capability handle */
 typedef uint32_t cap_handle_t;
 
-/* Maximum number of capabilities */
-#define MAX_CAPABILITIES 1024
-#define MAX_DOMAINS 256
-
 /* Domain capability space size */
 #define DOMAIN_CAP_SPACE_SIZE 64
 
@@ -55,15 +53,35 @@ typedef struct {
 #define HIK_CAP_MAGIC 0x43415000  /* "CAP\0" */
 
 /* Domain structure */
-typedef struct {
+typedef struct domain {
     uint64_t domain_id;         /* Domain ID */
     uint64_t memory_base;       /* Physical memory base */
     uint64_t memory_size;       /* Memory size */
     cap_handle_t cap_space[DOMAIN_CAP_SPACE_SIZE]; /* Capability handles */
     uint32_t num_caps;          /* Number of capabilities */
     uint32_t state;             /* Domain state */
+    uint32_t home_node;         /* NUMA node for the domain's memory */
+    uint64_t cpu_affinity;      /* CPUs the domain's threads may run on */
+    uint64_t cpu_quota;         /* TSC cycles its threads may run per period (0: no limit) */
+    uint64_t cpu_period;        /* Quota period in TSC cycles */
+    uint64_t cpu_period_start;  /* TSC the current period began at */
+    uint64_t cpu_period_used;   /* Cycles run in the current period */
+    uint64_t cpu_cycles;        /* Cycles run in total */
+    uint64_t cpu_exhausted;     /* Periods in which the quota ran out */
+    uint64_t cpu_lock;          /* Spinlock (CPU accounting; taken after a CPU's) */
+    struct domain *live_prev;   /* Previous live domain */
+    struct domain *live_next;   /* Next live domain */
 } domain_t;
 
+/* CPU time used by a domain */
+typedef struct {
+    uint64_t cycles;            /* TSC cycles its threads have run */
+    uint64_t period_cycles;     /* Cycles run in the current period */
+    uint64_t quota;             /* Cycles allowed per period (0: no limit) */
+    uint64_t period;            /* Quota period in cycles */
+    uint64_t exhausted;         /* Periods in which the quota ran out */
+} domain_cpu_usage_t;
+
 /* Domain states */
 #define DOMAIN_STATE_STOPPED    0
 #define DOMAIN_STATE_STARTING   1
@@ -73,10 +91,9 @@ typedef struct {
 
 /* Capability system state */
 typedef struct {
-    capability_t capabilities[MAX_CAPABILITIES]; /* Global capability table */
-    domain_t domains[MAX_DOMAINS];              /* Domain table */
-    uint32_t next_cap_handle;                    /* Next capability handle */
-    uint32_t next_domain_id;                     /* Next domain ID */
+    kmem_table_t capabilities;                   /* Capability table (indexed by handle) */
+    kmem_table_t domains;                        /* Domain table (indexed by domain ID) */
+    domain_t *live_domains;                      /* Domains not yet deleted */
     uint32_t num_caps;                          /* Number of capabilities */
     uint32_t num_domains;                       /* Number of domains */
     uint64_t lock;                              /* Spinlock for synchronization */
@@ -111,6 +128,27 @@ int cap_delete_domain(uint64_t domain_id);
 /* Get domain by ID */
 domain_t* cap_get_domain(uint64_t domain_id);
 
+/* Set/get the NUMA node a domain's memory is allocated from */
+int cap_domain_set_home_node(uint64_t domain_id, uint32_t node);
+uint32_t cap_domain_home_node(uint64_t domain_id);
+
+/* Set/get the CPUs a domain's threads may run on (bit n: CPU index n) */
+int cap_domain_set_affinity(uint64_t domain_id, uint64_t mask);
+uint64_t cap_domain_affinity(uint64_t domain_id);
+
+/* Set the CPU time a domain's threads may run per period, in TSC cycles
+ * summed over all CPUs (a zero quota removes the limit) */
+int cap_domain_set_quota(uint64_t domain_id, uint64_t quota, uint64_t period);
+
+/* Charge a domain CPU time at a TSC value; returns the cycles left of its
+ * quota this period (UINT64_MAX without one) and, through refill if not
+ * NULL, the TSC at which its next period starts */
+uint64_t cap_domain_charge(uint64_t domain_id, uint64_t cycles, uint64_t now,
+                           uint64_t *refill);
+
+/* Get the CPU time a domain has used */
+int cap_domain_cpu_usage(uint64_t domain_id, domain_cpu_usage_t *usage);
+
 /* Add capability to domain's capability space */
 int cap_domain_add_cap(uint64_t domain_id, cap_handle_t handle);
 
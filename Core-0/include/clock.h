@@ -0,0 +1,54 @@
+/*
+ * HIK Core-0 Clock Source
+ * 
+ * This file defines the kernel's monotonic clock: nanoseconds since
+ * clock_init, read from the TSC where it runs at a constant rate and
+ * from the HPET otherwise. TSC cycle counts (such as CPU time accounted
+ * per thread) convert to nanoseconds at the calibrated TSC rate.
+ */
+
+#ifndef HIK_CORE0_CLOCK_H
+#define HIK_CORE0_CLOCK_H
+
+#include "stdint.h"
+#include "cpu.h"
+
+/* Counter the clock reads */
+typedef enum {
+    CLOCK_SOURCE_NONE = 0,          /* Not calibrated */
+    CLOCK_SOURCE_TSC = 1,           /* Invariant TSC */
+    CLOCK_SOURCE_TSC_UNSTABLE = 2,  /* TSC whose rate may change (no HPET to use) */
+    CLOCK_SOURCE_HPET = 3           /* HPET main counter */
+} clock_source_t;
+
+/* Calibration interval of the TSC */
+#define CLOCK_CALIBRATE_US 10000
+
+/* Nanoseconds per second */
+#define CLOCK_NS_PER_SEC 1000000000ULL
+
+/* Calibrate the TSC and pick the clock's counter */
+int clock_init(void);
+
+/* Get the counter the clock reads */
+clock_source_t clock_source(void);
+
+/* Check whether the TSC runs at a constant rate in every power state */
+int clock_tsc_invariant(void);
+
+/* Get the calibrated TSC rate in Hz */
+uint64_t clock_tsc_hz(void);
+
+/* Get the time in nanoseconds since clock_init */
+uint64_t clock_ns(void);
+
+/* Convert TSC cycles to nanoseconds */
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+
+/* Convert nanoseconds to TSC cycles (0 before calibration) */
+uint64_t clock_ns_to_cycles(uint64_t ns);
+
+/* Get the TSC value at a clock time (0 unless the clock reads the TSC) */
+uint64_t clock_ns_to_tsc(uint64_t ns);
+
+#endif /* HIK_CORE0_CLOCK_H */
\ No newline at end of file
@@ -0,0 +1,62 @@
+/*
+ * HIK Core-0 Thread Context
+ * 
+ * This file defines the x86-64 context switch path: the callee-saved
+ * register switch (arch/x86_64/context.S) and the extended register
+ * state (x87/SSE/AVX), which is saved lazily per thread.
+ */
+
+#ifndef HIK_CORE0_CONTEXT_H
+#define HIK_CORE0_CONTEXT_H
+
+#include "stdint.h"
+#include "sched.h"
+
+/* Extended state save instruction in use (best available) */
+typedef enum {
+    FPU_SAVE_NONE = 0,        /* Not initialized */
+    FPU_SAVE_FXSAVE = 1,      /* Legacy x87/SSE only */
+    FPU_SAVE_XSAVE = 2,
+    FPU_SAVE_XSAVEC = 3,      /* Compacted, skips components in init state */
+    FPU_SAVE_XSAVEOPT = 4     /* Also skips components unmodified since restore */
+} fpu_save_mode_t;
+
+/* Thread flag: xstate holds the thread's saved extended state */
+#define THREAD_FLAG_XSTATE 0x01
+
+/* Extended state switch statistics */
+typedef struct {
+    uint64_t saves;           /* Outgoing state saved */
+    uint64_t skipped;         /* Outgoing state in init state, not saved */
+    uint64_t restores;        /* Incoming saved state restored */
+    uint64_t resets;          /* Registers reset for a thread with no state */
+} fpu_stats_t;
+
+/* Switch stacks; returns when prev is switched back in (context.S) */
+void context_switch(uint64_t *prev_sp, uint64_t next_sp);
+
+/* First code run by a new thread (context.S) */
+void context_thread_entry(void);
+
+/* Enable x87/SSE/AVX and pick the save instruction */
+int fpu_init(void);
+
+/* Enable the chosen components on the calling CPU (application processors) */
+void fpu_init_cpu(void);
+
+/* Get the save instruction in use */
+fpu_save_mode_t fpu_save_mode(void);
+
+/* Check whether state still in its initial state is detected (and not saved) */
+int fpu_tracks_in_use(void);
+
+/* Save prev's extended state if live and load next's */
+void fpu_switch(tcb_t *prev, tcb_t *next);
+
+/* Free a thread's save area */
+void fpu_release(tcb_t *tcb);
+
+/* Get extended state switch statistics */
+void fpu_get_stats(fpu_stats_t *stats);
+
+#endif /* HIK_CORE0_CONTEXT_H */
\ No newline at end of file
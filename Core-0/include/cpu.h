@@ -0,0 +1,69 @@
+/*
+ * HIK Core-0 CPU Local Definitions
+ * 
+ * This file defines per-CPU helpers used by Core-0 subsystems that keep
+ * CPU-local state (allocator magazines, run queues, etc.).
+ */
+
+#ifndef HIK_CORE0_CPU_H
+#define HIK_CORE0_CPU_H
+
+#include "stdint.h"
+#include "stddef.h"
+
+/* Maximum number of CPUs */
+#define MAX_CPUS 64
+
+/* Affinity mask allowing every CPU */
+#define CPU_MASK_ALL (~0ULL)
+
+/* Cache line size (for padding per-CPU data) */
+#define CACHE_LINE_SIZE 64
+
+/* RFLAGS interrupt enable flag */
+#define CPU_RFLAGS_IF 0x200
+
+/* Per-CPU data area, reached through the GS base of each CPU */
+typedef struct cpu_local {
+    struct cpu_local *self;      /* This area (so %gs:0 yields its address) */
+    uint32_t id;                 /* CPU index */
+    uint32_t apic_id;            /* Local APIC ID */
+    struct tcb *current;         /* Running thread */
+} __attribute__((aligned(CACHE_LINE_SIZE))) cpu_local_t;
+
+/* Get the current CPU's data area */
+static inline cpu_local_t* cpu_local(void) {
+    cpu_local_t *self;
+    __asm__ volatile("movq %%gs:0, %0" : "=r"(self));
+    return self;
+}
+
+/* Get current CPU index */
+static inline uint32_t cpu_current_id(void) {
+    uint32_t id;
+    __asm__ volatile("movl %%gs:%c1, %0" : "=r"(id) : "i"(offsetof(cpu_local_t, id)));
+    return id;
+}
+
+/* Read the time-stamp counter */
+static inline uint64_t cpu_rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Disable interrupts, returning the previous RFLAGS */
+static inline uint64_t cpu_irq_save(void) {
+    uint64_t flags;
+    __asm__ volatile("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+/* Restore the interrupt state saved by cpu_irq_save */
+static inline void cpu_irq_restore(uint64_t flags) {
+    if (flags & CPU_RFLAGS_IF) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
+#endif /* HIK_CORE0_CPU_H */
\ No newline at end of file
@@ -0,0 +1,85 @@
+/*
+ * HIK Core-0 Synchronous IPC
+ * 
+ * This file defines IPC endpoints: a client thread calls an endpoint with
+ * a short message and blocks until a server thread of the endpoint's
+ * domain replies. Messages are copied between the threads' buffers.
+ * 
+ * When the server is already waiting, the call hands the CPU straight to
+ * it (sched_handoff): the server runs on the caller's slice and priority
+ * until it replies, and a reply that waits for the next call hands the
+ * CPU straight back, so a round trip never touches a run queue.
+ * 
+ * A caller that finds the server busy lends it its priority until it is
+ * served (priority inheritance), as does any thread waiting on a caller
+ * that is in turn waiting: the boost follows the chain of calls, up to
+ * IPC_BOOST_DEPTH threads.
+ * 
+ * A call whose server is terminated returns -2 without a reply.
+ */
+
+#ifndef HIK_CORE0_IPC_H
+#define HIK_CORE0_IPC_H
+
+#include "stdint.h"
+#include "slab.h"
+#include "sched.h"
+
+/* Message words (besides the label) */
+#define IPC_MSG_WORDS 6
+
+/* Longest chain of waiting threads a priority boost is passed along */
+#define IPC_BOOST_DEPTH 8
+
+/* IPC message */
+typedef struct {
+    uint64_t label;                 /* Operation (request) or status (reply) */
+    uint64_t words[IPC_MSG_WORDS];  /* Payload */
+} ipc_msg_t;
+
+/* IPC endpoint */
+typedef struct ipc_endpoint {
+    uint64_t endpoint_id;           /* Endpoint ID */
+    uint64_t domain_id;             /* Domain whose threads serve it */
+    tcb_t *server;                  /* Server thread waiting for a call */
+    tcb_t *owner;                   /* Server thread busy with a call */
+    tcb_t *callers;                 /* Callers waiting for a server (by priority) */
+    uint64_t serving;               /* Calls taken and not yet replied to */
+    uint64_t calls;                 /* Calls made */
+    uint64_t lock;                  /* Spinlock (taken before the scheduler's) */
+} ipc_endpoint_t;
+
+/* IPC state */
+typedef struct {
+    kmem_table_t endpoints;         /* Endpoint table (indexed by endpoint ID) */
+    uint64_t lock;                  /* Spinlock (endpoint table) */
+    uint64_t chain_lock;            /* Spinlock (callers' servers, endpoint owners) */
+} ipc_state_t;
+
+/* Initialize IPC */
+int ipc_init(void);
+
+/* Create an endpoint served by a domain's threads */
+uint64_t ipc_endpoint_create(uint64_t domain_id);
+
+/* Delete an endpoint (no thread may be calling or waiting on it) */
+int ipc_endpoint_delete(uint64_t endpoint_id);
+
+/* Call an endpoint: send msg and wait for the reply, which overwrites it
+ * (-2 if the server died first) */
+int ipc_call(uint64_t endpoint_id, ipc_msg_t *msg);
+
+/* Wait for the next call on an endpoint (server) */
+int ipc_wait(uint64_t endpoint_id, ipc_msg_t *msg);
+
+/* Reply to the call being served and keep running (server) */
+int ipc_reply(const ipc_msg_t *reply);
+
+/* Reply to the call being served and wait for the next one (server) */
+int ipc_reply_wait(uint64_t endpoint_id, const ipc_msg_t *reply, ipc_msg_t *msg);
+
+/* Take a terminated thread off its endpoints, failing the call it serves;
+ * -1 while a peer still uses it (free it later) */
+int ipc_thread_exit(tcb_t *tcb);
+
+#endif /* HIK_CORE0_IPC_H */
\ No newline at end of file
@@ -22,19 +22,84 @@
 #define PT_FLAG_GLOBAL      0x100
 #define PT_FLAG_NX          0x8000000000000000ULL
 
+/* Leaf sizes (PS-bit entries in the PD and PDPT) */
+#define PT_LARGE_PAGE_SIZE  0x200000ULL     /* 2 MB */
+#define PT_HUGE_PAGE_SIZE   0x40000000ULL   /* 1 GB */
+
 /* Page table structure */
 typedef struct {
     uint64_t entries[512];
 } __attribute__((aligned(4096))) page_table_t;
 
+/* Software page-walk cache (lower half only; reset by every range operation,
+ * read and filled under the domain's lock) */
+#define PT_WALK_CACHE_SIZE 16
+
+typedef struct {
+    page_table_t *pd;                      /* Last PD walked through */
+    uint64_t pd_base;                      /* 1 GB region the PD covers */
+    page_table_t *pt;                      /* Last PT walked through */
+    uint64_t pt_base;                      /* 2 MB region the PT covers */
+    uint64_t tags[PT_WALK_CACHE_SIZE];     /* Page number + 1 (0 = empty) */
+    uint64_t ptes[PT_WALK_CACHE_SIZE];     /* Entries outside a PT (huge or absent) */
+} pt_walk_cache_t;
+
 /* Domain page table configuration */
 typedef struct {
     page_table_t *pml4;           /* PML4 table */
     uint64_t domain_id;           /* Domain ID */
     uint64_t capabilities;        /* Capabilities for this domain */
     uint32_t flags;               /* Domain flags */
+    uint32_t home_node;           /* NUMA node for page table frames */
+    uint64_t pcid_generation;     /* PCID allocation round (0 = none) */
+    uint32_t pcid;                /* Process-context ID tagging its TLB entries */
+    uint32_t lock;                /* Guards the tables and the walk cache */
+    uint64_t tlb_generation;      /* Invalidations published for other CPUs */
+    pt_walk_cache_t walk_cache;   /* Recent translations for access checks */
 } domain_page_table_t;
 
+/* Range operations on a domain's page tables */
+typedef enum {
+    PT_OP_MAP = 0,            /* Install translations */
+    PT_OP_UNMAP = 1,          /* Remove translations */
+    PT_OP_PROTECT = 2         /* Change leaf flags of existing translations */
+} pt_range_op_t;
+
+/* Process-context IDs (PCID 0 is the untagged/boot context) */
+#define PCID_MAX               4095
+#define CR3_PCID_MASK          0xFFFULL
+#define CR3_NOFLUSH            (1ULL << 63)   /* Keep the new PCID's TLB entries */
+
+/* INVPCID invalidation types */
+#define INVPCID_ADDRESS        0   /* One address in one PCID */
+#define INVPCID_CONTEXT        1   /* All non-global entries of one PCID */
+#define INVPCID_ALL_GLOBAL     2   /* All PCIDs, including global entries */
+#define INVPCID_ALL            3   /* All PCIDs, non-global entries */
+
+/* Freed page-table pages kept per NUMA node for reuse */
+#define PT_RECYCLE_MAX 512
+
+/* Most pages a flush set lists; beyond the threshold (at most this many)
+ * individual invlpg costs more than a full flush */
+#define PT_FLUSH_MAX_PAGES 32
+
+/* TLB entries a range operation made stale */
+typedef struct {
+    uint64_t pages[PT_FLUSH_MAX_PAGES];  /* Virtual addresses to invalidate */
+    uint32_t count;                      /* Number of listed addresses */
+    uint32_t flush_all;                  /* Too many to list: flush everything */
+    uint32_t global;                     /* Kernel-half (global) entries changed */
+    uint64_t domain_id;                  /* Address space the entries belong to */
+} pt_flush_set_t;
+
+/* TLB invalidations issued by flush commits */
+typedef struct {
+    uint64_t pages;               /* Single-page invalidations */
+    uint64_t full;                /* Whole-context (or whole-TLB) flushes */
+    uint64_t deferred;            /* Operations whose flush a batch absorbed */
+    uint64_t remote;              /* Flushes applied for another CPU's commit */
+} pt_flush_stats_t;
+
 /* Domain flags */
 #define DOMAIN_FLAG_KERNEL    0x01  /* Kernel domain */
 #define DOMAIN_FLAG_SERVICE   0x02  /* Service domain */
@@ -87,16 +152,23 @@ typedef enum {
 #define PD_INDEX(vaddr)        (((vaddr) >> 21) & 0x1FF)
 #define PT_INDEX(vaddr)        (((vaddr) >> 12) & 0x1FF)
 
+/* First PML4 entry of the kernel half (shared by all domains) */
+#define PML4_KERNEL_START      PML4_INDEX(KERNEL_BASE)
+
 /* Page table entry helpers */
 #define PTE_GET_ADDRESS(pte)   ((pte) & 0x000FFFFFFFFFF000ULL)
 #define PTE_SET_ADDRESS(pte, addr) (((pte) & 0xFFF0000000000FFFULL) | ((addr) & 0x000FFFFFFFFFF000ULL))
 #define PTE_IS_PRESENT(pte)    ((pte) & PT_FLAG_PRESENT)
 #define PTE_IS_WRITABLE(pte)   ((pte) & PT_FLAG_WRITABLE)
 #define PTE_IS_USER(pte)       ((pte) & PT_FLAG_USER)
+#define PTE_IS_LEAF(pte)       ((pte) & PT_FLAG_PS)    /* PD/PDPT entry maps a 2 MB/1 GB page */
 
 /* Initialize isolation system */
 int isolation_init(void);
 
+/* Enable global pages and PCIDs on the calling CPU (application processors) */
+void isolation_init_cpu(void);
+
 /* Create page tables for a domain */
 int isolation_create_page_tables(uint64_t domain_id, uint32_t flags);
 
@@ -110,6 +182,28 @@ int isolation_map_memory(uint64_t domain_id, uint64_t virt_addr, uint64_t phys_a
 /* Unmap memory from domain's address space */
 int isolation_unmap_memory(uint64_t domain_id, uint64_t virt_addr, uint64_t size);
 
+/* Change protection of mapped memory in domain's address space */
+int isolation_protect_memory(uint64_t domain_id, uint64_t virt_addr, uint64_t size,
+                             map_type_t map_type);
+
+/* Defer the TLB flushes of isolation map/unmap/protect calls on this CPU
+ * until the matching end (nestable) */
+void isolation_flush_begin(void);
+void isolation_flush_end(void);
+
+/* Load a domain's address space on this CPU (PCID-tagged when enabled) */
+int isolation_switch_domain(uint64_t domain_id);
+
+/* Return this CPU to the kernel domain on a saved CR3 (its boot tables) */
+void isolation_switch_kernel(uint64_t cr3);
+
+/* Apply the invalidations other CPUs committed to the loaded address space
+ * (Core-0 sends no shootdown IPIs; the scheduler calls this on every pass) */
+void isolation_tlb_sync(void);
+
+/* Enable/disable PCID tagging on domain switch; returns whether enabled */
+int isolation_set_pcid(int enable);
+
 /* Verify domain has access to memory */
 int isolation_verify_access(uint64_t domain_id, uint64_t addr, uint64_t size, uint32_t access);
 
@@ -132,17 +226,30 @@ int pt_clear_page_table(page_table_t *pt);
 uint64_t pt_get_entry(page_table_t *pt, uint64_t index);
 void pt_set_entry(page_table_t *pt, uint64_t index, uint64_t entry);
 int pt_is_entry_present(page_table_t *pt, uint64_t index);
+uint32_t pt_recycle_count(uint32_t node);
 
 /* Page table walking */
 page_table_t* pt_walk_get_pml4(uint64_t domain_id);
 page_table_t* pt_walk_get_pdpt(page_table_t *pml4, uint64_t vaddr);
 page_table_t* pt_walk_get_pd(page_table_t *pdpt, uint64_t vaddr);
 page_table_t* pt_walk_get_pt(page_table_t *pd, uint64_t vaddr);
-uint64_t pt_walk_get_pte(page_table_t *pml4, uint64_t vaddr);
+uint64_t pt_walk_get_pte(page_table_t *pml4, uint64_t vaddr);  /* Huge leaves as 4 KB entries */
+
+/* Range mapping (one descent per range; stale translations collected in flush) */
+int pt_map_range(domain_page_table_t *domain, uint64_t virt, uint64_t phys,
+                 uint64_t size, uint64_t flags, pt_flush_set_t *flush);
+int pt_unmap_range(domain_page_table_t *domain, uint64_t virt, uint64_t size,
+                   pt_flush_set_t *flush);
+int pt_protect_range(domain_page_table_t *domain, uint64_t virt, uint64_t size,
+                     uint64_t flags, pt_flush_set_t *flush);
+void pt_flush_commit(pt_flush_set_t *flush);
+void pt_set_flush_threshold(uint32_t pages);
+void pt_get_flush_stats(pt_flush_stats_t *stats);
 
 /* TLB management */
 void tlb_invalidate_page(uint64_t addr);
 void tlb_invalidate_all(void);
+void tlb_invalidate_global(void);
 void tlb_invalidate_asid(uint64_t asid);
 
 /* Identity mapping */
@@ -0,0 +1,78 @@
+/*
+ * HIK Core-0 Boot Memory Map
+ * 
+ * This file defines the firmware memory map formats handed over by the
+ * bootloader (BIOS E820 entries and UEFI memory descriptors) and the
+ * normalized region list Core-0 builds from them.
+ */
+
+#ifndef HIK_CORE0_MEMMAP_H
+#define HIK_CORE0_MEMMAP_H
+
+#include "stdint.h"
+#include "kernel.h"
+
+/* E820 entry (BIOS path, memory_map_entry_t in stage2.h) */
+typedef struct {
+    uint64_t base_address;
+    uint64_t length;
+    uint32_t type;
+    uint32_t attributes;
+} __attribute__((packed)) memory_map_entry_t;
+
+/* E820 entry types */
+#define E820_TYPE_USABLE        1
+#define E820_TYPE_RESERVED      2
+#define E820_TYPE_ACPI_RECLAIM  3
+#define E820_TYPE_NVS           4
+#define E820_TYPE_UNUSABLE      5
+
+/* UEFI memory descriptor (stride is memory_map_desc_size, not sizeof) */
+typedef struct {
+    uint32_t type;
+    uint32_t pad;
+    uint64_t physical_start;
+    uint64_t virtual_start;
+    uint64_t number_of_pages;
+    uint64_t attribute;
+} efi_memory_descriptor_t;
+
+/* UEFI memory types used by Core-0 */
+#define EFI_LOADER_CODE           1
+#define EFI_LOADER_DATA           2
+#define EFI_BOOT_SERVICES_CODE    3
+#define EFI_BOOT_SERVICES_DATA    4
+#define EFI_CONVENTIONAL_MEMORY   7
+
+/* UEFI descriptors are always 4KB pages */
+#define EFI_PAGE_SIZE 4096
+
+/* Normalized region kinds */
+#define MEMMAP_USABLE       1    /* Free RAM, usable immediately */
+#define MEMMAP_BOOT_RECLAIM 2    /* Boot services memory, usable after handoff */
+
+/* Maximum normalized regions */
+#define MEMMAP_MAX_REGIONS 128
+
+/* Normalized region (page aligned, [base, end)) */
+typedef struct {
+    uint64_t base;           /* First byte */
+    uint64_t end;            /* Byte after the region */
+    uint32_t kind;           /* MEMMAP_* */
+    uint32_t reserved;       /* Reserved for future use */
+} memmap_region_t;
+
+/* Normalized memory map (sorted by base, adjacent regions of a kind merged) */
+typedef struct {
+    memmap_region_t regions[MEMMAP_MAX_REGIONS];
+    uint32_t count;          /* Regions in use */
+    uint32_t dropped;        /* Entries lost because the table was full */
+} memmap_t;
+
+/* Parse the bootloader memory map (E820 or UEFI) */
+int memmap_parse(const boot_info_t *boot_info, memmap_t *map);
+
+/* Highest address covered by any region */
+uint64_t memmap_end(const memmap_t *map);
+
+#endif /* HIK_CORE0_MEMMAP_H */
@@ -9,17 +9,41 @@
 #define HIK_CORE0_MM_H
 
 #include "stdint.h"
+#include "kernel.h"
+#include "numa.h"
 
 /* Page size */
 #define PAGE_SIZE 4096
 #define PAGE_SHIFT 12
 
-/* Maximum physical memory (256GB) - reduced for testing to 512MB */
-#define MAX_PHYSICAL_MEMORY (512ULL * 1024 * 1024)
+/* Maximum physical memory (256GB) */
+#define MAX_PHYSICAL_MEMORY (256ULL * 1024 * 1024 * 1024)
 
 /* Maximum number of pages */
 #define MAX_PAGES (MAX_PHYSICAL_MEMORY / PAGE_SIZE)
 
+/* Buddy allocator orders (order k = 2^k contiguous, naturally aligned pages) */
+#define MM_MAX_ORDER 18                  /* Largest block: 1GB */
+#define MM_NUM_ORDERS (MM_MAX_ORDER + 1)
+
+/* Physical memory zones, one set per NUMA node (allocation prefers the
+ * highest zone of the nearest node) */
+#define MM_ZONE_DMA32 0                  /* Below 4GB (32-bit DMA capable) */
+#define MM_ZONE_NORMAL 1                 /* 4GB and above */
+#define MM_NUM_ZONES 2
+#define MM_DMA32_LIMIT (4ULL * 1024 * 1024 * 1024)
+
+/* Memory below this address is never handed to the allocator (BIOS data,
+ * boot structures, real-mode trampolines) */
+#define MM_LOW_MEMORY_LIMIT 0x100000
+
+/* Extent table sizing: one slot per MM_EXTENT_RATIO pages, grown on demand */
+#define MM_EXTENT_RATIO 1024
+#define MM_MIN_EXTENTS 256
+
+/* Owner home node hints (direct-mapped by owner ID) */
+#define MM_OWNER_HINTS 256
+
 /* Memory region types */
 typedef enum {
     MEM_TYPE_RESERVED = 0,    /* Reserved (BIOS, ACPI, etc.) */
@@ -31,46 +55,183 @@ typedef enum {
     MEM_TYPE_CUSTOM = 99      /* Custom type */
 } mem_type_t;
 
-/* Memory frame descriptor (global bitmap entry) */
+/* Memory frame descriptor (returned by mm_get_frame) */
 typedef struct {
     mem_type_t type;          /* Memory type */
     uint64_t owner;           /* Owner domain ID */
 } mem_frame_t;
 
-/* Memory manager state */
+/* Memory extent (run of pages with one type and owner) */
+typedef struct {
+    uint32_t base_pfn;        /* First page frame */
+    uint32_t pages;           /* Number of pages */
+    uint64_t owner;           /* Owner domain ID */
+    uint32_t type;            /* Memory type (mem_type_t) */
+    uint32_t reserved;        /* Reserved for future use */
+} mem_extent_t;
+
+/* Per-CPU frame magazines (cached order-0 and order-9 kernel frames) */
+#define MM_MAG_ORDER_SMALL 0              /* 4KB frames (page tables) */
+#define MM_MAG_ORDER_LARGE 9              /* 2MB frames */
+#define MM_MAG_SIZE_SMALL 64              /* Frames per small magazine */
+#define MM_MAG_SIZE_LARGE 8               /* Frames per large magazine */
+
+/* First word of a frame parked in a magazine, XORed with its address
+ * (the frame's contents are dead once it is freed) */
+#define MM_MAG_PARKED 0x4D41475041524B44ULL  /* "MAGPARKD" */
+
+/* Per-CPU magazine statistics */
 typedef struct {
-    mem_frame_t frames[MAX_PAGES];     /* Global frame bitmap */
+    uint64_t hits;            /* Served from the CPU's magazine */
+    uint64_t misses;          /* Magazine empty, refilled from the global pool */
+    uint64_t refills;         /* Frames moved in from the global pool */
+    uint64_t drains;          /* Frames moved back to the global pool */
+    uint64_t drain_errors;    /* Frames the global pool refused on a drain */
+} mm_magazine_stats_t;
+
+/* Pre-zeroed frame pool (refilled by the idle thread) */
+#define MM_ZERO_ORDER_SMALL 0             /* 4KB frames (page tables) */
+#define MM_ZERO_ORDER_LARGE 8             /* 1MB blocks (process images) */
+#define MM_ZERO_POOL_SMALL 128            /* Zeroed 4KB frames kept ready */
+#define MM_ZERO_POOL_LARGE 4              /* Zeroed 1MB blocks kept ready */
+#define MM_ZERO_REFILL_PAGES 256          /* Pages zeroed per idle pass */
+
+/* Zero pool statistics */
+typedef struct {
+    uint64_t hits;            /* Served from the pool */
+    uint64_t misses;          /* Pool empty, zeroed on the allocation path */
+    uint64_t refills;         /* Blocks zeroed by the idle thread */
+    uint64_t drains;          /* Blocks returned under memory pressure */
+} mm_zero_stats_t;
+
+/* Buddy free list (one per order) */
+typedef struct {
+    uint64_t head;                     /* Physical address of first free block (0 = empty) */
+    uint64_t count;                    /* Number of free blocks */
+} mm_free_area_t;
+
+/* Memory zone (free lists cover only the usable ranges inside the span) */
+typedef struct {
+    uint64_t start_pfn;                /* First usable page */
+    uint64_t end_pfn;                  /* Page after the last usable page */
+    uint64_t present_pages;            /* Usable pages reported by firmware */
+    uint64_t available_pages;          /* Free pages */
+    mm_free_area_t free_area[MM_NUM_ORDERS]; /* Buddy free lists */
+} mm_zone_t;
+
+/* Memory manager state
+ *
+ * A page is free when its bit in used_map is clear. Used pages get their
+ * type and owner from the sorted extent table; used pages outside every
+ * extent are MEM_TYPE_RESERVED. Both tables are sized from the highest
+ * RAM address in the boot memory map (about 0.15 bytes per page in total).
+ */
+typedef struct {
+    uint64_t *used_map;                /* Free/used bitmap (1 bit per page) */
+    mem_extent_t *extents;             /* Extent table, sorted by base_pfn */
+    uint64_t num_extents;              /* Extents in use */
+    uint64_t max_extents;              /* Extent table capacity */
+    mm_zone_t zones[NUMA_MAX_NODES][MM_NUM_ZONES]; /* Per-node zones (buddy free lists) */
     uint64_t total_pages;            /* Total number of pages */
     uint64_t available_pages;        /* Available pages */
     uint64_t allocated_pages;        /* Allocated pages */
     uint64_t lock;                    /* Spinlock */
 } mm_state_t;
 
-/* Initialize memory manager */
-int mm_init(uint64_t total_memory);
+/* Initialize memory manager from the boot memory map */
+int mm_init(const boot_info_t *boot_info);
 
-/* Allocate memory */
+/* Release boot services memory once firmware structures are no longer used */
+uint64_t mm_reclaim_boot_memory(void);
+
+/* Allocate memory (rounded up to whole pages, aligned to a power of two) */
 uint64_t mm_alloc(uint64_t size, uint64_t align, mem_type_t type, uint64_t owner);
 
-/* Free memory */
+/* Allocate memory from a zone or a lower one (e.g. MM_ZONE_DMA32) */
+uint64_t mm_alloc_zone(uint32_t zone, uint64_t size, uint64_t align,
+                       mem_type_t type, uint64_t owner);
+
+/* Allocate memory on a NUMA node, falling back to the nearest other nodes */
+uint64_t mm_alloc_node(uint32_t node, uint64_t size, uint64_t align,
+                       mem_type_t type, uint64_t owner);
+
+/* Preferred node for an owner (its home node hint, else the local node) */
+uint32_t mm_owner_node(uint64_t owner);
+
+/* Set an owner's home node hint (NUMA_NO_NODE drops it) */
+void mm_set_owner_node(uint64_t owner, uint32_t node);
+
+/* Free the whole allocation extent starting at addr */
 int mm_free(uint64_t addr);
 
+/* Allocate/free kernel blocks of one order in a batch (single lock hold);
+ * both return how many blocks they handled */
+uint32_t mm_alloc_batch(uint32_t order, uint64_t *frames, uint32_t count);
+uint32_t mm_free_batch(const uint64_t *frames, uint32_t count);
+
+/* Allocate a kernel frame (order 0 or 9) from the current CPU's magazine */
+uint64_t mm_alloc_frame(uint32_t order);
+
+/* Free a frame obtained from mm_alloc_frame */
+int mm_free_frame(uint64_t addr, uint32_t order);
+
+/* Check a frame about to be parked in a magazine (the head of an
+ * allocation of exactly that order, not already parked) and mark it
+ * parked in its first word; unmark it when it leaves */
+int mm_frame_cache(uint64_t addr, uint32_t order);
+void mm_frame_uncache(uint64_t addr);
+
+/* Return the current CPU's cached frames to the global pool */
+uint64_t mm_magazine_drain(void);
+
+/* Get magazine statistics for a CPU and order */
+int mm_magazine_get_stats(uint32_t cpu, uint32_t order, mm_magazine_stats_t *stats);
+
+/* Allocate zeroed memory, taking pre-zeroed blocks from the pool first */
+uint64_t mm_alloc_zeroed(uint64_t size, uint64_t align, mem_type_t type, uint64_t owner);
+uint64_t mm_alloc_zeroed_node(uint32_t node, uint64_t size, uint64_t align,
+                              mem_type_t type, uint64_t owner);
+
+/* Initialize the per-node zero pools */
+void mm_zero_pool_init(void);
+
+/* Zero free blocks into the pool (idle thread); returns pages zeroed */
+uint64_t mm_zero_pool_refill(uint64_t max_pages);
+
+/* Return all pooled blocks to the global pool */
+uint64_t mm_zero_pool_drain(void);
+
+/* Get zero pool statistics for an order */
+int mm_zero_pool_get_stats(uint32_t order, mm_zero_stats_t *stats);
+
+/* Change the type and owner of the allocation starting at addr */
+int mm_set_owner(uint64_t addr, mem_type_t type, uint64_t owner);
+
 /* Reserve memory region */
 int mm_reserve(uint64_t base, uint64_t size, mem_type_t type, uint64_t owner);
 
 /* Get memory type */
 mem_type_t mm_get_type(uint64_t addr);
 
-/* Get memory frame */
-mem_frame_t* mm_get_frame(uint64_t addr);
+/* Get memory frame (type and owner) */
+int mm_get_frame(uint64_t addr, mem_frame_t *frame);
 
 /* Dump memory map (for debugging) */
 void mm_dump(void);
 
+/* Get end of physical memory (bytes) */
+uint64_t mm_get_total(void);
+
 /* Get available pages */
 uint64_t mm_get_available(void);
 
 /* Get allocated pages */
 uint64_t mm_get_allocated(void);
 
+/* Get available memory in a zone across all nodes (bytes) */
+uint64_t mm_get_zone_available(uint32_t zone);
+
+/* Get available memory on a node (bytes) */
+uint64_t mm_get_node_available(uint32_t node);
+
 #endif /* HIK_CORE0_MM_H */
\ No newline at end of file
@@ -0,0 +1,80 @@
+/*
+ * HIK Core-0 NUMA Topology
+ * 
+ * This file defines the NUMA node map built from the ACPI SRAT and SLIT:
+ * which physical ranges and CPUs belong to which node, and the relative
+ * distance between nodes. Without an SRAT the machine is a single node.
+ */
+
+#ifndef HIK_CORE0_NUMA_H
+#define HIK_CORE0_NUMA_H
+
+#include "stdint.h"
+#include "cpu.h"
+
+/* Topology limits */
+#define NUMA_MAX_NODES 8
+#define NUMA_MAX_RANGES 64
+#define NUMA_NO_NODE 0xFFFFFFFF
+
+/* SLIT distances (used when the SLIT is absent) */
+#define NUMA_LOCAL_DISTANCE 10
+#define NUMA_REMOTE_DISTANCE 20
+
+/* Physical range owned by a node */
+typedef struct {
+    uint64_t base;               /* First byte */
+    uint64_t end;                /* Byte after the range */
+    uint32_t node;               /* Node index */
+    uint32_t reserved;           /* Reserved for future use */
+} numa_range_t;
+
+/* APIC ID to node mapping */
+typedef struct {
+    uint32_t apic_id;            /* Local APIC / x2APIC ID */
+    uint32_t node;               /* Node index */
+} numa_cpu_affinity_t;
+
+/* NUMA topology */
+typedef struct {
+    uint32_t num_nodes;                          /* Nodes (at least 1) */
+    uint32_t num_ranges;                         /* Memory ranges */
+    uint32_t num_cpus;                           /* CPU affinities */
+    uint32_t reserved;                           /* Reserved for future use */
+    uint32_t proximity[NUMA_MAX_NODES];          /* ACPI proximity domain of each node */
+    numa_range_t ranges[NUMA_MAX_RANGES];        /* Sorted by base */
+    numa_cpu_affinity_t cpus[MAX_CPUS];          /* APIC affinities from SRAT */
+    uint8_t distance[NUMA_MAX_NODES][NUMA_MAX_NODES];   /* Relative distance */
+    uint32_t fallback[NUMA_MAX_NODES][NUMA_MAX_NODES];  /* Nodes, nearest first */
+    uint32_t cpu_node[MAX_CPUS];                 /* Node of each CPU index */
+} numa_state_t;
+
+/* Build the topology from ACPI (call after acpi_init) */
+int numa_init(void);
+
+/* Get number of nodes */
+uint32_t numa_num_nodes(void);
+
+/* Get node owning a physical address */
+uint32_t numa_node_of_addr(uint64_t addr);
+
+/* Get the next address above addr where the owning node changes */
+uint64_t numa_node_boundary(uint64_t addr);
+
+/* Get node of an APIC ID */
+uint32_t numa_node_of_apic(uint32_t apic_id);
+
+/* Set/get the node of a CPU index */
+void numa_set_cpu_node(uint32_t cpu, uint32_t node);
+uint32_t numa_cpu_node(uint32_t cpu);
+
+/* Get node of the current CPU */
+uint32_t numa_current_node(void);
+
+/* Get distance between two nodes */
+uint32_t numa_distance(uint32_t from, uint32_t to);
+
+/* Get all nodes ordered by distance from a node (numa_num_nodes entries) */
+const uint32_t* numa_fallback_list(uint32_t node);
+
+#endif /* HIK_CORE0_NUMA_H */
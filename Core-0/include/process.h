@@ -10,9 +10,7 @@
 
 #include "stdint.h"
 #include "capability.h"
-
-/* Maximum number of processes */
-#define MAX_PROCESSES 256
+#include "slab.h"
 
 /* Process state */
 typedef enum {
@@ -48,9 +46,8 @@ typedef struct {
 
 /* Process manager state */
 typedef struct {
-    process_t processes[MAX_PROCESSES];  /* Process table */
+    kmem_table_t processes;              /* Process table (indexed by PID) */
     uint32_t num_processes;              /* Number of processes */
-    uint64_t next_pid;                   /* Next process ID */
     uint64_t lock;                       /* Spinlock */
 } process_manager_t;
 
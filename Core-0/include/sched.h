@@ -3,19 +3,52 @@
  * 
  * This file defines the thread scheduler for Core-0.
  * It manages thread execution and provides scheduling services.
+ * 
+ * Threads run in one of two classes. The priority class has the static
+ * levels of thread_priority_t, round robin within a level. The deadline
+ * class runs ahead of every priority level: a thread given a (budget,
+ * period) reservation is scheduled earliest deadline first as a constant
+ * bandwidth server, so it gets its budget in every period and one that
+ * overruns is throttled until its next period instead of delaying the
+ * others. Reservations are admitted per CPU up to SCHED_DL_MAX_UTIL.
+ * 
+ * Until Core-0 has an IDT the timer never interrupts a thread, so budgets
+ * are enforced cooperatively: an overrun is caught when the thread next
+ * passes through the scheduler (yield, block, sleep or IPC), not while it
+ * runs without doing so.
+ * 
+ * CPU time is also charged to the thread's domain. A domain given a quota
+ * runs its priority-class threads for at most that many cycles per period
+ * (over all CPUs); once it is used up they are throttled until the next
+ * period, so a service that keeps running cannot starve the others. Like
+ * budgets, quotas are enforced at scheduler passes: a service spinning
+ * without entering the scheduler is not stopped until a timer interrupt
+ * can preempt it.
+ * 
+ * A synchronous IPC call (ipc.h) can hand the CPU straight to the server
+ * thread waiting for it, and the reply straight back: the server runs on
+ * the caller's slice and at its priority, and neither thread passes
+ * through a run queue. A caller that has to wait for a busy server lends
+ * it its priority instead (sched_boost), and on down the chain of calls
+ * the server is itself waiting on, so a lower priority thread cannot
+ * hold it up.
  */
 
 #ifndef HIK_CORE0_SCHED_H
 #define HIK_CORE0_SCHED_H
 
 #include "stdint.h"
+#include "slab.h"
+#include "cpu.h"
+#include "timer.h"
 
 /* Thread states */
 typedef enum {
     THREAD_STATE_READY = 0,
     THREAD_STATE_RUNNING = 1,
     THREAD_STATE_BLOCKED = 2,
-    THREAD_STATE_TERMINATED = 3
+    THREAD_STATE_TERMINATED = 3,
+    THREAD_STATE_THROTTLED = 4    /* Out of budget (deadline) or domain quota until its next period */
 } thread_state_t;
 
 /* Thread priority */
@@ -27,39 +60,135 @@ typedef enum {
     THREAD_PRIORITY_REALTIME = 4
 } thread_priority_t;
 
-/* Maximum number of threads */
-#define MAX_THREADS 128
+/* Thread flags */
+#define THREAD_FLAG_IDLE 0x02     /* A CPU's idle thread (never blocks; 0x01 is in context.h) */
+
+/* Number of priority levels (one run queue each) */
+#define SCHED_NUM_PRIORITIES 5
+
+/* Run queue level of the deadline class (above every priority) */
+#define SCHED_LEVEL_DEADLINE SCHED_NUM_PRIORITIES
+#define SCHED_NUM_LEVELS (SCHED_NUM_PRIORITIES + 1)
+
+/* Reservation limits: periods from a tick (budgets are enforced at
+ * scheduler passes) to 10s, and per-CPU admitted bandwidth in 1/2^20
+ * units, leaving 5% to the priority class */
+#define SCHED_DL_MIN_PERIOD_NS TIMER_NS_PER_TICK
+#define SCHED_DL_MAX_PERIOD_NS (10 * 1000000000ULL)
+#define SCHED_DL_UTIL_SHIFT 20
+#define SCHED_DL_MAX_UTIL ((95ULL << SCHED_DL_UTIL_SHIFT) / 100)
+
+/* Timer ticks a thread runs before yielding to its priority peers */
+#define SCHED_TIME_SLICE 10
+
+/* Timer interrupt frequency (each CPU's APIC timer, while threads share
+ * the CPU; otherwise it only fires for the next timer) */
+#define SCHED_TICK_HZ 1000
+
+/* TSC cycles after switching out during which a thread's cache is
+ * considered warm (idle CPUs do not steal it) */
+#define SCHED_CACHE_HOT_CYCLES 500000
+
+/* Thread stack size */
 #define STACK_SIZE (64 * 1024)  /* 64KB stack */
 
 /* Thread control block */
-typedef struct {
+typedef struct tcb {
     uint64_t thread_id;        /* Thread ID */
     uint64_t domain_id;        /* Owning domain ID */
+    uint64_t process_id;       /* Owning process (0 for kernel threads) */
     thread_state_t state;      /* Thread state */
     thread_priority_t priority; /* Thread priority */
+    thread_priority_t base_priority; /* Own priority (IPC lends higher ones) */
     uint64_t stack_base;       /* Stack base address */
     uint64_t stack_size;       /* Stack size */
     uint64_t stack_ptr;        /* Current stack pointer */
     void (*entry_point)(void*); /* Thread entry point */
     void *arg;                 /* Thread argument */
     uint64_t time_slice;       /* Time slice remaining */
-    uint64_t total_time;       /* Total CPU time */
+    uint64_t total_time;       /* CPU time in nanoseconds (to its last switch out) */
     uint32_t flags;            /* Thread flags */
+    uint32_t cpu;              /* CPU whose scheduler owns the thread */
+    volatile uint32_t on_cpu;  /* Running, or not yet fully switched out */
+    uint64_t affinity;         /* CPUs the thread may run on (its domain's) */
+    uint64_t last_ran;         /* TSC when it last switched out */
+    uint64_t run_start;        /* TSC its CPU time was last charged up to */
+    struct tcb *run_prev;      /* Run queue links (while READY) */
+    struct tcb *run_next;
+    void *xstate;              /* Extended register save area (on first use) */
+    uint64_t dl_budget;        /* Reserved ns per period (0: priority class) */
+    uint64_t dl_period;        /* Reservation period in ns */
+    int64_t dl_runtime;        /* Budget left before the current deadline */
+    uint64_t dl_deadline;      /* Current absolute deadline (clock ns) */
+    uint32_t dl_cpu;           /* CPU whose bandwidth the reservation holds */
+    timer_t throttle_timer;    /* Makes it ready again when throttled */
+    timer_t sleep_timer;       /* Wakes it from sched_sleep */
+    void *ipc_msg;             /* Where its next IPC message goes */
+    struct tcb *ipc_partner;   /* Caller it is serving (IPC server) */
+    struct tcb *ipc_next;      /* Endpoint queue link (while calling) */
+    struct ipc_endpoint *ipc_endpoint; /* Endpoint it is calling */
+    struct tcb *ipc_server;    /* Server thread handling its call */
+    struct ipc_endpoint *ipc_serves; /* Endpoint it waits on or serves a call of */
+    int32_t ipc_status;        /* Result of its last call (-2: the server died) */
+    volatile uint32_t ipc_waiting; /* Blocked in IPC until a message arrives */
+    volatile uint32_t ipc_pins; /* IPC peers still using it after unlocking */
 } tcb_t;
 
+/* FIFO of ready threads at one priority (deadline order for the
+ * deadline class) */
+typedef struct {
+    tcb_t *head;               /* Next to run */
+    tcb_t *tail;               /* Most recently queued */
+} run_queue_t;
+
+/* Per-CPU load balancing statistics */
+typedef struct {
+    uint64_t steals;                 /* Threads this CPU took from busier ones */
+    uint64_t steal_attempts;         /* Times it found a busier CPU to take from */
+    uint64_t migrations;             /* Threads moved onto this CPU (steals included) */
+    uint64_t idle_cycles;            /* TSC cycles idle with nothing to take */
+    uint64_t ticks_avoided_est;      /* Estimated ticks avoided: tick periods
+                                        elapsed with the tick stopped */
+    uint64_t tick_starts;            /* Times the periodic tick was started */
+    uint64_t dl_throttles;           /* Deadline threads throttled for overrunning */
+    uint64_t quota_throttles;        /* Threads throttled for their domain's quota */
+    uint64_t direct_switches;        /* IPC handoffs that bypassed the run queues */
+    uint64_t priority_boosts;        /* Threads boosted by a waiting caller */
+} sched_stats_t;
+
+/* Per-CPU scheduler instance */
+typedef struct {
+    run_queue_t run_queues[SCHED_NUM_LEVELS]; /* Ready threads per level */
+    uint32_t ready_bitmap;           /* Bit l set: run_queues[l] non-empty */
+    uint32_t num_ready;              /* Threads in the run queues */
+    uint32_t load;                   /* Queued threads other than the idle thread */
+    tcb_t *idle;                     /* This CPU's idle thread */
+    tcb_t *prev;                     /* Thread being switched away from */
+    tcb_t *zombies;                  /* Exited threads freed after switching away */
+    sched_stats_t stats;             /* Load balancing statistics */
+    uint64_t timer_ticks;            /* Timer ticks */
+    uint32_t tickless;               /* Periodic tick stopped */
+    uint64_t timer_deadline;         /* Tick the timer is armed for when tickless
+                                        (UINT64_MAX: not armed) */
+    uint64_t tickless_since;         /* Tick skipped ticks are counted from */
+    uint64_t dl_util;                /* Admitted deadline bandwidth (global lock) */
+    uint64_t lock;                   /* Spinlock (run queues, owned thread states) */
+} __attribute__((aligned(CACHE_LINE_SIZE))) sched_cpu_t;
+
 /* Scheduler state */
 typedef struct {
-    tcb_t threads[MAX_THREADS];     /* Thread table */
+    kmem_table_t threads;            /* Thread table (indexed by thread ID) */
     uint32_t num_threads;            /* Number of threads */
-    uint32_t current_thread;         /* Current running thread */
-    uint64_t next_thread_id;         /* Next thread ID */
-    uint64_t lock;                   /* Spinlock */
-    uint64_t timer_ticks;            /* Timer ticks */
+    uint64_t lock;                   /* Spinlock (thread table; taken before a CPU's) */
+    sched_cpu_t cpus[MAX_CPUS];      /* Per-CPU instances */
 } sched_state_t;
 
 /* Initialize scheduler */
 int sched_init(void);
 
+/* Start the calling CPU's scheduler instance (application processors) */
+int sched_init_cpu(void);
+
 /* Create a new thread */
 uint64_t sched_create_thread(uint64_t domain_id, void (*entry_point)(void*),
                              void *arg, thread_priority_t priority);
@@ -67,6 +196,20 @@ uint64_t sched_create_thread(uint64_t domain_id, void (*entry_point)(void*),
 /* Terminate a thread */
 int sched_terminate_thread(uint64_t thread_id);
 
+/* Restrict a domain's threads to a set of CPUs */
+int sched_set_affinity(uint64_t domain_id, uint64_t mask);
+
+/* Reserve budget ns of CPU time in every period ns for a thread (deadline
+ * class; a zero budget returns it to its priority) */
+int sched_set_deadline(uint64_t thread_id, uint64_t budget_ns, uint64_t period_ns);
+
+/* Limit a domain's threads to quota_ns of CPU time in every period_ns
+ * (a zero quota removes the limit; deadline threads are not limited) */
+int sched_set_quota(uint64_t domain_id, uint64_t quota_ns, uint64_t period_ns);
+
+/* Get a CPU's load balancing and tick statistics */
+int sched_get_stats(uint32_t cpu, sched_stats_t *stats);
+
 /* Yield CPU to next thread */
 void sched_yield(void);
 
@@ -79,6 +222,24 @@ int sched_block(void);
 /* Unblock a thread */
 int sched_unblock(uint64_t thread_id);
 
+/* Block the current thread while a flag is set (a waker clears the flag,
+ * then unblocks it) */
+void sched_block_while(volatile uint32_t *flag);
+
+/* Block the current thread while a flag is set and run a blocked thread
+ * in its place on this CPU without going through the run queues. The
+ * thread gets the rest of the current slice and, if lend is set, the
+ * current priority where higher than its own. Returns -1, changing
+ * nothing, if the thread cannot run here now. */
+int sched_handoff(tcb_t *next, volatile uint32_t *flag, int lend);
+
+/* Run the current thread at a lent priority (its own where higher) */
+void sched_lend_priority(thread_priority_t priority);
+
+/* Raise a thread's priority to at least a given one (priority
+ * inheritance); returns 1 if it was raised */
+int sched_boost(tcb_t *tcb, thread_priority_t priority);
+
 /* Get current thread */
 tcb_t* sched_get_current(void);
 
@@ -88,6 +249,12 @@ void sched_schedule(void);
 /* Timer interrupt handler */
 void sched_timer_interrupt(void);
 
+/* Finish a switch into a new thread (called from context.S) */
+void sched_thread_start(void);
+
+/* Terminate the current thread (called when its entry point returns) */
+void sched_thread_exit(void) __attribute__((noreturn));
+
 /* Idle thread */
 void sched_idle_thread(void *arg);
 
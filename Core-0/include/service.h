@@ -10,9 +10,16 @@
 
 #include "stdint.h"
 #include "../include/capability.h"
+#include "slab.h"
 
-/* Maximum number of services */
-#define MAX_SERVICES 64
+/* CPU time a service's domain may use per period, set when it is created
+ * (build-time configuration: a zero quota leaves services unlimited) */
+#ifndef SERVICE_CPU_QUOTA_NS
+#define SERVICE_CPU_QUOTA_NS  50000000ULL    /* 50ms */
+#endif
+#ifndef SERVICE_CPU_PERIOD_NS
+#define SERVICE_CPU_PERIOD_NS 100000000ULL   /* 100ms */
+#endif
 
 /* Service state */
 typedef enum {
@@ -45,9 +52,8 @@ typedef struct {
 
 /* Service manager state */
 typedef struct {
-    service_t services[MAX_SERVICES];  /* Service table */
+    kmem_table_t services;              /* Service table (indexed by service ID) */
     uint32_t num_services;              /* Number of services */
-    uint64_t next_service_id;           /* Next service ID */
     uint64_t lock;                      /* Spinlock */
 } service_manager_t;
 
@@ -91,6 +97,12 @@ typedef struct {
     int (*service_start)(uint64_t service_id);
     int (*service_stop)(uint64_t service_id);
     int (*service_restart)(uint64_t service_id);
+    
+    /* Time */
+    uint64_t (*time_ns)(void);
+    
+    /* CPU time used by a domain */
+    int (*cpu_usage)(uint64_t domain_id, domain_cpu_usage_t *usage);
 } core0_api_t;
 
 /* Initialize service manager */
@@ -113,6 +125,12 @@ int service_restart(uint64_t service_id);
 /* Terminate a service */
 int service_terminate(uint64_t service_id);
 
+/* Limit a service's CPU time per period (a zero quota removes the limit) */
+int service_set_quota(uint64_t service_id, uint64_t quota_ns, uint64_t period_ns);
+
+/* Call an IPC endpoint through a capability of the caller's domain */
+int service_ipc_call(cap_handle_t endpoint, void *request, void *response);
+
 /* Get service by ID */
 service_t* service_get(uint64_t service_id);
 
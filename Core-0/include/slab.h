@@ -0,0 +1,103 @@
+/*
+ * HIK Core-0 Slab Allocator
+ * 
+ * This file defines object caches for fixed-size Core-0 kernel objects
+ * (threads, capabilities, domains, services, processes). Objects are carved
+ * from slabs taken from the buddy allocator and handed out through per-CPU
+ * free lists, so allocation and free are O(1) and tables grow with load.
+ * 
+ * ID tables may be read without their owner's lock. Memory such a reader
+ * may still hold (a replaced slot array, a deleted object) is freed with
+ * kmem_defer_free, once every online CPU has passed a quiescent point
+ * (kmem_quiesce, at each scheduler pass).
+ */
+
+#ifndef HIK_CORE0_SLAB_H
+#define HIK_CORE0_SLAB_H
+
+#include "stdint.h"
+#include "cpu.h"
+
+/* Cache parameters */
+#define KMEM_CPU_CACHE_SIZE 16     /* Objects per per-CPU free list */
+#define KMEM_MIN_OBJECTS 8         /* Minimum objects per slab */
+#define KMEM_MAX_EMPTY_SLABS 1     /* Empty slabs kept before returning memory */
+#define KMEM_NAME_LEN 32
+
+/* Initial ID table capacity (one page of slots) */
+#define KMEM_TABLE_MIN_SLOTS 512
+
+/* Slab (header at the start of each slab block, defined in slab.c) */
+typedef struct kmem_slab kmem_slab_t;
+
+/* Per-CPU free list */
+typedef struct {
+    uint32_t count;                          /* Cached objects */
+    uint32_t reserved;                       /* Reserved for future use */
+    void *objects[KMEM_CPU_CACHE_SIZE];      /* Cached object pointers */
+} __attribute__((aligned(CACHE_LINE_SIZE))) kmem_cpu_cache_t;
+
+/* Object cache */
+typedef struct {
+    char name[KMEM_NAME_LEN];                /* Cache name */
+    uint64_t object_size;                    /* Object size (rounded to align) */
+    uint64_t align;                          /* Object alignment */
+    uint32_t slab_order;                     /* Buddy order of each slab */
+    uint32_t objects_per_slab;               /* Objects per slab */
+    uint32_t colour_count;                   /* Number of colour offsets */
+    uint32_t colour_next;                    /* Colour of the next new slab */
+    void (*ctor)(void *obj);                 /* Constructor (run once per object) */
+    kmem_slab_t *partial;                    /* Slabs with free and used objects */
+    kmem_slab_t *full;                       /* Slabs with no free objects */
+    kmem_slab_t *empty;                      /* Slabs with no used objects */
+    uint64_t num_slabs;                      /* Slabs owned by the cache */
+    uint64_t num_empty;                      /* Slabs on the empty list */
+    uint64_t active_objects;                 /* Objects outside the slabs */
+    uint64_t lock;                           /* Spinlock (slab lists) */
+    kmem_cpu_cache_t cpu[MAX_CPUS];          /* Per-CPU free lists */
+} kmem_cache_t;
+
+/* Growable ID -> object table (IDs from 1; removed IDs are reused) */
+typedef struct {
+    void **slots;                            /* Object pointers (NULL = never used,
+                                                odd = free ID link) */
+    uint64_t capacity;                       /* Number of slots */
+    uint64_t end;                            /* One past the highest ID handed out */
+    uint64_t free_id;                        /* Most recently removed ID (0 = none) */
+} kmem_table_t;
+
+/* Initialize an object cache */
+int kmem_cache_init(kmem_cache_t *cache, const char *name, uint64_t size,
+                    uint64_t align, void (*ctor)(void *obj));
+
+/* Allocate an object (constructed state, contents otherwise undefined) */
+void* kmem_cache_alloc(kmem_cache_t *cache);
+
+/* Free an object (must be returned in its constructed state) */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/* Flush the current CPU's free list and release empty slabs */
+uint64_t kmem_cache_shrink(kmem_cache_t *cache);
+
+/* Free an object of a cache (or a mm_alloc block if cache is NULL) once
+ * no unlocked lookup can still hold it */
+void kmem_defer_free(kmem_cache_t *cache, void *obj);
+
+/* Note that the calling CPU holds nothing found by an unlocked lookup,
+ * and free what has waited long enough */
+void kmem_quiesce(void);
+
+/* Store an object under a free ID, growing the table if needed; returns
+ * the ID (0 if out of memory). Insert and remove need the owner's lock. */
+uint64_t kmem_table_insert(kmem_table_t *table, void *obj);
+
+/* Remove the object at an ID and make the ID free for reuse */
+void kmem_table_remove(kmem_table_t *table, uint64_t index);
+
+/* Look up an object by ID (NULL if free) */
+void* kmem_table_get(const kmem_table_t *table, uint64_t index);
+
+/* Get one past the highest ID in use so far (bound for a scan) */
+uint64_t kmem_table_end(const kmem_table_t *table);
+
+#endif /* HIK_CORE0_SLAB_H */
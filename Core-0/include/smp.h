@@ -0,0 +1,55 @@
+/*
+ * HIK Core-0 Multiprocessor Bring-Up
+ * 
+ * This file defines application processor startup. The boot CPU finds
+ * the other CPUs in the ACPI MADT and wakes each with INIT-SIPI-SIPI;
+ * they enter a real-mode trampoline copied below 1MB, switch to long
+ * mode on the boot CPU's page tables and continue in ap_main. Every CPU
+ * reaches its cpu_local_t through its GS base.
+ */
+
+#ifndef HIK_CORE0_SMP_H
+#define HIK_CORE0_SMP_H
+
+#include "stdint.h"
+#include "cpu.h"
+
+/* Physical address the trampoline is copied to (below 1MB, page aligned) */
+#define SMP_TRAMPOLINE_BASE 0x8000
+
+/* Time an application processor is given to come online */
+#define SMP_START_TIMEOUT_US 100000
+
+/* Model-specific register holding the GS base */
+#define MSR_GS_BASE 0xC0000101
+
+/* Multiprocessor state */
+typedef struct {
+    uint32_t num_cpus;                   /* CPUs online (boot CPU included) */
+    uint32_t num_found;                  /* Enabled CPUs listed in the MADT */
+    uint64_t lapic_base;                 /* Local APIC register base */
+    volatile uint32_t online[MAX_CPUS];  /* CPU index has finished startup */
+} smp_state_t;
+
+/* Set up the boot CPU's data area (first thing at boot) */
+void smp_init_boot_cpu(void);
+
+/* Start the application processors */
+int smp_init(void);
+
+/* Entry point of an application processor (from the trampoline) */
+void ap_main(uint32_t cpu) __attribute__((noreturn));
+
+/* Get the number of CPUs online */
+uint32_t smp_num_cpus(void);
+
+/* Get the number of enabled CPUs the firmware reported */
+uint32_t smp_num_found(void);
+
+/* Check whether a CPU index is online */
+int smp_cpu_online(uint32_t cpu);
+
+/* Get a CPU's data area */
+cpu_local_t* smp_cpu_local(uint32_t cpu);
+
+#endif /* HIK_CORE0_SMP_H */
\ No newline at end of file
@@ -0,0 +1,83 @@
+/*
+ * HIK Core-0 Timer Wheel
+ * 
+ * This file defines kernel timers. Each CPU keeps a hierarchical timing
+ * wheel: TIMER_LEVELS levels of TIMER_WHEEL_SIZE slots, each level
+ * TIMER_LEVEL_SHIFT bits coarser than the one below. A timer goes into
+ * the finest level whose range covers it, its deadline rounded up to that
+ * level's granularity, so adding and cancelling are O(1) and timers due
+ * close together (relative to how far away they are) share a slot and
+ * fire in one wakeup. Timers are never cascaded; the rounding bounds how
+ * late one fires to about 1/8 of its delay.
+ */
+
+#ifndef HIK_CORE0_TIMER_H
+#define HIK_CORE0_TIMER_H
+
+#include "stdint.h"
+#include "cpu.h"
+
+/* Timer tick rate (the wheel's clock: one tick per millisecond) */
+#define TIMER_HZ 1000
+
+/* Wheel geometry (a level's slots fit one 64-bit pending mask) */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_LEVEL_SHIFT 3
+#define TIMER_LEVELS 6
+
+/* Length of a tick */
+#define TIMER_NS_PER_TICK (1000000000ULL / TIMER_HZ)
+
+/* Kernel timer */
+typedef struct timer {
+    struct timer *next;          /* Slot list links (while pending) */
+    struct timer **pprev;
+    uint64_t expires;            /* Tick it fires at (rounded to its level) */
+    void (*fn)(void *arg);       /* Called on the wheel's CPU, no locks held */
+    void *arg;
+    uint32_t cpu;                /* Wheel it was added to */
+    uint32_t level;              /* Wheel level it is queued in */
+    uint32_t pending;            /* Queued and not yet fired or cancelled */
+} timer_t;
+
+/* Per-CPU timing wheel */
+typedef struct {
+    timer_t *slots[TIMER_LEVELS][TIMER_WHEEL_SIZE]; /* Pending timers per slot */
+    uint64_t pending[TIMER_LEVELS];  /* Bit s set: slots[level][s] non-empty */
+    uint64_t clk;                    /* Next tick to process */
+    uint32_t num_timers;             /* Pending timers */
+    timer_t *running;                /* Timer whose callback is running */
+    uint64_t lock;                   /* Spinlock */
+} __attribute__((aligned(CACHE_LINE_SIZE))) timer_wheel_t;
+
+/* Start the tick clock (the kernel clock must be calibrated) */
+int timer_init(void);
+
+/* Get the current tick */
+uint64_t timer_ticks(void);
+
+/* Get the TSC value at which a tick starts (0 unless the kernel clock
+ * reads the TSC) */
+uint64_t timer_tick_tsc(uint64_t tick);
+
+/* Convert milliseconds to ticks (rounded up) */
+uint64_t timer_ms_to_ticks(uint64_t milliseconds);
+
+/* Set up a timer */
+void timer_setup(timer_t *timer, void (*fn)(void *arg), void *arg);
+
+/* Queue a timer on the calling CPU's wheel to fire at a tick */
+int timer_add(timer_t *timer, uint64_t expires);
+
+/* Cancel a timer, waiting for its callback if it is running (0 if it was
+ * still pending; never call from the timer's own callback) */
+int timer_cancel(timer_t *timer);
+
+/* Fire the calling CPU's expired timers */
+void timer_poll(void);
+
+/* Get the tick of the calling CPU's next pending timer (UINT64_MAX if none) */
+uint64_t timer_next_expiry(void);
+
+#endif /* HIK_CORE0_TIMER_H */
\ No newline at end of file
@@ -0,0 +1,561 @@
+/*
+ * HIK Core-0 Synchronous IPC Implementation
+ * 
+ * The table lock covers the endpoint table and is held while an
+ * endpoint's lock is taken, so an endpoint cannot be deleted under a
+ * thread looking it up. An endpoint's lock covers its waiting server and
+ * caller queue and is released before the scheduler is entered.
+ * 
+ * A thread waiting in IPC blocks while its ipc_waiting flag is set.
+ * Whoever delivers its message copies it into the thread's buffer, clears
+ * the flag and then either hands it the CPU (sched_handoff) or unblocks
+ * it; a thread that has not blocked yet sees the flag clear and returns.
+ * 
+ * One server thread waits on an endpoint at a time. Callers that find none
+ * queue by priority and are taken by the server's next wait, which then
+ * runs at the caller's priority like a handoff would.
+ * 
+ * A thread in a call waits on the server handling it or, while queued, on
+ * the endpoint's owner (the server busy with an earlier call). Those links
+ * change under the chain lock, taken after an endpoint's lock and before
+ * the scheduler's, so a priority boost can follow them from endpoint to
+ * endpoint without taking any endpoint lock. An owner keeps the priority
+ * of the best queued caller until the queue is empty; a boost passed on
+ * through a chain lasts until its next reply.
+ * 
+ * A terminated thread leaves IPC when the scheduler frees it: a queued
+ * caller leaves the queue, one being served is forgotten by its server
+ * (whose reply then fails), and a server's call fails back to the caller
+ * with -2. A thread handed the CPU or woken by pointer after the endpoint
+ * is unlocked is pinned until then, and its memory kept until unpinned.
+ */
+
+#include "../include/ipc.h"
+#include "../include/string.h"
+#include "../include/stddef.h"
+
+/* Global IPC state */
+static ipc_state_t g_ipc_state;
+
+/* Endpoint object cache */
+static kmem_cache_t g_endpoint_cache;
+
+/* Spinlock operations */
+static inline void spin_lock(uint64_t *lock) {
+    while (__sync_lock_test_and_set(lock, 1)) {
+        /* Spin */
+    }
+}
+
+static inline void spin_unlock(uint64_t *lock) {
+    __sync_lock_release(lock);
+}
+
+/*
+ * Look up and lock an endpoint (interrupts off until unlocked)
+ */
+static ipc_endpoint_t* ipc_lock_endpoint(uint64_t endpoint_id, uint64_t *flags) {
+    *flags = cpu_irq_save();
+    spin_lock(&g_ipc_state.lock);
+    
+    ipc_endpoint_t *endpoint = kmem_table_get(&g_ipc_state.endpoints, endpoint_id);
+    if (endpoint != NULL) {
+        spin_lock(&endpoint->lock);
+    }
+    
+    spin_unlock(&g_ipc_state.lock);
+    if (endpoint == NULL) {
+        cpu_irq_restore(*flags);
+    }
+    
+    return endpoint;
+}
+
+static void ipc_unlock_endpoint(ipc_endpoint_t *endpoint, uint64_t flags) {
+    spin_unlock(&endpoint->lock);
+    cpu_irq_restore(flags);
+}
+
+/*
+ * Get the calling thread if it may block in IPC (not an idle thread)
+ */
+static tcb_t* ipc_current(void) {
+    tcb_t *current = sched_get_current();
+    if (current == NULL || (current->flags & THREAD_FLAG_IDLE)) {
+        return NULL;
+    }
+    return current;
+}
+
+/*
+ * Deliver a message to a thread waiting in IPC; it still has to be woken
+ */
+static void ipc_deliver(tcb_t *to, const ipc_msg_t *msg, tcb_t *partner) {
+    *(ipc_msg_t *)to->ipc_msg = *msg;
+    to->ipc_partner = partner;
+    __atomic_store_n(&to->ipc_waiting, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Fail a call whose server died: no reply, an error status (endpoint locked)
+ */
+static void ipc_abort(tcb_t *caller) {
+    caller->ipc_status = -2;
+    __atomic_store_n(&caller->ipc_waiting, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Register the calling server as waiting for a call (endpoint locked)
+ */
+static void ipc_wait_locked(ipc_endpoint_t *endpoint, tcb_t *current, ipc_msg_t *msg) {
+    current->ipc_msg = msg;
+    current->ipc_partner = NULL;
+    current->ipc_waiting = 1;
+    endpoint->server = current;
+    
+    spin_lock(&g_ipc_state.chain_lock);
+    current->ipc_serves = endpoint;
+    if (endpoint->owner == current) {
+        endpoint->owner = NULL;
+    }
+    spin_unlock(&g_ipc_state.chain_lock);
+}
+
+/*
+ * Queue a caller behind those of its priority or higher (endpoint locked)
+ */
+static void ipc_queue_caller(ipc_endpoint_t *endpoint, tcb_t *caller) {
+    tcb_t **link = &endpoint->callers;
+    while (*link != NULL && (*link)->priority >= caller->priority) {
+        link = &(*link)->ipc_next;
+    }
+    caller->ipc_next = *link;
+    *link = caller;
+}
+
+/*
+ * Make a server thread the one handling a call (endpoint locked)
+ */
+static void ipc_take_call(ipc_endpoint_t *endpoint, tcb_t *server, tcb_t *caller) {
+    endpoint->serving++;
+    
+    spin_lock(&g_ipc_state.chain_lock);
+    caller->ipc_server = server;
+    server->ipc_serves = endpoint;
+    endpoint->owner = server;
+    spin_unlock(&g_ipc_state.chain_lock);
+}
+
+/*
+ * Unlink a replied-to caller (NULL if it died meanwhile) from its server
+ * (endpoint locked); returns the priority the server keeps for the callers
+ * still queued
+ */
+static thread_priority_t ipc_finish_call(ipc_endpoint_t *endpoint, tcb_t *server, tcb_t *caller) {
+    endpoint->serving--;
+    server->ipc_partner = NULL;
+    
+    spin_lock(&g_ipc_state.chain_lock);
+    if (caller != NULL) {
+        caller->ipc_endpoint = NULL;
+        caller->ipc_server = NULL;
+    }
+    server->ipc_serves = NULL;
+    if (endpoint->callers == NULL && endpoint->owner == server) {
+        endpoint->owner = NULL;
+    }
+    spin_unlock(&g_ipc_state.chain_lock);
+    
+    return endpoint->callers != NULL ? endpoint->callers->priority : THREAD_PRIORITY_IDLE;
+}
+
+/*
+ * Get the thread a thread in a call waits on (chain lock held)
+ */
+static tcb_t* ipc_waits_on(tcb_t *tcb) {
+    if (tcb->ipc_endpoint == NULL) {
+        return NULL;  /* Not in a call */
+    }
+    return tcb->ipc_server != NULL ? tcb->ipc_server : tcb->ipc_endpoint->owner;
+}
+
+/*
+ * Pass a waiting thread's priority along the chain of threads it waits
+ * on. The walk stops at a thread already running as high (the rest of
+ * the chain was boosted when that one started waiting) and after
+ * IPC_BOOST_DEPTH threads, which also ends a cycle of calls.
+ */
+static void ipc_boost_chain(tcb_t *waiter) {
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&g_ipc_state.chain_lock);
+    
+    thread_priority_t priority = waiter->priority;
+    tcb_t *tcb = ipc_waits_on(waiter);
+    for (uint32_t depth = 0; tcb != NULL && depth < IPC_BOOST_DEPTH; depth++) {
+        if (!sched_boost(tcb, priority)) {
+            break;
+        }
+        tcb = ipc_waits_on(tcb);
+    }
+    
+    spin_unlock(&g_ipc_state.chain_lock);
+    cpu_irq_restore(flags);
+}
+
+/*
+ * Initialize IPC
+ */
+int ipc_init(void) {
+    memset(&g_ipc_state, 0, sizeof(ipc_state_t));
+    
+    if (kmem_cache_init(&g_endpoint_cache, "ipc_endpoint", sizeof(ipc_endpoint_t),
+                        CACHE_LINE_SIZE, NULL) != 0) {
+        return -1;
+    }
+    
+    g_ipc_state.lock = 0;
+    
+    return 0;
+}
+
+/*
+ * Create an endpoint
+ */
+uint64_t ipc_endpoint_create(uint64_t domain_id) {
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&g_ipc_state.lock);
+    
+    ipc_endpoint_t *endpoint = kmem_cache_alloc(&g_endpoint_cache);
+    if (endpoint == NULL) {
+        spin_unlock(&g_ipc_state.lock);
+        cpu_irq_restore(flags);
+        return 0;  /* Out of memory */
+    }
+    
+    uint64_t endpoint_id = kmem_table_insert(&g_ipc_state.endpoints, endpoint);
+    if (endpoint_id == 0) {
+        kmem_cache_free(&g_endpoint_cache, endpoint);
+        spin_unlock(&g_ipc_state.lock);
+        cpu_irq_restore(flags);
+        return 0;
+    }
+    
+    endpoint->endpoint_id = endpoint_id;
+    endpoint->domain_id = domain_id;
+    endpoint->server = NULL;
+    endpoint->owner = NULL;
+    endpoint->callers = NULL;
+    endpoint->serving = 0;
+    endpoint->calls = 0;
+    endpoint->lock = 0;
+    
+    spin_unlock(&g_ipc_state.lock);
+    cpu_irq_restore(flags);
+    
+    return endpoint_id;
+}
+
+/*
+ * Delete an endpoint
+ */
+int ipc_endpoint_delete(uint64_t endpoint_id) {
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&g_ipc_state.lock);
+    
+    ipc_endpoint_t *endpoint = kmem_table_get(&g_ipc_state.endpoints, endpoint_id);
+    if (endpoint == NULL) {
+        spin_unlock(&g_ipc_state.lock);
+        cpu_irq_restore(flags);
+        return -1;  /* Endpoint not found */
+    }
+    
+    spin_lock(&endpoint->lock);
+    int busy = endpoint->server != NULL || endpoint->callers != NULL || endpoint->serving != 0;
+    spin_unlock(&endpoint->lock);
+    if (busy) {
+        spin_unlock(&g_ipc_state.lock);
+        cpu_irq_restore(flags);
+        return -2;  /* Threads still waiting on it or calls in progress */
+    }
+    
+    kmem_table_remove(&g_ipc_state.endpoints, endpoint_id);
+    kmem_cache_free(&g_endpoint_cache, endpoint);
+    
+    spin_unlock(&g_ipc_state.lock);
+    cpu_irq_restore(flags);
+    
+    return 0;
+}
+
+/*
+ * Call an endpoint. A waiting server is handed the CPU (or, where it
+ * cannot run here, woken); otherwise the caller queues for the next one
+ * and lends its priority to the server busy meanwhile.
+ */
+int ipc_call(uint64_t endpoint_id, ipc_msg_t *msg) {
+    tcb_t *current = ipc_current();
+    if (current == NULL || msg == NULL) {
+        return -1;
+    }
+    
+    uint64_t flags;
+    ipc_endpoint_t *endpoint = ipc_lock_endpoint(endpoint_id, &flags);
+    if (endpoint == NULL) {
+        return -1;  /* Endpoint not found */
+    }
+    
+    current->ipc_msg = msg;
+    current->ipc_status = 0;
+    current->ipc_waiting = 1;
+    endpoint->calls++;
+    
+    spin_lock(&g_ipc_state.chain_lock);
+    current->ipc_endpoint = endpoint;
+    current->ipc_server = NULL;
+    spin_unlock(&g_ipc_state.chain_lock);
+    
+    tcb_t *server = endpoint->server;
+    if (server == NULL) {
+        ipc_queue_caller(endpoint, current);
+        ipc_boost_chain(current);
+        ipc_unlock_endpoint(endpoint, flags);
+        
+        sched_block_while(&current->ipc_waiting);
+        return current->ipc_status;
+    }
+    endpoint->server = NULL;
+    ipc_take_call(endpoint, server, current);
+    ipc_deliver(server, msg, current);
+    __atomic_add_fetch(&server->ipc_pins, 1, __ATOMIC_RELAXED);
+    ipc_unlock_endpoint(endpoint, flags);
+    
+    if (sched_handoff(server, &current->ipc_waiting, 1) != 0) {
+        /* Queued to run later or elsewhere: at the caller's priority */
+        ipc_boost_chain(current);
+        sched_unblock(server->thread_id);
+    }
+    __atomic_sub_fetch(&server->ipc_pins, 1, __ATOMIC_RELEASE);
+    
+    /* Returns at once after a reply handed the CPU back */
+    sched_block_while(&current->ipc_waiting);
+    return current->ipc_status;
+}
+
+/*
+ * Wait for the next call on an endpoint
+ */
+int ipc_wait(uint64_t endpoint_id, ipc_msg_t *msg) {
+    tcb_t *current = ipc_current();
+    if (current == NULL || msg == NULL) {
+        return -1;
+    }
+    
+    uint64_t flags;
+    ipc_endpoint_t *endpoint = ipc_lock_endpoint(endpoint_id, &flags);
+    if (endpoint == NULL) {
+        return -1;  /* Endpoint not found */
+    }
+    if (current->domain_id != endpoint->domain_id) {
+        ipc_unlock_endpoint(endpoint, flags);
+        return -1;  /* Not one of its server threads */
+    }
+    
+    /* A queued caller is served at once (read while it cannot go away) */
+    tcb_t *caller = endpoint->callers;
+    if (caller != NULL) {
+        endpoint->callers = caller->ipc_next;
+        caller->ipc_next = NULL;
+        ipc_take_call(endpoint, current, caller);
+        *msg = *(const ipc_msg_t *)caller->ipc_msg;
+        current->ipc_partner = caller;
+        thread_priority_t priority = caller->priority;
+        ipc_unlock_endpoint(endpoint, flags);
+        
+        sched_lend_priority(priority);
+        return 0;
+    }
+    
+    if (endpoint->server != NULL) {
+        ipc_unlock_endpoint(endpoint, flags);
+        return -2;  /* Another server thread is waiting */
+    }
+    ipc_wait_locked(endpoint, current, msg);
+    ipc_unlock_endpoint(endpoint, flags);
+    
+    /* The caller's handoff or boost has already raised this thread */
+    sched_block_while(&current->ipc_waiting);
+    return 0;
+}
+
+/*
+ * Reply to the call being served, back at the server's own priority (or
+ * that of the best caller still queued)
+ */
+int ipc_reply(const ipc_msg_t *reply) {
+    tcb_t *current = ipc_current();
+    if (current == NULL || reply == NULL || current->ipc_serves == NULL) {
+        return -1;
+    }
+    
+    /* A call in progress keeps its endpoint from being deleted, even once
+     * its caller has died */
+    ipc_endpoint_t *endpoint = current->ipc_serves;
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&endpoint->lock);
+    tcb_t *caller = current->ipc_partner;
+    thread_priority_t priority = ipc_finish_call(endpoint, current, caller);
+    uint64_t caller_id = 0;
+    if (caller != NULL) {
+        ipc_deliver(caller, reply, NULL);
+        caller_id = caller->thread_id;
+    }
+    ipc_unlock_endpoint(endpoint, flags);
+    
+    sched_lend_priority(priority);
+    if (caller == NULL) {
+        return -2;  /* Caller terminated during the call */
+    }
+    sched_unblock(caller_id);
+    
+    return 0;
+}
+
+/*
+ * Reply to the call being served and wait for the next one. With no other
+ * caller queued the CPU goes straight back to the caller; otherwise the
+ * caller is woken and the next one served (as is a call taken on another
+ * endpoint).
+ */
+int ipc_reply_wait(uint64_t endpoint_id, const ipc_msg_t *reply, ipc_msg_t *msg) {
+    tcb_t *current = ipc_current();
+    if (current == NULL || reply == NULL || msg == NULL || current->ipc_serves == NULL) {
+        return -1;
+    }
+    
+    uint64_t flags;
+    ipc_endpoint_t *endpoint = ipc_lock_endpoint(endpoint_id, &flags);
+    if (endpoint == NULL) {
+        return -1;  /* Endpoint not found */
+    }
+    if (current->domain_id != endpoint->domain_id) {
+        ipc_unlock_endpoint(endpoint, flags);
+        return -1;  /* Not one of its server threads */
+    }
+    tcb_t *caller = current->ipc_partner;
+    if (endpoint->callers != NULL || endpoint->server != NULL ||
+        current->ipc_serves != endpoint || caller == NULL) {
+        ipc_unlock_endpoint(endpoint, flags);
+        if (ipc_reply(reply) == -1) {
+            return -1;
+        }
+        return ipc_wait(endpoint_id, msg);
+    }
+    ipc_finish_call(endpoint, current, caller);
+    ipc_deliver(caller, reply, NULL);
+    __atomic_add_fetch(&caller->ipc_pins, 1, __ATOMIC_RELAXED);
+    ipc_wait_locked(endpoint, current, msg);
+    ipc_unlock_endpoint(endpoint, flags);
+    
+    sched_lend_priority(THREAD_PRIORITY_IDLE);
+    
+    if (sched_handoff(caller, &current->ipc_waiting, 0) != 0) {
+        sched_unblock(caller->thread_id);
+    }
+    __atomic_sub_fetch(&caller->ipc_pins, 1, __ATOMIC_RELEASE);
+    
+    /* The next caller's handoff or boost has already raised this thread */
+    sched_block_while(&current->ipc_waiting);
+    return 0;
+}
+
+/*
+ * Lock the endpoint a link of a dead thread points to, if any. The table
+ * lock keeps a linked endpoint from being deleted until it is locked; the
+ * link is checked again under its lock.
+ */
+static ipc_endpoint_t* ipc_lock_linked(ipc_endpoint_t **link, uint64_t *flags) {
+    for (;;) {
+        *flags = cpu_irq_save();
+        spin_lock(&g_ipc_state.lock);
+        
+        spin_lock(&g_ipc_state.chain_lock);
+        ipc_endpoint_t *endpoint = *link;
+        spin_unlock(&g_ipc_state.chain_lock);
+        if (endpoint != NULL) {
+            spin_lock(&endpoint->lock);
+        }
+        
+        spin_unlock(&g_ipc_state.lock);
+        if (endpoint == NULL) {
+            cpu_irq_restore(*flags);
+            return NULL;
+        }
+        if (*link == endpoint) {
+            return endpoint;
+        }
+        ipc_unlock_endpoint(endpoint, *flags);
+    }
+}
+
+/*
+ * Take a terminated thread out of IPC
+ */
+int ipc_thread_exit(tcb_t *tcb) {
+    uint64_t flags;
+    ipc_endpoint_t *endpoint;
+    
+    /* Its own call: leave the queue, or leave the server to a failed reply */
+    while ((endpoint = ipc_lock_linked(&tcb->ipc_endpoint, &flags)) != NULL) {
+        if (tcb->ipc_server == NULL) {
+            tcb_t **link = &endpoint->callers;
+            while (*link != NULL && *link != tcb) {
+                link = &(*link)->ipc_next;
+            }
+            if (*link == tcb) {
+                *link = tcb->ipc_next;
+            }
+            tcb->ipc_next = NULL;
+        } else if (tcb->ipc_server->ipc_partner == tcb) {
+            tcb->ipc_server->ipc_partner = NULL;
+        }
+        
+        spin_lock(&g_ipc_state.chain_lock);
+        tcb->ipc_endpoint = NULL;
+        tcb->ipc_server = NULL;
+        spin_unlock(&g_ipc_state.chain_lock);
+        ipc_unlock_endpoint(endpoint, flags);
+    }
+    
+    /* Its endpoint: stop waiting, or fail the call it was serving */
+    while ((endpoint = ipc_lock_linked(&tcb->ipc_serves, &flags)) != NULL) {
+        uint64_t caller_id = 0;
+        
+        if (endpoint->server == tcb) {
+            endpoint->server = NULL;
+            spin_lock(&g_ipc_state.chain_lock);
+            tcb->ipc_serves = NULL;
+            spin_unlock(&g_ipc_state.chain_lock);
+        } else {
+            tcb_t *caller = tcb->ipc_partner;
+            ipc_finish_call(endpoint, tcb, caller);
+            if (caller != NULL) {
+                ipc_abort(caller);
+                caller_id = caller->thread_id;
+            }
+        }
+        
+        /* Callers still queued wait for another server */
+        spin_lock(&g_ipc_state.chain_lock);
+        if (endpoint->owner == tcb) {
+            endpoint->owner = NULL;
+        }
+        spin_unlock(&g_ipc_state.chain_lock);
+        ipc_unlock_endpoint(endpoint, flags);
+        
+        if (caller_id != 0) {
+            sched_unblock(caller_id);
+        }
+    }
+    
+    return __atomic_load_n(&tcb->ipc_pins, __ATOMIC_ACQUIRE) != 0 ? -1 : 0;
+}
\ No newline at end of file
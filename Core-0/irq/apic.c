@@ -0,0 +1,273 @@
+/*
+ * HIK Core-0 Local APIC Implementation
+ * 
+ * Delays are measured with PIT channel 2, which counts at a fixed
+ * frequency and needs no interrupt: the boot CPU uses it once to
+ * calibrate the APIC timer, and bring-up uses it for the INIT/STARTUP
+ * waits. Timers are programmed masked: Core-0 has no interrupt
+ * descriptor table yet, so the count runs but raises nothing until the
+ * routing table installs a handler for the vector.
+ * 
+ * Besides the periodic tick, the timer can be armed for a single expiry,
+ * in TSC-deadline mode where the CPU has it (an absolute deadline, no
+ * conversion to APIC counts) or as a one-shot count otherwise.
+ */
+
+#include "../include/apic.h"
+#include "../include/stddef.h"
+
+/* Register offsets */
+#define APIC_REG_ID        0x020
+#define APIC_REG_TPR       0x080
+#define APIC_REG_SVR       0x0F0
+#define APIC_REG_ICR_LOW   0x300
+#define APIC_REG_ICR_HIGH  0x310
+#define APIC_REG_LVT_TIMER 0x320
+#define APIC_REG_TIMER_INIT 0x380
+#define APIC_REG_TIMER_CUR 0x390
+#define APIC_REG_TIMER_DIV 0x3E0
+
+/* Register bits */
+#define APIC_SVR_ENABLE      0x100
+#define APIC_ICR_INIT        0x500
+#define APIC_ICR_STARTUP     0x600
+#define APIC_ICR_ASSERT      0x4000
+#define APIC_ICR_PENDING     0x1000
+#define APIC_LVT_MASKED      0x10000
+#define APIC_TIMER_ONESHOT   0x00000
+#define APIC_TIMER_PERIODIC  0x20000
+#define APIC_TIMER_TSC_DEADLINE 0x40000
+#define APIC_TIMER_DIV_16    0x3
+
+/* PIT channel 2 */
+#define PIT_FREQUENCY  1193182
+#define PIT_PORT_CH2   0x42
+#define PIT_PORT_CMD   0x43
+#define PIT_PORT_GATE  0x61
+#define PIT_MAX_DELAY  50000     /* Microseconds per count (fits 16 bits) */
+
+/* TSC-deadline register and its CPUID.01H:ECX bit */
+#define MSR_TSC_DEADLINE     0x6E0
+#define CPUID_TSC_DEADLINE   (1U << 24)
+
+/* Calibration interval */
+#define APIC_CALIBRATE_US 10000
+
+/* Register base and timer rate (shared by all CPUs) */
+static volatile uint8_t *g_apic_base = NULL;
+static uint64_t g_apic_ticks_per_ms = 0;
+static int g_apic_tsc_deadline = 0;
+
+/* Port I/O */
+static inline void outb(uint16_t port, uint8_t value) {
+    __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t value;
+    __asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+/* MSR access */
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value),
+                     "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+/* Register access */
+static inline uint32_t apic_read(uint32_t reg) {
+    return *(volatile uint32_t *)(g_apic_base + reg);
+}
+
+static inline void apic_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t *)(g_apic_base + reg) = value;
+}
+
+/*
+ * Busy-wait for a number of microseconds
+ */
+void apic_delay_us(uint64_t microseconds) {
+    while (microseconds > 0) {
+        uint64_t chunk = microseconds > PIT_MAX_DELAY ? PIT_MAX_DELAY : microseconds;
+        uint32_t count = (uint32_t)(chunk * PIT_FREQUENCY / 1000000);
+        if (count == 0) {
+            count = 1;
+        }
+        
+        /* Gate on, speaker off; mode 0 output rises when the count expires */
+        outb(PIT_PORT_GATE, (inb(PIT_PORT_GATE) & ~0x02) | 0x01);
+        outb(PIT_PORT_CMD, 0xB0);
+        outb(PIT_PORT_CH2, count & 0xFF);
+        outb(PIT_PORT_CH2, (count >> 8) & 0xFF);
+        
+        while ((inb(PIT_PORT_GATE) & 0x20) == 0) {
+            __asm__ volatile("pause");
+        }
+        
+        microseconds -= chunk;
+    }
+}
+
+/*
+ * Initialize the boot CPU's APIC and calibrate its timer
+ */
+int apic_init(uint64_t base) {
+    if (base == 0) {
+        return -1;
+    }
+    
+    g_apic_base = (volatile uint8_t *)base;
+    apic_init_cpu();
+    
+    /* Count down from the maximum over a fixed PIT interval */
+    apic_write(APIC_REG_TIMER_DIV, APIC_TIMER_DIV_16);
+    apic_write(APIC_REG_LVT_TIMER, APIC_LVT_MASKED);
+    apic_write(APIC_REG_TIMER_INIT, 0xFFFFFFFF);
+    apic_delay_us(APIC_CALIBRATE_US);
+    uint32_t elapsed = 0xFFFFFFFF - apic_read(APIC_REG_TIMER_CUR);
+    apic_write(APIC_REG_TIMER_INIT, 0);
+    
+    g_apic_ticks_per_ms = elapsed / (APIC_CALIBRATE_US / 1000);
+    
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    g_apic_tsc_deadline = (ecx & CPUID_TSC_DEADLINE) != 0;
+    
+    return g_apic_ticks_per_ms != 0 ? 0 : -1;
+}
+
+/*
+ * Enable the calling CPU's APIC
+ */
+void apic_init_cpu(void) {
+    apic_write(APIC_REG_TPR, 0);
+    apic_write(APIC_REG_SVR, APIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+/*
+ * Get the calling CPU's APIC ID
+ */
+uint32_t apic_id(void) {
+    return apic_read(APIC_REG_ID) >> 24;
+}
+
+/*
+ * Send an IPI and wait for the APIC to accept it
+ */
+static int apic_send_ipi(uint32_t apic_id, uint32_t command) {
+    if (g_apic_base == NULL || apic_id > 0xFF) {
+        return -1;  /* xAPIC destinations are 8 bits */
+    }
+    
+    apic_write(APIC_REG_ICR_HIGH, apic_id << 24);
+    apic_write(APIC_REG_ICR_LOW, command);
+    
+    for (uint32_t i = 0; i < 1000; i++) {
+        if ((apic_read(APIC_REG_ICR_LOW) & APIC_ICR_PENDING) == 0) {
+            return 0;
+        }
+        apic_delay_us(10);
+    }
+    
+    return -1;  /* Never delivered */
+}
+
+/*
+ * Send an INIT IPI
+ */
+int apic_send_init(uint32_t apic_id) {
+    return apic_send_ipi(apic_id, APIC_ICR_INIT | APIC_ICR_ASSERT);
+}
+
+/*
+ * Send a STARTUP IPI
+ */
+int apic_send_startup(uint32_t apic_id, uint32_t page) {
+    if (page > 0xFF) {
+        return -1;  /* Must start below 1MB */
+    }
+    return apic_send_ipi(apic_id, APIC_ICR_STARTUP | page);
+}
+
+/*
+ * Start the calling CPU's periodic timer
+ */
+int apic_timer_start(uint8_t vector, uint32_t hz) {
+    if (g_apic_ticks_per_ms == 0 || hz == 0) {
+        return -1;
+    }
+    
+    uint64_t count = g_apic_ticks_per_ms * 1000 / hz;
+    if (count == 0 || count > 0xFFFFFFFF) {
+        return -1;
+    }
+    
+    /* Masked until the vector has a handler (see above) */
+    apic_write(APIC_REG_TIMER_DIV, APIC_TIMER_DIV_16);
+    apic_write(APIC_REG_LVT_TIMER, APIC_LVT_MASKED | APIC_TIMER_PERIODIC | vector);
+    apic_write(APIC_REG_TIMER_INIT, (uint32_t)count);
+    
+    return 0;
+}
+
+/*
+ * Check whether the timer has TSC-deadline mode
+ */
+int apic_has_tsc_deadline(void) {
+    return g_apic_tsc_deadline;
+}
+
+/*
+ * Arm the calling CPU's timer to fire once after a delay
+ */
+int apic_timer_oneshot(uint8_t vector, uint64_t microseconds) {
+    if (g_apic_ticks_per_ms == 0) {
+        return -1;
+    }
+    
+    uint64_t count = microseconds * g_apic_ticks_per_ms / 1000;
+    if (count == 0) {
+        count = 1;
+    } else if (count > 0xFFFFFFFF) {
+        count = 0xFFFFFFFF;  /* Fires early; the scheduler re-arms */
+    }
+    
+    apic_write(APIC_REG_TIMER_DIV, APIC_TIMER_DIV_16);
+    apic_write(APIC_REG_LVT_TIMER, APIC_LVT_MASKED | APIC_TIMER_ONESHOT | vector);
+    apic_write(APIC_REG_TIMER_INIT, (uint32_t)count);
+    
+    return 0;
+}
+
+/*
+ * Arm the calling CPU's timer to fire once at a TSC value
+ */
+int apic_timer_deadline(uint8_t vector, uint64_t tsc) {
+    if (g_apic_base == NULL || !g_apic_tsc_deadline) {
+        return -1;
+    }
+    
+    /* The mode switch must be visible before the deadline is written */
+    apic_write(APIC_REG_LVT_TIMER, APIC_LVT_MASKED | APIC_TIMER_TSC_DEADLINE | vector);
+    __asm__ volatile("mfence" : : : "memory");
+    wrmsr(MSR_TSC_DEADLINE, tsc);
+    
+    return 0;
+}
+
+/*
+ * Stop the calling CPU's timer
+ */
+void apic_timer_stop(void) {
+    if (g_apic_base == NULL) {
+        return;
+    }
+    
+    if (g_apic_tsc_deadline &&
+        (apic_read(APIC_REG_LVT_TIMER) & APIC_TIMER_TSC_DEADLINE)) {
+        wrmsr(MSR_TSC_DEADLINE, 0);
+    }
+    apic_write(APIC_REG_LVT_TIMER, APIC_LVT_MASKED);
+    apic_write(APIC_REG_TIMER_INIT, 0);
+}
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include "../include/isolation.h"
 #include "../include/capability.h"
 #include "../include/mm.h"
+#include "../include/cpu.h"
 #include "../include/string.h"
 
 /* Maximum number of domains */
@@ -19,6 +20,52 @@ static domain_page_table_t g_domain_tables[MAX_DOMAINS];
 /* Global call gate table */
 static call_gate_table_t g_call_gate_table;
 
+/* Recycled page-table pages, per NUMA node (zeroed except the link word) */
+typedef struct {
+    page_table_t *head;           /* Free list linked through entries[0] */
+    uint32_t count;               /* Pages on the list */
+    uint32_t lock;                /* Spinlock */
+} pt_recycle_pool_t;
+
+static pt_recycle_pool_t g_pt_recycle[NUMA_MAX_NODES];
+
+/* Upper-half PML4 entries shared by every domain (Core-0 and device space) */
+static page_table_t *g_kernel_pml4;
+static uint32_t g_kernel_pml4_lock;
+
+/* CR4 page global enable and PCID enable */
+#define CR4_PGE   0x80
+#define CR4_PCIDE 0x20000
+
+/* PCID state: IDs are handed out in rounds; when a round runs out, every
+ * context is flushed and all domains take fresh IDs on their next switch */
+static int g_pcid_supported;          /* CR4.PCIDE is set */
+static int g_invpcid_supported;       /* INVPCID instruction available */
+static int g_pcid_enabled;            /* Tag switches with PCIDs */
+static uint64_t g_pcid_generation;    /* Current allocation round */
+static uint32_t g_pcid_next;          /* Next free PCID in this round */
+static uint32_t g_pcid_lock;
+
+/* Domain whose address space each CPU has loaded */
+static uint64_t g_active_domain[MAX_CPUS];
+
+/* Kernel-half and PCID-round invalidations published for other CPUs */
+static uint64_t g_tlb_generation;
+
+/* Pages above which a flush set falls back to a full flush */
+static uint32_t g_pt_flush_threshold = PT_FLUSH_MAX_PAGES;
+
+/* Per-CPU flush batch and counters (one cache-line aligned slot per CPU) */
+typedef struct {
+    pt_flush_set_t batch;         /* Flushes deferred by isolation_flush_begin */
+    uint32_t depth;               /* Nesting of open batches */
+    pt_flush_stats_t stats;       /* Invalidations issued on this CPU */
+    uint64_t global_seen;         /* g_tlb_generation applied here */
+    uint64_t seen[MAX_DOMAINS];   /* Each domain's tlb_generation applied here */
+} __attribute__((aligned(CACHE_LINE_SIZE))) pt_flush_cpu_t;
+
+static pt_flush_cpu_t g_flush_cpu[MAX_CPUS];
+
 /* Spinlock operations */
 static inline void spin_lock(uint32_t *lock) {
     while (__sync_lock_test_and_set(lock, 1)) {
@@ -30,12 +77,108 @@ static inline void spin_unlock(uint32_t *lock) {
     __sync_lock_release(lock);
 }
 
+/*
+ * Publish an invalidation this CPU has just applied locally. Other CPUs
+ * apply it when they next load the address space or pass the scheduler;
+ * this CPU is only up to date if it had seen every earlier one.
+ */
+static void tlb_publish(uint64_t *generation, uint64_t *seen) {
+    uint64_t old = __atomic_fetch_add(generation, 1, __ATOMIC_RELEASE);
+    if (*seen == old) {
+        *seen = old + 1;
+    }
+}
+
+/*
+ * Drop everything on this CPU if another CPU published a kernel-half or
+ * PCID-round invalidation since it last looked
+ */
+static void tlb_sync_global(pt_flush_cpu_t *cpu) {
+    uint64_t generation = __atomic_load_n(&g_tlb_generation, __ATOMIC_ACQUIRE);
+    
+    if (cpu->global_seen != generation) {
+        tlb_invalidate_global();
+        cpu->global_seen = generation;
+        cpu->stats.remote++;
+    }
+}
+
+/*
+ * Invalidate with INVPCID
+ */
+static inline void invpcid(uint64_t type, uint64_t pcid, uint64_t addr) {
+    struct {
+        uint64_t pcid;
+        uint64_t addr;
+    } desc = { pcid, addr };
+    
+    __asm__ volatile("invpcid %0, %1" : : "m"(desc), "r"(type) : "memory");
+}
+
+/*
+ * Give a domain a PCID from the current round if it lacks one (PCID lock held)
+ */
+static void pcid_assign(domain_page_table_t *domain) {
+    if (domain->pcid_generation == g_pcid_generation) {
+        return;
+    }
+    
+    if (g_pcid_next > PCID_MAX) {
+        /* Round exhausted: drop every context's entries and start over
+         * (other CPUs drop theirs before they load a PCID of the new round) */
+        g_pcid_generation++;
+        g_pcid_next = 1;
+        tlb_invalidate_global();
+        tlb_publish(&g_tlb_generation, &g_flush_cpu[cpu_current_id()].global_seen);
+    }
+    
+    /* IDs are not reused within a round, so a fresh PCID holds no entries */
+    domain->pcid = g_pcid_next++;
+    domain->pcid_generation = g_pcid_generation;
+}
+
+static page_table_t* pt_kernel_pdpt(uint64_t index);
+
 /*
  * Initialize isolation system
  */
 int isolation_init(void) {
     /* Initialize domain page tables */
     memset(g_domain_tables, 0, sizeof(g_domain_tables));
+    memset(g_pt_recycle, 0, sizeof(g_pt_recycle));
+    
+    /* Pre-build the kernel-half PDPTs every domain links to */
+    g_kernel_pml4 = pt_alloc_page_table();
+    if (g_kernel_pml4 == NULL) {
+        return -1;
+    }
+    g_kernel_pml4_lock = 0;
+    
+    static const uint64_t kernel_regions[] = {
+        KERNEL_BASE, KERNEL_DATA_BASE, DEVICE_BASE, KERNEL_CODE_BASE
+    };
+    for (uint32_t i = 0; i < sizeof(kernel_regions) / sizeof(kernel_regions[0]); i++) {
+        if (pt_kernel_pdpt(PML4_INDEX(kernel_regions[i])) == NULL) {
+            return -1;
+        }
+    }
+    
+    /* PCIDs (CPUID.1:ECX[17]) and INVPCID (CPUID.7.0:EBX[10]) */
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    g_pcid_supported = (ecx >> 17) & 1;
+    eax = 7;
+    ecx = 0;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    g_invpcid_supported = g_pcid_supported && ((ebx >> 10) & 1);
+    isolation_init_cpu();
+    
+    g_pcid_enabled = g_pcid_supported;
+    g_pcid_generation = 1;
+    g_pcid_next = 1;
+    g_pcid_lock = 0;
+    memset(g_active_domain, 0, sizeof(g_active_domain));
+    g_tlb_generation = 0;
     
     /* Initialize call gate table */
     memset(&g_call_gate_table, 0, sizeof(call_gate_table_t));
@@ -45,19 +188,513 @@ int isolation_init(void) {
     return 0;
 }
 
+/*
+ * Enable global pages and PCIDs on the calling CPU
+ */
+void isolation_init_cpu(void) {
+    /* Kernel-half leaves are global and survive CR3 switches; PCIDE may
+     * only be set while the current PCID is 0, as it is at startup */
+    uint64_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PGE;
+    if (g_pcid_supported) {
+        cr4 |= CR4_PCIDE;
+    }
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+/*
+ * Take a page table from a node's recycle pool (NULL if empty)
+ */
+static page_table_t* pt_recycle_get(uint32_t node) {
+    pt_recycle_pool_t *pool = &g_pt_recycle[node];
+    
+    spin_lock(&pool->lock);
+    page_table_t *pt = pool->head;
+    if (pt != NULL) {
+        pool->head = (page_table_t *)pt->entries[0];
+        pool->count--;
+    }
+    spin_unlock(&pool->lock);
+    
+    if (pt != NULL) {
+        pt->entries[0] = 0;
+    }
+    return pt;
+}
+
+/*
+ * Return a zeroed page table to its node's recycle pool (or the allocator
+ * once the pool is full)
+ */
+static void pt_recycle_put(page_table_t *pt) {
+    pt_recycle_pool_t *pool = &g_pt_recycle[numa_node_of_addr((uint64_t)pt)];
+    
+    spin_lock(&pool->lock);
+    if (pool->count < PT_RECYCLE_MAX) {
+        pt->entries[0] = (uint64_t)pool->head;
+        pool->head = pt;
+        pool->count++;
+        pt = NULL;
+    }
+    spin_unlock(&pool->lock);
+    
+    if (pt != NULL) {
+        mm_free_frame((uint64_t)pt, MM_MAG_ORDER_SMALL);
+    }
+}
+
+/*
+ * Allocate a zeroed page table on a node, recycled pages first
+ */
+static page_table_t* pt_alloc_on_node(uint32_t node) {
+    page_table_t *pt = pt_recycle_get(node);
+    if (pt != NULL) {
+        return pt;
+    }
+    
+    return (page_table_t *)mm_alloc_zeroed_node(node, PAGE_SIZE, PAGE_SIZE, MEM_TYPE_KERNEL, 0);
+}
+
 /*
  * Allocate a page table
  */
 page_table_t* pt_alloc_page_table(void) {
-    uint64_t phys_addr = mm_alloc(PAGE_SIZE, PAGE_SIZE, MEM_TYPE_KERNEL, 0);
-    if (phys_addr == 0) {
+    return pt_alloc_on_node(numa_current_node());
+}
+
+/*
+ * Allocate a page table on a domain's home node (walks stay node-local)
+ */
+static page_table_t* domain_alloc_page_table(domain_page_table_t *domain) {
+    return pt_alloc_on_node(domain->home_node);
+}
+
+/*
+ * Check for 1 GB page support (CPUID 0x80000001 EDX.Page1GB)
+ */
+static int pt_huge_pages_supported(void) {
+    static int supported = -1;
+    
+    if (supported < 0) {
+        uint32_t eax = 0x80000001, ebx, ecx = 0, edx;
+        __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+        supported = (edx >> 26) & 1;
+    }
+    
+    return supported;
+}
+
+/*
+ * Split a 1 GB or 2 MB leaf into a table of entries of child_size
+ */
+static page_table_t* pt_split_leaf(domain_page_table_t *domain, page_table_t *table,
+                                   uint64_t index, uint64_t child_size) {
+    uint64_t entry = table->entries[index];
+    page_table_t *child = domain_alloc_page_table(domain);
+    if (child == NULL) {
         return NULL;
     }
     
-    page_table_t *pt = (page_table_t *)phys_addr;
-    memset(pt, 0, sizeof(page_table_t));
+    /* Children keep the leaf's permissions; 4 KB entries have no PS bit */
+    uint64_t base = PTE_GET_ADDRESS(entry);
+    if (child_size == PAGE_SIZE) {
+        entry &= ~(uint64_t)PT_FLAG_PS;
+    }
+    for (uint64_t i = 0; i < 512; i++) {
+        child->entries[i] = PTE_SET_ADDRESS(entry, base + i * child_size);
+    }
     
-    return pt;
+    table->entries[index] = (uint64_t)child | PT_FLAG_PRESENT | PT_FLAG_WRITABLE | PT_FLAG_USER;
+    return child;
+}
+
+/*
+ * Get the next-level table under an entry, creating it or splitting a
+ * leaf (of entries of child_size) in the way
+ */
+static page_table_t* pt_get_or_create_table(domain_page_table_t *domain, page_table_t *table,
+                                            uint64_t index, uint64_t child_size) {
+    uint64_t entry = table->entries[index];
+    
+    if (!(entry & PT_FLAG_PRESENT)) {
+        page_table_t *child = domain_alloc_page_table(domain);
+        if (child != NULL) {
+            table->entries[index] = (uint64_t)child | PT_FLAG_PRESENT | PT_FLAG_WRITABLE | PT_FLAG_USER;
+        }
+        return child;
+    }
+    
+    if (PTE_IS_LEAF(entry)) {
+        return pt_split_leaf(domain, table, index, child_size);
+    }
+    
+    return (page_table_t *)PTE_GET_ADDRESS(entry);
+}
+
+/*
+ * Check whether a leaf of leaf_size can map [virt, virt + remaining) at phys
+ */
+static inline int pt_leaf_fits(uint64_t virt, uint64_t phys, uint64_t remaining, uint64_t leaf_size) {
+    return ((virt | phys) & (leaf_size - 1)) == 0 && remaining >= leaf_size;
+}
+
+/* Bytes covered by one entry at each level (PT, PD, PDPT, PML4) */
+static const uint64_t g_level_size[4] = {
+    PAGE_SIZE, PT_LARGE_PAGE_SIZE, PT_HUGE_PAGE_SIZE, 512 * PT_HUGE_PAGE_SIZE
+};
+
+/* Range operation in progress */
+typedef struct {
+    domain_page_table_t *domain;  /* Target domain */
+    pt_range_op_t op;             /* Map, unmap or protect */
+    uint64_t virt;                /* Range start */
+    uint64_t phys;                /* Physical address mapped at virt (map) */
+    uint64_t flags;               /* Leaf flags (map/protect) */
+    pt_flush_set_t *flush;        /* Translations to invalidate */
+} pt_range_t;
+
+/*
+ * Record a translation that must be invalidated
+ */
+static inline void pt_flush_add(pt_flush_set_t *flush, uint64_t vaddr) {
+    if (vaddr >= KERNEL_BASE) {
+        flush->global = 1;
+    }
+    if (flush->flush_all) {
+        return;
+    }
+    if (flush->count < g_pt_flush_threshold) {
+        flush->pages[flush->count++] = vaddr;
+    } else {
+        flush->flush_all = 1;
+    }
+}
+
+/*
+ * Check whether a level can hold leaf entries
+ */
+static inline int pt_level_has_leaves(uint32_t level) {
+    return level == 0 || level == 1 || (level == 2 && pt_huge_pages_supported());
+}
+
+/*
+ * Apply a range operation to [start, end) within one table, filling runs
+ * of entries and descending only where the range splits an entry
+ */
+static int pt_range_level(pt_range_t *r, page_table_t *table, uint32_t level,
+                          uint64_t start, uint64_t end) {
+    uint64_t size = g_level_size[level];
+    uint64_t shift = PAGE_SHIFT + 9 * level;
+    uint64_t addr = start;
+    
+    while (addr < end) {
+        uint64_t index = (addr >> shift) & 0x1FF;
+        uint64_t next = (addr | (size - 1)) + 1;
+        if (next > end || next == 0) {
+            next = end;
+        }
+        
+        uint64_t entry = table->entries[index];
+        int present = (entry & PT_FLAG_PRESENT) != 0;
+        int leaf = present && (level == 0 || PTE_IS_LEAF(entry));
+        int whole = (addr & (size - 1)) == 0 && next - addr == size;
+        uint64_t leaf_ps = (level > 0) ? PT_FLAG_PS : 0;
+        
+        if (r->op == PT_OP_MAP) {
+            uint64_t phys = r->phys + (addr - r->virt);
+            
+            /* Install a leaf unless that would orphan a lower-level table */
+            if (pt_level_has_leaves(level) && (!present || leaf) &&
+                pt_leaf_fits(addr, phys, next - addr, size)) {
+                table->entries[index] = phys | r->flags | leaf_ps;
+                if (present) {
+                    pt_flush_add(r->flush, addr);
+                }
+                addr = next;
+                continue;
+            }
+        } else if (!present) {
+            addr = next;  /* Nothing to unmap or protect */
+            continue;
+        } else if (leaf && whole) {
+            uint64_t updated = 0;
+            if (r->op == PT_OP_PROTECT) {
+                uint64_t kept = entry & (PT_FLAG_ACCESSED | PT_FLAG_DIRTY);
+                updated = PTE_SET_ADDRESS(r->flags | leaf_ps | kept, PTE_GET_ADDRESS(entry));
+            }
+            if (updated != entry) {
+                table->entries[index] = updated;
+                pt_flush_add(r->flush, addr);
+            }
+            addr = next;
+            continue;
+        }
+        
+        /* Descend, creating the table or splitting a leaf in the way; kernel-half
+         * PDPTs are shared and created once for all domains */
+        page_table_t *child;
+        if (level == 3 && index >= PML4_KERNEL_START && !present) {
+            child = pt_kernel_pdpt(index);
+        } else {
+            child = pt_get_or_create_table(r->domain, table, index, g_level_size[level - 1]);
+        }
+        if (child == NULL) {
+            return -1;
+        }
+        if (pt_range_level(r, child, level - 1, addr, next) != 0) {
+            return -1;
+        }
+        addr = next;
+    }
+    
+    return 0;
+}
+
+/*
+ * Run a range operation from the PML4
+ */
+static int pt_range_apply(pt_range_t *r, uint64_t size) {
+    uint64_t start = r->virt & ~(PAGE_SIZE - 1);
+    uint64_t end = (r->virt + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    
+    if (r->domain == NULL || r->domain->pml4 == NULL || r->flush == NULL) {
+        return -1;
+    }
+    if (end < start) {
+        return -1;  /* Wraps the address space */
+    }
+    
+    r->phys &= ~(PAGE_SIZE - 1);
+    r->virt = start;
+    r->flush->domain_id = r->domain->domain_id;
+    
+    /* Core-0 translations are the same in every address space */
+    if (r->op != PT_OP_UNMAP && start >= KERNEL_BASE) {
+        r->flags |= PT_FLAG_GLOBAL;
+    }
+    
+    spin_lock(&r->domain->lock);
+    memset(&r->domain->walk_cache, 0, sizeof(pt_walk_cache_t));
+    int result = pt_range_level(r, r->domain->pml4, 3, start, end);
+    spin_unlock(&r->domain->lock);
+    
+    return result;
+}
+
+/*
+ * Map [virt, virt + size) to phys with the given leaf flags
+ */
+int pt_map_range(domain_page_table_t *domain, uint64_t virt, uint64_t phys,
+                 uint64_t size, uint64_t flags, pt_flush_set_t *flush) {
+    pt_range_t r = { domain, PT_OP_MAP, virt, phys, flags | PT_FLAG_PRESENT, flush };
+    return pt_range_apply(&r, size);
+}
+
+/*
+ * Unmap [virt, virt + size)
+ */
+int pt_unmap_range(domain_page_table_t *domain, uint64_t virt, uint64_t size,
+                   pt_flush_set_t *flush) {
+    pt_range_t r = { domain, PT_OP_UNMAP, virt, 0, 0, flush };
+    return pt_range_apply(&r, size);
+}
+
+/*
+ * Change the leaf flags of the mapped pages in [virt, virt + size)
+ */
+int pt_protect_range(domain_page_table_t *domain, uint64_t virt, uint64_t size,
+                     uint64_t flags, pt_flush_set_t *flush) {
+    pt_range_t r = { domain, PT_OP_PROTECT, virt, 0, flags | PT_FLAG_PRESENT, flush };
+    return pt_range_apply(&r, size);
+}
+
+/*
+ * Invalidate the translations collected by range operations
+ */
+void pt_flush_commit(pt_flush_set_t *flush) {
+    if (flush->count == 0 && !flush->flush_all) {
+        return;
+    }
+    
+    domain_page_table_t *domain = (flush->domain_id < MAX_DOMAINS) ?
+                                  &g_domain_tables[flush->domain_id] : NULL;
+    /* Only a domain holding a live PCID can have entries cached while it
+     * is not loaded; everything else is flushed from the current context */
+    int tagged = g_pcid_supported && domain != NULL &&
+                 g_active_domain[cpu_current_id()] != flush->domain_id &&
+                 domain->pcid_generation == g_pcid_generation;
+    
+    pt_flush_stats_t *stats = &g_flush_cpu[cpu_current_id()].stats;
+    
+    if (flush->flush_all && flush->global) {
+        tlb_invalidate_global();
+        stats->full++;
+    } else if (tagged && !g_invpcid_supported) {
+        domain->pcid_generation = 0;  /* Fresh (empty) PCID on next switch */
+    } else if (tagged) {
+        if (flush->flush_all) {
+            invpcid(INVPCID_CONTEXT, domain->pcid, 0);
+            stats->full++;
+        } else {
+            for (uint32_t i = 0; i < flush->count; i++) {
+                invpcid(INVPCID_ADDRESS, domain->pcid, flush->pages[i]);
+            }
+            stats->pages += flush->count;
+        }
+    } else if (flush->flush_all) {
+        tlb_invalidate_all();  /* With PCIDs this only drops the current context */
+        stats->full++;
+    } else {
+        for (uint32_t i = 0; i < flush->count; i++) {
+            tlb_invalidate_page(flush->pages[i]);
+        }
+        stats->pages += flush->count;
+    }
+    
+    /* Global (kernel-half) entries are cached once for every PCID */
+    if (tagged && flush->global && !flush->flush_all) {
+        for (uint32_t i = 0; i < flush->count; i++) {
+            tlb_invalidate_page(flush->pages[i]);
+        }
+        stats->pages += flush->count;
+    }
+    
+    /* No shootdown IPI (Core-0 has no IDT): other CPUs find the bumped
+     * generation when they next load the domain or pass the scheduler */
+    pt_flush_cpu_t *self = &g_flush_cpu[cpu_current_id()];
+    if (flush->global) {
+        tlb_publish(&g_tlb_generation, &self->global_seen);
+    }
+    if (domain != NULL) {
+        tlb_publish(&domain->tlb_generation, &self->seen[flush->domain_id]);
+    }
+    
+    flush->count = 0;
+    flush->flush_all = 0;
+    flush->global = 0;
+}
+
+/*
+ * Set how many pages a flush set lists before falling back to a full flush
+ */
+void pt_set_flush_threshold(uint32_t pages) {
+    g_pt_flush_threshold = (pages < PT_FLUSH_MAX_PAGES) ? pages : PT_FLUSH_MAX_PAGES;
+}
+
+/*
+ * Get flush statistics, summed over all CPUs
+ */
+void pt_get_flush_stats(pt_flush_stats_t *stats) {
+    memset(stats, 0, sizeof(pt_flush_stats_t));
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        stats->pages += g_flush_cpu[cpu].stats.pages;
+        stats->full += g_flush_cpu[cpu].stats.full;
+        stats->deferred += g_flush_cpu[cpu].stats.deferred;
+        stats->remote += g_flush_cpu[cpu].stats.remote;
+    }
+}
+
+/*
+ * Get the flush set for an isolation call: this CPU's batch when one is
+ * open, else the caller's own set (flushed when the call finishes)
+ */
+static pt_flush_set_t* pt_flush_get(uint64_t domain_id, pt_flush_set_t *own) {
+    pt_flush_cpu_t *cpu = &g_flush_cpu[cpu_current_id()];
+    
+    if (cpu->depth == 0) {
+        return own;
+    }
+    
+    /* A batch covers one address space; flush it before switching */
+    if (cpu->batch.domain_id != domain_id) {
+        pt_flush_commit(&cpu->batch);
+    }
+    cpu->stats.deferred++;
+    return &cpu->batch;
+}
+
+/*
+ * Finish an isolation call's flush (no-op while a batch is open)
+ */
+static void pt_flush_put(pt_flush_set_t *flush, pt_flush_set_t *own) {
+    if (flush == own) {
+        pt_flush_commit(own);
+    }
+}
+
+/*
+ * Open a flush batch on this CPU
+ */
+void isolation_flush_begin(void) {
+    g_flush_cpu[cpu_current_id()].depth++;
+}
+
+/*
+ * Close a flush batch, issuing the deferred flushes at the outermost end
+ */
+void isolation_flush_end(void) {
+    pt_flush_cpu_t *cpu = &g_flush_cpu[cpu_current_id()];
+    
+    if (cpu->depth > 0 && --cpu->depth == 0) {
+        pt_flush_commit(&cpu->batch);
+    }
+}
+
+/*
+ * Leaf flags for a mapping type
+ */
+static uint64_t pt_flags_for_type(map_type_t map_type) {
+    uint64_t pt_flags = PT_FLAG_PRESENT;
+    
+    switch (map_type) {
+        case MAP_TYPE_CODE:
+            pt_flags |= PT_FLAG_USER;  /* User mode executable */
+            break;
+        case MAP_TYPE_DATA:
+            pt_flags |= PT_FLAG_WRITABLE | PT_FLAG_USER;
+            break;
+        case MAP_TYPE_READONLY:
+            pt_flags |= PT_FLAG_USER;
+            break;
+        case MAP_TYPE_DEVICE:
+            pt_flags |= PT_FLAG_WRITABLE | PT_FLAG_PCD | PT_FLAG_PWT;
+            break;
+        case MAP_TYPE_SHARED:
+            pt_flags |= PT_FLAG_WRITABLE | PT_FLAG_USER;
+            break;
+    }
+    
+    return pt_flags;
+}
+
+/*
+ * Get (creating if needed) the shared PDPT behind a kernel-half PML4
+ * entry. A new entry is linked into every existing domain as well.
+ */
+static page_table_t* pt_kernel_pdpt(uint64_t index) {
+    spin_lock(&g_kernel_pml4_lock);
+    
+    uint64_t entry = g_kernel_pml4->entries[index];
+    if (!(entry & PT_FLAG_PRESENT)) {
+        page_table_t *pdpt = pt_alloc_page_table();
+        if (pdpt == NULL) {
+            spin_unlock(&g_kernel_pml4_lock);
+            return NULL;
+        }
+        
+        entry = (uint64_t)pdpt | PT_FLAG_PRESENT | PT_FLAG_WRITABLE;
+        g_kernel_pml4->entries[index] = entry;
+        for (uint32_t i = 0; i < MAX_DOMAINS; i++) {
+            if (g_domain_tables[i].pml4 != NULL) {
+                g_domain_tables[i].pml4->entries[index] = entry;
+            }
+        }
+    }
+    
+    spin_unlock(&g_kernel_pml4_lock);
+    
+    return (page_table_t *)PTE_GET_ADDRESS(entry);
 }
 
 /*
@@ -65,10 +702,39 @@ page_table_t* pt_alloc_page_table(void) {
  */
 void pt_free_page_table(page_table_t *pt) {
     if (pt != NULL) {
-        mm_free((uint64_t)pt);
+        memset(pt, 0, sizeof(page_table_t));
+        pt_recycle_put(pt);
+    }
+}
+
+/*
+ * Free the tables below an entry of the given level, clearing entries as
+ * they are visited so every freed table goes back already zeroed. Leaves
+ * map domain memory and are only dropped, never freed.
+ */
+static void pt_free_subtree(page_table_t *table, uint32_t level) {
+    for (uint64_t i = 0; i < 512; i++) {
+        uint64_t entry = table->entries[i];
+        if (entry == 0) {
+            continue;
+        }
+        table->entries[i] = 0;
+        
+        if (level > 0 && (entry & PT_FLAG_PRESENT) && !PTE_IS_LEAF(entry)) {
+            page_table_t *child = (page_table_t *)PTE_GET_ADDRESS(entry);
+            pt_free_subtree(child, level - 1);
+            pt_recycle_put(child);
+        }
     }
 }
 
+/*
+ * Get the number of recycled page tables held for a node
+ */
+uint32_t pt_recycle_count(uint32_t node) {
+    return (node < NUMA_MAX_NODES) ? g_pt_recycle[node].count : 0;
+}
+
 /*
  * Clear a page table
  */
@@ -152,7 +818,7 @@ page_table_t* pt_walk_get_pd(page_table_t *pdpt, uint64_t vaddr) {
     uint64_t pdpt_idx = PDPT_INDEX(vaddr);
     uint64_t pdpt_entry = pdpt->entries[pdpt_idx];
     
-    if (!(pdpt_entry & PT_FLAG_PRESENT)) {
+    if (!(pdpt_entry & PT_FLAG_PRESENT) || PTE_IS_LEAF(pdpt_entry)) {
         return NULL;
     }
     
@@ -170,7 +836,7 @@ page_table_t* pt_walk_get_pt(page_table_t *pd, uint64_t vaddr) {
     uint64_t pd_idx = PD_INDEX(vaddr);
     uint64_t pd_entry = pd->entries[pd_idx];
     
-    if (!(pd_entry & PT_FLAG_PRESENT)) {
+    if (!(pd_entry & PT_FLAG_PRESENT) || PTE_IS_LEAF(pd_entry)) {
         return NULL;
     }
     
@@ -178,26 +844,126 @@ page_table_t* pt_walk_get_pt(page_table_t *pd, uint64_t vaddr) {
 }
 
 /*
- * Get page table entry for virtual address
+ * Get the leaf entry for vaddr below a PD, with the table holding it if
+ * that is a PT and the end of the 2 MB region the PD entry covers
  */
-uint64_t pt_walk_get_pte(page_table_t *pml4, uint64_t vaddr) {
+static uint64_t pt_walk_pd_leaf(page_table_t *pd, uint64_t vaddr, page_table_t **pt_out,
+                                uint64_t *span_end) {
+    uint64_t pd_entry = pd->entries[PD_INDEX(vaddr)];
+    
+    *span_end = (vaddr | (PT_LARGE_PAGE_SIZE - 1)) + 1;
+    
+    if (!(pd_entry & PT_FLAG_PRESENT)) {
+        return 0;
+    }
+    
+    if (PTE_IS_LEAF(pd_entry)) {
+        uint64_t offset = vaddr & (PT_LARGE_PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        return PTE_SET_ADDRESS(pd_entry & ~(uint64_t)PT_FLAG_PS, PTE_GET_ADDRESS(pd_entry) + offset);
+    }
+    
+    page_table_t *pt = (page_table_t *)PTE_GET_ADDRESS(pd_entry);
+    *pt_out = pt;
+    return pt->entries[PT_INDEX(vaddr)];
+}
+
+/*
+ * Walk to the leaf entry for vaddr (a 1 GB or 2 MB leaf is returned as the
+ * equivalent 4 KB entry), reporting the PD and PT passed through and the
+ * end of the region that leaf or PT covers
+ */
+static uint64_t pt_walk_leaf(page_table_t *pml4, uint64_t vaddr, page_table_t **pd_out,
+                             page_table_t **pt_out, uint64_t *span_end) {
+    *pd_out = NULL;
+    *pt_out = NULL;
+    *span_end = (vaddr | (PAGE_SIZE - 1)) + 1;
+    
     page_table_t *pdpt = pt_walk_get_pdpt(pml4, vaddr);
     if (pdpt == NULL) {
         return 0;
     }
     
+    uint64_t pdpt_entry = pdpt->entries[PDPT_INDEX(vaddr)];
+    if ((pdpt_entry & PT_FLAG_PRESENT) && PTE_IS_LEAF(pdpt_entry)) {
+        uint64_t offset = vaddr & (PT_HUGE_PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        *span_end = (vaddr | (PT_HUGE_PAGE_SIZE - 1)) + 1;
+        return PTE_SET_ADDRESS(pdpt_entry & ~(uint64_t)PT_FLAG_PS, PTE_GET_ADDRESS(pdpt_entry) + offset);
+    }
+    
     page_table_t *pd = pt_walk_get_pd(pdpt, vaddr);
     if (pd == NULL) {
         return 0;
     }
     
-    page_table_t *pt = pt_walk_get_pt(pd, vaddr);
-    if (pt == NULL) {
-        return 0;
+    *pd_out = pd;
+    return pt_walk_pd_leaf(pd, vaddr, pt_out, span_end);
+}
+
+/*
+ * Get page table entry for virtual address (a 1 GB or 2 MB leaf is
+ * returned as the equivalent 4 KB entry)
+ */
+uint64_t pt_walk_get_pte(page_table_t *pml4, uint64_t vaddr) {
+    page_table_t *pd;
+    page_table_t *pt;
+    uint64_t span_end;
+    
+    return pt_walk_leaf(pml4, vaddr, &pd, &pt, &span_end);
+}
+
+/*
+ * Look up vaddr through a domain's walk cache: the last PT, then the
+ * direct-mapped entry cache, then the last PD, then a full walk. The
+ * shared kernel half changes without the domain seeing it, so it is
+ * always walked. Called with the domain's lock held.
+ */
+static uint64_t pt_walk_cached(domain_page_table_t *domain, uint64_t vaddr,
+                               page_table_t **pt_out, uint64_t *span_end) {
+    pt_walk_cache_t *cache = &domain->walk_cache;
+    page_table_t *pd;
+    
+    if (vaddr >= KERNEL_BASE) {
+        return pt_walk_leaf(domain->pml4, vaddr, &pd, pt_out, span_end);
+    }
+    
+    uint64_t pt_base = vaddr & ~(PT_LARGE_PAGE_SIZE - 1);
+    if (cache->pt != NULL && cache->pt_base == pt_base) {
+        *pt_out = cache->pt;
+        *span_end = pt_base + PT_LARGE_PAGE_SIZE;
+        return cache->pt->entries[PT_INDEX(vaddr)];
+    }
+    
+    uint64_t page = vaddr >> PAGE_SHIFT;
+    uint32_t slot = page & (PT_WALK_CACHE_SIZE - 1);
+    if (cache->tags[slot] == page + 1) {
+        *pt_out = NULL;
+        *span_end = (page + 1) << PAGE_SHIFT;
+        return cache->ptes[slot];
     }
     
-    uint64_t pt_idx = PT_INDEX(vaddr);
-    return pt->entries[pt_idx];
+    uint64_t pte;
+    uint64_t pd_base = vaddr & ~(PT_HUGE_PAGE_SIZE - 1);
+    *pt_out = NULL;
+    if (cache->pd != NULL && cache->pd_base == pd_base) {
+        pte = pt_walk_pd_leaf(cache->pd, vaddr, pt_out, span_end);
+    } else {
+        pte = pt_walk_leaf(domain->pml4, vaddr, &pd, pt_out, span_end);
+        if (pd != NULL) {
+            cache->pd = pd;
+            cache->pd_base = pd_base;
+        }
+    }
+    
+    /* A PT is read live; anything else is remembered per page */
+    if (*pt_out != NULL) {
+        cache->pt = *pt_out;
+        cache->pt_base = pt_base;
+    } else {
+        cache->tags[slot] = page + 1;
+        cache->ptes[slot] = pte;
+    }
+    
+    return pte;
 }
 
 /*
@@ -208,17 +974,26 @@ int isolation_create_page_tables(uint64_t domain_id, uint32_t flags) {
         return -1;
     }
     
-    /* Allocate PML4 table */
-    page_table_t *pml4 = pt_alloc_page_table();
+    domain_page_table_t *domain = &g_domain_tables[domain_id];
+    
+    domain->home_node = mm_owner_node(domain_id);
+    
+    /* Allocate PML4 table and link the shared kernel half */
+    page_table_t *pml4 = domain_alloc_page_table(domain);
     if (pml4 == NULL) {
         return -1;
     }
     
+    spin_lock(&g_kernel_pml4_lock);
+    memcpy(&pml4->entries[PML4_KERNEL_START], &g_kernel_pml4->entries[PML4_KERNEL_START],
+           (512 - PML4_KERNEL_START) * sizeof(uint64_t));
+    domain->pml4 = pml4;
+    spin_unlock(&g_kernel_pml4_lock);
+    
     /* Initialize domain page table structure */
-    g_domain_tables[domain_id].pml4 = pml4;
-    g_domain_tables[domain_id].domain_id = domain_id;
-    g_domain_tables[domain_id].capabilities = 0;
-    g_domain_tables[domain_id].flags = flags;
+    domain->domain_id = domain_id;
+    domain->capabilities = 0;
+    domain->flags = flags;
     
     return 0;
 }
@@ -237,9 +1012,20 @@ int isolation_destroy_page_tables(uint64_t domain_id) {
         return -1;
     }
     
-    /* TODO: Recursively free all page tables */
-    /* For now, just free PML4 */
-    pt_free_page_table(domain->pml4);
+    /* Unlink the shared kernel half, then free every PDPT, PD and PT below
+     * the domain's own lower half and the PML4 itself */
+    spin_lock(&domain->lock);
+    spin_lock(&g_kernel_pml4_lock);
+    memset(&domain->pml4->entries[PML4_KERNEL_START], 0,
+           (512 - PML4_KERNEL_START) * sizeof(uint64_t));
+    page_table_t *pml4 = domain->pml4;
+    domain->pml4 = NULL;
+    spin_unlock(&g_kernel_pml4_lock);
+    memset(&domain->walk_cache, 0, sizeof(pt_walk_cache_t));
+    spin_unlock(&domain->lock);
+    
+    pt_free_subtree(pml4, 3);
+    pt_recycle_put(pml4);
     
     /* Clear domain entry */
     memset(domain, 0, sizeof(domain_page_table_t));
@@ -267,85 +1053,43 @@ int isolation_map_memory(uint64_t domain_id, uint64_t virt_addr, uint64_t phys_a
         return -1;
     }
     
-    /* Calculate page table flags based on map type */
-    uint64_t pt_flags = PT_FLAG_PRESENT;
+    /* Map the whole range in one walk, using 1 GB and 2 MB leaves where
+     * alignment and size allow */
+    pt_flush_set_t own = { .count = 0, .flush_all = 0 };
+    pt_flush_set_t *flush = pt_flush_get(domain_id, &own);
+    int result = pt_map_range(domain, virt_addr, phys_addr, size, pt_flags_for_type(map_type), flush);
+    pt_flush_put(flush, &own);
     
-    switch (map_type) {
-        case MAP_TYPE_CODE:
-            pt_flags |= PT_FLAG_USER;  /* User mode executable */
-            break;
-        case MAP_TYPE_DATA:
-            pt_flags |= PT_FLAG_WRITABLE | PT_FLAG_USER;
-            break;
-        case MAP_TYPE_READONLY:
-            pt_flags |= PT_FLAG_USER;
-            break;
-        case MAP_TYPE_DEVICE:
-            pt_flags |= PT_FLAG_WRITABLE | PT_FLAG_PCD | PT_FLAG_PWT;
-            break;
-        case MAP_TYPE_SHARED:
-            pt_flags |= PT_FLAG_WRITABLE | PT_FLAG_USER;
-            break;
+    return result;
+}
+
+/*
+ * Unmap memory from domain's address space
+ */
+int isolation_unmap_memory(uint64_t domain_id, uint64_t virt_addr, uint64_t size) {
+    if (domain_id >= MAX_DOMAINS) {
+        return -1;
     }
     
-    /* Map pages */
-    uint64_t num_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    domain_page_table_t *domain = &g_domain_tables[domain_id];
     
-    for (uint64_t i = 0; i < num_pages; i++) {
-        uint64_t current_virt = virt_addr + i * PAGE_SIZE;
-        uint64_t current_phys = phys_addr + i * PAGE_SIZE;
-        
-        /* Walk page tables and create missing levels */
-        page_table_t *pml4 = domain->pml4;
-        uint64_t pml4_idx = PML4_INDEX(current_virt);
-        
-        /* Get or create PDPT */
-        page_table_t *pdpt = pt_walk_get_pdpt(pml4, current_virt);
-        if (pdpt == NULL) {
-            pdpt = pt_alloc_page_table();
-            if (pdpt == NULL) {
-                return -1;
-            }
-            uint64_t pdpt_phys = (uint64_t)pdpt;
-            pt_set_entry(pml4, pml4_idx, pdpt_phys | PT_FLAG_PRESENT | PT_FLAG_WRITABLE | PT_FLAG_USER);
-        }
-        
-        /* Get or create PD */
-        uint64_t pdpt_idx = PDPT_INDEX(current_virt);
-        page_table_t *pd = pt_walk_get_pd(pdpt, current_virt);
-        if (pd == NULL) {
-            pd = pt_alloc_page_table();
-            if (pd == NULL) {
-                return -1;
-            }
-            uint64_t pd_phys = (uint64_t)pd;
-            pt_set_entry(pdpt, pdpt_idx, pd_phys | PT_FLAG_PRESENT | PT_FLAG_WRITABLE | PT_FLAG_USER);
-        }
-        
-        /* Get or create PT */
-        uint64_t pd_idx = PD_INDEX(current_virt);
-        page_table_t *pt = pt_walk_get_pt(pd, current_virt);
-        if (pt == NULL) {
-            pt = pt_alloc_page_table();
-            if (pt == NULL) {
-                return -1;
-            }
-            uint64_t pt_phys = (uint64_t)pt;
-            pt_set_entry(pd, pd_idx, pt_phys | PT_FLAG_PRESENT | PT_FLAG_WRITABLE | PT_FLAG_USER);
-        }
-        
-        /* Set page table entry */
-        uint64_t pt_idx = PT_INDEX(current_virt);
-        pt_set_entry(pt, pt_idx, current_phys | pt_flags);
+    if (domain->pml4 == NULL) {
+        return -1;
     }
     
-    return 0;
+    /* Unmap in one walk, splitting 1 GB and 2 MB leaves the range only partly covers */
+    pt_flush_set_t own = { .count = 0, .flush_all = 0 };
+    pt_flush_set_t *flush = pt_flush_get(domain_id, &own);
+    int result = pt_unmap_range(domain, virt_addr, size, flush);
+    pt_flush_put(flush, &own);
+    
+    return result;
 }
 
 /*
- * Unmap memory from domain's address space
+ * Load a domain's address space on this CPU
  */
-int isolation_unmap_memory(uint64_t domain_id, uint64_t virt_addr, uint64_t size) {
+int isolation_switch_domain(uint64_t domain_id) {
     if (domain_id >= MAX_DOMAINS) {
         return -1;
     }
@@ -356,33 +1100,117 @@ int isolation_unmap_memory(uint64_t domain_id, uint64_t virt_addr, uint64_t size
         return -1;
     }
     
-    /* Unmap pages */
-    uint64_t num_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    pt_flush_cpu_t *self = &g_flush_cpu[cpu_current_id()];
+    uint64_t generation = __atomic_load_n(&domain->tlb_generation, __ATOMIC_ACQUIRE);
     
-    for (uint64_t i = 0; i < num_pages; i++) {
-        uint64_t current_virt = virt_addr + i * PAGE_SIZE;
-        
-        /* Walk page tables */
-        page_table_t *pt = pt_walk_get_pt(
-            pt_walk_get_pd(
-                pt_walk_get_pdpt(domain->pml4, current_virt),
-                current_virt
-            ),
-            current_virt
-        );
-        
-        if (pt != NULL) {
-            uint64_t pt_idx = PT_INDEX(current_virt);
-            pt_set_entry(pt, pt_idx, 0);
+    /* With PCIDs the new context's cached entries are kept (no flush)
+     * unless another CPU invalidated some of them since this one last
+     * loaded it; without, PCID 0 is reloaded and flushed as on a plain
+     * CR3 write */
+    uint64_t cr3 = (uint64_t)domain->pml4;
+    if (g_pcid_enabled) {
+        spin_lock(&g_pcid_lock);
+        pcid_assign(domain);
+        cr3 |= domain->pcid;
+        if (self->seen[domain_id] == generation) {
+            cr3 |= CR3_NOFLUSH;
+        } else {
+            self->stats.remote++;
         }
+        spin_unlock(&g_pcid_lock);
     }
     
-    /* Invalidate TLB */
-    tlb_invalidate_page(virt_addr);
+    /* After the PCID lock, so a round another CPU just ended is seen */
+    tlb_sync_global(self);
+    g_active_domain[cpu_current_id()] = domain_id;
+    __asm__ volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+    self->seen[domain_id] = generation;
     
     return 0;
 }
 
+/*
+ * Return this CPU to the kernel domain on a saved CR3
+ */
+void isolation_switch_kernel(uint64_t cr3) {
+    g_active_domain[cpu_current_id()] = 0;
+    __asm__ volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+/*
+ * Catch up with invalidations other CPUs committed while this one kept
+ * its address space loaded
+ */
+void isolation_tlb_sync(void) {
+    uint32_t cpu = cpu_current_id();
+    pt_flush_cpu_t *self = &g_flush_cpu[cpu];
+    uint64_t domain_id = g_active_domain[cpu];
+    
+    tlb_sync_global(self);
+    
+    uint64_t generation = __atomic_load_n(&g_domain_tables[domain_id].tlb_generation,
+                                          __ATOMIC_ACQUIRE);
+    if (self->seen[domain_id] != generation) {
+        tlb_invalidate_all();  /* Other contexts are checked when loaded */
+        self->seen[domain_id] = generation;
+        self->stats.remote++;
+    }
+}
+
+/*
+ * Enable or disable PCID tagging on domain switch
+ */
+int isolation_set_pcid(int enable) {
+    g_pcid_enabled = enable && g_pcid_supported;
+    return g_pcid_enabled;
+}
+
+/*
+ * Change the protection of mapped memory in a domain's address space
+ */
+int isolation_protect_memory(uint64_t domain_id, uint64_t virt_addr, uint64_t size,
+                             map_type_t map_type) {
+    if (domain_id >= MAX_DOMAINS) {
+        return -1;
+    }
+    
+    domain_page_table_t *domain = &g_domain_tables[domain_id];
+    
+    if (domain->pml4 == NULL) {
+        return -1;
+    }
+    
+    pt_flush_set_t own = { .count = 0, .flush_all = 0 };
+    pt_flush_set_t *flush = pt_flush_get(domain_id, &own);
+    int result = pt_protect_range(domain, virt_addr, size, pt_flags_for_type(map_type), flush);
+    pt_flush_put(flush, &own);
+    
+    return result;
+}
+
+/*
+ * Check that entries [first, last) of a PT all carry the required flags
+ * with a plain AND-reduction (Core-0 builds with -mgeneral-regs-only, so
+ * this is scalar code; the two accumulators only break the dependency
+ * chain)
+ */
+static int pt_check_entries(const page_table_t *pt, uint32_t first, uint32_t last,
+                            uint64_t required) {
+    uint64_t even = ~0ULL;
+    uint64_t odd = ~0ULL;
+    uint32_t i = first;
+    
+    for (; i + 2 <= last; i += 2) {
+        even &= pt->entries[i];
+        odd &= pt->entries[i + 1];
+    }
+    if (i < last) {
+        even &= pt->entries[i];
+    }
+    
+    return (((even & odd) & required) == required) ? 0 : -1;
+}
+
 /*
  * Verify domain has access to memory
  */
@@ -397,28 +1225,54 @@ int isolation_verify_access(uint64_t domain_id, uint64_t addr, uint64_t size, ui
         return -1;
     }
     
-    /* Check each page */
-    uint64_t num_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t required = PT_FLAG_PRESENT;
+    if (access & 0x01) {
+        required |= PT_FLAG_USER;      /* Need user access */
+    }
+    if (access & 0x02) {
+        required |= PT_FLAG_WRITABLE;  /* Need write access */
+    }
     
-    for (uint64_t i = 0; i < num_pages; i++) {
-        uint64_t current_addr = addr + i * PAGE_SIZE;
-        
-        uint64_t pte = pt_walk_get_pte(domain->pml4, current_addr);
+    uint64_t end = addr + size;
+    if (size == 0) {
+        return 0;
+    }
+    if (end < addr) {
+        return -1;  /* Wraps the address space */
+    }
+    
+    /* One lookup per leaf or PT; a PT's run of entries is checked at once */
+    int result = 0;
+    uint64_t vaddr = addr & ~(PAGE_SIZE - 1);
+    spin_lock(&domain->lock);
+    if (domain->pml4 == NULL) {
+        vaddr = end;  /* Destroyed since the check above */
+        result = -1;
+    }
+    while (vaddr < end) {
+        page_table_t *pt;
+        uint64_t span_end;
+        uint64_t pte = pt_walk_cached(domain, vaddr, &pt, &span_end);
         
-        if (!(pte & PT_FLAG_PRESENT)) {
-            return -1;  /* Page not present */
+        if (span_end > end || span_end == 0) {
+            span_end = end;
         }
         
-        if ((access & 0x01) && !(pte & PT_FLAG_USER)) {
-            return -1;  /* Need user access but not allowed */
+        if (pt != NULL) {
+            if (pt_check_entries(pt, PT_INDEX(vaddr), PT_INDEX(span_end - 1) + 1, required) != 0) {
+                result = -1;
+                break;
+            }
+        } else if ((pte & required) != required) {
+            result = -1;
+            break;
         }
         
-        if ((access & 0x02) && !(pte & PT_FLAG_WRITABLE)) {
-            return -1;  /* Need write access but not allowed */
-        }
+        vaddr = span_end;
     }
+    spin_unlock(&domain->lock);
     
-    return 0;
+    return result;
 }
 
 /*
@@ -519,11 +1373,26 @@ void tlb_invalidate_all(void) {
 }
 
 /*
- * Invalidate TLB for an ASID (not supported on x86_64)
+ * Invalidate entire TLB including global entries (toggles CR4.PGE)
+ */
+void tlb_invalidate_global(void) {
+    uint64_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4 & ~(uint64_t)CR4_PGE) : "memory");
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+/*
+ * Invalidate TLB entries tagged with a PCID
  */
 void tlb_invalidate_asid(uint64_t asid) {
-    (void)asid;
-    tlb_invalidate_all();
+    if (g_invpcid_supported) {
+        invpcid(INVPCID_CONTEXT, asid & CR3_PCID_MASK, 0);
+    } else if (g_pcid_supported) {
+        tlb_invalidate_global();  /* CR3 reloads only reach the current PCID */
+    } else {
+        tlb_invalidate_all();
+    }
 }
 
 /*
@@ -17,6 +17,25 @@ void* memcpy(void *dst, const void *src, uint64_t size) {
     return dst;
 }
 
+void* memmove(void *dst, const void *src, uint64_t size) {
+    uint8_t *d = (uint8_t*)dst;
+    const uint8_t *s = (const uint8_t*)src;
+    
+    if (d < s) {
+        while (size--) {
+            *d++ = *s++;
+        }
+    } else if (d > s) {
+        d += size;
+        s += size;
+        while (size--) {
+            *--d = *--s;
+        }
+    }
+    
+    return dst;
+}
+
 void* memset(void *ptr, uint8_t value, uint64_t size) {
     uint8_t *p = (uint8_t*)ptr;
     
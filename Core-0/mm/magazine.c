@@ -0,0 +1,183 @@
+/*
+ * HIK Core-0 Per-CPU Frame Magazines
+ * 
+ * Each CPU keeps small stacks ("magazines") of free order-0 and order-9
+ * kernel frames in front of the global buddy allocator. Allocation and
+ * free on the local CPU touch the buddy lists only once per batch, when a
+ * magazine runs empty (refill) or full (drain).
+ * 
+ * A frame stays allocated in the buddy allocator while it is parked, with
+ * a mark in its first word (mm_frame_cache): a free briefly takes the
+ * global lock to check that the frame heads an allocation of its order,
+ * and a double free finds the mark already there. Frames the global pool
+ * refuses on a drain are counted in drain_errors.
+ */
+
+#include "../include/mm.h"
+#include "../include/cpu.h"
+#include "../include/string.h"
+
+/* Magazine (stack of cached frames) */
+typedef struct {
+    uint32_t count;                      /* Cached frames */
+    uint32_t reserved;                   /* Reserved for future use */
+    mm_magazine_stats_t stats;           /* Hit/miss counters */
+    uint64_t frames[MM_MAG_SIZE_SMALL];  /* Cached frame addresses */
+} mm_magazine_t;
+
+/* Per-CPU magazines (one cache-line aligned slot per CPU) */
+typedef struct {
+    mm_magazine_t small;                 /* Order MM_MAG_ORDER_SMALL */
+    mm_magazine_t large;                 /* Order MM_MAG_ORDER_LARGE */
+} __attribute__((aligned(CACHE_LINE_SIZE))) mm_cpu_magazines_t;
+
+static mm_cpu_magazines_t g_magazines[MAX_CPUS];
+
+/*
+ * Get a CPU's magazine for an order (NULL if the order is not cached)
+ */
+static mm_magazine_t* magazine_get(uint32_t cpu, uint32_t order, uint32_t *capacity) {
+    if (order == MM_MAG_ORDER_SMALL) {
+        *capacity = MM_MAG_SIZE_SMALL;
+        return &g_magazines[cpu].small;
+    }
+    if (order == MM_MAG_ORDER_LARGE) {
+        *capacity = MM_MAG_SIZE_LARGE;
+        return &g_magazines[cpu].large;
+    }
+    return NULL;
+}
+
+/*
+ * Clear the parked marks of frames leaving for the global pool
+ */
+static void magazine_uncache(const uint64_t *frames, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        mm_frame_uncache(frames[i]);
+    }
+}
+
+/*
+ * Return the oldest frames of a magazine to the global pool
+ */
+static void magazine_drain(mm_magazine_t *mag, uint32_t batch) {
+    magazine_uncache(mag->frames, batch);
+    uint32_t freed = mm_free_batch(mag->frames, batch);
+    
+    mag->stats.drains += freed;
+    mag->stats.drain_errors += batch - freed;
+    
+    memmove(mag->frames, &mag->frames[batch], (mag->count - batch) * sizeof(uint64_t));
+    mag->count -= batch;
+}
+
+/*
+ * Allocate a kernel frame from the current CPU's magazine
+ */
+uint64_t mm_alloc_frame(uint32_t order) {
+    uint32_t capacity;
+    
+    if (magazine_get(0, order, &capacity) == NULL) {
+        return mm_alloc(PAGE_SIZE << order, PAGE_SIZE << order, MEM_TYPE_KERNEL, 0);
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    mm_magazine_t *mag = magazine_get(cpu_current_id(), order, &capacity);
+    
+    if (mag->count == 0) {
+        /* Refill half a magazine from the global pool */
+        mag->stats.misses++;
+        mag->count = mm_alloc_batch(order, mag->frames, capacity / 2);
+        mag->stats.refills += mag->count;
+        
+        if (mag->count == 0) {
+            cpu_irq_restore(flags);
+            return 0;
+        }
+    } else {
+        mag->stats.hits++;
+    }
+    
+    uint64_t addr = mag->frames[--mag->count];
+    mm_frame_uncache(addr);
+    
+    cpu_irq_restore(flags);
+    
+    return addr;
+}
+
+/*
+ * Free a frame into the current CPU's magazine
+ */
+int mm_free_frame(uint64_t addr, uint32_t order) {
+    uint32_t capacity;
+    
+    if (magazine_get(0, order, &capacity) == NULL) {
+        return mm_free(addr);
+    }
+    
+    if (addr == 0 || (addr & ((PAGE_SIZE << order) - 1)) != 0) {
+        return -1;
+    }
+    
+    /* Magazines only hold node-local frames */
+    if (numa_node_of_addr(addr) != numa_current_node()) {
+        return mm_free(addr);
+    }
+    
+    /* The checks mm_free would make, and none already parked */
+    if (mm_frame_cache(addr, order) != 0) {
+        return -1;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    mm_magazine_t *mag = magazine_get(cpu_current_id(), order, &capacity);
+    
+    if (mag->count >= capacity) {
+        /* Drain the oldest half, keeping recently freed (cache-hot) frames */
+        magazine_drain(mag, capacity / 2);
+    }
+    
+    mag->frames[mag->count++] = addr;
+    
+    cpu_irq_restore(flags);
+    
+    return 0;
+}
+
+/*
+ * Return the current CPU's cached frames to the global pool
+ */
+uint64_t mm_magazine_drain(void) {
+    uint64_t flags = cpu_irq_save();
+    mm_cpu_magazines_t *cpu = &g_magazines[cpu_current_id()];
+    uint64_t drained = cpu->small.stats.drains + cpu->large.stats.drains;
+    
+    magazine_drain(&cpu->small, cpu->small.count);
+    magazine_drain(&cpu->large, cpu->large.count);
+    
+    drained = cpu->small.stats.drains + cpu->large.stats.drains - drained;
+    
+    cpu_irq_restore(flags);
+    
+    return drained;
+}
+
+/*
+ * Get magazine statistics for a CPU and order
+ */
+int mm_magazine_get_stats(uint32_t cpu, uint32_t order, mm_magazine_stats_t *stats) {
+    uint32_t capacity;
+    
+    if (cpu >= MAX_CPUS || stats == NULL) {
+        return -1;
+    }
+    
+    mm_magazine_t *mag = magazine_get(cpu, order, &capacity);
+    if (mag == NULL) {
+        return -1;
+    }
+    
+    *stats = mag->stats;
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,246 @@
+/*
+ * HIK Core-0 Boot Memory Map Parsing
+ * 
+ * Turns the firmware memory map into a short list of page-aligned RAM
+ * regions sorted by address. The BIOS path hands over E820 entries, which
+ * may overlap; reserved entries always win over usable ones. The UEFI path
+ * hands over EFI_MEMORY_DESCRIPTORs; conventional memory is usable at
+ * once, and boot services memory is kept as a separate region kind so it
+ * can be reclaimed once Core-0 no longer depends on firmware structures.
+ */
+
+#include "../include/memmap.h"
+#include "../include/mm.h"
+#include "../include/string.h"
+
+/* Bytes of an E820 entry Core-0 reads (base, length, type) */
+#define E820_MIN_ENTRY_SIZE 20
+
+/*
+ * Insert a region at an index
+ */
+static void memmap_insert(memmap_t *map, uint32_t i, uint64_t base, uint64_t end, uint32_t kind) {
+    memmove(&map->regions[i + 1], &map->regions[i], (map->count - i) * sizeof(memmap_region_t));
+    
+    map->regions[i].base = base;
+    map->regions[i].end = end;
+    map->regions[i].kind = kind;
+    map->regions[i].reserved = 0;
+    map->count++;
+}
+
+/*
+ * Remove a region by index
+ */
+static void memmap_delete(memmap_t *map, uint32_t i) {
+    memmove(&map->regions[i], &map->regions[i + 1], (map->count - i - 1) * sizeof(memmap_region_t));
+    map->count--;
+}
+
+/*
+ * Merge touching regions of the same kind and clip overlaps
+ */
+static void memmap_merge(memmap_t *map) {
+    uint32_t i = 0;
+    
+    while (i + 1 < map->count) {
+        memmap_region_t *cur = &map->regions[i];
+        memmap_region_t *next = &map->regions[i + 1];
+        
+        if (next->base > cur->end) {
+            i++;
+        } else if (next->kind == cur->kind) {
+            if (next->end > cur->end) {
+                cur->end = next->end;
+            }
+            memmap_delete(map, i + 1);
+        } else if (next->end <= cur->end) {
+            /* Overlap of different kinds: the earlier region wins */
+            memmap_delete(map, i + 1);
+        } else {
+            next->base = cur->end;
+            i++;
+        }
+    }
+}
+
+/*
+ * Add a RAM range (shrunk to whole pages), keeping the list sorted
+ */
+static void memmap_add(memmap_t *map, uint64_t base, uint64_t end, uint32_t kind) {
+    base = (base + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    end &= ~(uint64_t)(PAGE_SIZE - 1);
+    
+    if (end <= base) {
+        return;
+    }
+    
+    if (map->count >= MEMMAP_MAX_REGIONS) {
+        memmap_merge(map);
+        if (map->count >= MEMMAP_MAX_REGIONS) {
+            map->dropped++;
+            return;
+        }
+    }
+    
+    uint32_t i = map->count;
+    while (i > 0 && map->regions[i - 1].base > base) {
+        i--;
+    }
+    
+    memmap_insert(map, i, base, end, kind);
+}
+
+/*
+ * Remove a non-RAM range (grown to whole pages) from every region
+ */
+static void memmap_subtract(memmap_t *map, uint64_t base, uint64_t end) {
+    base &= ~(uint64_t)(PAGE_SIZE - 1);
+    end = (end + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    
+    uint32_t i = 0;
+    while (i < map->count) {
+        memmap_region_t *r = &map->regions[i];
+        
+        if (r->end <= base || r->base >= end) {
+            i++;
+        } else if (r->base < base && r->end > end) {
+            /* Hole in the middle: split the region */
+            uint64_t tail = r->end;
+            r->end = base;
+            if (map->count < MEMMAP_MAX_REGIONS) {
+                memmap_insert(map, i + 1, end, tail, r->kind);
+            } else {
+                map->dropped++;
+            }
+            i += 2;
+        } else if (r->base < base) {
+            r->end = base;
+            i++;
+        } else if (r->end > end) {
+            r->base = end;
+            i++;
+        } else {
+            memmap_delete(map, i);
+        }
+    }
+}
+
+/*
+ * End address of a firmware range, saturating on overflow
+ */
+static inline uint64_t range_end(uint64_t base, uint64_t length) {
+    uint64_t end = base + length;
+    return (end < base) ? ~0ULL : end;
+}
+
+/*
+ * Parse UEFI memory descriptors
+ */
+static void memmap_parse_efi(const boot_info_t *boot_info, memmap_t *map) {
+    uint64_t stride = boot_info->memory_map_desc_size;
+    uint64_t count = boot_info->memory_map_size / stride;
+    
+    for (uint64_t i = 0; i < count; i++) {
+        const efi_memory_descriptor_t *desc =
+            (const efi_memory_descriptor_t *)(boot_info->memory_map_base + i * stride);
+        uint64_t end = range_end(desc->physical_start, desc->number_of_pages * EFI_PAGE_SIZE);
+        
+        switch (desc->type) {
+            case EFI_CONVENTIONAL_MEMORY:
+                memmap_add(map, desc->physical_start, end, MEMMAP_USABLE);
+                break;
+            case EFI_BOOT_SERVICES_CODE:
+            case EFI_BOOT_SERVICES_DATA:
+                memmap_add(map, desc->physical_start, end, MEMMAP_BOOT_RECLAIM);
+                break;
+            default:
+                /* Loader memory holds the kernel, boot info and stack */
+                break;
+        }
+    }
+}
+
+/*
+ * Parse BIOS E820 entries
+ */
+static void memmap_parse_e820(const boot_info_t *boot_info, memmap_t *map) {
+    uint64_t stride = boot_info->memory_map_desc_size;
+    if (stride == 0) {
+        stride = sizeof(memory_map_entry_t);
+    }
+    
+    uint64_t count = boot_info->memory_map_count;
+    if (count == 0) {
+        count = boot_info->memory_map_size / stride;
+    }
+    
+    /* Usable ranges first, then punch out every other entry */
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint64_t i = 0; i < count; i++) {
+            const memory_map_entry_t *entry =
+                (const memory_map_entry_t *)(boot_info->memory_map_base + i * stride);
+            uint64_t end = range_end(entry->base_address, entry->length);
+            
+            if (entry->length == 0) {
+                continue;
+            }
+            
+            if (pass == 0 && entry->type == E820_TYPE_USABLE) {
+                memmap_add(map, entry->base_address, end, MEMMAP_USABLE);
+            } else if (pass == 1 && entry->type != E820_TYPE_USABLE) {
+                memmap_subtract(map, entry->base_address, end);
+            }
+        }
+        
+        if (pass == 0) {
+            memmap_merge(map);
+        }
+    }
+}
+
+/*
+ * Parse the bootloader memory map (E820 or UEFI)
+ *
+ * The format is told apart by descriptor size: E820 entries are at most
+ * 24 bytes, UEFI descriptors at least 40.
+ */
+int memmap_parse(const boot_info_t *boot_info, memmap_t *map) {
+    if (boot_info == NULL || map == NULL) {
+        return -1;
+    }
+    
+    memset(map, 0, sizeof(memmap_t));
+    
+    if (boot_info->memory_map_base == 0 || boot_info->memory_map_size == 0) {
+        return -1;
+    }
+    
+    if (boot_info->memory_map_desc_size >= sizeof(efi_memory_descriptor_t)) {
+        memmap_parse_efi(boot_info, map);
+    } else if (boot_info->memory_map_desc_size == 0 ||
+               boot_info->memory_map_desc_size >= E820_MIN_ENTRY_SIZE) {
+        memmap_parse_e820(boot_info, map);
+    } else {
+        return -1;
+    }
+    
+    memmap_merge(map);
+    
+    return (map->count > 0) ? 0 : -1;
+}
+
+/*
+ * Highest address covered by any region
+ */
+uint64_t memmap_end(const memmap_t *map) {
+    uint64_t end = 0;
+    
+    for (uint32_t i = 0; i < map->count; i++) {
+        if (map->regions[i].end > end) {
+            end = map->regions[i].end;
+        }
+    }
+    
+    return end;
+}
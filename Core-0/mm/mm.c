@@ -1,16 +1,45 @@
 /*
  * HIK Core-0 Memory Management Implementation
- * 
+ *
  * This file implements physical memory management using global bitmaps
  * as specified in the documentation.
+ *
+ * Free frames are kept by a binary buddy allocator. A free block of
+ * order k covers 2^k pages and is aligned to 2^k pages; its list links
+ * and order live in the first bytes of the (identity mapped) free block
+ * itself. A packed bitmap holds one used/free bit per page, and a sorted
+ * run-length extent table records the type and owner of used pages.
  */
 
 #include "../include/mm.h"
+#include "../include/memmap.h"
 #include "../include/string.h"
 
+/* Kernel image bounds (linker.ld) */
+extern char _kernel_start[];
+extern char _kernel_end[];
+
 /* Global memory manager state */
 static mm_state_t g_mm_state;
 
+/* Normalized boot memory map (kept for boot memory reclaim) */
+static memmap_t g_boot_memmap;
+
+/* First page of a grown extent table (0 = boot metadata region) */
+static uint64_t g_extent_table_pfn = 0;
+
+/* Owner home node hints, (owner << 8) | node; 0 = no hint. The owners
+ * (capability domains) report their node here, so mm needs no lookup in
+ * the layers above it */
+static uint64_t g_owner_nodes[MM_OWNER_HINTS];
+
+/* Free block header (stored in the free memory) */
+typedef struct {
+    uint64_t next;            /* Physical address of next free block */
+    uint64_t prev;            /* Physical address of previous free block */
+    uint64_t order;           /* Block order */
+} mm_free_block_t;
+
 /* Spinlock operations */
 static inline void spin_lock(uint64_t *lock) {
     while (__sync_lock_test_and_set(lock, 1)) {
@@ -22,75 +51,691 @@ static inline void spin_unlock(uint64_t *lock) {
     __sync_lock_release(lock);
 }
 
+/*
+ * Zone holding a page (buddy blocks never straddle MM_DMA32_LIMIT or a
+ * node boundary)
+ */
+static inline mm_zone_t* zone_of(uint64_t pfn) {
+    uint32_t node = numa_node_of_addr(pfn << PAGE_SHIFT);
+    
+    if (pfn < MM_DMA32_LIMIT / PAGE_SIZE) {
+        return &g_mm_state.zones[node][MM_ZONE_DMA32];
+    }
+    return &g_mm_state.zones[node][MM_ZONE_NORMAL];
+}
+
+/*
+ * Check the used bit of a page
+ */
+static inline int page_is_used(uint64_t pfn) {
+    return (g_mm_state.used_map[pfn >> 6] >> (pfn & 63)) & 1;
+}
+
+/*
+ * Check whether a frame is parked in a magazine (its first word marks it)
+ */
+static inline int page_is_parked(uint64_t pfn) {
+    uint64_t addr = pfn << PAGE_SHIFT;
+    return __atomic_load_n((uint64_t *)addr, __ATOMIC_ACQUIRE) == (MM_MAG_PARKED ^ addr);
+}
+
+/*
+ * Set or clear the used bits of a page range, a word at a time
+ */
+static void bitmap_update_range(uint64_t pfn, uint64_t end, int used) {
+    while (pfn < end) {
+        uint64_t bit = pfn & 63;
+        uint64_t count = 64 - bit;
+        if (count > end - pfn) {
+            count = end - pfn;
+        }
+        
+        uint64_t mask = (count == 64) ? ~0ULL : (((1ULL << count) - 1) << bit);
+        if (used) {
+            g_mm_state.used_map[pfn >> 6] |= mask;
+        } else {
+            g_mm_state.used_map[pfn >> 6] &= ~mask;
+        }
+        
+        pfn += count;
+    }
+}
+
+/*
+ * Find the first page in [pfn, end) whose used bit matches (end if none)
+ */
+static uint64_t bitmap_find(uint64_t pfn, uint64_t end, int used) {
+    while (pfn < end) {
+        uint64_t word = g_mm_state.used_map[pfn >> 6];
+        if (!used) {
+            word = ~word;
+        }
+        word &= ~0ULL << (pfn & 63);
+        
+        if (word != 0) {
+            uint64_t hit = (pfn & ~63ULL) + __builtin_ctzll(word);
+            return (hit < end) ? hit : end;
+        }
+        
+        pfn = (pfn & ~63ULL) + 64;
+    }
+    return end;
+}
+
+/*
+ * Smallest order whose block holds the given number of pages
+ */
+static uint32_t buddy_order_for(uint64_t pages) {
+    uint32_t order = 0;
+    while ((1ULL << order) < pages) {
+        order++;
+    }
+    return order;
+}
+
+/*
+ * Check whether a frame heads a free block of the given order
+ *
+ * Only valid for frames that can be free only as a block head: the buddy
+ * of a block being freed, or candidates above the true order of the
+ * block containing a page (see buddy_find_block).
+ */
+static inline int buddy_is_free_head(uint64_t pfn, uint32_t order) {
+    if (pfn >= g_mm_state.total_pages || page_is_used(pfn)) {
+        return 0;
+    }
+    
+    return ((mm_free_block_t *)(pfn << PAGE_SHIFT))->order == order;
+}
+
+/*
+ * Push a block onto its free list
+ */
+static void buddy_push(uint64_t pfn, uint32_t order) {
+    mm_free_area_t *area = &zone_of(pfn)->free_area[order];
+    uint64_t addr = pfn << PAGE_SHIFT;
+    mm_free_block_t *block = (mm_free_block_t *)addr;
+    
+    block->next = area->head;
+    block->prev = 0;
+    block->order = order;
+    if (area->head != 0) {
+        ((mm_free_block_t *)area->head)->prev = addr;
+    }
+    area->head = addr;
+    area->count++;
+}
+
+/*
+ * Unlink a block from its free list
+ */
+static void buddy_remove(uint64_t pfn, uint32_t order) {
+    mm_free_area_t *area = &zone_of(pfn)->free_area[order];
+    mm_free_block_t *block = (mm_free_block_t *)(pfn << PAGE_SHIFT);
+    
+    if (block->prev != 0) {
+        ((mm_free_block_t *)block->prev)->next = block->next;
+    } else {
+        area->head = block->next;
+    }
+    if (block->next != 0) {
+        ((mm_free_block_t *)block->next)->prev = block->prev;
+    }
+    area->count--;
+    
+    block->order = MM_NUM_ORDERS;  /* No longer a head */
+}
+
+/*
+ * Free a block, merging it with its buddy as long as the buddy is free
+ */
+static void buddy_free_block(uint64_t pfn, uint32_t order) {
+    bitmap_update_range(pfn, pfn + (1ULL << order), 0);
+    
+    mm_zone_t *zone = zone_of(pfn);
+    
+    while (order < MM_MAX_ORDER) {
+        uint64_t buddy = pfn ^ (1ULL << order);
+        if (!buddy_is_free_head(buddy, order) || zone_of(buddy) != zone) {
+            break;
+        }
+        buddy_remove(buddy, order);
+        pfn &= ~(1ULL << order);
+        order++;
+    }
+    
+    buddy_push(pfn, order);
+}
+
+/*
+ * Return a page range to the free lists as maximal aligned blocks
+ */
+static void buddy_release_range(uint64_t pfn, uint64_t end) {
+    g_mm_state.available_pages += end - pfn;
+    
+    /* Each block clears its own bits, so later parts of the range still
+     * read as used while earlier blocks look for free buddies */
+    while (pfn < end) {
+        /* Blocks must not cross into another node */
+        uint64_t limit = numa_node_boundary(pfn << PAGE_SHIFT) >> PAGE_SHIFT;
+        if (limit > end) {
+            limit = end;
+        }
+        
+        uint32_t order = 0;
+        while (order < MM_MAX_ORDER &&
+               (pfn & ((2ULL << order) - 1)) == 0 &&
+               pfn + (2ULL << order) <= limit) {
+            order++;
+        }
+        zone_of(pfn)->available_pages += 1ULL << order;
+        buddy_free_block(pfn, order);
+        pfn += 1ULL << order;
+    }
+}
+
+/*
+ * Find the free block containing a free page
+ *
+ * Searching from the top order down only ever inspects real block heads:
+ * a free candidate above the containing block's order is itself a head
+ * (its block cannot span the page), and the first match is the block.
+ */
+static int buddy_find_block(uint64_t pfn, uint64_t *head, uint32_t *order) {
+    for (int32_t k = MM_MAX_ORDER; k >= 0; k--) {
+        uint64_t candidate = pfn & ~((1ULL << k) - 1);
+        if (buddy_is_free_head(candidate, (uint32_t)k)) {
+            *head = candidate;
+            *order = (uint32_t)k;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Allocate a naturally aligned run of pages from a zone or a lower one,
+ * trying nodes nearest first
+ */
+static uint64_t buddy_alloc_pages(uint64_t pages, uint64_t align_pages,
+                                  uint32_t max_zone, uint32_t node) {
+    /* Blocks are naturally aligned, so alignment only raises the order */
+    uint32_t order = buddy_order_for(pages);
+    uint32_t align_order = buddy_order_for(align_pages);
+    if (align_order > order) {
+        order = align_order;
+    }
+    if (order > MM_MAX_ORDER) {
+        return 0;
+    }
+    
+    /* Find the smallest non-empty free list: nearest node, highest zone first */
+    const uint32_t *nodes = numa_fallback_list(node);
+    uint32_t num_nodes = numa_num_nodes();
+    mm_zone_t *zone = NULL;
+    uint32_t k = MM_NUM_ORDERS;
+    for (uint32_t n = 0; n < num_nodes && k > MM_MAX_ORDER; n++) {
+        for (int32_t z = (int32_t)max_zone; z >= 0 && k > MM_MAX_ORDER; z--) {
+            zone = &g_mm_state.zones[nodes[n]][z];
+            k = order;
+            while (k <= MM_MAX_ORDER && zone->free_area[k].head == 0) {
+                k++;
+            }
+        }
+    }
+    
+    if (k > MM_MAX_ORDER) {
+        return 0;
+    }
+    
+    uint64_t pfn = zone->free_area[k].head >> PAGE_SHIFT;
+    buddy_remove(pfn, k);
+    bitmap_update_range(pfn, pfn + (1ULL << k), 1);
+    g_mm_state.available_pages -= 1ULL << k;
+    zone->available_pages -= 1ULL << k;
+    
+    /* Split down to the requested order */
+    while (k > order) {
+        k--;
+        buddy_release_range(pfn + (1ULL << k), pfn + (2ULL << k));
+    }
+    
+    /* Return the unused tail of the block */
+    if (pages < (1ULL << order)) {
+        buddy_release_range(pfn + pages, pfn + (1ULL << order));
+    }
+    
+    return pfn;
+}
+
+/*
+ * Take a page range out of the free lists, splitting blocks that straddle it
+ */
+static void buddy_carve_range(uint64_t pfn, uint64_t end) {
+    while (pfn < end) {
+        uint64_t head;
+        uint32_t order;
+        
+        pfn = bitmap_find(pfn, end, 0);
+        if (pfn >= end) {
+            break;
+        }
+        
+        if (buddy_find_block(pfn, &head, &order) != 0) {
+            pfn++;
+            continue;
+        }
+        
+        uint64_t block_end = head + (1ULL << order);
+        buddy_remove(head, order);
+        bitmap_update_range(head, block_end, 1);
+        g_mm_state.available_pages -= 1ULL << order;
+        zone_of(head)->available_pages -= 1ULL << order;
+        
+        /* Give back the parts of the block outside the range */
+        if (head < pfn) {
+            buddy_release_range(head, pfn);
+        }
+        if (block_end > end) {
+            buddy_release_range(end, block_end);
+            block_end = end;
+        }
+        
+        pfn = block_end;
+    }
+}
+
+/*
+ * Index of the first extent ending after a page
+ */
+static uint64_t extent_search(uint64_t pfn) {
+    uint64_t lo = 0;
+    uint64_t hi = g_mm_state.num_extents;
+    
+    while (lo < hi) {
+        uint64_t mid = (lo + hi) / 2;
+        mem_extent_t *ext = &g_mm_state.extents[mid];
+        if ((uint64_t)ext->base_pfn + ext->pages <= pfn) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    return lo;
+}
+
+/*
+ * Find the extent containing a page
+ */
+static mem_extent_t* extent_lookup(uint64_t pfn) {
+    uint64_t i = extent_search(pfn);
+    
+    if (i < g_mm_state.num_extents && g_mm_state.extents[i].base_pfn <= pfn) {
+        return &g_mm_state.extents[i];
+    }
+    return NULL;
+}
+
+/*
+ * Remove an extent by index
+ */
+static void extent_delete(uint64_t i) {
+    memmove(&g_mm_state.extents[i], &g_mm_state.extents[i + 1],
+            (g_mm_state.num_extents - i - 1) * sizeof(mem_extent_t));
+    g_mm_state.num_extents--;
+}
+
+static int extent_insert(uint64_t pfn, uint64_t pages, mem_type_t type, uint64_t owner);
+
+/*
+ * Double the extent table capacity
+ */
+static int extent_grow(void) {
+    uint64_t new_max = g_mm_state.max_extents * 2;
+    uint64_t pages = (new_max * sizeof(mem_extent_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+    
+    uint64_t pfn = buddy_alloc_pages(pages, 1, MM_NUM_ZONES - 1, numa_current_node());
+    if (pfn == 0) {
+        return -1;
+    }
+    
+    mem_extent_t *table = (mem_extent_t *)(pfn << PAGE_SHIFT);
+    memcpy(table, g_mm_state.extents, g_mm_state.num_extents * sizeof(mem_extent_t));
+    
+    uint64_t old_pfn = g_extent_table_pfn;
+    g_mm_state.extents = table;
+    g_mm_state.max_extents = new_max;
+    g_extent_table_pfn = pfn;
+    
+    /* Release the previous table unless it lives in the boot metadata */
+    if (old_pfn != 0) {
+        mem_extent_t *old = extent_lookup(old_pfn);
+        uint64_t old_pages = old->pages;
+        extent_delete(old - g_mm_state.extents);
+        buddy_release_range(old_pfn, old_pfn + old_pages);
+        g_mm_state.allocated_pages -= old_pages;
+    }
+    
+    g_mm_state.allocated_pages += pages;
+    return extent_insert(pfn, pages, MEM_TYPE_KERNEL, 0);
+}
+
+/*
+ * Insert an extent, keeping the table sorted
+ */
+static int extent_insert(uint64_t pfn, uint64_t pages, mem_type_t type, uint64_t owner) {
+    if (g_mm_state.num_extents >= g_mm_state.max_extents && extent_grow() != 0) {
+        return -1;
+    }
+    
+    uint64_t i = extent_search(pfn);
+    memmove(&g_mm_state.extents[i + 1], &g_mm_state.extents[i],
+            (g_mm_state.num_extents - i) * sizeof(mem_extent_t));
+    
+    mem_extent_t *ext = &g_mm_state.extents[i];
+    ext->base_pfn = (uint32_t)pfn;
+    ext->pages = (uint32_t)pages;
+    ext->owner = owner;
+    ext->type = type;
+    ext->reserved = 0;
+    
+    g_mm_state.num_extents++;
+    return 0;
+}
+
+/*
+ * Clip all extents to exclude a page range, returning the pages removed
+ */
+static uint64_t extent_remove_range(uint64_t pfn, uint64_t end) {
+    uint64_t removed = 0;
+    uint64_t i = extent_search(pfn);
+    
+    while (i < g_mm_state.num_extents && g_mm_state.extents[i].base_pfn < end) {
+        mem_extent_t *ext = &g_mm_state.extents[i];
+        uint64_t base = ext->base_pfn;
+        uint64_t limit = base + ext->pages;
+        
+        if (base < pfn && limit > end) {
+            /* Range punches a hole in the middle */
+            ext->pages = (uint32_t)(pfn - base);
+            removed += end - pfn;
+            extent_insert(end, limit - end, (mem_type_t)ext->type, ext->owner);
+            break;
+        } else if (base < pfn) {
+            ext->pages = (uint32_t)(pfn - base);
+            removed += limit - pfn;
+            i++;
+        } else if (limit > end) {
+            ext->base_pfn = (uint32_t)end;
+            ext->pages = (uint32_t)(limit - end);
+            removed += end - base;
+            break;
+        } else {
+            removed += ext->pages;
+            extent_delete(i);
+        }
+    }
+    
+    return removed;
+}
+
 /*
  * Initialize memory manager
+ *
+ * The bitmap and extent table are placed right after the kernel image.
+ * Only usable RAM from the boot memory map is handed to the buddy
+ * allocator; everything else (holes, firmware, MMIO) stays reserved.
  */
-int mm_init(uint64_t total_memory) {
+int mm_init(const boot_info_t *boot_info) {
     memset(&g_mm_state, 0, sizeof(mm_state_t));
+    mm_zero_pool_init();
+    
+    if (memmap_parse(boot_info, &g_boot_memmap) != 0) {
+        return -1;
+    }
     
-    g_mm_state.total_pages = total_memory / PAGE_SIZE;
-    g_mm_state.available_pages = g_mm_state.total_pages;
+    g_mm_state.total_pages = memmap_end(&g_boot_memmap) / PAGE_SIZE;
+    if (g_mm_state.total_pages > MAX_PAGES) {
+        g_mm_state.total_pages = MAX_PAGES;
+    }
+    g_mm_state.available_pages = 0;
     g_mm_state.allocated_pages = 0;
     g_mm_state.lock = 0;
+    g_extent_table_pfn = 0;
+    
+    /* Size the metadata from the amount of memory */
+    uint64_t map_bytes = ((g_mm_state.total_pages + 63) / 64) * sizeof(uint64_t);
+    uint64_t max_extents = g_mm_state.total_pages / MM_EXTENT_RATIO;
+    if (max_extents < MM_MIN_EXTENTS) {
+        max_extents = MM_MIN_EXTENTS;
+    }
+    uint64_t meta_size = map_bytes + max_extents * sizeof(mem_extent_t);
+    uint64_t meta_base = ((uint64_t)_kernel_end + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t meta_pages = (meta_size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t meta_end = meta_base + meta_pages * PAGE_SIZE;
+    
+    /* The metadata must sit in usable RAM */
+    int meta_usable = 0;
+    for (uint32_t i = 0; i < g_boot_memmap.count; i++) {
+        memmap_region_t *region = &g_boot_memmap.regions[i];
+        if (region->kind == MEMMAP_USABLE && region->base <= meta_base && region->end >= meta_end) {
+            meta_usable = 1;
+            break;
+        }
+    }
+    
+    if (!meta_usable || meta_end / PAGE_SIZE > g_mm_state.total_pages) {
+        return -1;
+    }
+    
+    g_mm_state.used_map = (uint64_t *)meta_base;
+    g_mm_state.extents = (mem_extent_t *)(meta_base + map_bytes);
+    g_mm_state.num_extents = 0;
+    g_mm_state.max_extents = max_extents;
     
     /* Mark all frames as reserved initially */
-    for (uint64_t i = 0; i < g_mm_state.total_pages; i++) {
-        g_mm_state.frames[i].type = MEM_TYPE_RESERVED;
-        g_mm_state.frames[i].owner = 0;
+    memset(g_mm_state.used_map, 0xFF, map_bytes);
+    
+    /* Kernel image and memory manager metadata */
+    uint64_t kernel_pfn = (uint64_t)_kernel_start / PAGE_SIZE;
+    uint64_t kernel_pages = meta_base / PAGE_SIZE - kernel_pfn;
+    extent_insert(kernel_pfn, kernel_pages, MEM_TYPE_KERNEL, 0);
+    extent_insert(meta_base / PAGE_SIZE, meta_pages, MEM_TYPE_KERNEL, 0);
+    g_mm_state.allocated_pages = kernel_pages + meta_pages;
+    
+    /* Zone spans and sizes cover both usable and reclaimable RAM */
+    for (uint32_t i = 0; i < g_boot_memmap.count; i++) {
+        memmap_region_t *region = &g_boot_memmap.regions[i];
+        uint64_t pfn = region->base / PAGE_SIZE;
+        uint64_t end = region->end / PAGE_SIZE;
+        if (end > g_mm_state.total_pages) {
+            end = g_mm_state.total_pages;
+        }
+        
+        while (pfn < end) {
+            mm_zone_t *zone = zone_of(pfn);
+            uint64_t limit = numa_node_boundary(pfn << PAGE_SHIFT) >> PAGE_SHIFT;
+            if (pfn < MM_DMA32_LIMIT / PAGE_SIZE && limit > MM_DMA32_LIMIT / PAGE_SIZE) {
+                limit = MM_DMA32_LIMIT / PAGE_SIZE;
+            }
+            if (limit > end) {
+                limit = end;
+            }
+            
+            if (zone->present_pages == 0 || pfn < zone->start_pfn) {
+                zone->start_pfn = pfn;
+            }
+            if (limit > zone->end_pfn) {
+                zone->end_pfn = limit;
+            }
+            zone->present_pages += limit - pfn;
+            pfn = limit;
+        }
+    }
+    
+    /* Release usable RAM (low memory stays reserved) */
+    for (uint32_t i = 0; i < g_boot_memmap.count; i++) {
+        memmap_region_t *region = &g_boot_memmap.regions[i];
+        uint64_t base = region->base;
+        if (region->kind != MEMMAP_USABLE || region->end <= MM_LOW_MEMORY_LIMIT) {
+            continue;
+        }
+        if (base < MM_LOW_MEMORY_LIMIT) {
+            base = MM_LOW_MEMORY_LIMIT;
+        }
+        mm_reserve(base, region->end - base, MEM_TYPE_AVAILABLE, 0);
     }
     
     return 0;
 }
 
 /*
- * Allocate memory using global bitmap
+ * Release boot services memory once firmware structures are no longer used
  */
-uint64_t mm_alloc(uint64_t size, uint64_t align, mem_type_t type, uint64_t owner) {
-    spin_lock(&g_mm_state.lock);
+uint64_t mm_reclaim_boot_memory(void) {
+    uint64_t before = g_mm_state.available_pages;
+    
+    for (uint32_t i = 0; i < g_boot_memmap.count; i++) {
+        memmap_region_t *region = &g_boot_memmap.regions[i];
+        uint64_t base = region->base;
+        if (region->kind != MEMMAP_BOOT_RECLAIM || region->end <= MM_LOW_MEMORY_LIMIT) {
+            continue;
+        }
+        if (base < MM_LOW_MEMORY_LIMIT) {
+            base = MM_LOW_MEMORY_LIMIT;
+        }
+        mm_reserve(base, region->end - base, MEM_TYPE_AVAILABLE, 0);
+        region->kind = MEMMAP_USABLE;
+    }
+    
+    return (g_mm_state.available_pages - before) * PAGE_SIZE;
+}
+
+/*
+ * Allocate pages on a node and zone (or nearest fallback) and record the extent
+ */
+static uint64_t mm_alloc_pages(uint32_t node, uint32_t zone, uint64_t size, uint64_t align,
+                               mem_type_t type, uint64_t owner) {
+    if (size == 0 || type == MEM_TYPE_AVAILABLE || type == MEM_TYPE_RESERVED ||
+        zone >= MM_NUM_ZONES || node >= numa_num_nodes()) {
+        return 0;
+    }
     
     /* Calculate number of pages needed */
     uint64_t pages_needed = (size + PAGE_SIZE - 1) / PAGE_SIZE;
     uint64_t align_pages = (align + PAGE_SIZE - 1) / PAGE_SIZE;
     
-    /* Find contiguous available pages */
-    uint64_t start_page = 0;
-    uint64_t found_pages = 0;
+    spin_lock(&g_mm_state.lock);
     
-    for (uint64_t i = 0; i < g_mm_state.total_pages; i++) {
-        if (g_mm_state.frames[i].type == MEM_TYPE_AVAILABLE) {
-            if (found_pages == 0) {
-                start_page = i;
-            }
-            found_pages++;
-            
-            if (found_pages >= pages_needed) {
-                /* Check alignment */
-                if ((start_page % align_pages) == 0) {
-                    /* Allocate pages */
-                    for (uint64_t j = start_page; j < start_page + pages_needed; j++) {
-                        g_mm_state.frames[j].type = type;
-                        g_mm_state.frames[j].owner = owner;
-                    }
-                    
-                    g_mm_state.available_pages -= pages_needed;
-                    g_mm_state.allocated_pages += pages_needed;
-                    
-                    spin_unlock(&g_mm_state.lock);
-                    
-                    return start_page * PAGE_SIZE;
-                } else {
-                    /* Not aligned, reset search */
-                    found_pages = 0;
-                }
-            }
-        } else {
-            found_pages = 0;
+    uint64_t pfn = buddy_alloc_pages(pages_needed, align_pages, zone, node);
+    if (pfn == 0) {
+        spin_unlock(&g_mm_state.lock);
+        
+        /* Frames parked in magazines or the zero pool may complete a block */
+        if (mm_magazine_drain() + mm_zero_pool_drain() == 0) {
+            return 0;  /* Allocation failed */
+        }
+        
+        spin_lock(&g_mm_state.lock);
+        pfn = buddy_alloc_pages(pages_needed, align_pages, zone, node);
+        if (pfn == 0) {
+            spin_unlock(&g_mm_state.lock);
+            return 0;
         }
     }
     
+    if (extent_insert(pfn, pages_needed, type, owner) != 0) {
+        buddy_release_range(pfn, pfn + pages_needed);
+        spin_unlock(&g_mm_state.lock);
+        return 0;
+    }
+    
+    g_mm_state.allocated_pages += pages_needed;
+    
     spin_unlock(&g_mm_state.lock);
     
-    return 0;  /* Allocation failed */
+    return pfn * PAGE_SIZE;
+}
+
+/*
+ * Allocate memory using the buddy free lists
+ */
+uint64_t mm_alloc(uint64_t size, uint64_t align, mem_type_t type, uint64_t owner) {
+    return mm_alloc_pages(mm_owner_node(owner), MM_NUM_ZONES - 1, size, align, type, owner);
+}
+
+/*
+ * Allocate memory from a zone or a lower one
+ */
+uint64_t mm_alloc_zone(uint32_t zone, uint64_t size, uint64_t align,
+                       mem_type_t type, uint64_t owner) {
+    return mm_alloc_pages(mm_owner_node(owner), zone, size, align, type, owner);
+}
+
+/*
+ * Allocate memory on a NUMA node, falling back to the nearest other nodes
+ */
+uint64_t mm_alloc_node(uint32_t node, uint64_t size, uint64_t align,
+                       mem_type_t type, uint64_t owner) {
+    return mm_alloc_pages(node, MM_NUM_ZONES - 1, size, align, type, owner);
+}
+
+/*
+ * Preferred node for an owner. Owners sharing a hint slot keep only the
+ * latest hint; the others fall back to the local node.
+ */
+uint32_t mm_owner_node(uint64_t owner) {
+    if (owner != 0) {
+        uint64_t hint = __atomic_load_n(&g_owner_nodes[owner % MM_OWNER_HINTS], __ATOMIC_RELAXED);
+        if ((hint >> 8) == owner) {
+            return (uint32_t)(hint & 0xFF);
+        }
+    }
+    return numa_current_node();
+}
+
+/*
+ * Set an owner's home node hint
+ */
+void mm_set_owner_node(uint64_t owner, uint32_t node) {
+    if (owner == 0) {
+        return;
+    }
+    
+    uint64_t *slot = &g_owner_nodes[owner % MM_OWNER_HINTS];
+    if (node == NUMA_NO_NODE) {
+        /* Drop the hint only if it is still this owner's */
+        uint64_t hint = __atomic_load_n(slot, __ATOMIC_RELAXED);
+        if ((hint >> 8) == owner) {
+            __atomic_compare_exchange_n(slot, &hint, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+    __atomic_store_n(slot, (owner << 8) | node, __ATOMIC_RELAXED);
+}
+
+/*
+ * Free the extent starting at a page (lock held)
+ */
+static int mm_free_locked(uint64_t page) {
+    if (page >= g_mm_state.total_pages) {
+        return -1;
+    }
+    
+    /* Only the start of an allocation extent can be freed, and not while
+     * it is parked in a magazine */
+    mem_extent_t *ext = extent_lookup(page);
+    if (ext == NULL || ext->base_pfn != page || page_is_parked(page)) {
+        return -1;
+    }
+    
+    uint64_t pages = ext->pages;
+    extent_delete(ext - g_mm_state.extents);
+    buddy_release_range(page, page + pages);
+    g_mm_state.allocated_pages -= pages;
+    
+    return 0;
 }
 
 /*
@@ -99,19 +744,122 @@ uint64_t mm_alloc(uint64_t size, uint64_t align, mem_type_t type, uint64_t owner
 int mm_free(uint64_t addr) {
     spin_lock(&g_mm_state.lock);
     
-    uint64_t page = addr / PAGE_SIZE;
+    int result = mm_free_locked(addr / PAGE_SIZE);
     
-    if (page >= g_mm_state.total_pages) {
+    spin_unlock(&g_mm_state.lock);
+    
+    return result;
+}
+
+/*
+ * Allocate up to count kernel blocks of one order under a single lock hold
+ */
+uint32_t mm_alloc_batch(uint32_t order, uint64_t *frames, uint32_t count) {
+    if (order > MM_MAX_ORDER || frames == NULL) {
+        return 0;
+    }
+    
+    uint64_t pages = 1ULL << order;
+    uint32_t node = numa_current_node();
+    uint32_t done = 0;
+    
+    spin_lock(&g_mm_state.lock);
+    
+    while (done < count) {
+        uint64_t pfn = buddy_alloc_pages(pages, pages, MM_NUM_ZONES - 1, node);
+        if (pfn == 0) {
+            break;
+        }
+        
+        if (extent_insert(pfn, pages, MEM_TYPE_KERNEL, 0) != 0) {
+            buddy_release_range(pfn, pfn + pages);
+            break;
+        }
+        
+        g_mm_state.allocated_pages += pages;
+        frames[done++] = pfn * PAGE_SIZE;
+    }
+    
+    spin_unlock(&g_mm_state.lock);
+    
+    return done;
+}
+
+/*
+ * Check a frame freed into a magazine the way mm_free would: it must
+ * head an allocation extent of exactly its order, so no page in the
+ * middle of a live allocation is ever parked and handed out again. Its
+ * first word is then set to the parked mark, so a second free of the
+ * frame (on any CPU) fails until it is handed out again. No metadata is
+ * kept per page for this.
+ */
+int mm_frame_cache(uint64_t addr, uint32_t order) {
+    uint64_t pfn = addr >> PAGE_SHIFT;
+    
+    if (order > MM_MAX_ORDER || pfn >= g_mm_state.total_pages) {
+        return -1;
+    }
+    
+    spin_lock(&g_mm_state.lock);
+    
+    mem_extent_t *ext = extent_lookup(pfn);
+    if (ext == NULL || ext->base_pfn != pfn || ext->pages != (1ULL << order) ||
+        page_is_parked(pfn)) {
         spin_unlock(&g_mm_state.lock);
+        return -1;  /* Not an allocation of this order, or already parked */
+    }
+    __atomic_store_n((uint64_t *)addr, MM_MAG_PARKED ^ addr, __ATOMIC_RELEASE);
+    
+    spin_unlock(&g_mm_state.lock);
+    
+    return 0;
+}
+
+/*
+ * Clear a frame's parked mark as it leaves its magazine
+ */
+void mm_frame_uncache(uint64_t addr) {
+    __atomic_store_n((uint64_t *)addr, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Free a set of allocations under a single lock hold; returns how many
+ * were freed (the others were not allocation heads)
+ */
+uint32_t mm_free_batch(const uint64_t *frames, uint32_t count) {
+    uint32_t freed = 0;
+    
+    spin_lock(&g_mm_state.lock);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        if (mm_free_locked(frames[i] / PAGE_SIZE) == 0) {
+            freed++;
+        }
+    }
+    
+    spin_unlock(&g_mm_state.lock);
+    
+    return freed;
+}
+
+/*
+ * Change the type and owner of the allocation starting at addr
+ */
+int mm_set_owner(uint64_t addr, mem_type_t type, uint64_t owner) {
+    if (type == MEM_TYPE_AVAILABLE || type == MEM_TYPE_RESERVED) {
         return -1;
     }
     
-    /* Mark frames as available */
-    g_mm_state.frames[page].type = MEM_TYPE_AVAILABLE;
-    g_mm_state.frames[page].owner = 0;
+    spin_lock(&g_mm_state.lock);
     
-    g_mm_state.available_pages++;
-    g_mm_state.allocated_pages--;
+    mem_extent_t *ext = extent_lookup(addr / PAGE_SIZE);
+    if (ext == NULL || ext->base_pfn != addr / PAGE_SIZE) {
+        spin_unlock(&g_mm_state.lock);
+        return -1;
+    }
+    
+    ext->type = type;
+    ext->owner = owner;
     
     spin_unlock(&g_mm_state.lock);
     
@@ -126,22 +874,55 @@ int mm_reserve(uint64_t base, uint64_t size, mem_type_t type, uint64_t owner) {
     
     uint64_t start_page = base / PAGE_SIZE;
     uint64_t num_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t end_page = start_page + num_pages;
     
-    for (uint64_t i = start_page; i < start_page + num_pages; i++) {
-        if (i >= g_mm_state.total_pages) {
-            spin_unlock(&g_mm_state.lock);
-            return -1;
-        }
-        
-        g_mm_state.frames[i].type = type;
-        g_mm_state.frames[i].owner = owner;
+    if (num_pages == 0 || end_page > g_mm_state.total_pages) {
+        spin_unlock(&g_mm_state.lock);
+        return -1;
     }
     
     if (type == MEM_TYPE_AVAILABLE) {
-        g_mm_state.available_pages += num_pages;
+        /* Hand reserved pages (used, but outside every extent) to the
+         * buddy allocator. Page 0 is never made available: address 0
+         * means failure. */
+        uint64_t page = (start_page == 0) ? 1 : start_page;
+        while (page < end_page) {
+            uint64_t run = bitmap_find(page, end_page, 1);
+            if (run >= end_page) {
+                break;
+            }
+            uint64_t run_end = bitmap_find(run, end_page, 0);
+            
+            uint64_t i = extent_search(run);
+            uint64_t cur = run;
+            while (cur < run_end) {
+                mem_extent_t *ext = &g_mm_state.extents[i];
+                if (i < g_mm_state.num_extents && ext->base_pfn <= cur) {
+                    cur = (uint64_t)ext->base_pfn + ext->pages;
+                    i++;
+                    continue;
+                }
+                uint64_t gap_end = run_end;
+                if (i < g_mm_state.num_extents && ext->base_pfn < run_end) {
+                    gap_end = ext->base_pfn;
+                }
+                buddy_release_range(cur, gap_end);
+                cur = gap_end;
+            }
+            
+            page = run_end;
+        }
     } else {
-        g_mm_state.available_pages -= num_pages;
-        g_mm_state.allocated_pages += num_pages;
+        buddy_carve_range(start_page, end_page);
+        g_mm_state.allocated_pages -= extent_remove_range(start_page, end_page);
+        
+        if (type != MEM_TYPE_RESERVED) {
+            if (extent_insert(start_page, num_pages, type, owner) != 0) {
+                spin_unlock(&g_mm_state.lock);
+                return -1;
+            }
+            g_mm_state.allocated_pages += num_pages;
+        }
     }
     
     spin_unlock(&g_mm_state.lock);
@@ -153,26 +934,39 @@ int mm_reserve(uint64_t base, uint64_t size, mem_type_t type, uint64_t owner) {
  * Get memory type
  */
 mem_type_t mm_get_type(uint64_t addr) {
-    uint64_t page = addr / PAGE_SIZE;
+    mem_frame_t frame;
     
-    if (page >= g_mm_state.total_pages) {
+    if (mm_get_frame(addr, &frame) != 0) {
         return MEM_TYPE_RESERVED;
     }
     
-    return g_mm_state.frames[page].type;
+    return frame.type;
 }
 
 /*
  * Get memory frame
  */
-mem_frame_t* mm_get_frame(uint64_t addr) {
+int mm_get_frame(uint64_t addr, mem_frame_t *frame) {
     uint64_t page = addr / PAGE_SIZE;
     
-    if (page >= g_mm_state.total_pages) {
-        return NULL;
+    if (frame == NULL || page >= g_mm_state.total_pages) {
+        return -1;
+    }
+    
+    spin_lock(&g_mm_state.lock);
+    
+    frame->type = MEM_TYPE_AVAILABLE;
+    frame->owner = 0;
+    
+    if (page_is_used(page)) {
+        mem_extent_t *ext = extent_lookup(page);
+        frame->type = ext ? (mem_type_t)ext->type : MEM_TYPE_RESERVED;
+        frame->owner = ext ? ext->owner : 0;
     }
     
-    return &g_mm_state.frames[page];
+    spin_unlock(&g_mm_state.lock);
+    
+    return 0;
 }
 
 /*
@@ -183,6 +977,13 @@ void mm_dump(void) {
     /* Simplified for now */
 }
 
+/*
+ * Get end of physical memory
+ */
+uint64_t mm_get_total(void) {
+    return g_mm_state.total_pages * PAGE_SIZE;
+}
+
 /*
  * Get available pages
  */
@@ -195,4 +996,34 @@ uint64_t mm_get_available(void) {
  */
 uint64_t mm_get_allocated(void) {
     return g_mm_state.allocated_pages * PAGE_SIZE;
+}
+
+/*
+ * Get available memory in a zone across all nodes
+ */
+uint64_t mm_get_zone_available(uint32_t zone) {
+    if (zone >= MM_NUM_ZONES) {
+        return 0;
+    }
+    
+    uint64_t pages = 0;
+    for (uint32_t node = 0; node < NUMA_MAX_NODES; node++) {
+        pages += g_mm_state.zones[node][zone].available_pages;
+    }
+    return pages * PAGE_SIZE;
+}
+
+/*
+ * Get available memory on a node
+ */
+uint64_t mm_get_node_available(uint32_t node) {
+    if (node >= NUMA_MAX_NODES) {
+        return 0;
+    }
+    
+    uint64_t pages = 0;
+    for (uint32_t zone = 0; zone < MM_NUM_ZONES; zone++) {
+        pages += g_mm_state.zones[node][zone].available_pages;
+    }
+    return pages * PAGE_SIZE;
 }
\ No newline at end of file
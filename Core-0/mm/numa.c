@@ -0,0 +1,309 @@
+/*
+ * HIK Core-0 NUMA Topology Implementation
+ * 
+ * Proximity domains from the SRAT are numbered densely in order of first
+ * appearance. Memory ranges are kept sorted and merged per node; an
+ * address belongs to the node of the last range starting at or below it,
+ * so holes between ranges never produce a node of their own.
+ */
+
+#include "../include/numa.h"
+#include "../include/acpi.h"
+#include "../include/string.h"
+
+/* Global NUMA topology */
+static numa_state_t g_numa;
+
+/*
+ * Map an ACPI proximity domain to a node index (new nodes on first use)
+ */
+static uint32_t numa_node_for_proximity(uint32_t proximity) {
+    for (uint32_t i = 0; i < g_numa.num_nodes; i++) {
+        if (g_numa.proximity[i] == proximity) {
+            return i;
+        }
+    }
+    
+    if (g_numa.num_nodes >= NUMA_MAX_NODES) {
+        return 0;  /* Fold extra domains into node 0 */
+    }
+    
+    g_numa.proximity[g_numa.num_nodes] = proximity;
+    return g_numa.num_nodes++;
+}
+
+/*
+ * Add a memory range, keeping the list sorted by base
+ */
+static void numa_add_range(uint64_t base, uint64_t end, uint32_t node) {
+    if (end <= base || g_numa.num_ranges >= NUMA_MAX_RANGES) {
+        return;
+    }
+    
+    uint32_t i = g_numa.num_ranges;
+    while (i > 0 && g_numa.ranges[i - 1].base > base) {
+        g_numa.ranges[i] = g_numa.ranges[i - 1];
+        i--;
+    }
+    
+    g_numa.ranges[i].base = base;
+    g_numa.ranges[i].end = end;
+    g_numa.ranges[i].node = node;
+    g_numa.ranges[i].reserved = 0;
+    g_numa.num_ranges++;
+}
+
+/*
+ * Merge neighbouring ranges of the same node
+ */
+static void numa_merge_ranges(void) {
+    uint32_t out = 0;
+    
+    for (uint32_t i = 0; i < g_numa.num_ranges; i++) {
+        if (out > 0 && g_numa.ranges[out - 1].node == g_numa.ranges[i].node) {
+            if (g_numa.ranges[i].end > g_numa.ranges[out - 1].end) {
+                g_numa.ranges[out - 1].end = g_numa.ranges[i].end;
+            }
+            continue;
+        }
+        g_numa.ranges[out++] = g_numa.ranges[i];
+    }
+    
+    g_numa.num_ranges = out;
+}
+
+/*
+ * Record a CPU affinity
+ */
+static void numa_add_cpu(uint32_t apic_id, uint32_t node) {
+    if (g_numa.num_cpus < MAX_CPUS) {
+        g_numa.cpus[g_numa.num_cpus].apic_id = apic_id;
+        g_numa.cpus[g_numa.num_cpus].node = node;
+        g_numa.num_cpus++;
+    }
+}
+
+/*
+ * Parse the SRAT
+ */
+static void numa_parse_srat(const acpi_srat_t *srat) {
+    const uint8_t *p = (const uint8_t *)srat + sizeof(acpi_srat_t);
+    const uint8_t *end = (const uint8_t *)srat + srat->header.length;
+    
+    while (p + sizeof(acpi_srat_entry_t) <= end) {
+        const acpi_srat_entry_t *entry = (const acpi_srat_entry_t *)p;
+        if (entry->length < sizeof(acpi_srat_entry_t) || p + entry->length > end) {
+            break;
+        }
+        
+        if (entry->type == ACPI_SRAT_CPU_AFFINITY && entry->length >= sizeof(acpi_srat_cpu_t)) {
+            const acpi_srat_cpu_t *cpu = (const acpi_srat_cpu_t *)p;
+            if (cpu->flags & ACPI_SRAT_ENABLED) {
+                uint32_t proximity = cpu->proximity_low |
+                                     ((uint32_t)cpu->proximity_high[0] << 8) |
+                                     ((uint32_t)cpu->proximity_high[1] << 16) |
+                                     ((uint32_t)cpu->proximity_high[2] << 24);
+                numa_add_cpu(cpu->apic_id, numa_node_for_proximity(proximity));
+            }
+        } else if (entry->type == ACPI_SRAT_MEMORY_AFFINITY &&
+                   entry->length >= sizeof(acpi_srat_memory_t)) {
+            const acpi_srat_memory_t *mem = (const acpi_srat_memory_t *)p;
+            if ((mem->flags & ACPI_SRAT_ENABLED) && mem->length != 0) {
+                numa_add_range(mem->base, mem->base + mem->length,
+                               numa_node_for_proximity(mem->proximity));
+            }
+        } else if (entry->type == ACPI_SRAT_X2APIC_AFFINITY &&
+                   entry->length >= sizeof(acpi_srat_x2apic_t)) {
+            const acpi_srat_x2apic_t *cpu = (const acpi_srat_x2apic_t *)p;
+            if (cpu->flags & ACPI_SRAT_ENABLED) {
+                numa_add_cpu(cpu->x2apic_id, numa_node_for_proximity(cpu->proximity));
+            }
+        }
+        
+        p += entry->length;
+    }
+    
+    numa_merge_ranges();
+}
+
+/*
+ * Fill distances from the SLIT (defaults when absent)
+ */
+static void numa_parse_slit(const acpi_slit_t *slit) {
+    for (uint32_t i = 0; i < g_numa.num_nodes; i++) {
+        for (uint32_t j = 0; j < g_numa.num_nodes; j++) {
+            uint32_t from = g_numa.proximity[i];
+            uint32_t to = g_numa.proximity[j];
+            
+            if (slit != NULL && from < slit->localities && to < slit->localities) {
+                g_numa.distance[i][j] = slit->distance[from * slit->localities + to];
+            } else {
+                g_numa.distance[i][j] = (i == j) ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+            }
+        }
+    }
+}
+
+/*
+ * Build each node's fallback list (nearest first, ties by index)
+ */
+static void numa_build_fallback(void) {
+    for (uint32_t n = 0; n < g_numa.num_nodes; n++) {
+        uint32_t *list = g_numa.fallback[n];
+        
+        for (uint32_t i = 0; i < g_numa.num_nodes; i++) {
+            uint32_t j = i;
+            while (j > 0 && g_numa.distance[n][list[j - 1]] > g_numa.distance[n][i]) {
+                list[j] = list[j - 1];
+                j--;
+            }
+            list[j] = i;
+        }
+    }
+}
+
+/*
+ * Read the local APIC ID of the current CPU
+ */
+static uint32_t numa_read_apic_id(void) {
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return ebx >> 24;
+}
+
+/*
+ * Build the topology from ACPI
+ */
+int numa_init(void) {
+    memset(&g_numa, 0, sizeof(numa_state_t));
+    
+    const acpi_srat_t *srat = (const acpi_srat_t *)acpi_find_table("SRAT");
+    if (srat != NULL) {
+        numa_parse_srat(srat);
+    }
+    
+    /* No (usable) SRAT: one node spanning all memory */
+    if (g_numa.num_nodes == 0 || g_numa.num_ranges == 0) {
+        memset(&g_numa, 0, sizeof(numa_state_t));
+        g_numa.num_nodes = 1;
+    }
+    
+    numa_parse_slit((const acpi_slit_t *)acpi_find_table("SLIT"));
+    numa_build_fallback();
+    
+    /* Boot CPU; application processors are set during bring-up */
+    g_numa.cpu_node[0] = numa_node_of_apic(numa_read_apic_id());
+    
+    return 0;
+}
+
+/*
+ * Get number of nodes
+ */
+uint32_t numa_num_nodes(void) {
+    return g_numa.num_nodes ? g_numa.num_nodes : 1;
+}
+
+/*
+ * Index of the last range starting at or below addr (num_ranges if none)
+ */
+static uint32_t numa_range_index(uint64_t addr) {
+    uint32_t lo = 0;
+    uint32_t hi = g_numa.num_ranges;
+    
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (g_numa.ranges[mid].base <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    return (lo == 0) ? g_numa.num_ranges : lo - 1;
+}
+
+/*
+ * Get node owning a physical address
+ */
+uint32_t numa_node_of_addr(uint64_t addr) {
+    if (g_numa.num_ranges == 0) {
+        return 0;
+    }
+    
+    uint32_t i = numa_range_index(addr);
+    if (i == g_numa.num_ranges) {
+        return g_numa.ranges[0].node;  /* Below the first range */
+    }
+    
+    return g_numa.ranges[i].node;
+}
+
+/*
+ * Get the next address above addr where the owning node changes
+ */
+uint64_t numa_node_boundary(uint64_t addr) {
+    if (g_numa.num_ranges == 0) {
+        return ~0ULL;
+    }
+    
+    uint32_t i = numa_range_index(addr);
+    uint32_t next = (i == g_numa.num_ranges) ? 1 : i + 1;
+    
+    return (next < g_numa.num_ranges) ? g_numa.ranges[next].base : ~0ULL;
+}
+
+/*
+ * Get node of an APIC ID
+ */
+uint32_t numa_node_of_apic(uint32_t apic_id) {
+    for (uint32_t i = 0; i < g_numa.num_cpus; i++) {
+        if (g_numa.cpus[i].apic_id == apic_id) {
+            return g_numa.cpus[i].node;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Set the node of a CPU index
+ */
+void numa_set_cpu_node(uint32_t cpu, uint32_t node) {
+    if (cpu < MAX_CPUS && node < numa_num_nodes()) {
+        g_numa.cpu_node[cpu] = node;
+    }
+}
+
+/*
+ * Get the node of a CPU index
+ */
+uint32_t numa_cpu_node(uint32_t cpu) {
+    return (cpu < MAX_CPUS) ? g_numa.cpu_node[cpu] : 0;
+}
+
+/*
+ * Get node of the current CPU
+ */
+uint32_t numa_current_node(void) {
+    return g_numa.cpu_node[cpu_current_id()];
+}
+
+/*
+ * Get distance between two nodes
+ */
+uint32_t numa_distance(uint32_t from, uint32_t to) {
+    if (from >= numa_num_nodes() || to >= numa_num_nodes()) {
+        return 0xFF;
+    }
+    return g_numa.distance[from][to];
+}
+
+/*
+ * Get all nodes ordered by distance from a node
+ */
+const uint32_t* numa_fallback_list(uint32_t node) {
+    if (node >= numa_num_nodes()) {
+        node = 0;
+    }
+    return g_numa.fallback[node];
+}
@@ -0,0 +1,550 @@
+/*
+ * HIK Core-0 Slab Allocator Implementation
+ * 
+ * A slab is a naturally aligned buddy block laid out as
+ * 
+ *   [ header | free index stack | colour | object 0 | object 1 | ... ]
+ * 
+ * The slab owning an object is found by masking the object address. Free
+ * objects are tracked by index in the header rather than through a link
+ * stored in the object, so the constructed state of a cached object is
+ * never overwritten. Successive slabs start their objects at different
+ * cache-line offsets (colours) so that objects at the same index in
+ * different slabs do not compete for the same cache sets.
+ */
+
+#include "../include/slab.h"
+#include "../include/mm.h"
+#include "../include/smp.h"
+#include "../include/string.h"
+
+/* Slab header */
+struct kmem_slab {
+    kmem_slab_t *next;         /* Next slab on the cache list */
+    kmem_slab_t *prev;         /* Previous slab on the cache list */
+    kmem_cache_t *cache;       /* Owning cache */
+    uint64_t objects;          /* Address of object 0 */
+    uint32_t inuse;            /* Allocated objects */
+    uint32_t free_top;         /* Entries on the free index stack */
+    uint16_t free_stack[];     /* Free object indices */
+};
+
+/* Largest object index representable on the free stack */
+#define KMEM_MAX_OBJECTS 0xFFFF
+
+/* Free ID link stored in an ID table slot */
+#define KMEM_FREE_LINK(id) ((void*)(((id) << 1) | 1))
+#define KMEM_IS_FREE_LINK(slot) (((uint64_t)(slot) & 1) != 0)
+
+/* Memory waiting for a grace period */
+typedef struct kmem_deferred {
+    struct kmem_deferred *next;    /* Next older entry */
+    uint64_t epoch;                /* Epoch it was retired at */
+    kmem_cache_t *cache;           /* Owning cache (NULL: mm_alloc block) */
+    void *obj;                     /* Object or block */
+} kmem_deferred_t;
+
+/* Last epoch each CPU passed a quiescent point at */
+typedef struct {
+    uint64_t epoch;
+} __attribute__((aligned(CACHE_LINE_SIZE))) kmem_quiet_t;
+
+static uint64_t g_kmem_epoch = 1;              /* Bumped at each retire */
+static kmem_quiet_t g_kmem_quiet[MAX_CPUS];
+static kmem_deferred_t *g_kmem_deferred;       /* Newest first */
+static kmem_cache_t g_kmem_deferred_cache;     /* Entries (set up on first use) */
+static uint64_t g_kmem_deferred_lock;
+
+/* Spinlock operations */
+static inline void spin_lock(uint64_t *lock) {
+    while (__sync_lock_test_and_set(lock, 1)) {
+        /* Spin */
+    }
+}
+
+static inline void spin_unlock(uint64_t *lock) {
+    __sync_lock_release(lock);
+}
+
+static inline uint64_t align_up(uint64_t value, uint64_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+/* Colour offsets are whole cache lines (or whole alignment units if larger) */
+static inline uint64_t colour_step(const kmem_cache_t *cache) {
+    return cache->align > CACHE_LINE_SIZE ? cache->align : CACHE_LINE_SIZE;
+}
+
+/*
+ * Compute how many objects fit in a slab; returns the unused bytes
+ */
+static uint64_t slab_layout(uint64_t slab_bytes, uint64_t size, uint64_t align,
+                            uint32_t *count) {
+    uint64_t n = (slab_bytes - sizeof(kmem_slab_t)) / (size + sizeof(uint16_t));
+    
+    if (n > KMEM_MAX_OBJECTS) {
+        n = KMEM_MAX_OBJECTS;
+    }
+    
+    while (n > 0 &&
+           align_up(sizeof(kmem_slab_t) + n * sizeof(uint16_t), align) + n * size > slab_bytes) {
+        n--;
+    }
+    
+    *count = (uint32_t)n;
+    if (n == 0) {
+        return 0;
+    }
+    
+    return slab_bytes - align_up(sizeof(kmem_slab_t) + n * sizeof(uint16_t), align) - n * size;
+}
+
+/*
+ * Slab list operations
+ */
+static void slab_list_add(kmem_slab_t **head, kmem_slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void slab_list_del(kmem_slab_t **head, kmem_slab_t *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+/*
+ * Create a slab and construct its objects (cache lock held)
+ */
+static kmem_slab_t* slab_create(kmem_cache_t *cache) {
+    uint64_t base = mm_alloc_frame(cache->slab_order);
+    if (base == 0) {
+        return NULL;
+    }
+    
+    uint32_t count = cache->objects_per_slab;
+    kmem_slab_t *slab = (kmem_slab_t*)base;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free_top = count;
+    slab->objects = align_up(base + sizeof(kmem_slab_t) + count * sizeof(uint16_t), cache->align) +
+                    cache->colour_next * colour_step(cache);
+    
+    cache->colour_next++;
+    if (cache->colour_next >= cache->colour_count) {
+        cache->colour_next = 0;
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        /* Hand out low indices first */
+        slab->free_stack[i] = (uint16_t)(count - 1 - i);
+        
+        if (cache->ctor) {
+            cache->ctor((void*)(slab->objects + i * cache->object_size));
+        }
+    }
+    
+    cache->num_slabs++;
+    
+    return slab;
+}
+
+/*
+ * Take up to count objects from the slabs (cache lock held)
+ */
+static uint32_t cache_refill(kmem_cache_t *cache, void **objects, uint32_t count) {
+    uint32_t got = 0;
+    
+    while (got < count) {
+        kmem_slab_t *slab = cache->partial;
+        
+        if (slab == NULL) {
+            slab = cache->empty;
+            if (slab) {
+                slab_list_del(&cache->empty, slab);
+                cache->num_empty--;
+            } else {
+                slab = slab_create(cache);
+                if (slab == NULL) {
+                    break;
+                }
+            }
+            slab_list_add(&cache->partial, slab);
+        }
+        
+        while (got < count && slab->free_top > 0) {
+            uint16_t index = slab->free_stack[--slab->free_top];
+            objects[got++] = (void*)(slab->objects + index * cache->object_size);
+            slab->inuse++;
+        }
+        
+        if (slab->free_top == 0) {
+            slab_list_del(&cache->partial, slab);
+            slab_list_add(&cache->full, slab);
+        }
+    }
+    
+    cache->active_objects += got;
+    
+    return got;
+}
+
+/*
+ * Return one object to its slab (cache lock held)
+ */
+static void cache_release(kmem_cache_t *cache, void *obj) {
+    uint64_t slab_mask = (PAGE_SIZE << cache->slab_order) - 1;
+    kmem_slab_t *slab = (kmem_slab_t*)((uint64_t)obj & ~slab_mask);
+    uint64_t index = ((uint64_t)obj - slab->objects) / cache->object_size;
+    
+    if (slab->free_top == 0) {
+        slab_list_del(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+    
+    slab->free_stack[slab->free_top++] = (uint16_t)index;
+    slab->inuse--;
+    cache->active_objects--;
+    
+    if (slab->inuse == 0) {
+        slab_list_del(&cache->partial, slab);
+        
+        if (cache->num_empty >= KMEM_MAX_EMPTY_SLABS) {
+            cache->num_slabs--;
+            mm_free_frame((uint64_t)slab, cache->slab_order);
+        } else {
+            slab_list_add(&cache->empty, slab);
+            cache->num_empty++;
+        }
+    }
+}
+
+/*
+ * Initialize an object cache
+ */
+int kmem_cache_init(kmem_cache_t *cache, const char *name, uint64_t size,
+                    uint64_t align, void (*ctor)(void *obj)) {
+    if (cache == NULL || size == 0) {
+        return -1;
+    }
+    
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+    
+    if ((align & (align - 1)) != 0) {
+        return -1;
+    }
+    
+    memset(cache, 0, sizeof(kmem_cache_t));
+    
+    if (name) {
+        strncpy(cache->name, name, KMEM_NAME_LEN - 1);
+    }
+    cache->object_size = align_up(size, align);
+    cache->align = align;
+    cache->ctor = ctor;
+    
+    /* Use the smallest slab that holds KMEM_MIN_OBJECTS objects */
+    uint32_t order;
+    uint64_t unused = 0;
+    for (order = 0; order < MM_NUM_ORDERS; order++) {
+        unused = slab_layout(PAGE_SIZE << order, cache->object_size, align,
+                             &cache->objects_per_slab);
+        if (cache->objects_per_slab >= KMEM_MIN_OBJECTS) {
+            break;
+        }
+    }
+    
+    if (order >= MM_NUM_ORDERS) {
+        return -1;
+    }
+    
+    cache->slab_order = order;
+    cache->colour_count = (uint32_t)(unused / colour_step(cache)) + 1;
+    cache->colour_next = 0;
+    
+    return 0;
+}
+
+/*
+ * Allocate an object
+ */
+void* kmem_cache_alloc(kmem_cache_t *cache) {
+    if (cache == NULL) {
+        return NULL;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    kmem_cpu_cache_t *cpu = &cache->cpu[cpu_current_id()];
+    
+    if (cpu->count == 0) {
+        /* Refill half the free list from the slabs */
+        spin_lock(&cache->lock);
+        cpu->count = cache_refill(cache, cpu->objects, KMEM_CPU_CACHE_SIZE / 2);
+        spin_unlock(&cache->lock);
+        
+        if (cpu->count == 0) {
+            cpu_irq_restore(flags);
+            return NULL;
+        }
+    }
+    
+    void *obj = cpu->objects[--cpu->count];
+    
+    cpu_irq_restore(flags);
+    
+    return obj;
+}
+
+/*
+ * Free an object
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (cache == NULL || obj == NULL) {
+        return;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    kmem_cpu_cache_t *cpu = &cache->cpu[cpu_current_id()];
+    
+    if (cpu->count >= KMEM_CPU_CACHE_SIZE) {
+        /* Return the oldest half, keeping recently freed (cache-hot) objects */
+        uint32_t batch = KMEM_CPU_CACHE_SIZE / 2;
+        
+        spin_lock(&cache->lock);
+        for (uint32_t i = 0; i < batch; i++) {
+            cache_release(cache, cpu->objects[i]);
+        }
+        spin_unlock(&cache->lock);
+        
+        memmove(cpu->objects, &cpu->objects[batch], (cpu->count - batch) * sizeof(void*));
+        cpu->count -= batch;
+    }
+    
+    cpu->objects[cpu->count++] = obj;
+    
+    cpu_irq_restore(flags);
+}
+
+/*
+ * Flush the current CPU's free list and release empty slabs
+ */
+uint64_t kmem_cache_shrink(kmem_cache_t *cache) {
+    if (cache == NULL) {
+        return 0;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    kmem_cpu_cache_t *cpu = &cache->cpu[cpu_current_id()];
+    uint64_t released = 0;
+    
+    spin_lock(&cache->lock);
+    
+    for (uint32_t i = 0; i < cpu->count; i++) {
+        cache_release(cache, cpu->objects[i]);
+    }
+    cpu->count = 0;
+    
+    while (cache->empty) {
+        kmem_slab_t *slab = cache->empty;
+        slab_list_del(&cache->empty, slab);
+        cache->num_empty--;
+        cache->num_slabs--;
+        mm_free_frame((uint64_t)slab, cache->slab_order);
+        released++;
+    }
+    
+    spin_unlock(&cache->lock);
+    cpu_irq_restore(flags);
+    
+    return released;
+}
+
+/*
+ * Free an object once every online CPU has passed a quiescent point
+ * after this call. The epoch is bumped after the object was unlinked, so
+ * a CPU that has seen the new epoch can no longer find it. If no entry
+ * can be allocated the object is kept (leaked) rather than freed early.
+ */
+void kmem_defer_free(kmem_cache_t *cache, void *obj) {
+    if (obj == NULL) {
+        return;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&g_kmem_deferred_lock);
+    
+    if (g_kmem_deferred_cache.object_size == 0 &&
+        kmem_cache_init(&g_kmem_deferred_cache, "deferred", sizeof(kmem_deferred_t), 8, NULL) != 0) {
+        spin_unlock(&g_kmem_deferred_lock);
+        cpu_irq_restore(flags);
+        return;
+    }
+    
+    kmem_deferred_t *entry = kmem_cache_alloc(&g_kmem_deferred_cache);
+    if (entry != NULL) {
+        entry->epoch = __atomic_add_fetch(&g_kmem_epoch, 1, __ATOMIC_ACQ_REL);
+        entry->cache = cache;
+        entry->obj = obj;
+        entry->next = g_kmem_deferred;
+        __atomic_store_n(&g_kmem_deferred, entry, __ATOMIC_RELEASE);
+    }
+    
+    spin_unlock(&g_kmem_deferred_lock);
+    cpu_irq_restore(flags);
+}
+
+/*
+ * Record a quiescent point of the calling CPU and free the entries every
+ * online CPU has passed one since (CPUs not yet online hold nothing)
+ */
+void kmem_quiesce(void) {
+    uint64_t epoch = __atomic_load_n(&g_kmem_epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&g_kmem_quiet[cpu_current_id()].epoch, epoch, __ATOMIC_RELEASE);
+    
+    /* Only one CPU reclaims at a time; the others just record */
+    if (__atomic_load_n(&g_kmem_deferred, __ATOMIC_RELAXED) == NULL ||
+        __sync_lock_test_and_set(&g_kmem_deferred_lock, 1)) {
+        return;
+    }
+    
+    uint64_t safe = epoch;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        uint64_t seen = __atomic_load_n(&g_kmem_quiet[cpu].epoch, __ATOMIC_ACQUIRE);
+        if (smp_cpu_online(cpu) && seen < safe) {
+            safe = seen;
+        }
+    }
+    
+    /* Entries are newest first: cut the list at the first one old enough */
+    kmem_deferred_t **link = &g_kmem_deferred;
+    while (*link != NULL && (*link)->epoch > safe) {
+        link = &(*link)->next;
+    }
+    kmem_deferred_t *expired = *link;
+    *link = NULL;
+    
+    while (expired != NULL) {
+        kmem_deferred_t *next = expired->next;
+        if (expired->cache != NULL) {
+            kmem_cache_free(expired->cache, expired->obj);
+        } else {
+            mm_free((uint64_t)expired->obj);
+        }
+        kmem_cache_free(&g_kmem_deferred_cache, expired);
+        expired = next;
+    }
+    
+    spin_unlock(&g_kmem_deferred_lock);
+}
+
+/*
+ * Grow a table's slot array to hold an index. Readers may still hold the
+ * old array: the new one is filled in before it is published (slots
+ * before capacity) and the old one is freed after a grace period.
+ */
+static int kmem_table_grow(kmem_table_t *table, uint64_t index) {
+    uint64_t capacity = table->capacity ? table->capacity : KMEM_TABLE_MIN_SLOTS;
+    while (capacity <= index) {
+        capacity *= 2;
+    }
+    
+    uint64_t bytes = capacity * sizeof(void*);
+    uint64_t addr = mm_alloc(bytes, PAGE_SIZE, MEM_TYPE_KERNEL, 0);
+    if (addr == 0) {
+        return -1;
+    }
+    
+    void **slots = (void**)addr;
+    memset(slots, 0, bytes);
+    
+    void **old = table->slots;
+    if (old) {
+        memcpy(slots, old, table->capacity * sizeof(void*));
+    }
+    
+    __atomic_store_n(&table->slots, slots, __ATOMIC_RELEASE);
+    __atomic_store_n(&table->capacity, capacity, __ATOMIC_RELEASE);
+    kmem_defer_free(NULL, old);
+    
+    return 0;
+}
+
+/*
+ * Store an object under a free ID: the most recently removed one, else
+ * the next never used
+ */
+uint64_t kmem_table_insert(kmem_table_t *table, void *obj) {
+    if (table == NULL || obj == NULL) {
+        return 0;
+    }
+    
+    uint64_t index = table->free_id;
+    if (index != 0) {
+        table->free_id = (uint64_t)table->slots[index] >> 1;
+    } else {
+        index = table->end ? table->end : 1;
+        if (index >= table->capacity && kmem_table_grow(table, index) != 0) {
+            return 0;
+        }
+        table->end = index + 1;
+    }
+    
+    __atomic_store_n(&table->slots[index], obj, __ATOMIC_RELEASE);
+    
+    return index;
+}
+
+/*
+ * Remove the object at an ID, linking the ID onto the free list
+ */
+void kmem_table_remove(kmem_table_t *table, uint64_t index) {
+    if (table == NULL || index == 0 || index >= table->end ||
+        table->slots[index] == NULL || KMEM_IS_FREE_LINK(table->slots[index])) {
+        return;
+    }
+    
+    __atomic_store_n(&table->slots[index], KMEM_FREE_LINK(table->free_id), __ATOMIC_RELEASE);
+    table->free_id = index;
+}
+
+/*
+ * Look up an object by ID
+ */
+void* kmem_table_get(const kmem_table_t *table, uint64_t index) {
+    if (table == NULL) {
+        return NULL;
+    }
+    
+    /* Capacity before slots: a capacity seen comes with its array */
+    uint64_t capacity = __atomic_load_n(&table->capacity, __ATOMIC_ACQUIRE);
+    if (index >= capacity) {
+        return NULL;
+    }
+    
+    void **slots = __atomic_load_n(&table->slots, __ATOMIC_ACQUIRE);
+    void *obj = __atomic_load_n(&slots[index], __ATOMIC_ACQUIRE);
+    
+    return KMEM_IS_FREE_LINK(obj) ? NULL : obj;
+}
+
+/*
+ * Get one past the highest ID handed out
+ */
+uint64_t kmem_table_end(const kmem_table_t *table) {
+    return table ? __atomic_load_n(&table->end, __ATOMIC_ACQUIRE) : 0;
+}
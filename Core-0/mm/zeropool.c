@@ -0,0 +1,280 @@
+/*
+ * HIK Core-0 Pre-Zeroed Frame Pool
+ * 
+ * Page tables and process images must start out zeroed. Instead of
+ * clearing them on the allocation path, the idle thread zeroes free
+ * blocks ahead of time with non-temporal stores (so the work does not
+ * evict the running threads' cache lines) and parks them here.
+ * mm_alloc_zeroed takes from the pool first and only zeroes inline when
+ * the pool is empty. Each NUMA node has its own pools, filled by idle
+ * CPUs on that node with node-local memory.
+ */
+
+#include "../include/mm.h"
+#include "../include/cpu.h"
+#include "../include/string.h"
+
+/* Pool of zeroed blocks of one order */
+typedef struct {
+    uint32_t order;                      /* Block order */
+    uint32_t capacity;                   /* Maximum pooled blocks */
+    uint32_t count;                      /* Pooled blocks */
+    uint32_t reserved;                   /* Reserved for future use */
+    mm_zero_stats_t stats;               /* Hit/miss counters */
+    uint64_t *blocks;                    /* Block addresses */
+    uint64_t lock;                       /* Spinlock */
+} mm_zero_pool_t;
+
+#define ZERO_POOL_COUNT 2
+
+static uint64_t g_zero_small[NUMA_MAX_NODES][MM_ZERO_POOL_SMALL];
+static uint64_t g_zero_large[NUMA_MAX_NODES][MM_ZERO_POOL_LARGE];
+
+static mm_zero_pool_t g_zero_pools[NUMA_MAX_NODES][ZERO_POOL_COUNT];
+
+/* Spinlock operations */
+static inline void spin_lock(uint64_t *lock) {
+    while (__sync_lock_test_and_set(lock, 1)) {
+        /* Spin */
+    }
+}
+
+static inline void spin_unlock(uint64_t *lock) {
+    __sync_lock_release(lock);
+}
+
+/*
+ * Initialize the per-node pools
+ */
+void mm_zero_pool_init(void) {
+    memset(g_zero_pools, 0, sizeof(g_zero_pools));
+    
+    for (uint32_t node = 0; node < NUMA_MAX_NODES; node++) {
+        mm_zero_pool_t *pools = g_zero_pools[node];
+        
+        pools[0].order = MM_ZERO_ORDER_SMALL;
+        pools[0].capacity = MM_ZERO_POOL_SMALL;
+        pools[0].blocks = g_zero_small[node];
+        
+        pools[1].order = MM_ZERO_ORDER_LARGE;
+        pools[1].capacity = MM_ZERO_POOL_LARGE;
+        pools[1].blocks = g_zero_large[node];
+    }
+}
+
+/*
+ * Get the pool index for an order (ZERO_POOL_COUNT if the order is not pooled)
+ */
+static uint32_t zero_pool_index(uint32_t order) {
+    uint32_t i = 0;
+    while (i < ZERO_POOL_COUNT && g_zero_pools[0][i].order != order) {
+        i++;
+    }
+    return i;
+}
+
+/*
+ * Zero pages with non-temporal stores (bypasses the cache)
+ */
+static void zero_pages_nt(uint64_t addr, uint64_t pages) {
+    uint64_t *p = (uint64_t *)addr;
+    uint64_t *end = p + pages * (PAGE_SIZE / sizeof(uint64_t));
+    
+    for (; p < end; p += 8) {
+        __asm__ volatile(
+            "movnti %1, 0(%0)\n"
+            "movnti %1, 8(%0)\n"
+            "movnti %1, 16(%0)\n"
+            "movnti %1, 24(%0)\n"
+            "movnti %1, 32(%0)\n"
+            "movnti %1, 40(%0)\n"
+            "movnti %1, 48(%0)\n"
+            "movnti %1, 56(%0)\n"
+            : : "r"(p), "r"(0ULL) : "memory");
+    }
+    
+    /* Order the weakly-ordered stores before the block is published */
+    __asm__ volatile("sfence" : : : "memory");
+}
+
+/*
+ * Zero pages through the cache (the caller is about to use them)
+ */
+static void zero_pages(uint64_t addr, uint64_t pages) {
+    uint64_t count = pages * (PAGE_SIZE / sizeof(uint64_t));
+    
+    __asm__ volatile("rep stosq"
+                     : "+D"(addr), "+c"(count)
+                     : "a"(0ULL)
+                     : "memory");
+}
+
+/*
+ * Take a zeroed block from a pool (0 if empty)
+ */
+static uint64_t zero_pool_pop(mm_zero_pool_t *pool) {
+    uint64_t addr = 0;
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&pool->lock);
+    
+    if (pool->count > 0) {
+        addr = pool->blocks[--pool->count];
+        pool->stats.hits++;
+    } else {
+        pool->stats.misses++;
+    }
+    
+    spin_unlock(&pool->lock);
+    cpu_irq_restore(flags);
+    
+    return addr;
+}
+
+/*
+ * Allocate zeroed memory, taking pre-zeroed blocks from the pool first
+ */
+uint64_t mm_alloc_zeroed(uint64_t size, uint64_t align, mem_type_t type, uint64_t owner) {
+    return mm_alloc_zeroed_node(mm_owner_node(owner), size, align, type, owner);
+}
+
+/*
+ * Allocate zeroed memory on a node
+ */
+uint64_t mm_alloc_zeroed_node(uint32_t node, uint64_t size, uint64_t align,
+                              mem_type_t type, uint64_t owner) {
+    if (size == 0 || node >= numa_num_nodes()) {
+        return 0;
+    }
+    
+    uint64_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    
+    /* Only requests that are exactly one pooled block can use the pool */
+    for (uint32_t i = 0; i < ZERO_POOL_COUNT; i++) {
+        mm_zero_pool_t *pool = &g_zero_pools[node][i];
+        uint64_t block_pages = 1ULL << pool->order;
+        
+        if (pages != block_pages || align > block_pages * PAGE_SIZE) {
+            continue;
+        }
+        
+        uint64_t addr = zero_pool_pop(pool);
+        if (addr != 0) {
+            if ((type != MEM_TYPE_KERNEL || owner != 0) &&
+                mm_set_owner(addr, type, owner) != 0) {
+                mm_free(addr);
+                return 0;
+            }
+            return addr;
+        }
+        
+        if (type == MEM_TYPE_KERNEL && owner == 0 && node == numa_current_node()) {
+            /* Keep local kernel frames on the magazine path */
+            addr = mm_alloc_frame(pool->order);
+            if (addr != 0) {
+                zero_pages(addr, pages);
+            }
+            return addr;
+        }
+        break;
+    }
+    
+    uint64_t addr = mm_alloc_node(node, size, align, type, owner);
+    if (addr != 0) {
+        zero_pages(addr, pages);
+    }
+    
+    return addr;
+}
+
+/*
+ * Zero free blocks into the current node's pools; returns pages zeroed
+ */
+uint64_t mm_zero_pool_refill(uint64_t max_pages) {
+    uint32_t node = numa_current_node();
+    uint64_t zeroed = 0;
+    
+    for (uint32_t i = 0; i < ZERO_POOL_COUNT; i++) {
+        mm_zero_pool_t *pool = &g_zero_pools[node][i];
+        uint64_t block_pages = 1ULL << pool->order;
+        
+        while (zeroed + block_pages <= max_pages && pool->count < pool->capacity) {
+            uint64_t addr;
+            if (mm_alloc_batch(pool->order, &addr, 1) == 0) {
+                return zeroed;  /* Out of free memory */
+            }
+            if (numa_node_of_addr(addr) != node) {
+                mm_free(addr);
+                return zeroed;  /* Node exhausted; do not pool remote memory */
+            }
+            
+            /* Zero outside the pool lock; the block is private until pushed */
+            zero_pages_nt(addr, block_pages);
+            zeroed += block_pages;
+            
+            uint64_t flags = cpu_irq_save();
+            spin_lock(&pool->lock);
+            
+            int pushed = 0;
+            if (pool->count < pool->capacity) {
+                pool->blocks[pool->count++] = addr;
+                pool->stats.refills++;
+                pushed = 1;
+            }
+            
+            spin_unlock(&pool->lock);
+            cpu_irq_restore(flags);
+            
+            if (!pushed) {
+                mm_free(addr);
+            }
+        }
+    }
+    
+    return zeroed;
+}
+
+/*
+ * Return all pooled blocks on every node to the global pool
+ */
+uint64_t mm_zero_pool_drain(void) {
+    uint64_t drained = 0;
+    
+    for (uint32_t i = 0; i < NUMA_MAX_NODES * ZERO_POOL_COUNT; i++) {
+        mm_zero_pool_t *pool = &g_zero_pools[i / ZERO_POOL_COUNT][i % ZERO_POOL_COUNT];
+        
+        uint64_t flags = cpu_irq_save();
+        spin_lock(&pool->lock);
+        
+        uint32_t count = mm_free_batch(pool->blocks, pool->count);
+        pool->stats.drains += count;
+        pool->count = 0;
+        
+        spin_unlock(&pool->lock);
+        cpu_irq_restore(flags);
+        
+        drained += count;
+    }
+    
+    return drained;
+}
+
+/*
+ * Get zero pool statistics for an order, summed over all nodes
+ */
+int mm_zero_pool_get_stats(uint32_t order, mm_zero_stats_t *stats) {
+    uint32_t i = zero_pool_index(order);
+    
+    if (i == ZERO_POOL_COUNT || stats == NULL) {
+        return -1;
+    }
+    
+    memset(stats, 0, sizeof(mm_zero_stats_t));
+    for (uint32_t node = 0; node < NUMA_MAX_NODES; node++) {
+        mm_zero_stats_t *s = &g_zero_pools[node][i].stats;
+        stats->hits += s->hits;
+        stats->misses += s->misses;
+        stats->refills += s->refills;
+        stats->drains += s->drains;
+    }
+    return 0;
+}
@@ -6,6 +6,9 @@
 
 #include "../include/isolation.h"
 #include "../include/mm.h"
+#include "../include/slab.h"
+#include "../include/numa.h"
+#include "../include/cpu.h"
 #include "../include/kernel.h"
 #include "../include/string.h"
 
@@ -193,6 +196,814 @@ static int test_memory_unmapping(void) {
     return 0;
 }
 
+/*
+ * Test 2 MB leaf mappings and splitting on partial unmap
+ */
+static int test_large_page_mapping(void) {
+    kernel_log("Testing large page mapping...\n");
+    
+    uint64_t test_domain = 4;
+    if (isolation_create_page_tables(test_domain, DOMAIN_FLAG_KERNEL) != 0) {
+        kernel_log("FAILED: Could not create page tables\n");
+        return -1;
+    }
+    
+    uint64_t phys_addr = mm_alloc(PT_LARGE_PAGE_SIZE, PT_LARGE_PAGE_SIZE, MEM_TYPE_KERNEL, test_domain);
+    if (phys_addr == 0) {
+        kernel_log("FAILED: Could not allocate physical memory\n");
+        return -1;
+    }
+    
+    uint64_t virt_addr = 0x4000000;
+    if (isolation_map_memory(test_domain, virt_addr, phys_addr, PT_LARGE_PAGE_SIZE, MAP_TYPE_DATA, 0) != 0) {
+        kernel_log("FAILED: Could not map memory\n");
+        mm_free(phys_addr);
+        return -1;
+    }
+    
+    /* An aligned 2 MB range is a single PD leaf, with no PT below it */
+    page_table_t *pml4 = pt_walk_get_pml4(test_domain);
+    page_table_t *pd = pt_walk_get_pd(pt_walk_get_pdpt(pml4, virt_addr), virt_addr);
+    if (pd == NULL || !PTE_IS_LEAF(pd->entries[PD_INDEX(virt_addr)])) {
+        kernel_log("FAILED: 2MB range not mapped with a large page\n");
+        mm_free(phys_addr);
+        return -1;
+    }
+    
+    uint64_t pte = pt_walk_get_pte(pml4, virt_addr + 0x5000);
+    if (!(pte & PT_FLAG_PRESENT) || PTE_GET_ADDRESS(pte) != phys_addr + 0x5000) {
+        kernel_log("FAILED: Large page translation mismatch\n");
+        mm_free(phys_addr);
+        return -1;
+    }
+    
+    /* Unmapping one page splits the leaf and keeps its neighbours */
+    if (isolation_unmap_memory(test_domain, virt_addr + 0x5000, PAGE_SIZE) != 0) {
+        kernel_log("FAILED: Could not unmap page\n");
+        mm_free(phys_addr);
+        return -1;
+    }
+    
+    pte = pt_walk_get_pte(pml4, virt_addr + 0x6000);
+    if (PTE_IS_LEAF(pd->entries[PD_INDEX(virt_addr)]) ||
+        (pt_walk_get_pte(pml4, virt_addr + 0x5000) & PT_FLAG_PRESENT) ||
+        !(pte & PT_FLAG_PRESENT) || PTE_GET_ADDRESS(pte) != phys_addr + 0x6000) {
+        kernel_log("FAILED: Large page not split correctly\n");
+        mm_free(phys_addr);
+        return -1;
+    }
+    
+    isolation_unmap_memory(test_domain, virt_addr, PT_LARGE_PAGE_SIZE);
+    mm_free(phys_addr);
+    
+    kernel_log("PASSED: Large page mapping\n");
+    return 0;
+}
+
+/*
+ * Test range map/protect/unmap and benchmark mapping throughput
+ */
+static int test_range_mapping(void) {
+    kernel_log("Testing range mapping...\n");
+    
+    uint64_t test_domain = 5;
+    if (isolation_create_page_tables(test_domain, DOMAIN_FLAG_KERNEL) != 0) {
+        kernel_log("FAILED: Could not create page tables\n");
+        return -1;
+    }
+    
+    domain_page_table_t *domain = isolation_get_page_tables(test_domain);
+    pt_flush_set_t flush = { .count = 0, .flush_all = 0 };
+    
+    /* 64MB of 4KB pages (physical base is not 2MB aligned); the domain is
+     * never loaded, so the frames behind it are not touched */
+    uint64_t virt_addr = 0x10000000;
+    uint64_t phys_addr = 0x10001000;
+    uint64_t size = 64 * 0x100000;
+    uint64_t pages = size / PAGE_SIZE;
+    
+    uint64_t start = cpu_rdtsc();
+    if (pt_map_range(domain, virt_addr, phys_addr, size, PT_FLAG_WRITABLE, &flush) != 0) {
+        kernel_log("FAILED: Could not map range\n");
+        return -1;
+    }
+    uint64_t range_cycles = cpu_rdtsc() - start;
+    pt_flush_commit(&flush);
+    
+    for (uint64_t i = 0; i < pages; i += 511) {
+        uint64_t pte = pt_walk_get_pte(domain->pml4, virt_addr + i * PAGE_SIZE);
+        if (PTE_GET_ADDRESS(pte) != phys_addr + i * PAGE_SIZE || !(pte & PT_FLAG_WRITABLE)) {
+            kernel_log("FAILED: Range translation mismatch\n");
+            return -1;
+        }
+    }
+    
+    /* Protect part of the range; only those pages become stale */
+    if (pt_protect_range(domain, virt_addr + PAGE_SIZE, 2 * PAGE_SIZE, 0, &flush) != 0 ||
+        flush.count != 2 || flush.flush_all ||
+        (pt_walk_get_pte(domain->pml4, virt_addr + PAGE_SIZE) & PT_FLAG_WRITABLE) ||
+        !(pt_walk_get_pte(domain->pml4, virt_addr) & PT_FLAG_WRITABLE)) {
+        kernel_log("FAILED: Range protect\n");
+        return -1;
+    }
+    pt_flush_commit(&flush);
+    
+    /* Baseline: the same pages mapped one call (and one descent) at a time */
+    start = cpu_rdtsc();
+    for (uint64_t i = 0; i < pages; i++) {
+        pt_map_range(domain, virt_addr + i * PAGE_SIZE, phys_addr + i * PAGE_SIZE,
+                     PAGE_SIZE, PT_FLAG_WRITABLE, &flush);
+    }
+    uint64_t page_cycles = cpu_rdtsc() - start;
+    flush.count = 0;
+    flush.flush_all = 0;
+    
+    if (pt_unmap_range(domain, virt_addr, size, &flush) != 0 || !flush.flush_all ||
+        (pt_walk_get_pte(domain->pml4, virt_addr + size - PAGE_SIZE) & PT_FLAG_PRESENT)) {
+        kernel_log("FAILED: Range unmap\n");
+        return -1;
+    }
+    flush.count = 0;
+    flush.flush_all = 0;
+    
+    kernel_log("Range map cycles/page: ");
+    kernel_log_hex(range_cycles / pages);
+    kernel_log("\nPer-page map cycles/page: ");
+    kernel_log_hex(page_cycles / pages);
+    kernel_log("\n");
+    
+    kernel_log("PASSED: Range mapping\n");
+    return 0;
+}
+
+/*
+ * Test page table teardown and page-table page recycling
+ */
+static int test_page_table_teardown(void) {
+    kernel_log("Testing page table teardown...\n");
+    
+    uint64_t test_domain = 6;
+    uint64_t allocated = 0;
+    
+    /* After the first cycle every table comes from the recycle pool */
+    for (uint32_t round = 0; round < 3; round++) {
+        if (isolation_create_page_tables(test_domain, DOMAIN_FLAG_SERVICE) != 0) {
+            kernel_log("FAILED: Could not create page tables\n");
+            return -1;
+        }
+        
+        domain_page_table_t *domain = isolation_get_page_tables(test_domain);
+        pt_flush_set_t flush = { .count = 0, .flush_all = 0 };
+        pt_map_range(domain, 0x10000000, 0x10001000, 0x400000, PT_FLAG_WRITABLE, &flush);
+        pt_map_range(domain, 0x7F0000000000ULL, 0x1000, 0x5000, PT_FLAG_WRITABLE, &flush);
+        
+        if (isolation_destroy_page_tables(test_domain) != 0) {
+            kernel_log("FAILED: Could not destroy page tables\n");
+            return -1;
+        }
+        
+        if (round == 1) {
+            allocated = mm_get_allocated();
+        } else if (round == 2 && mm_get_allocated() != allocated) {
+            kernel_log("FAILED: Page tables leaked across create/destroy\n");
+            return -1;
+        }
+    }
+    
+    if (pt_recycle_count(numa_current_node()) == 0) {
+        kernel_log("FAILED: Freed page tables not recycled\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Page table teardown\n");
+    return 0;
+}
+
+/*
+ * Test that the kernel half is shared by all domains
+ */
+static int test_shared_kernel_half(void) {
+    kernel_log("Testing shared kernel half...\n");
+    
+    uint64_t test_domain = 7;
+    if (isolation_create_page_tables(test_domain, DOMAIN_FLAG_SERVICE) != 0) {
+        kernel_log("FAILED: Could not create page tables\n");
+        return -1;
+    }
+    
+    /* The kernel domain's Core-0 mapping is visible without any copying */
+    page_table_t *kernel_pml4 = pt_walk_get_pml4(0);
+    page_table_t *pml4 = pt_walk_get_pml4(test_domain);
+    uint64_t pte = pt_walk_get_pte(pml4, KERNEL_CODE_BASE);
+    if (kernel_pml4 == NULL ||
+        pml4->entries[PML4_INDEX(KERNEL_CODE_BASE)] != kernel_pml4->entries[PML4_INDEX(KERNEL_CODE_BASE)] ||
+        !(pte & PT_FLAG_PRESENT) || !(pte & PT_FLAG_GLOBAL)) {
+        kernel_log("FAILED: Kernel mapping not shared\n");
+        isolation_destroy_page_tables(test_domain);
+        return -1;
+    }
+    
+    /* Destroying a domain leaves the shared subtrees intact */
+    isolation_destroy_page_tables(test_domain);
+    if (!(pt_walk_get_pte(kernel_pml4, KERNEL_CODE_BASE) & PT_FLAG_PRESENT)) {
+        kernel_log("FAILED: Shared kernel tables freed with a domain\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Shared kernel half\n");
+    return 0;
+}
+
+/*
+ * Test batched TLB flushes and the full-flush threshold
+ */
+static int test_flush_batching(void) {
+    kernel_log("Testing flush batching...\n");
+    
+    uint64_t test_domain = 10;
+    if (isolation_create_page_tables(test_domain, DOMAIN_FLAG_SERVICE) != 0) {
+        kernel_log("FAILED: Could not create page tables\n");
+        return -1;
+    }
+    
+    uint64_t virt_addr = 0x10000000;
+    pt_flush_set_t flush = { .count = 0, .flush_all = 0 };
+    pt_map_range(isolation_get_page_tables(test_domain), virt_addr, 0x10001000,
+                 64 * PAGE_SIZE, PT_FLAG_WRITABLE, &flush);
+    pt_flush_commit(&flush);
+    
+    /* Every page of an unmapped range is invalidated, once, at batch end */
+    pt_flush_stats_t before, after;
+    pt_get_flush_stats(&before);
+    isolation_flush_begin();
+    isolation_unmap_memory(test_domain, virt_addr, 4 * PAGE_SIZE);
+    isolation_unmap_memory(test_domain, virt_addr + 8 * PAGE_SIZE, 4 * PAGE_SIZE);
+    pt_get_flush_stats(&after);
+    int deferred = after.pages == before.pages && after.full == before.full;
+    isolation_flush_end();
+    pt_get_flush_stats(&after);
+    
+    if (!deferred || after.pages - before.pages != 8 || after.full != before.full) {
+        kernel_log("FAILED: Batched unmap flushes\n");
+        isolation_destroy_page_tables(test_domain);
+        return -1;
+    }
+    
+    /* Above the threshold one full flush replaces the per-page ones */
+    pt_set_flush_threshold(4);
+    pt_get_flush_stats(&before);
+    isolation_unmap_memory(test_domain, virt_addr + 16 * PAGE_SIZE, 8 * PAGE_SIZE);
+    pt_get_flush_stats(&after);
+    pt_set_flush_threshold(PT_FLUSH_MAX_PAGES);
+    
+    isolation_destroy_page_tables(test_domain);
+    
+    if (after.pages != before.pages || after.full - before.full != 1) {
+        kernel_log("FAILED: Flush threshold\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Flush batching\n");
+    return 0;
+}
+
+/*
+ * Test range access verification through the walk cache
+ */
+static int test_verify_access(void) {
+    kernel_log("Testing access verification...\n");
+    
+    uint64_t test_domain = 11;
+    if (isolation_create_page_tables(test_domain, DOMAIN_FLAG_SERVICE) != 0) {
+        kernel_log("FAILED: Could not create page tables\n");
+        return -1;
+    }
+    
+    /* A 1MB user buffer of 4KB pages */
+    uint64_t virt_addr = 0x10000000;
+    uint64_t size = 0x100000;
+    pt_flush_set_t flush = { .count = 0, .flush_all = 0 };
+    if (pt_map_range(isolation_get_page_tables(test_domain), virt_addr, 0x10001000, size,
+                     PT_FLAG_WRITABLE | PT_FLAG_USER, &flush) != 0) {
+        kernel_log("FAILED: Could not map buffer\n");
+        isolation_destroy_page_tables(test_domain);
+        return -1;
+    }
+    pt_flush_commit(&flush);
+    
+    uint64_t start = cpu_rdtsc();
+    int result = isolation_verify_access(test_domain, virt_addr, size, 0x03);
+    uint64_t verify_cycles = cpu_rdtsc() - start;
+    
+    /* Baseline: one full walk per page */
+    page_table_t *pml4 = pt_walk_get_pml4(test_domain);
+    start = cpu_rdtsc();
+    for (uint64_t offset = 0; offset < size; offset += PAGE_SIZE) {
+        if (!(pt_walk_get_pte(pml4, virt_addr + offset) & PT_FLAG_PRESENT)) {
+            break;
+        }
+    }
+    uint64_t walk_cycles = cpu_rdtsc() - start;
+    
+    if (result != 0) {
+        kernel_log("FAILED: Mapped buffer rejected\n");
+        isolation_destroy_page_tables(test_domain);
+        return -1;
+    }
+    
+    /* Changes made after a lookup must be seen by the next one */
+    isolation_protect_memory(test_domain, virt_addr + 100 * PAGE_SIZE, PAGE_SIZE, MAP_TYPE_READONLY);
+    if (isolation_verify_access(test_domain, virt_addr, size, 0x03) == 0 ||
+        isolation_verify_access(test_domain, virt_addr, size, 0x01) != 0) {
+        kernel_log("FAILED: Protection change not seen\n");
+        isolation_destroy_page_tables(test_domain);
+        return -1;
+    }
+    
+    /* The unmapped page fails, the one before it still passes */
+    isolation_unmap_memory(test_domain, virt_addr + size - PAGE_SIZE, PAGE_SIZE);
+    if (isolation_verify_access(test_domain, virt_addr, size, 0x01) == 0 ||
+        isolation_verify_access(test_domain, virt_addr + size - 2, 1, 0x01) == 0 ||
+        isolation_verify_access(test_domain, virt_addr + size - PAGE_SIZE - 1, 1, 0x01) != 0) {
+        kernel_log("FAILED: Unmap not seen\n");
+        isolation_destroy_page_tables(test_domain);
+        return -1;
+    }
+    
+    isolation_destroy_page_tables(test_domain);
+    
+    kernel_log("Verify 1MB cycles: ");
+    kernel_log_hex(verify_cycles);
+    kernel_log("\nPer-page walk 1MB cycles: ");
+    kernel_log_hex(walk_cycles);
+    kernel_log("\n");
+    
+    kernel_log("PASSED: Access verification\n");
+    return 0;
+}
+
+/*
+ * Cycles for rounds of switching between two domains, touching pages in each
+ */
+static uint64_t pcid_switch_cycles(uint64_t a, uint64_t b, uint64_t buf, uint32_t rounds) {
+    volatile uint64_t *p = (volatile uint64_t *)buf;
+    uint64_t start = cpu_rdtsc();
+    
+    for (uint32_t r = 0; r < rounds; r++) {
+        isolation_switch_domain((r & 1) ? b : a);
+        for (uint32_t i = 0; i < 16; i++) {
+            (void)p[i * (PAGE_SIZE / sizeof(uint64_t))];
+        }
+    }
+    
+    return cpu_rdtsc() - start;
+}
+
+/*
+ * Benchmark domain switches with and without PCID tagging
+ */
+static int test_pcid_switch(void) {
+    kernel_log("Testing PCID domain switch...\n");
+    
+    if (!isolation_set_pcid(1)) {
+        kernel_log("SKIPPED: PCID not supported\n");
+        return 0;
+    }
+    
+    uint64_t domain_a = 8;
+    uint64_t domain_b = 9;
+    if (isolation_create_page_tables(domain_a, DOMAIN_FLAG_KERNEL) != 0 ||
+        isolation_create_page_tables(domain_b, DOMAIN_FLAG_KERNEL) != 0) {
+        kernel_log("FAILED: Could not create page tables\n");
+        isolation_destroy_page_tables(domain_a);
+        return -1;
+    }
+    
+    /* Both domains see all of memory, so the test keeps running across switches */
+    pt_flush_set_t flush = { .count = 0, .flush_all = 0 };
+    if (pt_map_range(isolation_get_page_tables(domain_a), 0, 0, mm_get_total(),
+                     PT_FLAG_WRITABLE, &flush) != 0 ||
+        pt_map_range(isolation_get_page_tables(domain_b), 0, 0, mm_get_total(),
+                     PT_FLAG_WRITABLE, &flush) != 0) {
+        kernel_log("FAILED: Could not map memory\n");
+        isolation_destroy_page_tables(domain_a);
+        isolation_destroy_page_tables(domain_b);
+        return -1;
+    }
+    pt_flush_commit(&flush);
+    
+    uint64_t buf = mm_alloc(16 * PAGE_SIZE, PAGE_SIZE, MEM_TYPE_KERNEL, 0);
+    if (buf == 0) {
+        kernel_log("FAILED: Could not allocate buffer\n");
+        isolation_destroy_page_tables(domain_a);
+        isolation_destroy_page_tables(domain_b);
+        return -1;
+    }
+    
+    uint64_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    
+    uint32_t rounds = 10000;
+    uint64_t pcid_cycles = pcid_switch_cycles(domain_a, domain_b, buf, rounds);
+    isolation_set_pcid(0);
+    uint64_t flush_cycles = pcid_switch_cycles(domain_a, domain_b, buf, rounds);
+    isolation_set_pcid(1);
+    
+    /* Back in the kernel domain before the test domains go away */
+    isolation_switch_kernel(cr3);
+    
+    mm_free(buf);
+    isolation_destroy_page_tables(domain_a);
+    isolation_destroy_page_tables(domain_b);
+    
+    kernel_log("PCID switch cycles/round: ");
+    kernel_log_hex(pcid_cycles / rounds);
+    kernel_log("\nFlushing switch cycles/round: ");
+    kernel_log_hex(flush_cycles / rounds);
+    kernel_log("\n");
+    
+    kernel_log("PASSED: PCID domain switch\n");
+    return 0;
+}
+
+/*
+ * Test buddy allocation extents
+ */
+static int test_buddy_allocation(void) {
+    kernel_log("Testing buddy allocation...\n");
+    
+    uint64_t available = mm_get_available();
+    
+    /* Three pages with 16KB alignment come from an order-2 block */
+    uint64_t addr = mm_alloc(3 * PAGE_SIZE, 4 * PAGE_SIZE, MEM_TYPE_KERNEL, 0);
+    if (addr == 0) {
+        kernel_log("FAILED: Could not allocate pages\n");
+        return -1;
+    }
+    
+    if (addr & (4 * PAGE_SIZE - 1)) {
+        kernel_log("FAILED: Allocation not aligned\n");
+        mm_free(addr);
+        return -1;
+    }
+    
+    if (mm_get_available() != available - 3 * PAGE_SIZE) {
+        kernel_log("FAILED: Unused tail page not returned\n");
+        mm_free(addr);
+        return -1;
+    }
+    
+    /* Every page of the extent carries its type and owner */
+    mem_frame_t frame;
+    if (mm_get_frame(addr + 2 * PAGE_SIZE, &frame) != 0 ||
+        frame.type != MEM_TYPE_KERNEL || frame.owner != 0 ||
+        mm_get_type(addr + 3 * PAGE_SIZE) != MEM_TYPE_AVAILABLE) {
+        kernel_log("FAILED: Extent type mismatch\n");
+        mm_free(addr);
+        return -1;
+    }
+    
+    /* Interior pages are not extent heads */
+    if (mm_free(addr + PAGE_SIZE) == 0) {
+        kernel_log("FAILED: Freed the middle of an extent\n");
+        return -1;
+    }
+    
+    /* Freeing the head releases the whole extent */
+    if (mm_free(addr) != 0 || mm_get_available() != available) {
+        kernel_log("FAILED: Extent not fully freed\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Buddy allocation\n");
+    return 0;
+}
+
+/*
+ * Test memory zones
+ */
+static int test_memory_zones(void) {
+    kernel_log("Testing memory zones...\n");
+    
+    uint64_t dma_before = mm_get_zone_available(MM_ZONE_DMA32);
+    uint64_t addr = mm_alloc_zone(MM_ZONE_DMA32, 2 * PAGE_SIZE, PAGE_SIZE, MEM_TYPE_DEVICE, 0);
+    if (addr == 0 || addr + 2 * PAGE_SIZE > MM_DMA32_LIMIT || addr < MM_LOW_MEMORY_LIMIT) {
+        kernel_log("FAILED: DMA32 allocation out of zone\n");
+        return -1;
+    }
+    
+    if (mm_get_zone_available(MM_ZONE_DMA32) != dma_before - 2 * PAGE_SIZE) {
+        kernel_log("FAILED: Zone accounting not updated\n");
+        return -1;
+    }
+    
+    mm_free(addr);
+    if (mm_get_zone_available(MM_ZONE_DMA32) != dma_before) {
+        kernel_log("FAILED: Zone accounting not restored\n");
+        return -1;
+    }
+    
+    /* Firmware low memory is never handed out */
+    if (mm_get_type(0x9F000) != MEM_TYPE_RESERVED) {
+        kernel_log("FAILED: Low memory handed to allocator\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Memory zones\n");
+    return 0;
+}
+
+/*
+ * Sum a buffer with a cache-line stride; returns elapsed TSC cycles
+ */
+static uint64_t numa_touch_cycles(uint64_t addr, uint64_t size) {
+    volatile uint64_t *p = (volatile uint64_t *)addr;
+    uint64_t sum = 0;
+    
+    uint64_t start = cpu_rdtsc();
+    for (uint64_t i = 0; i < size / sizeof(uint64_t); i += CACHE_LINE_SIZE / sizeof(uint64_t)) {
+        sum += p[i];
+    }
+    uint64_t cycles = cpu_rdtsc() - start;
+    
+    (void)sum;
+    return cycles;
+}
+
+/*
+ * Test NUMA node placement (and compare local/remote access cost)
+ */
+static int test_numa_nodes(void) {
+    kernel_log("Testing NUMA nodes...\n");
+    
+    uint32_t nodes = numa_num_nodes();
+    
+    for (uint32_t node = 0; node < nodes; node++) {
+        uint64_t before = mm_get_node_available(node);
+        if (before == 0) {
+            continue;  /* Memoryless node */
+        }
+        
+        uint64_t addr = mm_alloc_node(node, PAGE_SIZE, PAGE_SIZE, MEM_TYPE_KERNEL, 0);
+        if (addr == 0 || numa_node_of_addr(addr) != node) {
+            kernel_log("FAILED: Allocation not on requested node\n");
+            return -1;
+        }
+        
+        if (mm_get_node_available(node) != before - PAGE_SIZE) {
+            kernel_log("FAILED: Node accounting not updated\n");
+            mm_free(addr);
+            return -1;
+        }
+        mm_free(addr);
+    }
+    
+    if (numa_fallback_list(0)[0] != 0 || numa_distance(0, 0) != NUMA_LOCAL_DISTANCE) {
+        kernel_log("FAILED: Local node is not nearest\n");
+        return -1;
+    }
+    
+    /* An owner's allocations follow its home node hint until it is dropped */
+    uint64_t owner = 0xABC;
+    mm_set_owner_node(owner, nodes - 1);
+    if (mm_owner_node(owner) != nodes - 1) {
+        kernel_log("FAILED: Owner home node hint not used\n");
+        return -1;
+    }
+    mm_set_owner_node(owner, NUMA_NO_NODE);
+    if (mm_owner_node(owner) != numa_current_node()) {
+        kernel_log("FAILED: Owner home node hint not dropped\n");
+        return -1;
+    }
+    
+    if (nodes > 1) {
+        /* Benchmark: read 1MB on the local node and on the farthest node */
+        uint32_t local = numa_current_node();
+        uint32_t remote = numa_fallback_list(local)[nodes - 1];
+        uint64_t local_buf = mm_alloc_node(local, 0x100000, PAGE_SIZE, MEM_TYPE_KERNEL, 0);
+        uint64_t remote_buf = mm_alloc_node(remote, 0x100000, PAGE_SIZE, MEM_TYPE_KERNEL, 0);
+        
+        if (local_buf != 0 && remote_buf != 0) {
+            kernel_log("Local 1MB read cycles: ");
+            kernel_log_hex(numa_touch_cycles(local_buf, 0x100000));
+            kernel_log("\nRemote 1MB read cycles: ");
+            kernel_log_hex(numa_touch_cycles(remote_buf, 0x100000));
+            kernel_log("\n");
+        }
+        
+        if (local_buf != 0) {
+            mm_free(local_buf);
+        }
+        if (remote_buf != 0) {
+            mm_free(remote_buf);
+        }
+    }
+    
+    kernel_log("PASSED: NUMA nodes\n");
+    return 0;
+}
+
+/*
+ * Test per-CPU frame magazines
+ */
+static int test_frame_magazines(void) {
+    kernel_log("Testing frame magazines...\n");
+    
+    mm_magazine_stats_t before;
+    mm_magazine_stats_t after;
+    mm_magazine_get_stats(0, MM_MAG_ORDER_SMALL, &before);
+    
+    uint64_t frame = mm_alloc_frame(MM_MAG_ORDER_SMALL);
+    if (frame == 0 || (frame & (PAGE_SIZE - 1))) {
+        kernel_log("FAILED: Could not allocate frame\n");
+        return -1;
+    }
+    
+    /* A freed frame is reused by the next allocation on this CPU */
+    mm_free_frame(frame, MM_MAG_ORDER_SMALL);
+    if (mm_alloc_frame(MM_MAG_ORDER_SMALL) != frame) {
+        kernel_log("FAILED: Magazine did not reuse frame\n");
+        return -1;
+    }
+    mm_free_frame(frame, MM_MAG_ORDER_SMALL);
+    
+    /* A second free of a parked frame is refused, as mm_free would */
+    if (mm_free_frame(frame, MM_MAG_ORDER_SMALL) == 0 || mm_free(frame) == 0) {
+        kernel_log("FAILED: Double free of a magazine frame accepted\n");
+        return -1;
+    }
+    
+    /* A page in the middle of a live allocation is never parked */
+    uint64_t pair = mm_alloc(2 * PAGE_SIZE, PAGE_SIZE, MEM_TYPE_KERNEL, 0);
+    if (pair != 0) {
+        int refused = mm_free_frame(pair + PAGE_SIZE, MM_MAG_ORDER_SMALL) != 0;
+        mm_free(pair);
+        if (!refused) {
+            kernel_log("FAILED: Magazine accepted a page inside an allocation\n");
+            return -1;
+        }
+    }
+    
+    mm_magazine_get_stats(0, MM_MAG_ORDER_SMALL, &after);
+    if (after.hits + after.misses != before.hits + before.misses + 2 ||
+        after.hits == before.hits) {
+        kernel_log("FAILED: Magazine counters not updated\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Frame magazines\n");
+    return 0;
+}
+
+/*
+ * Test pre-zeroed frame pool
+ */
+static int test_zero_pool(void) {
+    kernel_log("Testing zero pool...\n");
+    
+    /* Dirty a frame and give it back, so zeroing is observable */
+    uint64_t dirty = mm_alloc(PAGE_SIZE, PAGE_SIZE, MEM_TYPE_KERNEL, 0);
+    if (dirty == 0) {
+        kernel_log("FAILED: Could not allocate frame\n");
+        return -1;
+    }
+    memset((void *)dirty, 0xA5, PAGE_SIZE);
+    mm_free(dirty);
+    
+    mm_zero_stats_t before;
+    mm_zero_stats_t after;
+    mm_zero_pool_drain();
+    mm_zero_pool_get_stats(MM_ZERO_ORDER_SMALL, &before);
+    
+    if (mm_zero_pool_refill(4) != 4) {
+        kernel_log("FAILED: Pool not refilled\n");
+        return -1;
+    }
+    
+    uint64_t frame = mm_alloc_zeroed(PAGE_SIZE, PAGE_SIZE, MEM_TYPE_APPLICATION, 7);
+    mm_zero_pool_get_stats(MM_ZERO_ORDER_SMALL, &after);
+    if (frame == 0 || after.hits != before.hits + 1) {
+        kernel_log("FAILED: Allocation not served from pool\n");
+        return -1;
+    }
+    
+    mem_frame_t desc;
+    if (mm_get_frame(frame, &desc) != 0 || desc.type != MEM_TYPE_APPLICATION || desc.owner != 7) {
+        kernel_log("FAILED: Pooled frame not retyped\n");
+        return -1;
+    }
+    
+    /* Pooled and inline-zeroed memory must both read as zero */
+    uint64_t large = mm_alloc_zeroed(3 * PAGE_SIZE, PAGE_SIZE, MEM_TYPE_KERNEL, 0);
+    if (large == 0) {
+        kernel_log("FAILED: Could not allocate zeroed range\n");
+        return -1;
+    }
+    
+    const uint64_t *words = (const uint64_t *)frame;
+    const uint64_t *large_words = (const uint64_t *)large;
+    for (uint64_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (words[i] != 0 || large_words[i] != 0) {
+            kernel_log("FAILED: Memory not zeroed\n");
+            return -1;
+        }
+    }
+    
+    mm_free(frame);
+    mm_free(large);
+    mm_zero_pool_drain();
+    
+    kernel_log("PASSED: Zero pool\n");
+    return 0;
+}
+
+/*
+ * Test slab object caches
+ */
+static kmem_cache_t g_test_cache;
+static uint64_t g_test_ctor_calls;
+
+static void test_slab_ctor(void *obj) {
+    g_test_ctor_calls++;
+}
+
+static int test_slab_cache(void) {
+    kernel_log("Testing slab object caches...\n");
+    
+    if (kmem_cache_init(&g_test_cache, "test", 200, CACHE_LINE_SIZE, test_slab_ctor) != 0) {
+        kernel_log("FAILED: Could not create cache\n");
+        return -1;
+    }
+    
+    if (g_test_cache.objects_per_slab < KMEM_MIN_OBJECTS || g_test_cache.colour_count < 1) {
+        kernel_log("FAILED: Bad slab layout\n");
+        return -1;
+    }
+    
+    /* Allocate across several slabs */
+    void *objs[40];
+    for (uint32_t i = 0; i < 40; i++) {
+        objs[i] = kmem_cache_alloc(&g_test_cache);
+        if (objs[i] == NULL || ((uint64_t)objs[i] & (CACHE_LINE_SIZE - 1))) {
+            kernel_log("FAILED: Could not allocate object\n");
+            return -1;
+        }
+        for (uint32_t j = 0; j < i; j++) {
+            if (objs[j] == objs[i]) {
+                kernel_log("FAILED: Object handed out twice\n");
+                return -1;
+            }
+        }
+    }
+    
+    if (g_test_ctor_calls != g_test_cache.num_slabs * g_test_cache.objects_per_slab) {
+        kernel_log("FAILED: Constructor not run once per object\n");
+        return -1;
+    }
+    
+    /* A freed object is reused by the next allocation on this CPU */
+    kmem_cache_free(&g_test_cache, objs[7]);
+    if (kmem_cache_alloc(&g_test_cache) != objs[7]) {
+        kernel_log("FAILED: Per-CPU free list did not reuse object\n");
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < 40; i++) {
+        kmem_cache_free(&g_test_cache, objs[i]);
+    }
+    kmem_cache_shrink(&g_test_cache);
+    
+    if (g_test_cache.active_objects != 0 || g_test_cache.num_slabs != 0) {
+        kernel_log("FAILED: Slabs not released\n");
+        return -1;
+    }
+    
+    /* ID tables grow on demand and hand removed IDs out again */
+    kmem_table_t table;
+    memset(&table, 0, sizeof(table));
+    uint64_t last = 0;
+    for (uint32_t i = 0; i < 3 * KMEM_TABLE_MIN_SLOTS; i++) {
+        last = kmem_table_insert(&table, &table);
+        if (last != i + 1) {
+            kernel_log("FAILED: ID table did not grow\n");
+            return -1;
+        }
+    }
+    
+    kmem_table_remove(&table, 5);
+    if (kmem_table_get(&table, 5) != NULL || kmem_table_get(&table, last) != &table ||
+        kmem_table_get(&table, 4 * KMEM_TABLE_MIN_SLOTS) != NULL ||
+        kmem_table_insert(&table, &g_test_cache) != 5 ||
+        kmem_table_get(&table, 5) != &g_test_cache || kmem_table_end(&table) != last + 1) {
+        kernel_log("FAILED: ID table did not reuse a removed ID\n");
+        return -1;
+    }
+    mm_free((uint64_t)table.slots);
+    
+    kernel_log("PASSED: Slab object caches\n");
+    return 0;
+}
+
 /*
  * Test address space checks
  */
@@ -247,6 +1058,19 @@ int mmu_run_tests(void) {
     if (test_pt_walking() != 0) failures++;
     if (test_memory_mapping() != 0) failures++;
     if (test_memory_unmapping() != 0) failures++;
+    if (test_large_page_mapping() != 0) failures++;
+    if (test_range_mapping() != 0) failures++;
+    if (test_page_table_teardown() != 0) failures++;
+    if (test_shared_kernel_half() != 0) failures++;
+    if (test_flush_batching() != 0) failures++;
+    if (test_verify_access() != 0) failures++;
+    if (test_pcid_switch() != 0) failures++;
+    if (test_buddy_allocation() != 0) failures++;
+    if (test_memory_zones() != 0) failures++;
+    if (test_numa_nodes() != 0) failures++;
+    if (test_frame_magazines() != 0) failures++;
+    if (test_slab_cache() != 0) failures++;
+    if (test_zero_pool() != 0) failures++;
     if (test_address_space_checks() != 0) failures++;
     
     kernel_log("\n");
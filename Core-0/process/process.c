@@ -6,12 +6,17 @@
 #include "../include/mm.h"
 #include "../include/capability.h"
 #include "../include/sched.h"
+#include "../include/ipc.h"
+#include "../include/clock.h"
 #include "../include/isolation.h"
 #include "../include/string.h"
 
 /* Global process manager state */
 static process_manager_t g_process_manager;
 
+/* Process object cache */
+static kmem_cache_t g_process_cache;
+
 /* Spinlock operations */
 static inline void spin_lock(uint64_t *lock) {
     while (__sync_lock_test_and_set(lock, 1)) {
@@ -23,17 +28,17 @@ static inline void spin_unlock(uint64_t *lock) {
     __sync_lock_release(lock);
 }
 
-/* Current process ID (per-CPU) */
-static __thread uint64_t g_current_pid = 0;
-
 /*
  * Initialize process manager
  */
 int process_init(void) {
     memset(&g_process_manager, 0, sizeof(process_manager_t));
     
+    if (kmem_cache_init(&g_process_cache, "process", sizeof(process_t), CACHE_LINE_SIZE, NULL) != 0) {
+        return -1;
+    }
+    
     g_process_manager.num_processes = 0;
-    g_process_manager.next_pid = 1;
     g_process_manager.lock = 0;
     
     return 0;
@@ -45,23 +50,25 @@ int process_init(void) {
 uint64_t process_create(const char *path, int argc, char **argv) {
     spin_lock(&g_process_manager.lock);
     
-    /* Find free process slot */
-    uint32_t slot = 0;
-    for (slot = 0; slot < MAX_PROCESSES; slot++) {
-        if (g_process_manager.processes[slot].state == 0) {
-            break;
-        }
+    process_t *process = kmem_cache_alloc(&g_process_cache);
+    if (process == NULL) {
+        spin_unlock(&g_process_manager.lock);
+        return 0;  /* Out of memory */
     }
     
-    if (slot >= MAX_PROCESSES) {
+    uint64_t pid = kmem_table_insert(&g_process_manager.processes, process);
+    if (pid == 0) {
+        kmem_cache_free(&g_process_cache, process);
         spin_unlock(&g_process_manager.lock);
-        return 0;  /* No free slots */
+        return 0;
     }
     
     /* Allocate physical memory for process */
     uint64_t total_size = 0x100000;  /* 1MB for code, data, stack, heap */
-    uint64_t phys_addr = mm_alloc(total_size, PAGE_SIZE, MEM_TYPE_APPLICATION, 0);
+    uint64_t phys_addr = mm_alloc_zeroed(total_size, PAGE_SIZE, MEM_TYPE_APPLICATION, 0);
     if (phys_addr == 0) {
+        kmem_table_remove(&g_process_manager.processes, pid);
+        kmem_defer_free(&g_process_cache, process);
         spin_unlock(&g_process_manager.lock);
         return 0;
     }
@@ -70,6 +77,8 @@ uint64_t process_create(const char *path, int argc, char **argv) {
     uint64_t domain_id = cap_create_domain(phys_addr, total_size);
     if (domain_id == 0) {
         mm_free(phys_addr);
+        kmem_table_remove(&g_process_manager.processes, pid);
+        kmem_defer_free(&g_process_cache, process);
         spin_unlock(&g_process_manager.lock);
         return 0;
     }
@@ -78,14 +87,15 @@ uint64_t process_create(const char *path, int argc, char **argv) {
     if (isolation_create_page_tables(domain_id, DOMAIN_FLAG_APP) != 0) {
         cap_delete_domain(domain_id);
         mm_free(phys_addr);
+        kmem_table_remove(&g_process_manager.processes, pid);
+        kmem_defer_free(&g_process_cache, process);
         spin_unlock(&g_process_manager.lock);
         return 0;
     }
     
     /* Initialize process */
-    process_t *process = &g_process_manager.processes[slot];
-    process->process_id = g_process_manager.next_pid++;
-    process->parent_pid = g_current_pid;
+    process->process_id = pid;
+    process->parent_pid = process_getpid();
     process->state = PROCESS_STATE_NEW;
     process->domain_id = domain_id;
     process->entry_point = 0x400000;  /* User base address */
@@ -118,7 +128,7 @@ uint64_t process_create(const char *path, int argc, char **argv) {
     
     spin_unlock(&g_process_manager.lock);
     
-    return process->process_id;
+    return pid;
 }
 
 /*
@@ -149,7 +159,7 @@ int process_wait(uint64_t pid, int *status) {
  * Exit current process
  */
 void process_exit(int code) {
-    uint64_t pid = g_current_pid;
+    uint64_t pid = process_getpid();
     
     /* Terminate process */
     process_t *process = process_get(pid);
@@ -172,26 +182,22 @@ void process_exit(int code) {
  * Get process by ID
  */
 process_t* process_get(uint64_t pid) {
-    for (uint32_t i = 0; i < MAX_PROCESSES; i++) {
-        if (g_process_manager.processes[i].process_id == pid) {
-            return &g_process_manager.processes[i];
-        }
-    }
-    return NULL;
+    return kmem_table_get(&g_process_manager.processes, pid);
 }
 
 /*
  * Get current process ID
  */
 uint64_t process_getpid(void) {
-    return g_current_pid;
+    tcb_t *current = sched_get_current();
+    return (current != NULL) ? current->process_id : 0;
 }
 
 /*
  * Get parent process ID
  */
 uint64_t process_getppid(void) {
-    process_t *process = process_get(g_current_pid);
+    process_t *process = process_get(process_getpid());
     if (process) {
         return process->parent_pid;
     }
@@ -206,6 +212,20 @@ int process_kill(uint64_t pid, int signal) {
     return 0;
 }
 
+/* isolation_verify_access mode for syscall buffers the kernel writes */
+#define SYSCALL_BUF_WRITE 0x03   /* User-readable and writable */
+
+/*
+ * Check that the calling thread's domain maps a syscall buffer for access
+ */
+static int syscall_check_buffer(uint64_t addr, uint64_t size, uint32_t access) {
+    tcb_t *current = sched_get_current();
+    if (current == NULL || addr == 0) {
+        return -1;
+    }
+    return isolation_verify_access(current->domain_id, addr, size, access);
+}
+
 /*
  * Process system call handler
  */
@@ -245,16 +265,29 @@ int process_handle_syscall(uint64_t syscall_num, uint64_t arg1, uint64_t arg2,
             break;
             
         case 8:  /* SYS_IPC_CALL */
-            /* Handle IPC call to service */
-            break;
+            /* Call endpoint arg1 with the message at arg2 (overwritten by
+             * the reply) */
+            if (syscall_check_buffer(arg2, sizeof(ipc_msg_t), SYSCALL_BUF_WRITE) != 0) {
+                return -1;
+            }
+            return ipc_call(arg1, (ipc_msg_t *)arg2);
             
-        case 9:  /* SYS_IPC_REGISTER */
-            /* Handle IPC register */
-            break;
+        case 9:  /* SYS_IPC_REGISTER */ {
+            /* Create an endpoint served by the caller's domain */
+            tcb_t *current = sched_get_current();
+            if (current == NULL) {
+                return -1;
+            }
+            uint64_t endpoint_id = ipc_endpoint_create(current->domain_id);
+            return endpoint_id != 0 ? (int)endpoint_id : -1;
+        }
             
         case 10:  /* SYS_IPC_WAIT */
-            /* Handle IPC wait */
-            break;
+            /* Wait for a call on endpoint arg1 into the message at arg2 */
+            if (syscall_check_buffer(arg2, sizeof(ipc_msg_t), SYSCALL_BUF_WRITE) != 0) {
+                return -1;
+            }
+            return ipc_wait(arg1, (ipc_msg_t *)arg2);
             
         case 11:  /* SYS_GETPID */
             return process_getpid();
@@ -271,7 +304,12 @@ int process_handle_syscall(uint64_t syscall_num, uint64_t arg1, uint64_t arg2,
             break;
             
         case 15:  /* SYS_GETTIME */
-            /* Handle gettime */
+            /* Nanoseconds since boot, stored through arg1 (they do not
+             * fit the return value) */
+            if (syscall_check_buffer(arg1, sizeof(uint64_t), SYSCALL_BUF_WRITE) != 0) {
+                return -1;
+            }
+            *(uint64_t *)arg1 = clock_ns();
             break;
             
         default:
@@ -0,0 +1,213 @@
+/*
+ * HIK Core-0 Clock Source Implementation
+ * 
+ * The TSC is measured once against the HPET main counter when ACPI lists
+ * an HPET (its period is given in femtoseconds), else against PIT
+ * channel 2. An invariant TSC is the clock: one instruction to read and
+ * a constant rate. A TSC without that guarantee changes rate with the
+ * CPU frequency and may stop in deep sleep states, so the clock reads
+ * the HPET instead when it has a 64-bit counter; with no such HPET it
+ * stays on the TSC, reported as unstable.
+ * 
+ * Counts convert to nanoseconds by a 32.32 fixed point multiply: the
+ * rounding of the factor costs under a nanosecond per second.
+ */
+
+#include "../include/clock.h"
+#include "../include/apic.h"
+#include "../include/acpi.h"
+#include "../include/stddef.h"
+
+/* HPET registers */
+#define HPET_REG_CAPS        0x000
+#define HPET_REG_CONFIG      0x010
+#define HPET_REG_COUNTER     0x0F0
+
+/* HPET register bits */
+#define HPET_CAPS_COUNT_64   0x2000
+#define HPET_CONFIG_ENABLE   0x1
+#define HPET_MAX_PERIOD_FS   100000000ULL  /* Specification limit (100ns) */
+
+/* Invariant TSC: CPUID.80000007H:EDX bit 8 */
+#define CPUID_INVARIANT_TSC  (1U << 8)
+
+/* Fixed point shift of the conversion factors */
+#define CLOCK_SHIFT 32
+
+/* Clock state */
+static clock_source_t g_clock_source = CLOCK_SOURCE_NONE;
+static int g_tsc_invariant = 0;
+static uint64_t g_tsc_hz = 0;
+static uint64_t g_tsc_mult = 0;          /* Nanoseconds per cycle (32.32) */
+static uint64_t g_tsc_base = 0;          /* TSC at clock time 0 */
+
+/* HPET state */
+static volatile uint8_t *g_hpet_base = NULL;
+static uint64_t g_hpet_period_fs = 0;
+static uint64_t g_hpet_mask = 0;         /* Counter width */
+static uint64_t g_hpet_mult = 0;         /* Nanoseconds per count (32.32) */
+static uint64_t g_hpet_start = 0;        /* Counter at clock time 0 */
+
+/* Register access */
+static inline uint64_t hpet_read(uint32_t reg) {
+    return *(volatile uint64_t *)(g_hpet_base + reg);
+}
+
+static inline void hpet_write(uint32_t reg, uint64_t value) {
+    *(volatile uint64_t *)(g_hpet_base + reg) = value;
+}
+
+/* Scale a count by a 32.32 factor */
+static inline uint64_t clock_scale(uint64_t count, uint64_t mult) {
+    return (uint64_t)(((unsigned __int128)count * mult) >> CLOCK_SHIFT);
+}
+
+/*
+ * Find and enable the HPET
+ */
+static int clock_hpet_init(void) {
+    const acpi_hpet_t *hpet = (const acpi_hpet_t *)acpi_find_table("HPET");
+    if (hpet == NULL || hpet->address_space != ACPI_GAS_MEMORY || hpet->address == 0) {
+        return -1;
+    }
+    
+    g_hpet_base = (volatile uint8_t *)hpet->address;
+    uint64_t caps = hpet_read(HPET_REG_CAPS);
+    uint64_t period = caps >> 32;
+    if (period == 0 || period > HPET_MAX_PERIOD_FS) {
+        g_hpet_base = NULL;
+        return -1;
+    }
+    
+    g_hpet_period_fs = period;
+    g_hpet_mask = (caps & HPET_CAPS_COUNT_64) ? ~0ULL : 0xFFFFFFFFULL;
+    g_hpet_mult = (period << CLOCK_SHIFT) / 1000000;
+    hpet_write(HPET_REG_CONFIG, hpet_read(HPET_REG_CONFIG) | HPET_CONFIG_ENABLE);
+    
+    return 0;
+}
+
+/*
+ * Measure the TSC rate against the HPET, or the PIT without one
+ */
+static uint64_t clock_calibrate_tsc(void) {
+    if (g_hpet_base == NULL) {
+        uint64_t start = cpu_rdtsc();
+        apic_delay_us(CLOCK_CALIBRATE_US);
+        uint64_t elapsed = cpu_rdtsc() - start;
+        return elapsed * 1000000 / CLOCK_CALIBRATE_US;
+    }
+    
+    uint64_t target = CLOCK_CALIBRATE_US * 1000000000ULL / g_hpet_period_fs;
+    uint64_t hpet_start = hpet_read(HPET_REG_COUNTER);
+    uint64_t tsc_start = cpu_rdtsc();
+    uint64_t counts;
+    do {
+        __asm__ volatile("pause");
+        counts = (hpet_read(HPET_REG_COUNTER) - hpet_start) & g_hpet_mask;
+    } while (counts < target);
+    uint64_t cycles = cpu_rdtsc() - tsc_start;
+    
+    uint64_t elapsed_ns = counts * g_hpet_period_fs / 1000000;
+    return cycles * CLOCK_NS_PER_SEC / elapsed_ns;
+}
+
+/*
+ * Calibrate the TSC and pick the clock's counter
+ */
+int clock_init(void) {
+    uint32_t eax = 0x80000000, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    if (eax >= 0x80000007) {
+        eax = 0x80000007;
+        ecx = 0;
+        __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+        g_tsc_invariant = (edx & CPUID_INVARIANT_TSC) != 0;
+    }
+    
+    clock_hpet_init();
+    g_tsc_hz = clock_calibrate_tsc();
+    if (g_tsc_hz == 0) {
+        return -1;
+    }
+    g_tsc_mult = (CLOCK_NS_PER_SEC << CLOCK_SHIFT) / g_tsc_hz;
+    
+    if (g_tsc_invariant) {
+        g_clock_source = CLOCK_SOURCE_TSC;
+    } else if (g_hpet_base != NULL && g_hpet_mask == ~0ULL) {
+        g_clock_source = CLOCK_SOURCE_HPET;
+    } else {
+        g_clock_source = CLOCK_SOURCE_TSC_UNSTABLE;
+    }
+    
+    g_tsc_base = cpu_rdtsc();
+    if (g_hpet_base != NULL) {
+        g_hpet_start = hpet_read(HPET_REG_COUNTER);
+    }
+    
+    return 0;
+}
+
+/*
+ * Get the counter the clock reads
+ */
+clock_source_t clock_source(void) {
+    return g_clock_source;
+}
+
+/*
+ * Check whether the TSC runs at a constant rate in every power state
+ */
+int clock_tsc_invariant(void) {
+    return g_tsc_invariant;
+}
+
+/*
+ * Get the calibrated TSC rate in Hz
+ */
+uint64_t clock_tsc_hz(void) {
+    return g_tsc_hz;
+}
+
+/*
+ * Get the time in nanoseconds since clock_init
+ */
+uint64_t clock_ns(void) {
+    switch (g_clock_source) {
+        case CLOCK_SOURCE_TSC:
+        case CLOCK_SOURCE_TSC_UNSTABLE:
+            return clock_scale(cpu_rdtsc() - g_tsc_base, g_tsc_mult);
+        case CLOCK_SOURCE_HPET:
+            return clock_scale(hpet_read(HPET_REG_COUNTER) - g_hpet_start, g_hpet_mult);
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Convert TSC cycles to nanoseconds
+ */
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    return clock_scale(cycles, g_tsc_mult);
+}
+
+/*
+ * Convert nanoseconds to TSC cycles
+ */
+uint64_t clock_ns_to_cycles(uint64_t ns) {
+    /* Whole seconds apart so the product cannot overflow */
+    uint64_t seconds = ns / CLOCK_NS_PER_SEC;
+    uint64_t rest = ns % CLOCK_NS_PER_SEC;
+    return seconds * g_tsc_hz + rest * g_tsc_hz / CLOCK_NS_PER_SEC;
+}
+
+/*
+ * Get the TSC value at a clock time
+ */
+uint64_t clock_ns_to_tsc(uint64_t ns) {
+    if (g_clock_source != CLOCK_SOURCE_TSC && g_clock_source != CLOCK_SOURCE_TSC_UNSTABLE) {
+        return 0;
+    }
+    
+    return g_tsc_base + clock_ns_to_cycles(ns);
+}
\ No newline at end of file
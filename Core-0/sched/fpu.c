@@ -0,0 +1,267 @@
+/*
+ * HIK Core-0 Extended Register State
+ * 
+ * x87/SSE/AVX registers are switched separately from the general
+ * registers and only when they hold something. With XGETBV(1) the CPU
+ * reports which state components are out of their initial state: a
+ * thread that never touched vector registers (or left them cleared) is
+ * switched without a save, and its save area is only allocated the first
+ * time there is live state to keep. Restores use XRSTOR from the thread's
+ * area, or from a static initial-state image when the incoming thread has
+ * nothing saved but the outgoing one left registers dirty.
+ */
+
+#include "../include/context.h"
+#include "../include/slab.h"
+#include "../include/string.h"
+
+/* Control register bits */
+#define CR0_MP         0x02
+#define CR0_EM         0x04
+#define CR0_TS         0x08
+#define CR4_OSFXSR     0x200
+#define CR4_OSXMMEXCPT 0x400
+#define CR4_OSXSAVE    0x40000
+
+/* XCR0 state components */
+#define XCR0_X87       0x01
+#define XCR0_SSE       0x02
+#define XCR0_AVX       0x04
+#define XCR0_AVX512    0xE0      /* Opmask, ZMM_Hi256, Hi16_ZMM */
+
+/* Legacy area plus XSAVE header */
+#define FPU_LEGACY_SIZE 512
+#define FPU_HEADER_SIZE 64
+
+/* Extended state configuration */
+static fpu_save_mode_t g_fpu_mode;
+static uint64_t g_fpu_xcr0;            /* Components switched */
+static int g_fpu_xinuse;               /* XGETBV(1) reports components in use */
+static uint64_t g_fpu_area_size;       /* Bytes per save area */
+static kmem_cache_t g_xstate_cache;    /* Save areas */
+
+/* Per-CPU statistics (one cache-line aligned slot per CPU) */
+typedef struct {
+    fpu_stats_t stats;
+} __attribute__((aligned(CACHE_LINE_SIZE))) fpu_cpu_t;
+
+static fpu_cpu_t g_fpu_cpu[MAX_CPUS];
+
+/* Initial state: default control words, all components marked init */
+static uint8_t g_fpu_init_area[FPU_LEGACY_SIZE + FPU_HEADER_SIZE] __attribute__((aligned(64)));
+
+/*
+ * Execute CPUID with a subleaf
+ */
+static inline void fpu_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx,
+                             uint32_t *ecx, uint32_t *edx) {
+    __asm__ volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                     : "a"(leaf), "c"(subleaf));
+}
+
+/*
+ * Read an extended control register
+ */
+static inline uint64_t fpu_xgetbv(uint32_t index) {
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(index));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/*
+ * Enable x87/SSE/AVX and pick the save instruction
+ */
+int fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    
+    fpu_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    int has_xsave = (ecx >> 26) & 1;
+    
+    g_fpu_mode = FPU_SAVE_FXSAVE;
+    g_fpu_xcr0 = XCR0_X87 | XCR0_SSE;
+    g_fpu_xinuse = 0;
+    g_fpu_area_size = FPU_LEGACY_SIZE;
+    
+    if (has_xsave) {
+        fpu_cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        g_fpu_xcr0 = eax & (XCR0_X87 | XCR0_SSE | XCR0_AVX);
+        if ((eax & XCR0_AVX512) == XCR0_AVX512 && (g_fpu_xcr0 & XCR0_AVX)) {
+            g_fpu_xcr0 |= XCR0_AVX512;
+        }
+        g_fpu_mode = FPU_SAVE_XSAVE;
+    }
+    
+    fpu_init_cpu();
+    
+    if (has_xsave) {
+        /* Standard-format size for the enabled components */
+        fpu_cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        g_fpu_area_size = ebx;
+        
+        fpu_cpuid(0xD, 1, &eax, &ebx, &ecx, &edx);
+        if (eax & 0x01) {
+            g_fpu_mode = FPU_SAVE_XSAVEOPT;
+        } else if (eax & 0x02) {
+            g_fpu_mode = FPU_SAVE_XSAVEC;
+            g_fpu_area_size = ebx;
+        }
+        g_fpu_xinuse = (eax >> 2) & 1;
+    }
+    
+    /* FCW 0x37F and MXCSR 0x1F80; XSTATE_BV = 0 marks every component init */
+    memset(g_fpu_init_area, 0, sizeof(g_fpu_init_area));
+    *(uint16_t *)&g_fpu_init_area[0] = 0x37F;
+    *(uint32_t *)&g_fpu_init_area[24] = 0x1F80;
+    
+    memset(g_fpu_cpu, 0, sizeof(g_fpu_cpu));
+    
+    return kmem_cache_init(&g_xstate_cache, "xstate", g_fpu_area_size, 64, NULL);
+}
+
+/*
+ * Enable the chosen components on the calling CPU
+ */
+void fpu_init_cpu(void) {
+    uint64_t cr0, cr4;
+    
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 = (cr0 & ~(uint64_t)(CR0_EM | CR0_TS)) | CR0_MP;
+    __asm__ volatile("mov %0, %%cr0" : : "r"(cr0));
+    
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (g_fpu_mode != FPU_SAVE_FXSAVE) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+    
+    if (g_fpu_mode != FPU_SAVE_FXSAVE) {
+        __asm__ volatile("xsetbv" : : "c"(0), "a"((uint32_t)g_fpu_xcr0),
+                         "d"((uint32_t)(g_fpu_xcr0 >> 32)));
+    }
+    __asm__ volatile("fninit");
+}
+
+/*
+ * Get the save instruction in use
+ */
+fpu_save_mode_t fpu_save_mode(void) {
+    return g_fpu_mode;
+}
+
+/*
+ * Check whether switches can tell untouched state apart (XGETBV(1))
+ */
+int fpu_tracks_in_use(void) {
+    return g_fpu_xinuse;
+}
+
+/*
+ * Get the components out of their initial state (all if unknown)
+ */
+static inline uint64_t fpu_in_use(void) {
+    return g_fpu_xinuse ? (fpu_xgetbv(1) & g_fpu_xcr0) : ~0ULL;
+}
+
+/*
+ * Save the extended state to an area
+ */
+static inline void fpu_save(void *area) {
+    uint32_t lo = (uint32_t)g_fpu_xcr0;
+    uint32_t hi = (uint32_t)(g_fpu_xcr0 >> 32);
+    
+    switch (g_fpu_mode) {
+        case FPU_SAVE_XSAVEOPT:
+            __asm__ volatile("xsaveopt64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+            break;
+        case FPU_SAVE_XSAVEC:
+            __asm__ volatile("xsavec64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+            break;
+        case FPU_SAVE_XSAVE:
+            __asm__ volatile("xsave64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+            break;
+        default:
+            __asm__ volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+            break;
+    }
+}
+
+/*
+ * Load the extended state from an area
+ */
+static inline void fpu_restore(const void *area) {
+    uint32_t lo = (uint32_t)g_fpu_xcr0;
+    uint32_t hi = (uint32_t)(g_fpu_xcr0 >> 32);
+    
+    if (g_fpu_mode == FPU_SAVE_FXSAVE) {
+        __asm__ volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+    } else {
+        __asm__ volatile("xrstor64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    }
+}
+
+/*
+ * Save prev's extended state if live and load next's
+ */
+void fpu_switch(tcb_t *prev, tcb_t *next) {
+    if (g_fpu_mode == FPU_SAVE_NONE) {
+        return;
+    }
+    
+    fpu_stats_t *stats = &g_fpu_cpu[cpu_current_id()].stats;
+    uint64_t in_use = fpu_in_use();
+    
+    if (prev != NULL && prev->state != THREAD_STATE_TERMINATED) {
+        prev->flags &= ~THREAD_FLAG_XSTATE;
+        
+        if (in_use == 0) {
+            stats->skipped++;  /* Nothing beyond the initial state to keep */
+        } else {
+            if (prev->xstate == NULL) {
+                /* XRSTOR faults on a non-zero reserved header, so start clean */
+                prev->xstate = kmem_cache_alloc(&g_xstate_cache);
+                if (prev->xstate != NULL) {
+                    memset(prev->xstate, 0, g_fpu_area_size);
+                }
+            }
+            if (prev->xstate != NULL) {
+                fpu_save(prev->xstate);
+                prev->flags |= THREAD_FLAG_XSTATE;
+                stats->saves++;
+            }
+        }
+    }
+    
+    if (next->flags & THREAD_FLAG_XSTATE) {
+        fpu_restore(next->xstate);
+        stats->restores++;
+    } else if (in_use != 0) {
+        /* Do not let the next thread see (or inherit) the previous state */
+        fpu_restore(g_fpu_init_area);
+        stats->resets++;
+    }
+}
+
+/*
+ * Free a thread's save area
+ */
+void fpu_release(tcb_t *tcb) {
+    if (tcb->xstate != NULL) {
+        kmem_cache_free(&g_xstate_cache, tcb->xstate);
+        tcb->xstate = NULL;
+    }
+    tcb->flags &= ~THREAD_FLAG_XSTATE;
+}
+
+/*
+ * Get extended state switch statistics, summed over all CPUs
+ */
+void fpu_get_stats(fpu_stats_t *stats) {
+    memset(stats, 0, sizeof(fpu_stats_t));
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        stats->saves += g_fpu_cpu[cpu].stats.saves;
+        stats->skipped += g_fpu_cpu[cpu].stats.skipped;
+        stats->restores += g_fpu_cpu[cpu].stats.restores;
+        stats->resets += g_fpu_cpu[cpu].stats.resets;
+    }
+}
\ No newline at end of file
@@ -1,14 +1,68 @@
 /*
  * HIK Core-0 Scheduler Implementation
+ * 
+ * Each CPU runs its own scheduler instance: run queues, idle thread and
+ * tick count live in its sched_cpu_t, the running thread in its
+ * cpu_local_t. A thread is queued on the CPU it last ran on while its
+ * domain's affinity allows (its cache may still be warm); an idle CPU
+ * takes threads from the tail of the busiest CPU's queues.
+ * 
+ * The global lock only covers the thread table; a CPU's lock covers its
+ * run queues and the states of its threads, and is taken after the
+ * global one. A thread's cpu only changes with both CPUs' locks held:
+ * two CPU locks are taken in index order, except by a thief, which holds
+ * its own and only tries the victim's. A thread is never moved while
+ * on_cpu is set, so no CPU can pick a thread another is still switching
+ * away from. Code that picks the locks to take from a thread's cpu checks
+ * it again once they are held.
+ * 
+ * Deadline threads are partitioned: admission control places a
+ * reservation on a CPU with bandwidth to spare and pins the thread there,
+ * so each CPU runs plain EDF over its own deadline queue. Budgets are
+ * charged whenever the scheduler runs; a thread out of budget is
+ * throttled and a timer on the wheel replenishes it at its deadline.
+ * With the timer vector still unhandled (the LAPIC timer is programmed
+ * masked), the scheduler only runs when a thread enters it, so this is
+ * cooperative: a thread that never yields, blocks or calls is not
+ * stopped at the end of its budget.
+ * 
+ * The same charge goes to the thread's domain (capability.h), whose lock
+ * is taken after the CPU's. A priority-class thread whose domain has used
+ * up its quota is throttled the same way, at the charge or when it is
+ * picked, until the domain's next period (cooperatively as well: a domain
+ * overruns its quota by as long as its thread runs between passes).
+ * 
+ * A handoff (the IPC fast path) switches from the running thread straight
+ * to a blocked one: the first blocks, the second runs on this CPU, and
+ * no run queue is touched. It holds the target's CPU lock as well as this
+ * one, in index order, to take the target over.
+ * 
+ * The periodic tick only runs while threads share a CPU and slices need
+ * enforcing. A CPU that is idle or has a single thread stops it and arms
+ * its timer for the next timer-wheel deadline instead (a wheel's lock is
+ * taken after the CPU's); work queued from elsewhere restarts the tick
+ * at the CPU's next pass through the scheduler.
  */
 
 #include "../include/sched.h"
+#include "../include/context.h"
 #include "../include/mm.h"
 #include "../include/string.h"
+#include "../include/smp.h"
+#include "../include/capability.h"
+#include "../include/timer.h"
+#include "../include/clock.h"
+#include "../include/apic.h"
+#include "../include/irq.h"
+#include "../include/isolation.h"
+#include "../include/ipc.h"
 
 /* Global scheduler state */
 static sched_state_t g_sched_state;
 
+/* Thread control block cache */
+static kmem_cache_t g_tcb_cache;
+
 /* Spinlock operations */
 static inline void spin_lock(uint64_t *lock) {
     while (__sync_lock_test_and_set(lock, 1)) {
@@ -16,76 +70,567 @@ static inline void spin_lock(uint64_t *lock) {
     }
 }
 
+static inline int spin_trylock(uint64_t *lock) {
+    return __sync_lock_test_and_set(lock, 1) == 0;
+}
+
 static inline void spin_unlock(uint64_t *lock) {
     __sync_lock_release(lock);
 }
 
+static void sched_reschedule(int tick);
+static void sched_sleep_expired(void *arg);
+
+/*
+ * Get the calling CPU's scheduler instance
+ */
+static inline sched_cpu_t* sched_cpu(void) {
+    return &g_sched_state.cpus[cpu_current_id()];
+}
+
+/*
+ * Get the run queue level a thread is scheduled at
+ */
+static inline uint32_t sched_level(tcb_t *tcb) {
+    return tcb->dl_period != 0 ? SCHED_LEVEL_DEADLINE : (uint32_t)tcb->priority;
+}
+
+/*
+ * Queue a ready thread at the tail (or head) of its level's run queue;
+ * deadline threads go in deadline order, after any equal deadline
+ */
+static void run_queue_insert(sched_cpu_t *sched, tcb_t *tcb, int at_head) {
+    uint32_t level = sched_level(tcb);
+    run_queue_t *queue = &sched->run_queues[level];
+    
+    if (level == SCHED_LEVEL_DEADLINE) {
+        /* Scanned from the tail: new deadlines are usually the latest */
+        tcb_t *after = queue->tail;
+        while (after != NULL && after->dl_deadline > tcb->dl_deadline) {
+            after = after->run_prev;
+        }
+        tcb->run_prev = after;
+        tcb->run_next = after != NULL ? after->run_next : queue->head;
+        if (tcb->run_next != NULL) {
+            tcb->run_next->run_prev = tcb;
+        } else {
+            queue->tail = tcb;
+        }
+        if (after != NULL) {
+            after->run_next = tcb;
+        } else {
+            queue->head = tcb;
+        }
+    } else if (at_head) {
+        tcb->run_prev = NULL;
+        tcb->run_next = queue->head;
+        if (queue->head != NULL) {
+            queue->head->run_prev = tcb;
+        } else {
+            queue->tail = tcb;
+        }
+        queue->head = tcb;
+    } else {
+        tcb->run_next = NULL;
+        tcb->run_prev = queue->tail;
+        if (queue->tail != NULL) {
+            queue->tail->run_next = tcb;
+        } else {
+            queue->head = tcb;
+        }
+        queue->tail = tcb;
+    }
+    
+    sched->ready_bitmap |= 1U << level;
+    sched->num_ready++;
+    if (tcb != sched->idle) {
+        sched->load++;
+    }
+}
+
+/*
+ * Remove a thread from its run queue
+ */
+static void run_queue_remove(sched_cpu_t *sched, tcb_t *tcb) {
+    uint32_t level = sched_level(tcb);
+    run_queue_t *queue = &sched->run_queues[level];
+    
+    if (tcb->run_prev != NULL) {
+        tcb->run_prev->run_next = tcb->run_next;
+    } else {
+        queue->head = tcb->run_next;
+    }
+    if (tcb->run_next != NULL) {
+        tcb->run_next->run_prev = tcb->run_prev;
+    } else {
+        queue->tail = tcb->run_prev;
+    }
+    tcb->run_prev = NULL;
+    tcb->run_next = NULL;
+    
+    if (queue->head == NULL) {
+        sched->ready_bitmap &= ~(1U << level);
+    }
+    sched->num_ready--;
+    if (tcb != sched->idle) {
+        sched->load--;
+    }
+}
+
+/*
+ * Get the highest level with a ready thread (-1 if none)
+ */
+static inline int run_queue_top(sched_cpu_t *sched) {
+    uint32_t bitmap = sched->ready_bitmap;
+    return bitmap ? 31 - __builtin_clz(bitmap) : -1;
+}
+
+/*
+ * Check whether a thread may run on a CPU
+ */
+static inline int sched_allowed(uint64_t affinity, uint32_t cpu) {
+    return (affinity >> cpu) & 1;
+}
+
+/*
+ * Pick the CPU to queue a thread on: the one it last ran on while allowed
+ * there, else the least loaded allowed CPU
+ */
+static uint32_t sched_select_cpu(uint64_t affinity, uint32_t last) {
+    if (sched_allowed(affinity, last)) {
+        return last;
+    }
+    
+    uint32_t best = last;
+    uint32_t best_load = UINT32_MAX;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!sched_allowed(affinity, cpu) || !smp_cpu_online(cpu)) {
+            continue;
+        }
+        uint32_t load = __atomic_load_n(&g_sched_state.cpus[cpu].load, __ATOMIC_RELAXED);
+        if (load < best_load) {
+            best = cpu;
+            best_load = load;
+        }
+    }
+    
+    return best;
+}
+
+/*
+ * Lock two CPUs' instances in index order (interrupts off until unlocked)
+ */
+static uint64_t sched_lock_pair(uint32_t a, uint32_t b) {
+    uint64_t flags = cpu_irq_save();
+    
+    spin_lock(&g_sched_state.cpus[a < b ? a : b].lock);
+    if (a != b) {
+        spin_lock(&g_sched_state.cpus[a < b ? b : a].lock);
+    }
+    
+    return flags;
+}
+
+static void sched_unlock_pair(uint32_t a, uint32_t b, uint64_t flags) {
+    spin_unlock(&g_sched_state.cpus[a].lock);
+    if (a != b) {
+        spin_unlock(&g_sched_state.cpus[b].lock);
+    }
+    cpu_irq_restore(flags);
+}
+
+/*
+ * Lock the CPU that owns a thread (a thief may move it until the lock is
+ * held)
+ */
+static sched_cpu_t* sched_lock_owner(tcb_t *tcb, uint64_t *flags) {
+    while (1) {
+        uint32_t cpu = __atomic_load_n(&tcb->cpu, __ATOMIC_RELAXED);
+        sched_cpu_t *sched = &g_sched_state.cpus[cpu];
+        
+        *flags = cpu_irq_save();
+        spin_lock(&sched->lock);
+        if (tcb->cpu == cpu) {
+            return sched;
+        }
+        spin_unlock(&sched->lock);
+        cpu_irq_restore(*flags);
+    }
+}
+
+/*
+ * Move a queued thread to another CPU's run queue (both locks held)
+ */
+static void sched_move_thread(tcb_t *tcb, uint32_t cpu) {
+    sched_cpu_t *to = &g_sched_state.cpus[cpu];
+    
+    run_queue_remove(&g_sched_state.cpus[tcb->cpu], tcb);
+    tcb->cpu = cpu;
+    run_queue_insert(to, tcb, 0);
+    to->stats.migrations++;
+}
+
+/*
+ * Convert clock nanoseconds to ticks, rounded up
+ */
+static inline uint64_t sched_ns_tick(uint64_t ns) {
+    return (ns + TIMER_NS_PER_TICK - 1) / TIMER_NS_PER_TICK;
+}
+
+/*
+ * Get the bandwidth of a reservation (SCHED_DL_UTIL_SHIFT fixed point)
+ */
+static inline uint64_t sched_dl_util(uint64_t budget, uint64_t period) {
+    return (budget << SCHED_DL_UTIL_SHIFT) / period;  /* Periods are bounded: no overflow */
+}
+
+/*
+ * Take a deadline thread that is out of budget off the CPU until its
+ * deadline, when the replenish timer gives it the next period's (lock
+ * held; the timer may still be armed from an earlier deadline, in which
+ * case its callback re-arms it)
+ */
+static void sched_dl_throttle(sched_cpu_t *sched, tcb_t *tcb) {
+    tcb->state = THREAD_STATE_THROTTLED;
+    sched->stats.dl_throttles++;
+    timer_add(&tcb->throttle_timer, sched_ns_tick(tcb->dl_deadline));
+}
+
+/*
+ * Apply the constant bandwidth server's wakeup rule to a deadline thread
+ * (lock held): it keeps its deadline only if the budget left would not
+ * exceed its bandwidth until then, and otherwise starts a new period.
+ * Returns 0 if it woke out of budget and was throttled instead.
+ */
+static int sched_dl_wakeup(sched_cpu_t *sched, tcb_t *tcb) {
+    uint64_t now = clock_ns();
+    
+    if (tcb->dl_deadline <= now ||
+        (tcb->dl_runtime > 0 &&
+         (unsigned __int128)tcb->dl_runtime * tcb->dl_period >=
+         (unsigned __int128)(tcb->dl_deadline - now) * tcb->dl_budget)) {
+        tcb->dl_deadline = now + tcb->dl_period;
+        tcb->dl_runtime = (int64_t)tcb->dl_budget;
+    } else if (tcb->dl_runtime <= 0) {
+        sched_dl_throttle(sched, tcb);
+        return 0;
+    }
+    
+    return 1;
+}
+
+/*
+ * Replenish a throttled deadline thread at its deadline (lock held). Each
+ * period gives one budget, so an overrun is paid back first.
+ */
+static void sched_dl_replenish(sched_cpu_t *sched, tcb_t *tcb) {
+    uint64_t now = clock_ns();
+    
+    if (now < tcb->dl_deadline) {
+        timer_add(&tcb->throttle_timer, sched_ns_tick(tcb->dl_deadline));
+        return;
+    }
+    
+    while (tcb->dl_runtime <= 0) {
+        tcb->dl_deadline += tcb->dl_period;
+        tcb->dl_runtime += (int64_t)tcb->dl_budget;
+    }
+    if (tcb->dl_deadline <= now) {
+        tcb->dl_deadline = now + tcb->dl_period;
+        tcb->dl_runtime = (int64_t)tcb->dl_budget;
+    }
+    tcb->state = THREAD_STATE_READY;
+    run_queue_insert(sched, tcb, 0);
+}
+
+/*
+ * Charge a thread's domain CPU time (lock held). A priority-class thread,
+ * running or queued, whose domain has no quota left is throttled until
+ * the domain's next period; returns 1 if it was.
+ */
+static int sched_quota_charge(sched_cpu_t *sched, tcb_t *tcb, uint64_t cycles, uint64_t now) {
+    uint64_t refill;
+    if (cap_domain_charge(tcb->domain_id, cycles, now, &refill) != 0 ||
+        tcb->dl_period != 0 || tcb == sched->idle ||
+        (tcb->state != THREAD_STATE_RUNNING && tcb->state != THREAD_STATE_READY)) {
+        return 0;
+    }
+    
+    if (tcb->state == THREAD_STATE_READY) {
+        run_queue_remove(sched, tcb);
+    }
+    tcb->state = THREAD_STATE_THROTTLED;
+    sched->stats.quota_throttles++;
+    uint64_t wait = refill > now ? clock_cycles_to_ns(refill - now) : 0;
+    timer_add(&tcb->throttle_timer, sched_ns_tick(clock_ns() + wait));
+    
+    return 1;
+}
+
+/*
+ * Make a throttled thread ready again (timer callback): a deadline thread
+ * at its deadline, any other once its domain's next period has begun
+ */
+static void sched_replenish(void *arg) {
+    spin_lock(&g_sched_state.lock);
+    
+    tcb_t *tcb = kmem_table_get(&g_sched_state.threads, (uint64_t)arg);
+    if (tcb != NULL) {
+        uint64_t flags;
+        sched_cpu_t *sched = sched_lock_owner(tcb, &flags);
+        
+        if (tcb->state != THREAD_STATE_THROTTLED) {
+            /* Woken or reserved afresh since */
+        } else if (tcb->dl_period != 0) {
+            sched_dl_replenish(sched, tcb);
+        } else {
+            /* Queued first: still out of quota, it is throttled again */
+            tcb->state = THREAD_STATE_READY;
+            run_queue_insert(sched, tcb, 0);
+            sched_quota_charge(sched, tcb, 0, cpu_rdtsc());
+        }
+        
+        spin_unlock(&sched->lock);
+        cpu_irq_restore(flags);
+    }
+    
+    spin_unlock(&g_sched_state.lock);
+}
+
+/*
+ * Charge the running thread the CPU time since it was last charged (lock
+ * held); a deadline thread that has used up its budget, or another whose
+ * domain has used up its quota, is throttled
+ */
+static void sched_charge(sched_cpu_t *sched, tcb_t *tcb, uint64_t now) {
+    uint64_t cycles = now - tcb->run_start;
+    uint64_t ns = clock_cycles_to_ns(cycles);
+    tcb->run_start = now;
+    tcb->total_time += ns;
+    sched_quota_charge(sched, tcb, cycles, now);
+    
+    if (tcb->dl_period == 0) {
+        return;
+    }
+    tcb->dl_runtime -= (int64_t)ns;
+    if (tcb->dl_runtime <= 0 && tcb->state == THREAD_STATE_RUNNING) {
+        sched_dl_throttle(sched, tcb);
+    }
+}
+
+/*
+ * Check whether the running thread keeps the CPU against the highest
+ * ready level: it does at a higher level, or at the same one with slice
+ * left (priority class) or a deadline no later than the earliest queued
+ * (deadline class)
+ */
+static inline int sched_keeps_cpu(sched_cpu_t *sched, tcb_t *current, int top) {
+    int level = (int)sched_level(current);
+    
+    if (level != top) {
+        return level > top;
+    }
+    if (level == SCHED_LEVEL_DEADLINE) {
+        return current->dl_deadline <= sched->run_queues[top].head->dl_deadline;
+    }
+    return current->time_slice > 0;
+}
+
+static uint64_t sched_create_on(uint32_t cpu, uint64_t affinity, uint64_t domain_id,
+                                void (*entry_point)(void*), void *arg,
+                                thread_priority_t priority);
+
 /*
  * Initialize scheduler
  */
 int sched_init(void) {
     memset(&g_sched_state, 0, sizeof(sched_state_t));
     
+    if (kmem_cache_init(&g_tcb_cache, "tcb", sizeof(tcb_t), CACHE_LINE_SIZE, NULL) != 0) {
+        return -1;
+    }
+    if (fpu_init() != 0) {
+        return -1;
+    }
+    if (timer_init() != 0) {
+        return -1;
+    }
+    
     g_sched_state.num_threads = 0;
-    g_sched_state.current_thread = 0;
-    g_sched_state.next_thread_id = 1;
-    g_sched_state.timer_ticks = 0;
     g_sched_state.lock = 0;
     
-    /* Create idle thread */
-    sched_create_thread(0, sched_idle_thread, NULL, THREAD_PRIORITY_IDLE);
+    return sched_init_cpu();
+}
+
+/*
+ * Start the calling CPU's scheduler instance
+ */
+int sched_init_cpu(void) {
+    uint32_t cpu = cpu_current_id();
+    sched_cpu_t *sched = &g_sched_state.cpus[cpu];
+    memset(sched, 0, sizeof(sched_cpu_t));
+    
+    /* Create idle thread (initially current: the CPU's boot flow runs as it) */
+    uint64_t idle_id = sched_create_on(cpu, 1ULL << cpu, 0, sched_idle_thread, NULL,
+                                       THREAD_PRIORITY_IDLE);
+    
+    spin_lock(&g_sched_state.lock);
+    tcb_t *idle = kmem_table_get(&g_sched_state.threads, idle_id);
+    spin_unlock(&g_sched_state.lock);
+    if (idle == NULL) {
+        return -1;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&sched->lock);
+    run_queue_remove(sched, idle);
+    idle->state = THREAD_STATE_RUNNING;
+    idle->flags |= THREAD_FLAG_IDLE;
+    idle->on_cpu = 1;
+    idle->run_start = cpu_rdtsc();
+    sched->idle = idle;
+    cpu_local()->current = idle;
+    spin_unlock(&sched->lock);
+    cpu_irq_restore(flags);
     
     return 0;
 }
 
 /*
- * Create a new thread
+ * Create a new thread (on the creating CPU if its domain allows it there)
  */
 uint64_t sched_create_thread(uint64_t domain_id, void (*entry_point)(void*),
                              void *arg, thread_priority_t priority) {
-    spin_lock(&g_sched_state.lock);
+    uint64_t affinity = cap_domain_affinity(domain_id);
     
-    /* Find free thread slot */
-    uint32_t slot = 0;
-    for (slot = 0; slot < MAX_THREADS; slot++) {
-        if (g_sched_state.threads[slot].state == THREAD_STATE_TERMINATED ||
-            g_sched_state.threads[slot].state == 0) {
-            break;
-        }
+    return sched_create_on(sched_select_cpu(affinity, cpu_current_id()), affinity,
+                           domain_id, entry_point, arg, priority);
+}
+
+/*
+ * Create a new thread on a CPU's run queue
+ */
+static uint64_t sched_create_on(uint32_t cpu, uint64_t affinity, uint64_t domain_id,
+                                void (*entry_point)(void*), void *arg,
+                                thread_priority_t priority) {
+    if ((uint32_t)priority >= SCHED_NUM_PRIORITIES) {
+        return 0;
     }
     
-    if (slot >= MAX_THREADS) {
+    spin_lock(&g_sched_state.lock);
+    
+    tcb_t *tcb = kmem_cache_alloc(&g_tcb_cache);
+    if (tcb == NULL) {
         spin_unlock(&g_sched_state.lock);
-        return 0;  /* No free slots */
+        return 0;  /* Out of memory */
     }
     
     /* Allocate stack */
     uint64_t stack_base = mm_alloc(STACK_SIZE, 16, MEM_TYPE_KERNEL, domain_id);
     if (stack_base == 0) {
+        kmem_cache_free(&g_tcb_cache, tcb);
+        spin_unlock(&g_sched_state.lock);
+        return 0;
+    }
+    
+    uint64_t thread_id = kmem_table_insert(&g_sched_state.threads, tcb);
+    if (thread_id == 0) {
+        mm_free(stack_base);
+        kmem_cache_free(&g_tcb_cache, tcb);
         spin_unlock(&g_sched_state.lock);
         return 0;
     }
     
     /* Initialize TCB */
-    tcb_t *tcb = &g_sched_state.threads[slot];
-    tcb->thread_id = g_sched_state.next_thread_id++;
+    tcb->thread_id = thread_id;
     tcb->domain_id = domain_id;
+    tcb_t *creator = sched_get_current();
+    tcb->process_id = (creator != NULL) ? creator->process_id : 0;  /* Same process */
     tcb->state = THREAD_STATE_READY;
     tcb->priority = priority;
+    tcb->base_priority = priority;
     tcb->stack_base = stack_base;
     tcb->stack_size = STACK_SIZE;
-    tcb->stack_ptr = stack_base + STACK_SIZE;  /* Stack grows down */
     tcb->entry_point = entry_point;
     tcb->arg = arg;
-    tcb->time_slice = 10;  /* Default time slice */
+    tcb->time_slice = SCHED_TIME_SLICE;
     tcb->total_time = 0;
     tcb->flags = 0;
+    tcb->cpu = cpu;
+    tcb->on_cpu = 0;
+    tcb->affinity = affinity;
+    tcb->last_ran = 0;
+    tcb->run_start = 0;
+    tcb->xstate = NULL;
+    tcb->dl_budget = 0;
+    tcb->dl_period = 0;
+    tcb->dl_runtime = 0;
+    tcb->dl_deadline = 0;
+    tcb->dl_cpu = cpu;
+    timer_setup(&tcb->throttle_timer, sched_replenish, (void *)thread_id);
+    timer_setup(&tcb->sleep_timer, sched_sleep_expired, (void *)thread_id);
+    tcb->ipc_msg = NULL;
+    tcb->ipc_partner = NULL;
+    tcb->ipc_next = NULL;
+    tcb->ipc_endpoint = NULL;
+    tcb->ipc_server = NULL;
+    tcb->ipc_serves = NULL;
+    tcb->ipc_status = 0;
+    tcb->ipc_waiting = 0;
+    tcb->ipc_pins = 0;
     
+    /* Initial frame for context_switch: callee-saved registers, then the
+     * return into context_thread_entry (stack grows down, 16-byte aligned) */
+    uint64_t *sp = (uint64_t *)((stack_base + STACK_SIZE - 16) & ~15ULL);
+    *--sp = (uint64_t)context_thread_entry;
+    *--sp = 0;                          /* rbp */
+    *--sp = 0;                          /* rbx */
+    *--sp = (uint64_t)entry_point;      /* r12 */
+    *--sp = (uint64_t)arg;              /* r13 */
+    *--sp = 0;                          /* r14 */
+    *--sp = 0;                          /* r15 */
+    tcb->stack_ptr = (uint64_t)sp;
+    
+    sched_cpu_t *sched = &g_sched_state.cpus[cpu];
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&sched->lock);
+    run_queue_insert(sched, tcb, 0);
+    spin_unlock(&sched->lock);
+    cpu_irq_restore(flags);
     g_sched_state.num_threads++;
     
     spin_unlock(&g_sched_state.lock);
     
-    return tcb->thread_id;
+    return thread_id;
+}
+
+/*
+ * Queue a terminated thread to be freed after this CPU's next switch
+ */
+static void sched_defer_free(sched_cpu_t *sched, tcb_t *tcb) {
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&sched->lock);
+    tcb->run_next = sched->zombies;
+    sched->zombies = tcb;
+    spin_unlock(&sched->lock);
+    cpu_irq_restore(flags);
+}
+
+/*
+ * Free a terminated thread's stack, save area and TCB, once it is out of
+ * IPC (an IPC peer may still be about to wake it: then it waits)
+ */
+static void sched_free_thread(tcb_t *tcb) {
+    if (ipc_thread_exit(tcb) != 0) {
+        sched_defer_free(sched_cpu(), tcb);
+        return;
+    }
+    
+    timer_cancel(&tcb->throttle_timer);
+    timer_cancel(&tcb->sleep_timer);
+    mm_free(tcb->stack_base);
+    fpu_release(tcb);
+    kmem_cache_free(&g_tcb_cache, tcb);
 }
 
 /*
@@ -94,47 +639,378 @@ uint64_t sched_create_thread(uint64_t domain_id, void (*entry_point)(void*),
 int sched_terminate_thread(uint64_t thread_id) {
     spin_lock(&g_sched_state.lock);
     
-    for (uint32_t i = 0; i < MAX_THREADS; i++) {
-        tcb_t *tcb = &g_sched_state.threads[i];
+    tcb_t *tcb = kmem_table_get(&g_sched_state.threads, thread_id);
+    if (tcb == NULL) {
+        spin_unlock(&g_sched_state.lock);
+        return -1;  /* Thread not found */
+    }
+    
+    kmem_table_remove(&g_sched_state.threads, thread_id);
+    g_sched_state.num_threads--;
+    if (tcb->dl_period != 0) {
+        g_sched_state.cpus[tcb->dl_cpu].dl_util -= sched_dl_util(tcb->dl_budget, tcb->dl_period);
+    }
+    
+    uint64_t flags;
+    sched_cpu_t *sched = sched_lock_owner(tcb, &flags);
+    
+    if (tcb->state == THREAD_STATE_READY) {
+        run_queue_remove(sched, tcb);
+    }
+    tcb->state = THREAD_STATE_TERMINATED;
+    
+    /* A stack cannot be freed while its thread is running (or, on another
+     * CPU, may still be switching away); its CPU frees it after the next
+     * switch */
+    int free_now = tcb->cpu == cpu_current_id() && sched_get_current() != tcb;
+    if (!free_now) {
+        tcb->run_next = sched->zombies;
+        sched->zombies = tcb;
+    }
+    
+    spin_unlock(&sched->lock);
+    cpu_irq_restore(flags);
+    spin_unlock(&g_sched_state.lock);
+    
+    if (free_now) {
+        sched_free_thread(tcb);
+    }
+    
+    return 0;
+}
+
+/*
+ * Restrict a domain's threads to a set of CPUs. Queued threads move now;
+ * running ones when they next reach the scheduler, blocked ones when they
+ * are unblocked. Deadline threads stay on the CPU that admitted them.
+ */
+int sched_set_affinity(uint64_t domain_id, uint64_t mask) {
+    uint64_t online = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (smp_cpu_online(cpu)) {
+            online |= 1ULL << cpu;
+        }
+    }
+    if ((mask & online) == 0) {
+        return -2;  /* The domain's threads could never run */
+    }
+    
+    spin_lock(&g_sched_state.lock);
+    
+    int result = cap_domain_set_affinity(domain_id, mask);
+    if (result != 0) {
+        spin_unlock(&g_sched_state.lock);
+        return result;
+    }
+    
+    for (uint64_t id = 1; id < kmem_table_end(&g_sched_state.threads); id++) {
+        tcb_t *tcb = kmem_table_get(&g_sched_state.threads, id);
+        if (tcb == NULL || tcb->domain_id != domain_id || tcb->dl_period != 0) {
+            continue;
+        }
         
-        if (tcb->thread_id == thread_id) {
-            tcb->state = THREAD_STATE_TERMINATED;
-            
-            /* Free stack */
-            mm_free(tcb->stack_base);
-            
-            g_sched_state.num_threads--;
-            
+        __atomic_store_n(&tcb->affinity, mask, __ATOMIC_RELAXED);
+        
+        uint32_t from = __atomic_load_n(&tcb->cpu, __ATOMIC_RELAXED);
+        if (sched_allowed(mask, from)) {
+            continue;
+        }
+        
+        uint32_t to = sched_select_cpu(mask, from);
+        uint64_t flags = sched_lock_pair(from, to);
+        if (tcb->cpu == from && tcb->state == THREAD_STATE_READY && !tcb->on_cpu) {
+            sched_move_thread(tcb, to);
+        }
+        sched_unlock_pair(from, to, flags);
+    }
+    
+    spin_unlock(&g_sched_state.lock);
+    
+    return 0;
+}
+
+/*
+ * Pick the CPU to admit a reservation on (global lock held): the thread's
+ * own CPU if the bandwidth fits there, else the allowed CPU with the most
+ * to spare; MAX_CPUS if none has room
+ */
+static uint32_t sched_dl_select_cpu(uint64_t affinity, uint32_t last, uint64_t util) {
+    if (sched_allowed(affinity, last) && smp_cpu_online(last) &&
+        g_sched_state.cpus[last].dl_util + util <= SCHED_DL_MAX_UTIL) {
+        return last;
+    }
+    
+    uint32_t best = MAX_CPUS;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!sched_allowed(affinity, cpu) || !smp_cpu_online(cpu) ||
+            g_sched_state.cpus[cpu].dl_util + util > SCHED_DL_MAX_UTIL) {
+            continue;
+        }
+        if (best == MAX_CPUS || g_sched_state.cpus[cpu].dl_util < g_sched_state.cpus[best].dl_util) {
+            best = cpu;
+        }
+    }
+    
+    return best;
+}
+
+/*
+ * Reserve CPU time for a thread. The reservation starts a fresh period
+ * with a full budget. A queued or blocked thread moves to the admitting
+ * CPU now, a running one when it next reaches the scheduler.
+ */
+int sched_set_deadline(uint64_t thread_id, uint64_t budget_ns, uint64_t period_ns) {
+    if (budget_ns != 0 && (period_ns < SCHED_DL_MIN_PERIOD_NS ||
+                           period_ns > SCHED_DL_MAX_PERIOD_NS || budget_ns > period_ns)) {
+        return -1;
+    }
+    uint64_t util = budget_ns != 0 ? sched_dl_util(budget_ns, period_ns) : 0;
+    
+    spin_lock(&g_sched_state.lock);
+    
+    tcb_t *tcb = kmem_table_get(&g_sched_state.threads, thread_id);
+    if (tcb == NULL || tcb == g_sched_state.cpus[tcb->cpu].idle) {
+        spin_unlock(&g_sched_state.lock);
+        return -1;  /* No such thread (idle threads keep their class) */
+    }
+    
+    /* Give back the current reservation before looking for room */
+    uint64_t old_util = tcb->dl_period != 0 ? sched_dl_util(tcb->dl_budget, tcb->dl_period) : 0;
+    g_sched_state.cpus[tcb->dl_cpu].dl_util -= old_util;
+    
+    uint64_t affinity = cap_domain_affinity(tcb->domain_id);
+    uint32_t from = __atomic_load_n(&tcb->cpu, __ATOMIC_RELAXED);
+    uint32_t admit = MAX_CPUS;
+    if (util != 0) {
+        admit = sched_dl_select_cpu(affinity, from, util);
+        if (admit == MAX_CPUS) {
+            g_sched_state.cpus[tcb->dl_cpu].dl_util += old_util;
             spin_unlock(&g_sched_state.lock);
-            
-            return 0;
+            return -2;  /* Not enough bandwidth left */
+        }
+    }
+    
+    /* A thief may move a queued thread until both locks are held */
+    uint32_t to;
+    uint64_t flags;
+    while (1) {
+        to = util != 0 ? admit : from;
+        flags = sched_lock_pair(from, to);
+        if (tcb->cpu == from) {
+            break;
         }
+        sched_unlock_pair(from, to, flags);
+        from = __atomic_load_n(&tcb->cpu, __ATOMIC_RELAXED);
     }
     
+    /* Queued by level: out of the old one before the class changes */
+    if (tcb->state == THREAD_STATE_READY) {
+        run_queue_remove(&g_sched_state.cpus[from], tcb);
+    } else if (tcb->state == THREAD_STATE_THROTTLED) {
+        tcb->state = THREAD_STATE_READY;  /* A pending replenish finds it ready */
+    }
+    
+    tcb->dl_budget = budget_ns;
+    tcb->dl_period = budget_ns != 0 ? period_ns : 0;
+    tcb->dl_runtime = (int64_t)budget_ns;
+    tcb->dl_deadline = clock_ns() + period_ns;
+    tcb->dl_cpu = to;
+    __atomic_store_n(&tcb->affinity, util != 0 ? 1ULL << to : affinity, __ATOMIC_RELAXED);
+    g_sched_state.cpus[to].dl_util += util;
+    
+    if (tcb->state != THREAD_STATE_RUNNING && !tcb->on_cpu && to != from) {
+        tcb->cpu = to;
+        g_sched_state.cpus[to].stats.migrations++;
+    }
+    if (tcb->state == THREAD_STATE_READY) {
+        run_queue_insert(&g_sched_state.cpus[tcb->cpu], tcb, 0);
+    }
+    
+    sched_unlock_pair(from, to, flags);
     spin_unlock(&g_sched_state.lock);
     
-    return -1;  /* Thread not found */
+    return 0;
+}
+
+/*
+ * Limit a domain's CPU time. Its threads throttled under an earlier quota
+ * stay so until the period they were throttled in ends.
+ */
+int sched_set_quota(uint64_t domain_id, uint64_t quota_ns, uint64_t period_ns) {
+    if (quota_ns != 0 && (period_ns < SCHED_DL_MIN_PERIOD_NS ||
+                          period_ns > SCHED_DL_MAX_PERIOD_NS ||
+                          quota_ns > period_ns * MAX_CPUS)) {
+        return -1;
+    }
+    
+    uint64_t quota = clock_ns_to_cycles(quota_ns);
+    uint64_t period = clock_ns_to_cycles(period_ns);
+    if (quota_ns != 0 && quota == 0) {
+        return -1;  /* Clock not calibrated */
+    }
+    
+    return cap_domain_set_quota(domain_id, quota, period);
+}
+
+/*
+ * Credit the tick periods elapsed since they were last counted while the
+ * tick is stopped (lock held); taken is the number of timer interrupts
+ * that arrived meanwhile. This is an estimate of the ticks avoided: it
+ * counts what a running periodic tick would have delivered.
+ */
+static void sched_count_ticks(sched_cpu_t *sched, uint64_t now, uint64_t taken) {
+    if (!sched->tickless || now <= sched->tickless_since) {
+        return;
+    }
+    
+    uint64_t elapsed = now - sched->tickless_since;
+    if (elapsed > taken) {
+        sched->stats.ticks_avoided_est += elapsed - taken;
+    }
+    sched->tickless_since = now;
+}
+
+/*
+ * Program the calling CPU's timer for what it runs now (lock held): the
+ * periodic tick while other threads are queued, otherwise a single expiry
+ * at the next timer-wheel deadline (or the running thread's budget or
+ * domain quota running out), or nothing with no timer pending
+ */
+static void sched_program_timer(sched_cpu_t *sched, tcb_t *running) {
+    uint32_t tickless = sched->load == 0;
+    uint64_t deadline = tickless ? timer_next_expiry() : UINT64_MAX;
+    
+    /* A thread running alone still needs its budget or quota enforced */
+    if (tickless && running != NULL && running != sched->idle) {
+        uint64_t left;
+        if (running->dl_period != 0) {
+            left = running->dl_runtime > 0 ? (uint64_t)running->dl_runtime : 0;
+        } else {
+            left = cap_domain_charge(running->domain_id, 0, cpu_rdtsc(), NULL);
+            left = left != UINT64_MAX ? clock_cycles_to_ns(left) : UINT64_MAX;
+        }
+        if (left != UINT64_MAX) {
+            uint64_t exhausted = timer_ticks() + sched_ns_tick(left);
+            if (exhausted < deadline) {
+                deadline = exhausted;
+            }
+        }
+    }
+    
+    /* Reprogrammed only on a change: this runs on every reschedule */
+    if (tickless == sched->tickless && deadline == sched->timer_deadline) {
+        return;
+    }
+    
+    uint64_t now = timer_ticks();
+    if (sched->tickless) {
+        sched_count_ticks(sched, now, 0);
+    } else {
+        sched->tickless_since = now;
+    }
+    sched->tickless = tickless;
+    sched->timer_deadline = deadline;
+    
+    uint64_t tsc = tickless && deadline != UINT64_MAX ? timer_tick_tsc(deadline) : 0;
+    if (!tickless) {
+        apic_timer_start(IRQ_VECTOR_TIMER, SCHED_TICK_HZ);
+        sched->stats.tick_starts++;
+    } else if (deadline == UINT64_MAX) {
+        apic_timer_stop();
+    } else if (tsc == 0 || apic_timer_deadline(IRQ_VECTOR_TIMER, tsc) != 0) {
+        uint64_t ticks = deadline > now ? deadline - now : 0;
+        apic_timer_oneshot(IRQ_VECTOR_TIMER, ticks * 1000000 / TIMER_HZ);
+    }
+}
+
+/*
+ * Get a CPU's load balancing and tick statistics
+ */
+int sched_get_stats(uint32_t cpu, sched_stats_t *stats) {
+    if (cpu >= MAX_CPUS || stats == NULL) {
+        return -1;
+    }
+    
+    sched_cpu_t *sched = &g_sched_state.cpus[cpu];
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&sched->lock);
+    *stats = sched->stats;
+    
+    /* Include the stretch the tick is stopped for right now */
+    uint64_t now = timer_ticks();
+    if (sched->tickless && now > sched->tickless_since) {
+        stats->ticks_avoided_est += now - sched->tickless_since;
+    }
+    spin_unlock(&sched->lock);
+    cpu_irq_restore(flags);
+    
+    return 0;
 }
 
 /*
  * Yield CPU to next thread
  */
 void sched_yield(void) {
-    /* In real implementation, would trigger context switch */
-    /* For now, just return */
+    sched_reschedule(0);
+}
+
+/*
+ * Mark the current thread blocked (it keeps running until it reaches the
+ * scheduler, and an unblock before then just makes it ready again). With
+ * a flag it only blocks while the flag is set: read under the lock, so a
+ * waker that clears it and then unblocks is never missed.
+ */
+static void sched_set_blocked(volatile uint32_t *flag) {
+    sched_cpu_t *sched = sched_cpu();
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&sched->lock);
+    
+    tcb_t *current = sched_get_current();
+    if (current && current->state == THREAD_STATE_RUNNING &&
+        (flag == NULL || __atomic_load_n(flag, __ATOMIC_ACQUIRE))) {
+        current->state = THREAD_STATE_BLOCKED;
+    }
+    
+    spin_unlock(&sched->lock);
+    cpu_irq_restore(flags);
+}
+
+/*
+ * Wake a sleeping thread (timer callback)
+ */
+static void sched_sleep_expired(void *arg) {
+    sched_unblock((uint64_t)arg);
 }
 
 /*
  * Sleep for specified milliseconds
  */
 void sched_sleep(uint64_t milliseconds) {
-    /* In real implementation, would block thread and set wake time */
-    /* For now, just busy wait */
-    volatile uint64_t count = 0;
-    for (uint64_t i = 0; i < milliseconds * 1000; i++) {
-        for (uint64_t j = 0; j < 1000; j++) {
-            count++;
+    uint64_t deadline = timer_ticks() + timer_ms_to_ticks(milliseconds);
+    tcb_t *current = sched_get_current();
+    
+    /* The idle thread has to stay runnable: it waits in place, letting
+     * whatever becomes ready run (and the tick stop while nothing does) */
+    if (current == NULL || current == sched_cpu()->idle) {
+        while (timer_ticks() < deadline) {
+            if (current != NULL) {
+                sched_yield();
+            } else {
+                timer_poll();
+            }
+            __asm__ volatile("pause");
         }
+        return;
+    }
+    
+    /* Blocked before the timer is armed, so an early expiry is not lost;
+     * woken before the deadline (sched_unblock), it goes back to sleep.
+     * The timer lives in the TCB, so terminating a sleeper cancels it. */
+    while (timer_ticks() < deadline) {
+        sched_set_blocked(NULL);
+        timer_add(&current->sleep_timer, deadline);
+        sched_reschedule(0);
+        timer_cancel(&current->sleep_timer);
     }
 }
 
@@ -142,95 +1018,349 @@ void sched_sleep(uint64_t milliseconds) {
  * Block current thread
  */
 int sched_block(void) {
-    spin_lock(&g_sched_state.lock);
+    sched_set_blocked(NULL);
     
-    tcb_t *current = sched_get_current();
-    if (current) {
-        current->state = THREAD_STATE_BLOCKED;
-    }
-    
-    spin_unlock(&g_sched_state.lock);
+    /* Runs again once unblocked and picked */
+    sched_reschedule(0);
     
     return 0;
 }
 
+/*
+ * Block the current thread while a flag is set
+ */
+void sched_block_while(volatile uint32_t *flag) {
+    while (__atomic_load_n(flag, __ATOMIC_ACQUIRE)) {
+        sched_set_blocked(flag);
+        sched_reschedule(0);
+    }
+}
+
 /*
  * Unblock a thread
  */
 int sched_unblock(uint64_t thread_id) {
+    int result = -1;  /* Thread not found */
+    
     spin_lock(&g_sched_state.lock);
     
-    for (uint32_t i = 0; i < MAX_THREADS; i++) {
-        tcb_t *tcb = &g_sched_state.threads[i];
+    tcb_t *tcb = kmem_table_get(&g_sched_state.threads, thread_id);
+    while (tcb) {
+        /* A handoff may move a blocked thread under just the two CPU
+         * locks, so its CPU is checked again once they are held. One
+         * still switching away stays put (it moves on after the switch). */
+        uint32_t from = __atomic_load_n(&tcb->cpu, __ATOMIC_RELAXED);
+        uint32_t to = from;
+        if (!__atomic_load_n(&tcb->on_cpu, __ATOMIC_ACQUIRE)) {
+            to = sched_select_cpu(tcb->affinity, from);
+        }
         
-        if (tcb->thread_id == thread_id && tcb->state == THREAD_STATE_BLOCKED) {
+        uint64_t flags = sched_lock_pair(from, to);
+        if (tcb->cpu != from || (to != from && tcb->on_cpu)) {
+            sched_unlock_pair(from, to, flags);
+            continue;
+        }
+        
+        if (tcb->state == THREAD_STATE_BLOCKED) {
             tcb->state = THREAD_STATE_READY;
-            
-            spin_unlock(&g_sched_state.lock);
-            
-            return 0;
+            if (to != from) {
+                tcb->cpu = to;
+                g_sched_state.cpus[to].stats.migrations++;
+            }
+            if (tcb->dl_period == 0 || sched_dl_wakeup(&g_sched_state.cpus[to], tcb)) {
+                run_queue_insert(&g_sched_state.cpus[to], tcb, 0);
+            }
+            result = 0;
         }
+        
+        sched_unlock_pair(from, to, flags);
+        break;
     }
     
     spin_unlock(&g_sched_state.lock);
     
-    return -1;  /* Thread not found */
+    return result;
 }
 
 /*
  * Get current thread
  */
 tcb_t* sched_get_current(void) {
-    if (g_sched_state.current_thread < MAX_THREADS) {
-        return &g_sched_state.threads[g_sched_state.current_thread];
+    return cpu_local()->current;
+}
+
+/*
+ * Switch from prev to next (lock released, interrupts off); returns when
+ * prev runs again
+ */
+static void sched_switch(tcb_t *prev, tcb_t *next) {
+    uint64_t unused_sp;
+    
+    /* Let go of prev once on next's stack (sched_thread_start); its time
+     * was charged when it reached the scheduler */
+    uint64_t now = cpu_rdtsc();
+    sched_cpu()->prev = prev;
+    if (prev != NULL) {
+        prev->last_ran = now;
     }
-    return NULL;
+    next->run_start = now;
+    
+    fpu_switch(prev, next);
+    context_switch(prev ? &prev->stack_ptr : &unused_sp, next->stack_ptr);
+    
+    /* Back on prev's stack, now running again */
+    sched_thread_start();
 }
 
 /*
- * Schedule next thread (called by timer interrupt)
+ * Pick the next thread and switch to it. On a timer tick the current
+ * thread's slice is charged; otherwise (yield/block) it gives up the rest.
  */
-void sched_schedule(void) {
-    spin_lock(&g_sched_state.lock);
+static void sched_reschedule(int tick) {
+    /* Timer callbacks wake threads, so they run before picking one */
+    timer_poll();
     
-    g_sched_state.timer_ticks++;
+    /* TLB invalidations other CPUs committed reach this one here */
+    isolation_tlb_sync();
     
-    /* Decrement current thread's time slice */
+    /* Nothing found by an unlocked table lookup is held across a pass */
+    kmem_quiesce();
+    
+    uint64_t flags = cpu_irq_save();
+    uint32_t cpu = cpu_current_id();
+    sched_cpu_t *sched = &g_sched_state.cpus[cpu];
+    spin_lock(&sched->lock);
+    
+    uint64_t now = cpu_rdtsc();
     tcb_t *current = sched_get_current();
-    if (current && current->time_slice > 0) {
-        current->time_slice--;
+    if (current) {
+        sched_charge(sched, current, now);
+    }
+    if (tick) {
+        sched->timer_ticks++;
+        sched_count_ticks(sched, timer_ticks(), 1);
+        
+        /* Decrement current thread's time slice */
+        if (current && current->time_slice > 0) {
+            current->time_slice--;
+        }
+    } else if (current) {
+        current->time_slice = 0;
     }
     
-    /* Find next ready thread */
-    uint32_t next_thread = 0;
-    int found = 0;
+    /* The running thread keeps the CPU until its slice runs out (then
+     * peers at its priority go first), a higher level becomes ready or,
+     * in the deadline class, an earlier deadline does; one its affinity
+     * no longer allows here gives way at once */
+    int top = run_queue_top(sched);
+    int running = current && current->state == THREAD_STATE_RUNNING;
+    int stay = running && sched_allowed(current->affinity, cpu);
     
-    /* Simple round-robin scheduling */
-    for (uint32_t i = 1; i <= g_sched_state.num_threads; i++) {
-        uint32_t idx = (g_sched_state.current_thread + i) % MAX_THREADS;
-        tcb_t *tcb = &g_sched_state.threads[idx];
-        
-        if (tcb->state == THREAD_STATE_READY) {
-            next_thread = idx;
-            found = 1;
-            break;
+    /* A queued thread whose domain ran out of quota meanwhile is not run */
+    while (top >= 0 && !(stay && sched_keeps_cpu(sched, current, top)) &&
+           sched_quota_charge(sched, sched->run_queues[top].head, 0, now)) {
+        top = run_queue_top(sched);
+    }
+    
+    if (top < 0 || (stay && sched_keeps_cpu(sched, current, top))) {
+        sched_program_timer(sched, current);
+        spin_unlock(&sched->lock);
+        cpu_irq_restore(flags);
+        return;
+    }
+    
+    tcb_t *next = sched->run_queues[top].head;
+    run_queue_remove(sched, next);
+    
+    if (running) {
+        /* Preempted with slice left: resume first among its peers */
+        current->state = THREAD_STATE_READY;
+        run_queue_insert(sched, current, current->time_slice > 0);
+    }
+    
+    cpu_local()->current = next;
+    next->state = THREAD_STATE_RUNNING;
+    next->on_cpu = 1;
+    if (next->time_slice == 0) {
+        next->time_slice = SCHED_TIME_SLICE;
+    }
+    sched_program_timer(sched, next);
+    
+    spin_unlock(&sched->lock);
+    
+    /* A blocking thread unblocked before it got here just keeps running */
+    if (next != current) {
+        sched_switch(current, next);
+    }
+    cpu_irq_restore(flags);
+}
+
+/*
+ * Hand the CPU to a blocked thread. Only priority-class threads are
+ * handed to (a deadline thread's budget and deadline need its own
+ * wakeup), and only while the target's affinity and domain quota let it
+ * run here; otherwise the caller takes the slow path.
+ */
+int sched_handoff(tcb_t *next, volatile uint32_t *flag, int lend) {
+    tcb_t *current = sched_get_current();
+    uint32_t cpu = cpu_current_id();
+    uint32_t from = __atomic_load_n(&next->cpu, __ATOMIC_RELAXED);
+    sched_cpu_t *sched = &g_sched_state.cpus[cpu];
+    
+    if (current == NULL || current == sched->idle || next == current) {
+        return -1;
+    }
+    
+    uint64_t flags = sched_lock_pair(from, cpu);
+    
+    uint64_t now = cpu_rdtsc();
+    sched_charge(sched, current, now);
+    if (next->cpu != from || next->state != THREAD_STATE_BLOCKED || next->on_cpu ||
+        next->dl_period != 0 || !sched_allowed(next->affinity, cpu) ||
+        current->state != THREAD_STATE_RUNNING || current->dl_period != 0 ||
+        !__atomic_load_n(flag, __ATOMIC_ACQUIRE) ||
+        cap_domain_charge(next->domain_id, 0, now, NULL) == 0) {
+        sched_unlock_pair(from, cpu, flags);
+        return -1;
+    }
+    
+    if (from != cpu) {
+        next->cpu = cpu;
+        sched->stats.migrations++;
+    }
+    current->state = THREAD_STATE_BLOCKED;
+    next->state = THREAD_STATE_RUNNING;
+    next->on_cpu = 1;
+    next->time_slice = current->time_slice;
+    if (lend && current->priority > next->base_priority) {
+        next->priority = current->priority;
+    }
+    cpu_local()->current = next;
+    sched->stats.direct_switches++;
+    sched_program_timer(sched, next);
+    
+    /* Interrupts stay off until the switch is done */
+    spin_unlock(&g_sched_state.cpus[from].lock);
+    if (from != cpu) {
+        spin_unlock(&sched->lock);
+    }
+    sched_switch(current, next);
+    cpu_irq_restore(flags);
+    
+    return 0;
+}
+
+/*
+ * Run the current thread at a lent priority
+ */
+void sched_lend_priority(thread_priority_t priority) {
+    sched_cpu_t *sched = sched_cpu();
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&sched->lock);
+    
+    tcb_t *current = sched_get_current();
+    if (current && current != sched->idle) {
+        current->priority = priority > current->base_priority ? priority : current->base_priority;
+    }
+    
+    spin_unlock(&sched->lock);
+    cpu_irq_restore(flags);
+}
+
+/*
+ * Raise a thread's priority to at least a given one. A queued thread
+ * moves to its new level's run queue; a running one may be preempted
+ * later by a thread it now outranks, but not before.
+ */
+int sched_boost(tcb_t *tcb, thread_priority_t priority) {
+    uint64_t flags;
+    sched_cpu_t *sched = sched_lock_owner(tcb, &flags);
+    
+    int raised = tcb != sched->idle && tcb->priority < priority;
+    if (raised) {
+        /* Queued by level: out of the old one before it changes */
+        int queued = tcb->state == THREAD_STATE_READY;
+        if (queued) {
+            run_queue_remove(sched, tcb);
+        }
+        tcb->priority = priority;
+        if (queued) {
+            run_queue_insert(sched, tcb, 0);
+        }
+        sched->stats.priority_boosts++;
+    }
+    
+    spin_unlock(&sched->lock);
+    cpu_irq_restore(flags);
+    
+    return raised;
+}
+
+/*
+ * Schedule next thread (called by timer interrupt)
+ */
+void sched_schedule(void) {
+    sched_reschedule(1);
+}
+
+/*
+ * Finish a switch: let go of the previous thread (moving it on if its
+ * affinity no longer allows this CPU) and free threads that exited on
+ * the way out
+ */
+void sched_thread_start(void) {
+    uint32_t cpu = cpu_current_id();
+    sched_cpu_t *sched = &g_sched_state.cpus[cpu];
+    tcb_t *prev = sched->prev;
+    sched->prev = NULL;
+    
+    /* Until on_cpu is cleared nothing else can move or free prev */
+    uint32_t to = cpu;
+    if (prev != NULL && !sched_allowed(prev->affinity, cpu)) {
+        to = sched_select_cpu(prev->affinity, cpu);
+    }
+    
+    uint64_t flags = sched_lock_pair(cpu, to);
+    if (prev != NULL) {
+        if (to != cpu && prev->state == THREAD_STATE_READY) {
+            sched_move_thread(prev, to);
         }
+        __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
     }
+    tcb_t *zombies = sched->zombies;
+    sched->zombies = NULL;
+    sched_unlock_pair(cpu, to, flags);
     
-    if (found && next_thread != g_sched_state.current_thread) {
-        /* Context switch would happen here */
-        g_sched_state.current_thread = next_thread;
+    tcb_t *current = sched_get_current();
+    while (zombies != NULL) {
+        tcb_t *next = zombies->run_next;
         
-        if (current) {
-            current->state = THREAD_STATE_READY;
+        if (zombies == current) {
+            /* Terminated from another CPU after being picked: still running */
+            sched_defer_free(sched, current);
+        } else {
+            sched_free_thread(zombies);
         }
         
-        tcb_t *next = &g_sched_state.threads[next_thread];
-        next->state = THREAD_STATE_RUNNING;
-        next->time_slice = 10;  /* Reset time slice */
+        zombies = next;
+    }
+}
+
+/*
+ * Terminate the current thread
+ */
+void sched_thread_exit(void) {
+    tcb_t *current = sched_get_current();
+    if (current) {
+        sched_terminate_thread(current->thread_id);
     }
     
-    spin_unlock(&g_sched_state.lock);
+    sched_reschedule(0);
+    
+    /* Never picked again */
+    while (1) {
+        __asm__ volatile("hlt");
+    }
 }
 
 /*
@@ -240,13 +1370,111 @@ void sched_timer_interrupt(void) {
     sched_schedule();
 }
 
+/*
+ * Check whether a thief may take a queued thread: not one still switching
+ * away, one its affinity keeps off the thief, or one whose cache is warm
+ */
+static inline int sched_can_steal(tcb_t *tcb, uint32_t cpu, uint64_t now) {
+    return !tcb->on_cpu && sched_allowed(tcb->affinity, cpu) &&
+           now - tcb->last_ran >= SCHED_CACHE_HOT_CYCLES;
+}
+
+/*
+ * Take up to half the load of the busiest CPU, from the tail of its
+ * highest priority queues (called by the idle thread); returns the number
+ * of threads taken
+ */
+static uint32_t sched_steal(uint32_t cpu) {
+    sched_cpu_t *sched = &g_sched_state.cpus[cpu];
+    
+    /* Loads are read unlocked: a stale one only misdirects this attempt */
+    uint32_t victim = cpu;
+    uint32_t busiest = 0;
+    for (uint32_t other = 0; other < MAX_CPUS; other++) {
+        if (other == cpu || !smp_cpu_online(other)) {
+            continue;
+        }
+        uint32_t load = __atomic_load_n(&g_sched_state.cpus[other].load, __ATOMIC_RELAXED);
+        if (load > busiest) {
+            victim = other;
+            busiest = load;
+        }
+    }
+    if (busiest == 0) {
+        return 0;
+    }
+    
+    sched_cpu_t *from = &g_sched_state.cpus[victim];
+    sched->stats.steal_attempts++;
+    
+    /* Out of lock order, so only try the victim's lock */
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&sched->lock);
+    if (!spin_trylock(&from->lock)) {
+        spin_unlock(&sched->lock);
+        cpu_irq_restore(flags);
+        return 0;
+    }
+    
+    uint32_t want = (from->load + 1) / 2;
+    uint32_t taken = 0;
+    uint64_t now = cpu_rdtsc();
+    
+    /* Priority levels only: deadline threads stay where they were admitted */
+    for (int priority = SCHED_NUM_PRIORITIES - 1; priority >= 0 && taken < want; priority--) {
+        tcb_t *tcb = from->run_queues[priority].tail;
+        while (tcb != NULL && taken < want) {
+            tcb_t *prev = tcb->run_prev;
+            if (tcb != from->idle && sched_can_steal(tcb, cpu, now)) {
+                sched_move_thread(tcb, cpu);
+                taken++;
+            }
+            tcb = prev;
+        }
+    }
+    sched->stats.steals += taken;
+    
+    spin_unlock(&from->lock);
+    spin_unlock(&sched->lock);
+    cpu_irq_restore(flags);
+    
+    return taken;
+}
+
 /*
  * Idle thread
  */
 void sched_idle_thread(void *arg) {
+    uint32_t cpu = cpu_current_id();
+    sched_cpu_t *sched = &g_sched_state.cpus[cpu];
+    
     while (1) {
-        /* Halt until next interrupt */
-        __asm__ volatile("hlt");
+        uint64_t start = cpu_rdtsc();
+        kmem_quiesce();
+        timer_poll();
+        
+        /* Run whatever was queued on this CPU, else take from the busiest */
+        if (__atomic_load_n(&sched->ready_bitmap, __ATOMIC_RELAXED) != 0 ||
+            sched_steal(cpu) != 0) {
+            sched_yield();
+            continue;
+        }
+        
+        /* Zero free frames ahead of page table and process allocation */
+        if (mm_zero_pool_refill(MM_ZERO_REFILL_PAGES) != 0) {
+            continue;
+        }
+        
+        /* Pool full: stop the tick until the next timer. No timer
+         * interrupt is routed yet, so poll for work rather than halt. */
+        uint64_t flags = cpu_irq_save();
+        spin_lock(&sched->lock);
+        sched_program_timer(sched, sched->idle);
+        spin_unlock(&sched->lock);
+        cpu_irq_restore(flags);
+        
+        __asm__ volatile("pause");
+        sched->stats.idle_cycles += cpu_rdtsc() - start;
     }
 }
 
@@ -0,0 +1,321 @@
+/*
+ * HIK Core-0 Timer Wheel Implementation
+ * 
+ * The tick clock is the kernel clock (clock.h) divided down to TIMER_HZ.
+ * A wheel is advanced by timer_poll on its own CPU: the
+ * idle loop and every pass through the scheduler poll, and the timer
+ * interrupt will once its vector is routed. Polling jumps straight to the
+ * next pending slot (found from the per-level bitmaps), so a CPU that has
+ * not polled for a while catches up in one step per expiring slot.
+ * 
+ * Slot lists link through a pointer to the previous link, so a timer can
+ * be cancelled while it sits on a list being fired as well as in a slot.
+ */
+
+#include "../include/timer.h"
+#include "../include/clock.h"
+#include "../include/stddef.h"
+
+/* Per-CPU wheels */
+static timer_wheel_t g_timer_wheels[MAX_CPUS];
+
+/* Spinlock operations */
+static inline void spin_lock(uint64_t *lock) {
+    while (__sync_lock_test_and_set(lock, 1)) {
+        /* Spin */
+    }
+}
+
+static inline void spin_unlock(uint64_t *lock) {
+    __sync_lock_release(lock);
+}
+
+/*
+ * Start the tick clock
+ */
+int timer_init(void) {
+    return clock_source() != CLOCK_SOURCE_NONE ? 0 : -1;
+}
+
+/*
+ * Get the current tick
+ */
+uint64_t timer_ticks(void) {
+    return clock_ns() / TIMER_NS_PER_TICK;
+}
+
+/*
+ * Get the TSC value at which a tick starts
+ */
+uint64_t timer_tick_tsc(uint64_t tick) {
+    return clock_ns_to_tsc(tick * TIMER_NS_PER_TICK);
+}
+
+/*
+ * Convert milliseconds to ticks (rounded up)
+ */
+uint64_t timer_ms_to_ticks(uint64_t milliseconds) {
+    return (milliseconds * TIMER_HZ + 999) / 1000;
+}
+
+/*
+ * Link a timer at the head of a list
+ */
+static inline void timer_link(timer_t *timer, timer_t **head) {
+    timer->next = *head;
+    timer->pprev = head;
+    if (*head != NULL) {
+        (*head)->pprev = &timer->next;
+    }
+    *head = timer;
+}
+
+/*
+ * Unlink a timer from whatever list it is on
+ */
+static inline void timer_unlink(timer_t *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/*
+ * Get a timer's slot index within its level
+ */
+static inline uint32_t timer_slot(timer_t *timer) {
+    return (timer->expires >> (timer->level * TIMER_LEVEL_SHIFT)) & (TIMER_WHEEL_SIZE - 1);
+}
+
+/*
+ * Set up a timer
+ */
+void timer_setup(timer_t *timer, void (*fn)(void *arg), void *arg) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->cpu = 0;
+    timer->level = 0;
+    timer->pending = 0;
+}
+
+/*
+ * Put a timer in the finest level that reaches its deadline (lock held)
+ */
+static void timer_enqueue(timer_wheel_t *wheel, timer_t *timer, uint64_t expires) {
+    if (expires < wheel->clk) {
+        expires = wheel->clk;  /* Already due: fires on the next poll */
+    }
+    
+    uint32_t level;
+    uint32_t shift = 0;
+    uint64_t index = 0;
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        shift = level * TIMER_LEVEL_SHIFT;
+        index = (expires + (1ULL << shift) - 1) >> shift;
+        if (index - (wheel->clk >> shift) < TIMER_WHEEL_SIZE) {
+            break;
+        }
+    }
+    if (level == TIMER_LEVELS) {
+        /* Beyond the wheel: fire at its far end (callers re-arm) */
+        level = TIMER_LEVELS - 1;
+        index = (wheel->clk >> shift) + TIMER_WHEEL_SIZE - 1;
+    }
+    
+    timer->expires = index << shift;
+    timer->level = level;
+    
+    uint32_t slot = timer_slot(timer);
+    timer_link(timer, &wheel->slots[level][slot]);
+    wheel->pending[level] |= 1ULL << slot;
+    wheel->num_timers++;
+    timer->pending = 1;
+}
+
+/*
+ * Find the tick of the next pending slot (lock held). Slots of a level
+ * only hold deadlines within one turn of its clock, so the first pending
+ * bit at or after the level's position is its earliest.
+ */
+static uint64_t timer_next_locked(timer_wheel_t *wheel) {
+    uint64_t next = UINT64_MAX;
+    
+    for (uint32_t level = 0; level < TIMER_LEVELS; level++) {
+        uint64_t bits = wheel->pending[level];
+        if (bits == 0) {
+            continue;
+        }
+        
+        uint32_t shift = level * TIMER_LEVEL_SHIFT;
+        uint64_t base = (wheel->clk + (1ULL << shift) - 1) >> shift;
+        uint32_t start = base & (TIMER_WHEEL_SIZE - 1);
+        if (start != 0) {
+            bits = (bits >> start) | (bits << (TIMER_WHEEL_SIZE - start));
+        }
+        
+        uint64_t expires = (base + __builtin_ctzll(bits)) << shift;
+        if (expires < next) {
+            next = expires;
+        }
+    }
+    
+    return next;
+}
+
+/*
+ * Queue a timer on the calling CPU's wheel to fire at a tick
+ */
+int timer_add(timer_t *timer, uint64_t expires) {
+    if (timer == NULL || timer->fn == NULL) {
+        return -1;
+    }
+    
+    uint32_t cpu = cpu_current_id();
+    timer_wheel_t *wheel = &g_timer_wheels[cpu];
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&wheel->lock);
+    
+    if (timer->pending) {
+        spin_unlock(&wheel->lock);
+        cpu_irq_restore(flags);
+        return -2;  /* Already queued */
+    }
+    
+    /* Levels are chosen relative to the wheel's clock: catch up a wheel
+     * with nothing due first, or the timer lands in a coarser level */
+    uint64_t now = timer_ticks();
+    if (wheel->clk < now && timer_next_locked(wheel) > now) {
+        wheel->clk = now;
+    }
+    
+    timer->cpu = cpu;
+    timer_enqueue(wheel, timer, expires);
+    
+    spin_unlock(&wheel->lock);
+    cpu_irq_restore(flags);
+    
+    return 0;
+}
+
+/*
+ * Cancel a timer, waiting for its callback if it is running
+ */
+int timer_cancel(timer_t *timer) {
+    if (timer == NULL) {
+        return -1;
+    }
+    
+    timer_wheel_t *wheel = &g_timer_wheels[timer->cpu];
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&wheel->lock);
+    
+    int result = -1;
+    if (timer->pending) {
+        timer_unlink(timer);
+        if (wheel->slots[timer->level][timer_slot(timer)] == NULL) {
+            wheel->pending[timer->level] &= ~(1ULL << timer_slot(timer));
+        }
+        wheel->num_timers--;
+        timer->pending = 0;
+        result = 0;
+    } else {
+        while (wheel->running == timer) {
+            spin_unlock(&wheel->lock);
+            __asm__ volatile("pause");
+            spin_lock(&wheel->lock);
+        }
+    }
+    
+    spin_unlock(&wheel->lock);
+    cpu_irq_restore(flags);
+    
+    return result;
+}
+
+/*
+ * Move the timers due at a tick onto a list (lock held): the tick's slot
+ * in level 0, and in each coarser level whose clock it advances
+ */
+static void timer_collect(timer_wheel_t *wheel, uint64_t tick, timer_t **expired) {
+    for (uint32_t level = 0; level < TIMER_LEVELS; level++) {
+        uint32_t shift = level * TIMER_LEVEL_SHIFT;
+        if (tick & ((1ULL << shift) - 1)) {
+            break;
+        }
+        
+        uint32_t slot = (tick >> shift) & (TIMER_WHEEL_SIZE - 1);
+        timer_t **head = &wheel->slots[level][slot];
+        while (*head != NULL) {
+            timer_t *timer = *head;
+            timer_unlink(timer);
+            timer_link(timer, expired);
+        }
+        wheel->pending[level] &= ~(1ULL << slot);
+    }
+}
+
+/*
+ * Fire the calling CPU's expired timers
+ */
+void timer_poll(void) {
+    timer_wheel_t *wheel = &g_timer_wheels[cpu_current_id()];
+    uint64_t now = timer_ticks();
+    
+    if (__atomic_load_n(&wheel->clk, __ATOMIC_RELAXED) > now) {
+        return;  /* Already processed this tick */
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&wheel->lock);
+    
+    while (wheel->clk <= now) {
+        uint64_t next = timer_next_locked(wheel);
+        if (next > now) {
+            wheel->clk = now + 1;
+            break;
+        }
+        
+        timer_t *expired = NULL;
+        timer_collect(wheel, next, &expired);
+        wheel->clk = next + 1;
+        
+        /* One at a time: the rest stay cancellable while this one runs */
+        while (expired != NULL) {
+            timer_t *timer = expired;
+            timer_unlink(timer);
+            wheel->num_timers--;
+            timer->pending = 0;
+            wheel->running = timer;
+            
+            spin_unlock(&wheel->lock);
+            cpu_irq_restore(flags);
+            timer->fn(timer->arg);
+            flags = cpu_irq_save();
+            spin_lock(&wheel->lock);
+            
+            wheel->running = NULL;
+        }
+    }
+    
+    spin_unlock(&wheel->lock);
+    cpu_irq_restore(flags);
+}
+
+/*
+ * Get the tick of the calling CPU's next pending timer
+ */
+uint64_t timer_next_expiry(void) {
+    timer_wheel_t *wheel = &g_timer_wheels[cpu_current_id()];
+    uint64_t flags = cpu_irq_save();
+    spin_lock(&wheel->lock);
+    uint64_t next = timer_next_locked(wheel);
+    spin_unlock(&wheel->lock);
+    cpu_irq_restore(flags);
+    
+    return next;
+}
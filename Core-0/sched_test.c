@@ -0,0 +1,1301 @@
+/*
+ * HIK Core-0 Scheduler Test Functions
+ * 
+ * This file contains test functions for verifying scheduler functionality.
+ * They run on the boot thread, which the scheduler treats as the idle
+ * thread, so any test thread of higher priority runs as soon as it yields.
+ */
+
+#include "../include/sched.h"
+#include "../include/ipc.h"
+#include "../include/context.h"
+#include "../include/cpu.h"
+#include "../include/smp.h"
+#include "../include/kernel.h"
+#include "../include/capability.h"
+#include "../include/timer.h"
+#include "../include/clock.h"
+#include "../include/apic.h"
+
+/* Context switch benchmark state */
+#define SWITCH_ROUNDS 10000
+
+static volatile uint32_t g_switch_done;
+static volatile uint32_t g_switch_errors;
+
+/* Load balancing test state */
+#define BALANCE_THREADS 8
+#define BALANCE_SPIN_CYCLES 2000000
+
+static volatile uint32_t g_balance_done;
+static volatile uint32_t g_balance_cpu[BALANCE_THREADS];
+
+/* Timer test state */
+#define SLEEP_MS 20
+#define SLEEP_SLACK_TICKS 5
+
+static volatile uint32_t g_sleep_done;
+static volatile uint64_t g_sleep_ticks;
+
+/* A sleeper terminated long before it would wake */
+#define SLEEPER_MS 10000
+
+static volatile uint32_t g_sleeper_started;
+
+/* Clock test state */
+#define CLOCK_READS 1000
+#define CLOCK_DELAY_US 5000
+#define CLOCK_SPIN_NS 2000000ULL
+
+static volatile uint32_t g_clock_done;
+static volatile uint64_t g_clock_cpu_time;
+
+/* Deadline class benchmark state: periodic service threads next to one
+ * that overruns its reservation and a priority-class thread. Work is done
+ * in slices with a pass through the scheduler after each, standing in for
+ * the timer tick: budgets are only enforced there (no timer interrupt
+ * yet), so a thread that never yields would not be stopped. */
+#define DL_PERIODIC_THREADS 3
+#define DL_PERIOD_MS 10
+#define DL_BUDGET_NS 2000000ULL
+#define DL_WORK_NS 1000000ULL
+#define DL_HOG_BUDGET_NS 3000000ULL
+#define DL_SLICE_NS 100000ULL
+#define DL_ROUNDS 20
+
+static volatile uint32_t g_dl_done;
+static volatile uint32_t g_dl_stop;
+static volatile uint64_t g_dl_start_tick;
+static volatile uint64_t g_dl_misses;
+static volatile uint64_t g_dl_max_jitter;
+static volatile uint64_t g_dl_background;
+
+/* Domain quota test state: a quota-limited domain and an unlimited one
+ * spinning on one CPU, in slices that pass through the scheduler (quotas
+ * are charged there; without a timer interrupt nothing stops a thread
+ * between passes) */
+#define QUOTA_NS 2000000ULL
+#define QUOTA_PERIOD_MS 10
+#define QUOTA_RUN_MS 50
+
+static volatile uint64_t g_quota_end;
+static volatile uint32_t g_quota_done;
+
+/* IPC test state: a high priority client calling a low priority server */
+#define IPC_ROUNDS 1000
+#define IPC_LABEL_ECHO 1
+#define IPC_LABEL_STOP 2
+
+static volatile uint64_t g_ipc_endpoint;
+static volatile uint32_t g_ipc_done;
+static volatile uint32_t g_ipc_errors;
+static volatile uint32_t g_ipc_lent;
+static volatile uint64_t g_ipc_cycles;
+
+/* Priority inversion test state: while the server works on a low priority
+ * call, a normal priority thread in a third domain spins and a high
+ * priority client calls */
+#define INV_LABEL_WORK 3
+#define INV_WORK_MS 10
+#define INV_SETTLE_MS 2
+#define INV_SPIN_MS 50
+
+static volatile uint64_t g_inv_domains[3];  /* Server, clients, spinner */
+static volatile uint64_t g_inv_end;
+static volatile uint64_t g_inv_called;
+static volatile uint64_t g_inv_replied;
+
+/* IPC termination test state: threads terminated while in IPC */
+#define EXIT_WAIT_MS 100
+
+static volatile uint32_t g_exit_started;
+static volatile uint32_t g_exit_serving;
+static volatile uint32_t g_exit_done;
+static volatile int g_exit_result;
+
+/* Tickless test state */
+#define TICKLESS_SHARE_MS 10
+
+static volatile uint32_t g_share_done;
+
+/*
+ * Ping-pong with the other benchmark thread, touching no vector registers
+ */
+static void switch_plain_thread(void *arg) {
+    for (uint32_t i = 0; i < SWITCH_ROUNDS; i++) {
+        sched_yield();
+    }
+    g_switch_done++;
+}
+
+/*
+ * Ping-pong with live vector state that must survive each switch
+ */
+static void switch_vector_thread(void *arg) {
+    uint64_t pattern = (uint64_t)arg;
+    
+    for (uint32_t i = 0; i < SWITCH_ROUNDS; i++) {
+        uint64_t seen;
+        /* Core-0 itself never uses vector registers, so no clobber is needed */
+        __asm__ volatile("movq %0, %%xmm15" : : "r"(pattern));
+        sched_yield();
+        __asm__ volatile("movq %%xmm15, %0" : "=r"(seen));
+        if (seen != pattern) {
+            g_switch_errors++;
+        }
+    }
+    g_switch_done++;
+}
+
+/*
+ * Run two threads of a domain yielding to each other; returns cycles per
+ * switch
+ */
+static uint64_t switch_cycles(uint64_t domain_id, void (*thread)(void *)) {
+    g_switch_done = 0;
+    g_switch_errors = 0;
+    
+    sched_create_thread(domain_id, thread, (void *)0x1111111111111111ULL, THREAD_PRIORITY_HIGH);
+    sched_create_thread(domain_id, thread, (void *)0x2222222222222222ULL, THREAD_PRIORITY_HIGH);
+    
+    /* Both run to completion before the boot thread is picked again */
+    uint64_t start = cpu_rdtsc();
+    while (g_switch_done < 2) {
+        sched_yield();
+    }
+    
+    return (cpu_rdtsc() - start) / (2 * SWITCH_ROUNDS);
+}
+
+/*
+ * Benchmark context switches with and without vector state
+ */
+static int test_context_switch(void) {
+    kernel_log("Testing context switch...\n");
+    
+    /* Keep the pair on this CPU: idle CPUs would otherwise take one */
+    uint64_t domain = cap_create_domain(0, 0);
+    if (domain == 0 || sched_set_affinity(domain, 1ULL << cpu_current_id()) != 0) {
+        kernel_log("FAILED: Cannot pin benchmark domain\n");
+        return -1;
+    }
+    
+    fpu_stats_t before, plain, vector;
+    fpu_get_stats(&before);
+    uint64_t plain_cycles = switch_cycles(domain, switch_plain_thread);
+    fpu_get_stats(&plain);
+    uint64_t vector_cycles = switch_cycles(domain, switch_vector_thread);
+    fpu_get_stats(&vector);
+    
+    if (g_switch_errors != 0) {
+        kernel_log("FAILED: Vector state lost across switch\n");
+        return -1;
+    }
+    
+    kernel_log("Save mode: ");
+    kernel_log_hex(fpu_save_mode());
+    kernel_log("\nPlain switch cycles: ");
+    kernel_log_hex(plain_cycles);
+    kernel_log(" (saves ");
+    kernel_log_hex(plain.saves - before.saves);
+    kernel_log(", skipped ");
+    kernel_log_hex(plain.skipped - before.skipped);
+    kernel_log(")\nVector switch cycles: ");
+    kernel_log_hex(vector_cycles);
+    kernel_log(" (saves ");
+    kernel_log_hex(vector.saves - plain.saves);
+    kernel_log(", skipped ");
+    kernel_log_hex(vector.skipped - plain.skipped);
+    kernel_log(")\n");
+    
+    /* Threads that never touched vector registers switch without an XSAVE;
+     * only the boot thread, switched out at the start, may be saved */
+    if (fpu_tracks_in_use() &&
+        (plain.saves - before.saves > 1 || plain.skipped - before.skipped < SWITCH_ROUNDS)) {
+        kernel_log("FAILED: Untouched vector state saved on switch\n");
+        return -1;
+    }
+    if (vector.saves - plain.saves < SWITCH_ROUNDS) {
+        kernel_log("FAILED: Live vector state not saved on switch\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Context switch\n");
+    return 0;
+}
+
+/*
+ * Check that every CPU the firmware reported came up with its own data
+ * area and scheduler instance
+ */
+static int test_smp_bringup(void) {
+    kernel_log("Testing SMP bring-up...\n");
+    
+    kernel_log("CPUs online: ");
+    kernel_log_hex(smp_num_cpus());
+    kernel_log(" of ");
+    kernel_log_hex(smp_num_found());
+    kernel_log("\n");
+    
+    if (smp_num_cpus() != smp_num_found() && smp_num_cpus() < MAX_CPUS) {
+        kernel_log("FAILED: Not all CPUs came online\n");
+        return -1;
+    }
+    if (cpu_current_id() != 0 || cpu_local() != smp_cpu_local(0)) {
+        kernel_log("FAILED: Boot CPU data area not in GS base\n");
+        return -1;
+    }
+    
+    for (uint32_t cpu = 0; cpu < smp_num_cpus(); cpu++) {
+        cpu_local_t *local = smp_cpu_local(cpu);
+        
+        if (!smp_cpu_online(cpu) || local->self != local || local->id != cpu) {
+            kernel_log("FAILED: Bad data area for CPU ");
+            kernel_log_hex(cpu);
+            kernel_log("\n");
+            return -1;
+        }
+        
+        /* Every CPU runs (or is ready to run) its own idle thread */
+        tcb_t *current = local->current;
+        if (current == NULL || current->cpu != cpu) {
+            kernel_log("FAILED: No scheduler instance on CPU ");
+            kernel_log_hex(cpu);
+            kernel_log("\n");
+            return -1;
+        }
+    }
+    
+    kernel_log("PASSED: SMP bring-up\n");
+    return 0;
+}
+
+/*
+ * Record the CPU a thread runs on after keeping it busy for a while
+ */
+static void balance_thread(void *arg) {
+    uint64_t start = cpu_rdtsc();
+    while (cpu_rdtsc() - start < BALANCE_SPIN_CYCLES) {
+        __asm__ volatile("pause");
+    }
+    
+    g_balance_cpu[(uint64_t)arg] = cpu_current_id();
+    __atomic_add_fetch(&g_balance_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Run threads of a domain to completion
+ */
+static void balance_run(uint64_t domain_id, uint32_t count) {
+    g_balance_done = 0;
+    
+    for (uint64_t i = 0; i < count; i++) {
+        g_balance_cpu[i] = MAX_CPUS;
+        sched_create_thread(domain_id, balance_thread, (void *)i, THREAD_PRIORITY_NORMAL);
+    }
+    while (__atomic_load_n(&g_balance_done, __ATOMIC_ACQUIRE) < count) {
+        sched_yield();
+    }
+}
+
+/*
+ * Check affinity masks and that idle CPUs take queued threads from a busy
+ * one
+ */
+static int test_load_balance(void) {
+    kernel_log("Testing load balancing...\n");
+    
+    sched_stats_t stats;
+    uint64_t domain = cap_create_domain(0, 0);
+    if (domain == 0 || sched_set_affinity(domain, 0) != -2 ||
+        sched_set_affinity(0, CPU_MASK_ALL) != -1 || sched_get_stats(MAX_CPUS, &stats) != -1) {
+        kernel_log("FAILED: Bad affinity or statistics request accepted\n");
+        return -1;
+    }
+    
+    uint32_t num_cpus = smp_num_cpus();
+    uint64_t steals = 0;
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        sched_get_stats(cpu, &stats);
+        steals -= stats.steals;
+    }
+    
+    /* A domain pinned to the last CPU only ever runs there */
+    uint32_t pinned = num_cpus - 1;
+    if (sched_set_affinity(domain, 1ULL << pinned) != 0) {
+        kernel_log("FAILED: Cannot set affinity\n");
+        return -1;
+    }
+    balance_run(domain, BALANCE_THREADS);
+    for (uint32_t i = 0; i < BALANCE_THREADS; i++) {
+        if (g_balance_cpu[i] != pinned) {
+            kernel_log("FAILED: Thread ran outside its affinity mask\n");
+            return -1;
+        }
+    }
+    
+    /* Unrestricted threads queued here spread to the idle CPUs */
+    balance_run(0, BALANCE_THREADS);
+    uint32_t moved = 0;
+    for (uint32_t i = 0; i < BALANCE_THREADS; i++) {
+        moved += g_balance_cpu[i] != cpu_current_id();
+    }
+    
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        sched_get_stats(cpu, &stats);
+        steals += stats.steals;
+        
+        kernel_log("CPU ");
+        kernel_log_hex(cpu);
+        kernel_log(": steals ");
+        kernel_log_hex(stats.steals);
+        kernel_log(", migrations ");
+        kernel_log_hex(stats.migrations);
+        kernel_log(", idle cycles ");
+        kernel_log_hex(stats.idle_cycles);
+        kernel_log("\n");
+    }
+    
+    if (num_cpus > 1 && (moved == 0 || steals == 0)) {
+        kernel_log("FAILED: No thread was taken by an idle CPU\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Load balancing\n");
+    return 0;
+}
+
+/*
+ * Count timer expiries
+ */
+static void timer_count(void *arg) {
+    (*(volatile uint32_t *)arg)++;
+}
+
+/*
+ * Measure how long a sleep keeps a thread off the CPU
+ */
+static void sleep_thread(void *arg) {
+    uint64_t start = timer_ticks();
+    sched_sleep(SLEEP_MS);
+    g_sleep_ticks = timer_ticks() - start;
+    __atomic_store_n(&g_sleep_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Check timer coalescing and cancelling, and that a sleeping thread
+ * wakes at its deadline
+ */
+static int test_timer_wheel(void) {
+    kernel_log("Testing timer wheel...\n");
+    
+    /* Far-off deadlines a few ticks apart share a slot (level 2: 64 ticks) */
+    timer_t early, late;
+    volatile uint32_t fired = 0;
+    timer_setup(&early, timer_count, (void *)&fired);
+    timer_setup(&late, timer_count, (void *)&fired);
+    
+    timer_poll();
+    uint64_t boundary = ((timer_ticks() >> 6) + 20) << 6;
+    timer_add(&early, boundary - 3);
+    timer_add(&late, boundary);
+    
+    if (early.expires != boundary || late.expires != boundary) {
+        kernel_log("FAILED: Nearby deadlines not coalesced\n");
+        timer_cancel(&early);
+        timer_cancel(&late);
+        return -1;
+    }
+    if (timer_cancel(&early) != 0 || timer_cancel(&early) != -1 ||
+        timer_cancel(&late) != 0 || fired != 0) {
+        kernel_log("FAILED: Timer cancel\n");
+        return -1;
+    }
+    
+    g_sleep_done = 0;
+    sched_create_thread(0, sleep_thread, NULL, THREAD_PRIORITY_NORMAL);
+    while (!__atomic_load_n(&g_sleep_done, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    
+    kernel_log("Slept ticks: ");
+    kernel_log_hex(g_sleep_ticks);
+    kernel_log("\n");
+    
+    if (g_sleep_ticks < SLEEP_MS * TIMER_HZ / 1000 ||
+        g_sleep_ticks > SLEEP_MS * TIMER_HZ / 1000 + SLEEP_SLACK_TICKS) {
+        kernel_log("FAILED: Sleep did not end at its deadline\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Timer wheel\n");
+    return 0;
+}
+
+/*
+ * Run for a while, then block so the run is accounted
+ */
+static void clock_spin_thread(void *arg) {
+    uint64_t start = clock_ns();
+    while (clock_ns() - start < CLOCK_SPIN_NS) {
+        __asm__ volatile("pause");
+    }
+    
+    sched_sleep(1);
+    g_clock_cpu_time = sched_get_current()->total_time;
+    __atomic_store_n(&g_clock_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Check that the clock is monotonic, agrees with the PIT, and that
+ * thread CPU time is accounted in nanoseconds
+ */
+static int test_clock(void) {
+    kernel_log("Testing clock source...\n");
+    
+    kernel_log("Source ");
+    kernel_log_hex(clock_source());
+    kernel_log(", invariant TSC ");
+    kernel_log_hex(clock_tsc_invariant());
+    kernel_log(", TSC Hz ");
+    kernel_log_hex(clock_tsc_hz());
+    kernel_log("\n");
+    
+    if (clock_source() == CLOCK_SOURCE_NONE || clock_tsc_hz() == 0) {
+        kernel_log("FAILED: Clock not calibrated\n");
+        return -1;
+    }
+    
+    uint64_t last = clock_ns();
+    for (uint32_t i = 0; i < CLOCK_READS; i++) {
+        uint64_t now = clock_ns();
+        if (now < last) {
+            kernel_log("FAILED: Clock went backwards\n");
+            return -1;
+        }
+        last = now;
+    }
+    
+    /* A PIT delay reads as the same time on the clock (within 10%; the
+     * delay may overrun on a busy host, not undershoot) */
+    uint64_t start = clock_ns();
+    apic_delay_us(CLOCK_DELAY_US);
+    uint64_t elapsed = clock_ns() - start;
+    
+    kernel_log("PIT delay in ns: ");
+    kernel_log_hex(elapsed);
+    kernel_log("\n");
+    
+    if (elapsed < CLOCK_DELAY_US * 900ULL || elapsed > CLOCK_DELAY_US * 2000ULL) {
+        kernel_log("FAILED: Clock disagrees with the PIT\n");
+        return -1;
+    }
+    
+    g_clock_done = 0;
+    sched_create_thread(0, clock_spin_thread, NULL, THREAD_PRIORITY_NORMAL);
+    while (!__atomic_load_n(&g_clock_done, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    
+    if (g_clock_cpu_time < CLOCK_SPIN_NS) {
+        kernel_log("FAILED: Thread CPU time not accounted\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Clock source\n");
+    return 0;
+}
+
+/*
+ * Do some work in slices, passing through the scheduler after each
+ */
+static void dl_work(uint64_t ns) {
+    for (uint64_t done = 0; done < ns; done += DL_SLICE_NS) {
+        uint64_t start = clock_ns();
+        while (clock_ns() - start < DL_SLICE_NS) {
+            __asm__ volatile("pause");
+        }
+        sched_yield();
+    }
+}
+
+/*
+ * Periodic service thread: wake at each release, work, and record the
+ * wakeup jitter and whether the work finished by the next release
+ */
+static void dl_periodic_thread(void *arg) {
+    uint64_t release = g_dl_start_tick;
+    
+    for (uint32_t round = 0; round < DL_ROUNDS; round++) {
+        release += timer_ms_to_ticks(DL_PERIOD_MS);
+        uint64_t now = timer_ticks();
+        if (release > now) {
+            sched_sleep((release - now) * 1000 / TIMER_HZ);
+        }
+        
+        uint64_t release_ns = release * TIMER_NS_PER_TICK;
+        uint64_t woke = clock_ns();
+        uint64_t jitter = woke > release_ns ? woke - release_ns : 0;
+        uint64_t max = g_dl_max_jitter;
+        while (jitter > max &&
+               !__atomic_compare_exchange_n(&g_dl_max_jitter, &max, jitter, 0,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            /* Retry with the newer maximum */
+        }
+        
+        dl_work(DL_WORK_NS);
+        if (clock_ns() > release_ns + DL_PERIOD_MS * 1000000ULL) {
+            __atomic_add_fetch(&g_dl_misses, 1, __ATOMIC_RELAXED);
+        }
+    }
+    
+    /* The last one out stops the others */
+    if (__atomic_add_fetch(&g_dl_done, 1, __ATOMIC_RELEASE) == DL_PERIODIC_THREADS) {
+        __atomic_store_n(&g_dl_stop, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * Overrunning service thread: asks for more than its budget until stopped,
+ * still passing through the scheduler after every slice
+ */
+static void dl_hog_thread(void *arg) {
+    while (!__atomic_load_n(&g_dl_stop, __ATOMIC_ACQUIRE)) {
+        dl_work(DL_SLICE_NS);
+    }
+}
+
+/*
+ * Priority-class thread: counts the slices it gets
+ */
+static void dl_background_thread(void *arg) {
+    while (!__atomic_load_n(&g_dl_stop, __ATOMIC_ACQUIRE)) {
+        dl_work(DL_SLICE_NS);
+        g_dl_background++;
+    }
+}
+
+/*
+ * Check deadline reservations: argument checks and admission control,
+ * then a benchmark of deadline misses and wakeup jitter for periodic
+ * threads sharing a CPU with an overrunning reservation (caught at its
+ * scheduler passes)
+ */
+static int test_deadline(void) {
+    kernel_log("Testing deadline class...\n");
+    
+    uint32_t cpu = cpu_current_id();
+    uint64_t domain = cap_create_domain(0, 0);
+    if (domain == 0 || sched_set_affinity(domain, 1ULL << cpu) != 0) {
+        kernel_log("FAILED: Cannot pin test domain\n");
+        return -1;
+    }
+    
+    g_dl_done = 0;
+    g_dl_stop = 0;
+    g_dl_misses = 0;
+    g_dl_max_jitter = 0;
+    g_dl_background = 0;
+    
+    uint64_t period = DL_PERIOD_MS * 1000000ULL;
+    uint64_t hog = sched_create_thread(domain, dl_hog_thread, NULL, THREAD_PRIORITY_NORMAL);
+    if (sched_set_deadline(hog, DL_HOG_BUDGET_NS, TIMER_NS_PER_TICK / 2) != -1 ||
+        sched_set_deadline(hog, period + 1, period) != -1 ||
+        sched_set_deadline(0, DL_HOG_BUDGET_NS, period) != -1 ||
+        sched_set_deadline(hog, DL_HOG_BUDGET_NS, period) != 0) {
+        kernel_log("FAILED: Reservation arguments\n");
+        return -1;
+    }
+    for (uint32_t i = 0; i < DL_PERIODIC_THREADS; i++) {
+        uint64_t id = sched_create_thread(domain, dl_periodic_thread, NULL, THREAD_PRIORITY_NORMAL);
+        if (sched_set_deadline(id, DL_BUDGET_NS, period) != 0) {
+            kernel_log("FAILED: Reservation within bandwidth refused\n");
+            return -1;
+        }
+    }
+    sched_create_thread(domain, dl_background_thread, NULL, THREAD_PRIORITY_NORMAL);
+    
+    /* 90% of the CPU is reserved: another 10% does not fit */
+    if (sched_set_deadline(hog, DL_HOG_BUDGET_NS + period / 10, period) != -2) {
+        kernel_log("FAILED: Reservation beyond bandwidth admitted\n");
+        return -1;
+    }
+    
+    sched_stats_t stats;
+    sched_get_stats(cpu, &stats);
+    uint64_t throttles = stats.dl_throttles;
+    
+    g_dl_start_tick = timer_ticks();
+    while (!__atomic_load_n(&g_dl_stop, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    
+    sched_get_stats(cpu, &stats);
+    throttles = stats.dl_throttles - throttles;
+    
+    kernel_log("Deadline misses: ");
+    kernel_log_hex(g_dl_misses);
+    kernel_log(", max wakeup jitter ns: ");
+    kernel_log_hex(g_dl_max_jitter);
+    kernel_log(", throttles: ");
+    kernel_log_hex(throttles);
+    kernel_log(", background slices: ");
+    kernel_log_hex(g_dl_background);
+    kernel_log("\n");
+    
+    if (g_dl_misses != 0) {
+        kernel_log("FAILED: Periodic threads missed deadlines\n");
+        return -1;
+    }
+    if (throttles == 0 || g_dl_background == 0) {
+        kernel_log("FAILED: Overrunning reservation was not throttled\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Deadline class\n");
+    return 0;
+}
+
+/*
+ * Spin in slices until the end of the run, entering the scheduler after
+ * each one
+ */
+static void quota_spin_thread(void *arg) {
+    while (timer_ticks() < g_quota_end) {
+        dl_work(DL_SLICE_NS);
+    }
+    __atomic_add_fetch(&g_quota_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Get the CPU time a domain has used in nanoseconds
+ */
+static uint64_t quota_used_ns(uint64_t domain_id, domain_cpu_usage_t *usage) {
+    if (cap_domain_cpu_usage(domain_id, usage) != 0) {
+        return 0;
+    }
+    return clock_cycles_to_ns(usage->cycles);
+}
+
+/*
+ * Check domain CPU quotas: argument checks, then a domain with a quota
+ * spinning next to an unlimited one is held to its quota per period
+ */
+static int test_quota(void) {
+    kernel_log("Testing domain CPU quotas...\n");
+    
+    uint32_t cpu = cpu_current_id();
+    uint64_t limited = cap_create_domain(0, 0);
+    uint64_t unlimited = cap_create_domain(0, 0);
+    if (limited == 0 || unlimited == 0 ||
+        sched_set_affinity(limited, 1ULL << cpu) != 0 ||
+        sched_set_affinity(unlimited, 1ULL << cpu) != 0) {
+        kernel_log("FAILED: Cannot pin test domains\n");
+        return -1;
+    }
+    
+    uint64_t period = QUOTA_PERIOD_MS * 1000000ULL;
+    if (sched_set_quota(limited, QUOTA_NS, TIMER_NS_PER_TICK / 2) != -1 ||
+        sched_set_quota(limited, period * MAX_CPUS + 1, period) != -1 ||
+        sched_set_quota(0, QUOTA_NS, period) != -1 ||
+        sched_set_quota(limited, QUOTA_NS, period) != 0) {
+        kernel_log("FAILED: Quota arguments\n");
+        return -1;
+    }
+    
+    g_quota_end = timer_ticks() + timer_ms_to_ticks(QUOTA_RUN_MS);
+    g_quota_done = 0;
+    
+    sched_stats_t stats;
+    sched_get_stats(cpu, &stats);
+    uint64_t throttles = stats.quota_throttles;
+    
+    sched_create_thread(limited, quota_spin_thread, NULL, THREAD_PRIORITY_NORMAL);
+    sched_create_thread(unlimited, quota_spin_thread, NULL, THREAD_PRIORITY_NORMAL);
+    while (__atomic_load_n(&g_quota_done, __ATOMIC_ACQUIRE) < 2) {
+        sched_yield();
+    }
+    
+    domain_cpu_usage_t usage;
+    uint64_t limited_ns = quota_used_ns(limited, &usage);
+    uint64_t exhausted = usage.exhausted;
+    uint64_t unlimited_ns = quota_used_ns(unlimited, &usage);
+    
+    sched_get_stats(cpu, &stats);
+    throttles = stats.quota_throttles - throttles;
+    
+    kernel_log("Limited domain ns: ");
+    kernel_log_hex(limited_ns);
+    kernel_log(", unlimited domain ns: ");
+    kernel_log_hex(unlimited_ns);
+    kernel_log(", periods exhausted: ");
+    kernel_log_hex(exhausted);
+    kernel_log(", throttles: ");
+    kernel_log_hex(throttles);
+    kernel_log("\n");
+    
+    /* Each period started gives one quota, overrun by at most the slice
+     * between two scheduler passes (the limited thread may wait out one
+     * more period to see the end) */
+    uint64_t periods = QUOTA_RUN_MS / QUOTA_PERIOD_MS + 2;
+    if (limited_ns == 0 || limited_ns > periods * (QUOTA_NS + DL_SLICE_NS)) {
+        kernel_log("FAILED: Domain exceeded its quota\n");
+        return -1;
+    }
+    if (exhausted == 0 || throttles == 0 || unlimited_ns <= limited_ns) {
+        kernel_log("FAILED: Domain was not throttled\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Domain CPU quotas\n");
+    return 0;
+}
+
+/*
+ * Echo each call's first word plus one until told to stop, noting the
+ * priority calls are served at
+ */
+static void ipc_server_thread(void *arg) {
+    ipc_msg_t msg, reply;
+    if (ipc_wait(g_ipc_endpoint, &msg) != 0) {
+        g_ipc_errors++;
+        __atomic_add_fetch(&g_ipc_done, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    
+    while (msg.label == IPC_LABEL_ECHO) {
+        g_ipc_lent = sched_get_current()->priority;
+        reply.label = 0;
+        reply.words[0] = msg.words[0] + 1;
+        if (ipc_reply_wait(g_ipc_endpoint, &reply, &msg) != 0) {
+            g_ipc_errors++;
+            break;
+        }
+    }
+    
+    reply.label = 0;
+    ipc_reply(&reply);
+    __atomic_add_fetch(&g_ipc_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Make round trips to the server and check each echo
+ */
+static void ipc_client_thread(void *arg) {
+    ipc_msg_t msg;
+    
+    uint64_t start = cpu_rdtsc();
+    for (uint64_t i = 0; i < IPC_ROUNDS; i++) {
+        msg.label = IPC_LABEL_ECHO;
+        msg.words[0] = i;
+        if (ipc_call(g_ipc_endpoint, &msg) != 0 || msg.words[0] != i + 1) {
+            g_ipc_errors++;
+        }
+    }
+    g_ipc_cycles = (cpu_rdtsc() - start) / IPC_ROUNDS;
+    
+    msg.label = IPC_LABEL_STOP;
+    if (ipc_call(g_ipc_endpoint, &msg) != 0) {
+        g_ipc_errors++;
+    }
+    __atomic_add_fetch(&g_ipc_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Check IPC round trips between a client and a server on one CPU: calls
+ * and replies switch straight to the partner, and the server runs at the
+ * client's priority while serving
+ */
+static int test_ipc(void) {
+    kernel_log("Testing IPC direct switch...\n");
+    
+    uint32_t cpu = cpu_current_id();
+    uint64_t server = cap_create_domain(0, 0);
+    uint64_t client = cap_create_domain(0, 0);
+    if (server == 0 || client == 0 ||
+        sched_set_affinity(server, 1ULL << cpu) != 0 ||
+        sched_set_affinity(client, 1ULL << cpu) != 0) {
+        kernel_log("FAILED: Cannot pin test domains\n");
+        return -1;
+    }
+    
+    g_ipc_endpoint = ipc_endpoint_create(server);
+    ipc_msg_t msg = { 0 };
+    if (g_ipc_endpoint == 0 || ipc_call(g_ipc_endpoint, &msg) != -1 ||
+        ipc_wait(g_ipc_endpoint, &msg) != -1) {
+        kernel_log("FAILED: IPC arguments\n");
+        return -1;
+    }
+    
+    g_ipc_done = 0;
+    g_ipc_errors = 0;
+    g_ipc_lent = THREAD_PRIORITY_IDLE;
+    
+    sched_stats_t stats;
+    sched_get_stats(cpu, &stats);
+    uint64_t direct = stats.direct_switches;
+    
+    sched_create_thread(server, ipc_server_thread, NULL, THREAD_PRIORITY_LOW);
+    sched_create_thread(client, ipc_client_thread, NULL, THREAD_PRIORITY_HIGH);
+    while (__atomic_load_n(&g_ipc_done, __ATOMIC_ACQUIRE) < 2) {
+        sched_yield();
+    }
+    
+    sched_get_stats(cpu, &stats);
+    direct = stats.direct_switches - direct;
+    
+    kernel_log("Round trip cycles: ");
+    kernel_log_hex(g_ipc_cycles);
+    kernel_log(", direct switches: ");
+    kernel_log_hex(direct);
+    kernel_log("\n");
+    
+    if (g_ipc_errors != 0) {
+        kernel_log("FAILED: Bad echo\n");
+        return -1;
+    }
+    /* Only the first call may find the server not yet waiting */
+    if (direct < 2 * IPC_ROUNDS) {
+        kernel_log("FAILED: Round trips went through the run queue\n");
+        return -1;
+    }
+    if (g_ipc_lent != THREAD_PRIORITY_HIGH) {
+        kernel_log("FAILED: Server did not run at the caller's priority\n");
+        return -1;
+    }
+    if (ipc_endpoint_delete(g_ipc_endpoint) != 0) {
+        kernel_log("FAILED: Cannot delete endpoint\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: IPC direct switch\n");
+    return 0;
+}
+
+/*
+ * Serve calls: work ones take a while, echo ones note their priority
+ */
+static void inv_server_thread(void *arg) {
+    ipc_msg_t msg, reply;
+    int result = ipc_wait(g_ipc_endpoint, &msg);
+    
+    while (result == 0 && msg.label != IPC_LABEL_STOP) {
+        if (msg.label == INV_LABEL_WORK) {
+            dl_work(INV_WORK_MS * 1000000ULL);
+        } else {
+            g_ipc_lent = sched_get_current()->priority;
+        }
+        reply.label = 0;
+        result = ipc_reply_wait(g_ipc_endpoint, &reply, &msg);
+    }
+    
+    if (result != 0) {
+        g_ipc_errors++;
+    } else {
+        reply.label = 0;
+        ipc_reply(&reply);
+    }
+    __atomic_add_fetch(&g_ipc_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Low priority client: one call the server works on for a while
+ */
+static void inv_low_thread(void *arg) {
+    ipc_msg_t msg = { .label = INV_LABEL_WORK };
+    if (ipc_call(g_ipc_endpoint, &msg) != 0) {
+        g_ipc_errors++;
+    }
+    __atomic_add_fetch(&g_ipc_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Normal priority thread of an unrelated domain: spins until the end
+ */
+static void inv_spin_thread(void *arg) {
+    while (clock_ns() < g_inv_end) {
+        dl_work(DL_SLICE_NS);
+    }
+    __atomic_add_fetch(&g_ipc_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * High priority client: sets the inversion up, then calls the server
+ */
+static void inv_high_thread(void *arg) {
+    sched_create_thread(g_inv_domains[0], inv_server_thread, NULL, THREAD_PRIORITY_LOW);
+    sched_create_thread(g_inv_domains[1], inv_low_thread, NULL, THREAD_PRIORITY_LOW);
+    
+    /* Back with the server busy on the low priority call */
+    sched_sleep(INV_SETTLE_MS);
+    g_inv_end = clock_ns() + INV_SPIN_MS * 1000000ULL;
+    sched_create_thread(g_inv_domains[2], inv_spin_thread, NULL, THREAD_PRIORITY_NORMAL);
+    
+    ipc_msg_t msg = { .label = IPC_LABEL_ECHO };
+    g_inv_called = clock_ns();
+    if (ipc_call(g_ipc_endpoint, &msg) != 0) {
+        g_ipc_errors++;
+    }
+    g_inv_replied = clock_ns();
+    
+    msg.label = IPC_LABEL_STOP;
+    if (ipc_call(g_ipc_endpoint, &msg) != 0) {
+        g_ipc_errors++;
+    }
+    __atomic_add_fetch(&g_ipc_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Reproduce a priority inversion across three domains: a high priority
+ * client waits on a low priority server that a normal priority thread
+ * keeps off the CPU. With the server inheriting the client's priority the
+ * call returns once the server's current work is done, not once the
+ * normal priority thread is.
+ */
+static int test_priority_inheritance(void) {
+    kernel_log("Testing IPC priority inheritance...\n");
+    
+    uint32_t cpu = cpu_current_id();
+    for (int i = 0; i < 3; i++) {
+        g_inv_domains[i] = cap_create_domain(0, 0);
+        if (g_inv_domains[i] == 0 || sched_set_affinity(g_inv_domains[i], 1ULL << cpu) != 0) {
+            kernel_log("FAILED: Cannot pin test domains\n");
+            return -1;
+        }
+    }
+    
+    g_ipc_endpoint = ipc_endpoint_create(g_inv_domains[0]);
+    if (g_ipc_endpoint == 0) {
+        kernel_log("FAILED: Cannot create endpoint\n");
+        return -1;
+    }
+    
+    g_ipc_done = 0;
+    g_ipc_errors = 0;
+    g_ipc_lent = THREAD_PRIORITY_IDLE;
+    
+    sched_stats_t stats;
+    sched_get_stats(cpu, &stats);
+    uint64_t boosts = stats.priority_boosts;
+    
+    sched_create_thread(g_inv_domains[1], inv_high_thread, NULL, THREAD_PRIORITY_HIGH);
+    while (__atomic_load_n(&g_ipc_done, __ATOMIC_ACQUIRE) < 4) {
+        sched_yield();
+    }
+    
+    sched_get_stats(cpu, &stats);
+    boosts = stats.priority_boosts - boosts;
+    
+    kernel_log("High priority call ns: ");
+    kernel_log_hex(g_inv_replied - g_inv_called);
+    kernel_log(", boosts: ");
+    kernel_log_hex(boosts);
+    kernel_log("\n");
+    
+    if (g_ipc_errors != 0) {
+        kernel_log("FAILED: IPC error\n");
+        return -1;
+    }
+    if (g_inv_replied >= g_inv_end || boosts == 0) {
+        kernel_log("FAILED: Caller waited out a lower priority thread\n");
+        return -1;
+    }
+    if (g_ipc_lent != THREAD_PRIORITY_HIGH) {
+        kernel_log("FAILED: Server did not run at the caller's priority\n");
+        return -1;
+    }
+    if (ipc_endpoint_delete(g_ipc_endpoint) != 0) {
+        kernel_log("FAILED: Cannot delete endpoint\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: IPC priority inheritance\n");
+    return 0;
+}
+
+/*
+ * Take one call and never reply to it
+ */
+static void exit_server_thread(void *arg) {
+    ipc_msg_t msg;
+    
+    __atomic_store_n(&g_exit_started, 1, __ATOMIC_RELEASE);
+    if (ipc_wait(g_ipc_endpoint, &msg) != 0) {
+        return;
+    }
+    __atomic_store_n(&g_exit_serving, 1, __ATOMIC_RELEASE);
+    for (;;) {
+        sched_block();
+    }
+}
+
+/*
+ * Make one call and note how it ended
+ */
+static void exit_client_thread(void *arg) {
+    ipc_msg_t msg = { 0 };
+    
+    __atomic_store_n(&g_exit_started, 1, __ATOMIC_RELEASE);
+    g_exit_result = ipc_call(g_ipc_endpoint, &msg);
+    __atomic_store_n(&g_exit_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Start a test thread and let it run until it blocks in IPC
+ */
+static uint64_t exit_start(uint64_t domain, void (*entry)(void *)) {
+    g_exit_started = 0;
+    uint64_t thread = sched_create_thread(domain, entry, NULL, THREAD_PRIORITY_NORMAL);
+    while (thread != 0 && !__atomic_load_n(&g_exit_started, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    sched_yield();
+    return thread;
+}
+
+/*
+ * Check that terminating a thread in IPC takes it off its endpoint: a
+ * waiting server, a queued caller and a server in the middle of a call
+ * (whose caller gets -2). Each time the endpoint is busy until then.
+ */
+static int test_ipc_terminate(void) {
+    kernel_log("Testing termination in IPC...\n");
+    
+    uint32_t cpu = cpu_current_id();
+    uint64_t server = cap_create_domain(0, 0);
+    uint64_t client = cap_create_domain(0, 0);
+    if (server == 0 || client == 0 ||
+        sched_set_affinity(server, 1ULL << cpu) != 0 ||
+        sched_set_affinity(client, 1ULL << cpu) != 0) {
+        kernel_log("FAILED: Cannot pin test domains\n");
+        return -1;
+    }
+    
+    /* A waiting server */
+    g_ipc_endpoint = ipc_endpoint_create(server);
+    uint64_t thread = exit_start(server, exit_server_thread);
+    if (thread == 0 || ipc_endpoint_delete(g_ipc_endpoint) != -2 ||
+        sched_terminate_thread(thread) != 0 || ipc_endpoint_delete(g_ipc_endpoint) != 0) {
+        kernel_log("FAILED: Terminated server still waits on its endpoint\n");
+        return -1;
+    }
+    
+    /* A queued caller */
+    g_ipc_endpoint = ipc_endpoint_create(server);
+    thread = exit_start(client, exit_client_thread);
+    if (thread == 0 || ipc_endpoint_delete(g_ipc_endpoint) != -2 ||
+        sched_terminate_thread(thread) != 0 || ipc_endpoint_delete(g_ipc_endpoint) != 0) {
+        kernel_log("FAILED: Terminated caller still queued on its endpoint\n");
+        return -1;
+    }
+    
+    /* A server in the middle of a call */
+    g_ipc_endpoint = ipc_endpoint_create(server);
+    g_exit_serving = 0;
+    g_exit_done = 0;
+    g_exit_result = 0;
+    thread = exit_start(server, exit_server_thread);
+    if (thread == 0 || exit_start(client, exit_client_thread) == 0) {
+        kernel_log("FAILED: Cannot create test threads\n");
+        return -1;
+    }
+    while (!__atomic_load_n(&g_exit_serving, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    if (sched_terminate_thread(thread) != 0) {
+        kernel_log("FAILED: Cannot terminate server\n");
+        return -1;
+    }
+    
+    uint64_t deadline = timer_ticks() + timer_ms_to_ticks(EXIT_WAIT_MS);
+    while (!__atomic_load_n(&g_exit_done, __ATOMIC_ACQUIRE) && timer_ticks() < deadline) {
+        sched_yield();
+    }
+    if (!g_exit_done || g_exit_result != -2) {
+        kernel_log("FAILED: Call outlived its server\n");
+        return -1;
+    }
+    if (ipc_endpoint_delete(g_ipc_endpoint) != 0) {
+        kernel_log("FAILED: Failed call still counted on its endpoint\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Termination in IPC\n");
+    return 0;
+}
+
+/*
+ * Get the tick periods a CPU has spent with its tick stopped so far
+ */
+static uint64_t ticks_avoided(uint32_t cpu) {
+    sched_stats_t stats;
+    sched_get_stats(cpu, &stats);
+    return stats.ticks_avoided_est;
+}
+
+/*
+ * Get the times a CPU has started its periodic tick so far
+ */
+static uint64_t tick_starts(uint32_t cpu) {
+    sched_stats_t stats;
+    sched_get_stats(cpu, &stats);
+    return stats.tick_starts;
+}
+
+/*
+ * Take turns on the CPU with the other sharing thread for a while
+ */
+static void share_thread(void *arg) {
+    uint64_t end = timer_ticks() + timer_ms_to_ticks(TICKLESS_SHARE_MS);
+    while (timer_ticks() < end) {
+        sched_yield();
+    }
+    __atomic_add_fetch(&g_share_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Check that the tick stops while a CPU has nothing else to run and is
+ * started while threads share it
+ */
+static int test_tickless(void) {
+    kernel_log("Testing tickless idle...\n");
+    
+    uint32_t cpu = cpu_current_id();
+    uint64_t avoided = ticks_avoided(cpu);
+    sched_sleep(SLEEP_MS);
+    avoided = ticks_avoided(cpu) - avoided;
+    
+    kernel_log("Ticks avoided while idle (estimated): ");
+    kernel_log_hex(avoided);
+    kernel_log("\n");
+    
+    if (avoided + SLEEP_SLACK_TICKS < SLEEP_MS * TIMER_HZ / 1000) {
+        kernel_log("FAILED: Tick kept running on an idle CPU\n");
+        return -1;
+    }
+    
+    /* Two threads pinned here need the tick to enforce their slices */
+    uint64_t domain = cap_create_domain(0, 0);
+    if (domain == 0 || sched_set_affinity(domain, 1ULL << cpu) != 0) {
+        kernel_log("FAILED: Cannot pin test domain\n");
+        return -1;
+    }
+    
+    g_share_done = 0;
+    uint64_t starts = tick_starts(cpu);
+    avoided = ticks_avoided(cpu);
+    sched_create_thread(domain, share_thread, NULL, THREAD_PRIORITY_NORMAL);
+    sched_create_thread(domain, share_thread, NULL, THREAD_PRIORITY_NORMAL);
+    while (__atomic_load_n(&g_share_done, __ATOMIC_ACQUIRE) < 2) {
+        sched_yield();
+    }
+    avoided = ticks_avoided(cpu) - avoided;
+    starts = tick_starts(cpu) - starts;
+    
+    if (starts == 0 || avoided > SLEEP_SLACK_TICKS) {
+        kernel_log("FAILED: Tick stopped while threads shared the CPU\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Tickless idle\n");
+    return 0;
+}
+
+/*
+ * Sleep far past the end of the test (it is terminated first)
+ */
+static void sleeper_thread(void *arg) {
+    (void)arg;
+    
+    __atomic_store_n(&g_sleeper_started, 1, __ATOMIC_RELEASE);
+    sched_sleep(SLEEPER_MS);
+    kernel_log("FAILED: Terminated sleeper woke up\n");
+}
+
+/*
+ * Check that terminating a sleeping thread takes its timer off the wheel
+ * before the thread's memory is freed
+ */
+static int test_sleep_terminate(void) {
+    kernel_log("Testing termination of a sleeping thread...\n");
+    
+    /* Pinned here, so the sleeper's timer is on this CPU's wheel */
+    uint32_t cpu = cpu_current_id();
+    uint64_t domain = cap_create_domain(0, 0);
+    if (domain == 0 || sched_set_affinity(domain, 1ULL << cpu) != 0) {
+        kernel_log("FAILED: Cannot pin test domain\n");
+        return -1;
+    }
+    
+    g_sleeper_started = 0;
+    uint64_t sleeper = sched_create_thread(domain, sleeper_thread, NULL, THREAD_PRIORITY_NORMAL);
+    if (sleeper == 0) {
+        kernel_log("FAILED: Cannot create sleeper\n");
+        return -1;
+    }
+    
+    /* The sleeper blocks before this thread runs again */
+    while (!__atomic_load_n(&g_sleeper_started, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    sched_yield();
+    
+    uint64_t wake = timer_ticks() + timer_ms_to_ticks(SLEEPER_MS);
+    uint64_t armed = timer_next_expiry();
+    if (armed == UINT64_MAX) {
+        kernel_log("FAILED: Sleeper has no timer pending\n");
+        return -1;
+    }
+    
+    if (sched_terminate_thread(sleeper) != 0) {
+        kernel_log("FAILED: Cannot terminate sleeper\n");
+        return -1;
+    }
+    
+    /* Nothing else on this wheel is due as late as the sleeper was */
+    uint64_t next = timer_next_expiry();
+    if (next != UINT64_MAX && next + SLEEP_SLACK_TICKS >= wake) {
+        kernel_log("FAILED: Sleeper's timer outlived the thread\n");
+        return -1;
+    }
+    
+    kernel_log("PASSED: Terminating a sleeping thread\n");
+    return 0;
+}
+
+/*
+ * Run all scheduler tests
+ */
+int sched_run_tests(void) {
+    kernel_log("\n");
+    kernel_log("========================================\n");
+    kernel_log("Running Scheduler Tests\n");
+    kernel_log("========================================\n\n");
+    
+    int failures = 0;
+    
+    if (test_smp_bringup() != 0) failures++;
+    if (test_load_balance() != 0) failures++;
+    if (test_clock() != 0) failures++;
+    if (test_timer_wheel() != 0) failures++;
+    if (test_tickless() != 0) failures++;
+    if (test_sleep_terminate() != 0) failures++;
+    if (test_deadline() != 0) failures++;
+    if (test_quota() != 0) failures++;
+    if (test_ipc() != 0) failures++;
+    if (test_priority_inheritance() != 0) failures++;
+    if (test_ipc_terminate() != 0) failures++;
+    if (test_context_switch() != 0) failures++;
+    
+    kernel_log("\n");
+    kernel_log("========================================\n");
+    if (failures == 0) {
+        kernel_log("All scheduler tests PASSED\n");
+    } else {
+        kernel_log_hex(failures);
+        kernel_log(" test(s) FAILED\n");
+    }
+    kernel_log("========================================\n\n");
+    
+    return failures;
+}
\ No newline at end of file
@@ -6,11 +6,16 @@
 #include "../include/mm.h"
 #include "../include/capability.h"
 #include "../include/sched.h"
+#include "../include/ipc.h"
+#include "../include/clock.h"
 #include "../include/string.h"
 
 /* Global service manager state */
 static service_manager_t g_service_manager;
 
+/* Service object cache */
+static kmem_cache_t g_service_cache;
+
 /* Spinlock operations */
 static inline void spin_lock(uint64_t *lock) {
     while (__sync_lock_test_and_set(lock, 1)) {
@@ -28,8 +33,11 @@ static inline void spin_unlock(uint64_t *lock) {
 int service_init(void) {
     memset(&g_service_manager, 0, sizeof(service_manager_t));
     
+    if (kmem_cache_init(&g_service_cache, "service", sizeof(service_t), CACHE_LINE_SIZE, NULL) != 0) {
+        return -1;
+    }
+    
     g_service_manager.num_services = 0;
-    g_service_manager.next_service_id = 1;
     g_service_manager.lock = 0;
     
     return 0;
@@ -43,29 +51,32 @@ uint64_t service_create(const char *name, uint64_t entry_point,
                        uint64_t data_base, uint64_t data_size) {
     spin_lock(&g_service_manager.lock);
     
-    /* Find free service slot */
-    uint32_t slot = 0;
-    for (slot = 0; slot < MAX_SERVICES; slot++) {
-        if (g_service_manager.services[slot].state == 0) {
-            break;
-        }
+    service_t *service = kmem_cache_alloc(&g_service_cache);
+    if (service == NULL) {
+        spin_unlock(&g_service_manager.lock);
+        return 0;  /* Out of memory */
     }
     
-    if (slot >= MAX_SERVICES) {
+    uint64_t service_id = kmem_table_insert(&g_service_manager.services, service);
+    if (service_id == 0) {
+        kmem_cache_free(&g_service_cache, service);
         spin_unlock(&g_service_manager.lock);
-        return 0;  /* No free slots */
+        return 0;
     }
     
     /* Create domain for service */
     uint64_t domain_id = cap_create_domain(code_base, code_size + data_size + STACK_SIZE);
     if (domain_id == 0) {
+        kmem_table_remove(&g_service_manager.services, service_id);
+        kmem_defer_free(&g_service_cache, service);
         spin_unlock(&g_service_manager.lock);
         return 0;
     }
+    sched_set_quota(domain_id, SERVICE_CPU_QUOTA_NS, SERVICE_CPU_PERIOD_NS);
     
     /* Initialize service */
-    service_t *service = &g_service_manager.services[slot];
-    service->service_id = g_service_manager.next_service_id++;
+    memset(service, 0, sizeof(service_t));
+    service->service_id = service_id;
     strncpy(service->name, name, sizeof(service->name) - 1);
     service->state = SERVICE_STATE_STOPPED;
     service->domain_id = domain_id;
@@ -89,7 +100,7 @@ uint64_t service_create(const char *name, uint64_t entry_point,
     
     spin_unlock(&g_service_manager.lock);
     
-    return service->service_id;
+    return service_id;
 }
 
 /*
@@ -191,8 +202,9 @@ int service_terminate(uint64_t service_id) {
     /* Delete domain */
     cap_delete_domain(service->domain_id);
     
-    /* Clear service */
-    memset(service, 0, sizeof(service_t));
+    /* Unlocked lookups (service_get) may still hold it for a while */
+    kmem_table_remove(&g_service_manager.services, service_id);
+    kmem_defer_free(&g_service_cache, service);
     
     g_service_manager.num_services--;
     
@@ -201,25 +213,60 @@ int service_terminate(uint64_t service_id) {
     return 0;
 }
 
+/*
+ * Limit a service's CPU time per period
+ */
+int service_set_quota(uint64_t service_id, uint64_t quota_ns, uint64_t period_ns) {
+    service_t *service = service_get(service_id);
+    if (!service) {
+        return -1;
+    }
+    
+    return sched_set_quota(service->domain_id, quota_ns, period_ns);
+}
+
+/*
+ * Call an IPC endpoint through a capability (request and response are
+ * ipc_msg_t messages)
+ */
+int service_ipc_call(cap_handle_t endpoint, void *request, void *response) {
+    tcb_t *current = sched_get_current();
+    if (current == NULL || request == NULL || response == NULL) {
+        return -1;
+    }
+    if (cap_check(current->domain_id, endpoint, CAP_PERM_WRITE) != 0) {
+        return -2;  /* Not held with permission to call */
+    }
+    
+    capability_t *cap = cap_get_capability(endpoint);
+    if (!cap || cap->type != CAP_TYPE_IPC_ENDPOINT) {
+        return -2;
+    }
+    
+    ipc_msg_t msg = *(const ipc_msg_t *)request;
+    if (ipc_call(cap->resource_id, &msg) != 0) {
+        return -1;
+    }
+    *(ipc_msg_t *)response = msg;
+    
+    return 0;
+}
+
 /*
  * Get service by ID
  */
 service_t* service_get(uint64_t service_id) {
-    for (uint32_t i = 0; i < MAX_SERVICES; i++) {
-        if (g_service_manager.services[i].service_id == service_id) {
-            return &g_service_manager.services[i];
-        }
-    }
-    return NULL;
+    return kmem_table_get(&g_service_manager.services, service_id);
 }
 
 /*
  * Get service by name
  */
 service_t* service_get_by_name(const char *name) {
-    for (uint32_t i = 0; i < MAX_SERVICES; i++) {
-        if (strcmp(g_service_manager.services[i].name, name) == 0) {
-            return &g_service_manager.services[i];
+    for (uint64_t id = 1; id < kmem_table_end(&g_service_manager.services); id++) {
+        service_t *service = kmem_table_get(&g_service_manager.services, id);
+        if (service && strcmp(service->name, name) == 0) {
+            return service;
         }
     }
     return NULL;
@@ -269,7 +316,7 @@ core0_api_t* service_get_api(void) {
         .mem_free = NULL,   /* Would wrap mm_free */
         .mem_map = NULL,
         .mem_unmap = NULL,
-        .ipc_call = NULL,
+        .ipc_call = service_ipc_call,
         .ipc_register = NULL,
         .ipc_unregister = NULL,
         .thread_create = NULL,  /* Would wrap sched_create_thread */
@@ -286,7 +333,9 @@ core0_api_t* service_get_api(void) {
         .log_hex = NULL,
         .service_start = service_start,
         .service_stop = service_stop,
-        .service_restart = service_restart
+        .service_restart = service_restart,
+        .time_ns = clock_ns,
+        .cpu_usage = cap_domain_cpu_usage
     };
     
     return &api;
@@ -6,17 +6,23 @@
 
 #include "../include/kernel.h"
 #include "../include/mm.h"
+#include "../include/acpi.h"
+#include "../include/numa.h"
 #include "../include/capability.h"
 #include "../include/sched.h"
+#include "../include/ipc.h"
+#include "../include/clock.h"
 #include "../include/service.h"
 #include "../include/process.h"
 #include "../include/longmode.h"
 #include "../include/irq.h"
 #include "../include/isolation.h"
+#include "../include/smp.h"
 #include "../include/string.h"
 
 /* External test function */
 extern int mmu_run_tests(void);
+extern int sched_run_tests(void);
 
 /* Boot information */
 static boot_info_t *g_boot_info = NULL;
@@ -107,6 +113,9 @@ int kernel_init(boot_info_t *boot_info) {
     vga[8] = (uint16_t)'1' | 0x0F00;
 
     g_boot_info = boot_info;
+    
+    /* Per-CPU data (GS base) must be in place before anything per-CPU */
+    smp_init_boot_cpu();
 
     /* Debug: Step 2 */
     vga[9] = (uint16_t)'2' | 0x0F00;
@@ -136,14 +145,24 @@ int kernel_init(boot_info_t *boot_info) {
 
     kernel_log("Initializing...\n\n");
     
+    /* Discover the NUMA topology before the allocator builds its zones */
+    kernel_log("Initializing NUMA topology...\n");
+    acpi_init(boot_info ? boot_info->rsdp : 0);
+    if (numa_init() != 0) {
+        kernel_panic("Failed to initialize NUMA topology");
+    }
+    kernel_log("NUMA nodes: ");
+    kernel_log_hex(numa_num_nodes());
+    kernel_log("\n\n");
+    
     /* Initialize memory manager */
     kernel_log("Initializing memory manager...\n");
-    if (mm_init(boot_info->memory_map_size) != 0) {
+    if (mm_init(boot_info) != 0) {
         kernel_panic("Failed to initialize memory manager");
     }
     kernel_log("Memory manager initialized\n");
-    kernel_log("Total memory: ");
-    kernel_log_hex(boot_info->memory_map_size);
+    kernel_log("Available memory: ");
+    kernel_log_hex(mm_get_available());
     kernel_log(" bytes\n\n");
     
     /* Initialize capability system */
@@ -153,6 +172,17 @@ int kernel_init(boot_info_t *boot_info) {
     }
     kernel_log("Capability system initialized\n\n");
     
+    /* Calibrate the clock (the HPET is found through ACPI) */
+    kernel_log("Initializing clock source...\n");
+    if (clock_init() != 0) {
+        kernel_panic("Failed to initialize clock source");
+    }
+    kernel_log("TSC frequency: ");
+    kernel_log_hex(clock_tsc_hz());
+    kernel_log(" Hz, source ");
+    kernel_log_hex(clock_source());
+    kernel_log("\n\n");
+    
     /* Initialize scheduler */
     kernel_log("Initializing scheduler...\n");
     if (sched_init() != 0) {
@@ -160,6 +190,13 @@ int kernel_init(boot_info_t *boot_info) {
     }
     kernel_log("Scheduler initialized\n\n");
     
+    /* Initialize IPC */
+    kernel_log("Initializing IPC...\n");
+    if (ipc_init() != 0) {
+        kernel_panic("Failed to initialize IPC");
+    }
+    kernel_log("IPC initialized\n\n");
+    
     /* Initialize interrupt routing table */
     kernel_log("Initializing interrupt routing table...\n");
     if (irq_init() != 0) {
@@ -194,10 +231,23 @@ int kernel_init(boot_info_t *boot_info) {
     
     kernel_log("MMU setup complete\n\n");
     
+    /* Start the application processors */
+    kernel_log("Starting application processors...\n");
+    if (smp_init() != 0) {
+        kernel_log("WARNING: SMP bring-up failed, continuing on the boot CPU\n");
+    }
+    kernel_log("CPUs online: ");
+    kernel_log_hex(smp_num_cpus());
+    kernel_log("\n\n");
+    
     /* Run MMU tests */
     kernel_log("Running MMU tests...\n");
     mmu_run_tests();
     
+    /* Run scheduler tests */
+    kernel_log("Running scheduler tests...\n");
+    sched_run_tests();
+    
     /* Initialize service manager */
     kernel_log("Initializing service manager...\n");
     if (service_init() != 0) {
@@ -223,6 +273,11 @@ int kernel_init(boot_info_t *boot_info) {
     
     kernel_log("Long mode initialized\n\n");
     
+    /* Firmware page tables and boot services data are no longer in use */
+    kernel_log("Reclaimed boot memory: ");
+    kernel_log_hex(mm_reclaim_boot_memory());
+    kernel_log(" bytes\n\n");
+    
     kernel_log("Kernel initialization complete\n");
     kernel_log("Starting Core-1 services...\n\n");
     
@@ -281,13 +336,7 @@ void kernel_main(void) {
     kernel_log("System ready\n");
     kernel_log("Press Ctrl+C to stop (not implemented)\n\n");
     
-    /* Main kernel loop */
-    while (1) {
-        /* Handle interrupts */
-        /* Schedule threads */
-        /* Process events */
-        
-        /* Sleep for a bit */
-        sched_sleep(1000);
-    }
+    /* The boot flow is the boot CPU's idle thread: from here on it runs
+     * expired timers, takes work from busy CPUs and otherwise waits */
+    sched_idle_thread(NULL);
 }
\ No newline at end of file
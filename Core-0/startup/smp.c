@@ -0,0 +1,255 @@
+/*
+ * HIK Core-0 Multiprocessor Bring-Up Implementation
+ * 
+ * CPUs are started one at a time because they share the trampoline's
+ * parameter block: the boot CPU fills it in, sends INIT-SIPI-SIPI and
+ * waits for the new CPU to report itself online before moving on. An AP
+ * initializes its own state (GS base, control registers, APIC and timer,
+ * scheduler instance) and then becomes its idle thread.
+ */
+
+#include "../include/smp.h"
+#include "../include/apic.h"
+#include "../include/acpi.h"
+#include "../include/numa.h"
+#include "../include/sched.h"
+#include "../include/context.h"
+#include "../include/isolation.h"
+#include "../include/irq.h"
+#include "../include/mm.h"
+#include "../include/string.h"
+
+/* Trampoline image and parameter block (trampoline.S) */
+extern uint8_t trampoline_start[];
+extern uint8_t trampoline_end[];
+extern uint8_t trampoline_cr3[];
+extern uint8_t trampoline_efer[];
+extern uint8_t trampoline_stack[];
+extern uint8_t trampoline_cpu[];
+
+/* Per-CPU data areas */
+static cpu_local_t g_cpu_local[MAX_CPUS];
+
+/* Multiprocessor state */
+static smp_state_t g_smp;
+
+/*
+ * Point a parameter of the trampoline copy at its location below 1MB
+ */
+static inline void* smp_trampoline_param(uint8_t *symbol) {
+    return (void *)(SMP_TRAMPOLINE_BASE + (uint64_t)(symbol - trampoline_start));
+}
+
+/*
+ * Set up a CPU's data area and load it into GS base
+ */
+static void smp_init_cpu_local(uint32_t cpu, uint32_t apic_id) {
+    cpu_local_t *local = &g_cpu_local[cpu];
+    
+    memset(local, 0, sizeof(cpu_local_t));
+    local->self = local;
+    local->id = cpu;
+    local->apic_id = apic_id;
+    
+    uint64_t base = (uint64_t)local;
+    __asm__ volatile("wrmsr" : : "c"(MSR_GS_BASE), "a"((uint32_t)base),
+                     "d"((uint32_t)(base >> 32)) : "memory");
+}
+
+/*
+ * Read the local APIC ID of the current CPU (usable before the APIC is)
+ */
+static uint32_t smp_read_apic_id(void) {
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return ebx >> 24;
+}
+
+/*
+ * Set up the boot CPU's data area
+ */
+void smp_init_boot_cpu(void) {
+    memset(&g_smp, 0, sizeof(smp_state_t));
+    smp_init_cpu_local(0, smp_read_apic_id());
+    
+    g_smp.num_cpus = 1;
+    g_smp.num_found = 1;
+    g_smp.online[0] = 1;
+}
+
+/*
+ * Wake one application processor and wait for it to come online
+ */
+static int smp_start_cpu(uint32_t cpu, uint32_t apic_id) {
+    uint64_t stack = mm_alloc(STACK_SIZE, 16, MEM_TYPE_KERNEL, 0);
+    if (stack == 0) {
+        return -1;
+    }
+    
+    g_cpu_local[cpu].apic_id = apic_id;
+    *(uint64_t *)smp_trampoline_param(trampoline_stack) = stack + STACK_SIZE;
+    *(uint32_t *)smp_trampoline_param(trampoline_cpu) = cpu;
+    __sync_synchronize();
+    
+    if (apic_send_init(apic_id) != 0) {
+        mm_free(stack);
+        return -1;
+    }
+    apic_delay_us(10000);
+    
+    /* The second STARTUP is only needed if the first was missed */
+    for (uint32_t sipi = 0; sipi < 2 && !g_smp.online[cpu]; sipi++) {
+        apic_send_startup(apic_id, SMP_TRAMPOLINE_BASE >> 12);
+        apic_delay_us(200);
+    }
+    
+    for (uint32_t waited = 0; waited < SMP_START_TIMEOUT_US; waited += 100) {
+        if (__atomic_load_n(&g_smp.online[cpu], __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+        apic_delay_us(100);
+    }
+    
+    /* The stack stays allocated: a late CPU may still be running on it */
+    return -1;
+}
+
+/*
+ * Start the application processors
+ */
+int smp_init(void) {
+    const acpi_madt_t *madt = (const acpi_madt_t *)acpi_find_table("APIC");
+    
+    g_smp.lapic_base = madt ? madt->lapic_address : APIC_DEFAULT_BASE;
+    if (madt != NULL) {
+        const uint8_t *p = (const uint8_t *)madt + sizeof(acpi_madt_t);
+        const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+        
+        while (p + sizeof(acpi_madt_entry_t) <= end) {
+            const acpi_madt_entry_t *entry = (const acpi_madt_entry_t *)p;
+            if (entry->length < sizeof(acpi_madt_entry_t) || p + entry->length > end) {
+                break;
+            }
+            if (entry->type == ACPI_MADT_LAPIC_OVERRIDE &&
+                entry->length >= sizeof(acpi_madt_lapic_override_t)) {
+                g_smp.lapic_base = ((const acpi_madt_lapic_override_t *)p)->lapic_address;
+            }
+            p += entry->length;
+        }
+    }
+    
+    if (apic_init(g_smp.lapic_base) != 0) {
+        return -1;
+    }
+    g_cpu_local[0].apic_id = apic_id();
+    apic_timer_start(IRQ_VECTOR_TIMER, SCHED_TICK_HZ);
+    
+    if (madt == NULL) {
+        return 0;  /* No MADT: uniprocessor */
+    }
+    
+    /* The trampoline loads CR3 while still in 32-bit mode */
+    uint64_t cr3, efer_lo, efer_hi;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ volatile("rdmsr" : "=a"(efer_lo), "=d"(efer_hi) : "c"(0xC0000080));
+    cr3 &= ~0xFFFULL;
+    if (cr3 >> 32) {
+        return -1;
+    }
+    
+    memcpy((void *)SMP_TRAMPOLINE_BASE, trampoline_start,
+           (uint64_t)(trampoline_end - trampoline_start));
+    *(uint32_t *)smp_trampoline_param(trampoline_cr3) = (uint32_t)cr3;
+    *(uint32_t *)smp_trampoline_param(trampoline_efer) = (uint32_t)efer_lo;
+    
+    const uint8_t *p = (const uint8_t *)madt + sizeof(acpi_madt_t);
+    const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+    
+    while (p + sizeof(acpi_madt_entry_t) <= end) {
+        const acpi_madt_entry_t *entry = (const acpi_madt_entry_t *)p;
+        if (entry->length < sizeof(acpi_madt_entry_t) || p + entry->length > end) {
+            break;
+        }
+        
+        uint32_t id = 0xFFFFFFFF;
+        uint32_t flags = 0;
+        if (entry->type == ACPI_MADT_LAPIC && entry->length >= sizeof(acpi_madt_lapic_t)) {
+            id = ((const acpi_madt_lapic_t *)p)->apic_id;
+            flags = ((const acpi_madt_lapic_t *)p)->flags;
+        } else if (entry->type == ACPI_MADT_X2APIC && entry->length >= sizeof(acpi_madt_x2apic_t)) {
+            id = ((const acpi_madt_x2apic_t *)p)->x2apic_id;
+            flags = ((const acpi_madt_x2apic_t *)p)->flags;
+        }
+        p += entry->length;
+        
+        if (!(flags & ACPI_MADT_ENABLED) || id == g_cpu_local[0].apic_id) {
+            continue;
+        }
+        g_smp.num_found++;
+        
+        /* CPU indexes stay dense: a CPU that fails to start does not take one */
+        if (g_smp.num_cpus < MAX_CPUS && smp_start_cpu(g_smp.num_cpus, id) == 0) {
+            g_smp.num_cpus++;
+        }
+    }
+    
+    return 0;
+}
+
+/*
+ * Entry point of an application processor
+ */
+void ap_main(uint32_t cpu) {
+    uint32_t apic = g_cpu_local[cpu].apic_id;
+    
+    /* Everything per-CPU (allocator magazines included) needs GS first */
+    smp_init_cpu_local(cpu, apic);
+    fpu_init_cpu();
+    isolation_init_cpu();
+    apic_init_cpu();
+    apic_timer_start(IRQ_VECTOR_TIMER, SCHED_TICK_HZ);
+    numa_set_cpu_node(cpu, numa_node_of_apic(apic));
+    
+    if (sched_init_cpu() != 0) {
+        while (1) {
+            __asm__ volatile("cli; hlt");
+        }
+    }
+    
+    __atomic_store_n(&g_smp.online[cpu], 1, __ATOMIC_RELEASE);
+    
+    /* The boot flow becomes this CPU's idle thread */
+    sched_idle_thread(NULL);
+    
+    while (1) {
+        __asm__ volatile("cli; hlt");
+    }
+}
+
+/*
+ * Get the number of CPUs online
+ */
+uint32_t smp_num_cpus(void) {
+    return g_smp.num_cpus;
+}
+
+/*
+ * Get the number of enabled CPUs the firmware reported
+ */
+uint32_t smp_num_found(void) {
+    return g_smp.num_found;
+}
+
+/*
+ * Check whether a CPU index is online
+ */
+int smp_cpu_online(uint32_t cpu) {
+    return cpu < MAX_CPUS && g_smp.online[cpu];
+}
+
+/*
+ * Get a CPU's data area
+ */
+cpu_local_t* smp_cpu_local(uint32_t cpu) {
+    return cpu < MAX_CPUS ? &g_cpu_local[cpu] : NULL;
+}
\ No newline at end of file
@@ -107,6 +107,22 @@ void core1_cleanup(void) {
     }
 }
 
+/* Get Core-0's monotonic time in nanoseconds */
+uint64_t core1_time_ns(void) {
+    if (g_core0_api && g_core0_api->time_ns) {
+        return g_core0_api->time_ns();
+    }
+    return 0;
+}
+
+/* Get the CPU time this service's domain has used */
+int core1_cpu_usage(cpu_usage_t *usage) {
+    if (g_core0_api && g_core0_api->cpu_usage && g_service_info) {
+        return g_core0_api->cpu_usage(g_service_info->domain_id, usage);
+    }
+    return -1;
+}
+
 /* Panic handler */
 void core1_panic(const char *message) {
     /* Disable interrupts */
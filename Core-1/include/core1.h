@@ -35,6 +35,15 @@ typedef struct {
     uint64_t cap_handles[64];    /* Capability handles */
 } __attribute__((packed)) service_info_t;
 
+/* CPU time used by a domain, in TSC cycles */
+typedef struct {
+    uint64_t cycles;             /* Cycles its threads have run */
+    uint64_t period_cycles;      /* Cycles run in the current period */
+    uint64_t quota;              /* Cycles allowed per period (0: no limit) */
+    uint64_t period;             /* Quota period in cycles */
+    uint64_t exhausted;          /* Periods in which the quota ran out */
+} __attribute__((packed)) cpu_usage_t;
+
 /* Core-0 API structure */
 typedef struct {
     /* Capability operations */
@@ -75,6 +84,12 @@ typedef struct {
     int (*service_start)(uint64_t service_id);
     int (*service_stop)(uint64_t service_id);
     int (*service_restart)(uint64_t service_id);
+    
+    /* Time */
+    uint64_t (*time_ns)(void);
+    
+    /* CPU time used by a domain */
+    int (*cpu_usage)(uint64_t domain_id, cpu_usage_t *usage);
 } __attribute__((packed)) core0_api_t;
 
 /* Global service info and API pointer */
@@ -90,6 +105,12 @@ void core1_main(void);
 /* Service cleanup */
 void core1_cleanup(void);
 
+/* Get Core-0's monotonic time in nanoseconds (0 if unavailable) */
+uint64_t core1_time_ns(void);
+
+/* Get the CPU time this service's domain has used (-1 if unavailable) */
+int core1_cpu_usage(cpu_usage_t *usage);
+
 /* Panic handler */
 void core1_panic(const char *message) __attribute__((noreturn));
 
@@ -44,7 +44,7 @@ typedef struct {
     uint32_t dst_service;       /* Destination service ID */
     uint32_t data_size;         /* Data size */
     uint32_t flags;             /* Message flags */
-    uint64_t timestamp;         /* Timestamp */
+    uint64_t timestamp;         /* Send time (ns, Core-0 clock) */
 } __attribute__((packed)) ipc_msg_header_t;
 
 /* IPC message */
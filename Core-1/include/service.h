@@ -38,7 +38,7 @@ typedef struct {
 typedef struct {
     service_config_t config;    /* Service configuration */
     service_state_t state;      /* Current state */
-    uint64_t start_time;        /* Start timestamp */
+    uint64_t start_time;        /* Start timestamp (ns) */
     uint64_t uptime;            /* Uptime in ms */
     uint32_t error_count;       /* Error count */
     uint64_t last_error;        /* Last error code */
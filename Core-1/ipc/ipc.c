@@ -159,7 +159,7 @@ int ipc_send(uint64_t endpoint_id, ipc_msg_t *msg) {
     msg->header.msg_id = g_next_msg_id++;
     msg->header.src_service = g_service_info->service_id;
     msg->header.dst_service = ep->service_id;
-    msg->header.timestamp = 0;  /* Would get from system timer */
+    msg->header.timestamp = core1_time_ns();
 
     /* Call handler */
     if (ep->handler) {
@@ -44,7 +44,7 @@ int service_framework_init(const char *name, const char *version, uint32_t flags
     g_service_ctx.config.priority = 0;
     
     g_service_ctx.state = SERVICE_STATE_INIT;
-    g_service_ctx.start_time = 0;  /* Would get from system timer */
+    g_service_ctx.start_time = core1_time_ns();
     g_service_ctx.uptime = 0;
     g_service_ctx.error_count = 0;
     g_service_ctx.last_error = 0;
@@ -78,7 +78,8 @@ int service_start(void) {
     }
 
     g_service_ctx.state = SERVICE_STATE_RUNNING;
-    g_service_ctx.start_time = 0;  /* Would get from system timer */
+    g_service_ctx.start_time = core1_time_ns();
+    g_service_ctx.uptime = 0;
 
     spin_unlock(&g_service_lock);
 
@@ -145,8 +146,13 @@ void service_report_error(uint64_t error_code) {
 
 /* Update uptime */
 void service_update_uptime(void) {
-    /* In a real implementation, this would get the current time
-       from the system timer and update the uptime */
+    uint64_t now = core1_time_ns();
+
+    spin_lock(&g_service_lock);
+    if (g_service_ctx.state == SERVICE_STATE_RUNNING && now >= g_service_ctx.start_time) {
+        g_service_ctx.uptime = (now - g_service_ctx.start_time) / 1000000;
+    }
+    spin_unlock(&g_service_lock);
 }
 
 /* Yield CPU to other services */
@@ -156,8 +162,13 @@ void service_yield(void) {
 
 /* Sleep for specified milliseconds */
 void service_sleep(uint64_t milliseconds) {
-    /* In a real implementation, this would use the system timer
-       to sleep for the specified duration */
+    /* Core-0 blocks the thread until the deadline */
+    if (g_core0_api && g_core0_api->thread_sleep) {
+        g_core0_api->thread_sleep(milliseconds);
+        return;
+    }
+
+    /* Not attached to Core-0 (yet): wait in place */
     for (volatile uint64_t i = 0; i < milliseconds * 1000; i++) {
         __asm__ volatile ("pause");
     }
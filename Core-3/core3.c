@@ -178,3 +178,10 @@ int sleep_ms(uint64_t milliseconds) {
 void yield(void) {
     syscall(SYS_YIELD, 0, 0, 0, 0, 0);
 }
+
+/* Get monotonic time in nanoseconds since boot */
+uint64_t gettime_ns(void) {
+    uint64_t ns = 0;
+    syscall(SYS_GETTIME, (uint64_t)&ns, 0, 0, 0, 0);
+    return ns;
+}
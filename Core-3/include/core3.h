@@ -110,4 +110,7 @@ int sleep_ms(uint64_t milliseconds);
 /* Yield CPU */
 void yield(void);
 
+/* Get monotonic time in nanoseconds since boot */
+uint64_t gettime_ns(void);
+
 #endif /* HIK_CORE3_H */
\ No newline at end of file